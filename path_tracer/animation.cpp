@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "animation.h"
+#include "stats.h"
+
+namespace {
+	const double pi = 3.14159265358979323846;
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// rotate v around the vertical axis
+	Vector3D RotateY(Vector3D const &v, double angle) {
+		double c = cos(angle), s = sin(angle);
+		return Vector3D(c * v.x + s * v.z, v.y, -s * v.x + c * v.z);
+	}
+
+	// Writes frames on a thread of its own, one at a time. Submit waits until the previous frame is written,
+	// so the caller may render into the buffer of the frame before while the encoder works on this one.
+	class FrameEncoder {
+		public:
+			explicit FrameEncoder(ToneMapping tone_mapping) : writer(1, tone_mapping), image_ptr(nullptr), stop(false),
+				thread([this]() { Loop(); }) {}
+			~FrameEncoder() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stop = true;
+				}
+				condition.notify_all();
+				thread.join();
+			}
+			// image must stay untouched until the next Submit or Finish returns
+			void Submit(std::string const &path_, Vector3D const *image_ptr_, int width_, int height_) {
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return image_ptr == nullptr; });
+				path = path_;
+				image_ptr = image_ptr_;
+				width = width_;
+				height = height_;
+				condition.notify_all();
+			}
+			// wait until the last frame is written
+			void Finish() {
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return image_ptr == nullptr; });
+			}
+
+		private:
+			void Loop() {
+				std::unique_lock<std::mutex> lock(mutex);
+				while (true) {
+					condition.wait(lock, [this]() { return stop || image_ptr != nullptr; });
+					if (image_ptr == nullptr) return;
+					lock.unlock();
+					{
+						STATS_TIMER("write frame", "output");
+						if (!writer.Write(path, image_ptr, width, height)) fprintf(stderr, "Cannot write %s\n", path.c_str());
+					}
+					lock.lock();
+					image_ptr = nullptr;
+					condition.notify_all();
+				}
+			}
+
+			ImageWriter writer;
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::string path;
+			Vector3D const *image_ptr; // frame being written, nullptr when idle
+			int width, height;
+			bool stop;
+			std::thread thread;
+	};
+}
+
+Animation::Animation(Scene const &scene, SceneDescription const &description, AnimationSettings const &settings) :
+	camera_origin(description.camera_origin), camera_direction(description.camera_direction),
+	width(description.width), height(description.height), frame_count(std::max(settings.frame_count, 1)),
+	orbit_radians(settings.orbit_degrees * pi / 180.0), dolly(settings.dolly) {
+	double max_radius = 0.0;
+	for (int i = 0; i < scene.GetObjectCount(); i++) {
+		SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(scene.GetObject(i));
+		if (sphere_ptr == nullptr || sphere_ptr->IsLight()) continue;
+		max_radius = std::max(max_radius, sphere_ptr->GetRadius());
+	}
+	std::vector<int> small, all;
+	for (int i = 0; i < scene.GetObjectCount(); i++) {
+		SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(scene.GetObject(i));
+		if (sphere_ptr == nullptr || sphere_ptr->IsLight()) continue;
+		all.push_back(i);
+		if (sphere_ptr->GetRadius() < 0.01 * max_radius) small.push_back(i);
+	}
+	if (small.empty()) small = all;
+
+	// the camera turns around the center of the small spheres, or around a point ahead of it
+	pivot = camera_origin + camera_direction * 100.0;
+	if (!small.empty()) {
+		BoundingBox bounds;
+		for (int index : small) bounds.Extend(scene.GetObject(index)->GetBounds());
+		pivot = bounds.Center();
+	}
+
+	// spread the bouncing spheres over the small ones with phases that do not repeat
+	int count = settings.moving_spheres >= 0 ? settings.moving_spheres : std::max(2, int(small.size()) / 50);
+	count = std::min(count, int(small.size()));
+	for (int i = 0; i < count; i++) {
+		int index = small[size_t(i) * small.size() / count];
+		SphereObject const &sphere = static_cast<SphereObject const &>(*scene.GetObject(index));
+		moving.push_back({ index, sphere.GetCenter(), sphere.GetRadius(), 0.618034 * i });
+	}
+}
+
+Camera Animation::Apply(int frame, Scene &scene) const {
+	double time = frame_count > 1 ? double(frame) / (frame_count - 1) : 0.0;
+	// two bounces over the sequence
+	for (MovingSphere const &sphere : moving) {
+		double lift = sphere.height * fabs(sin(pi * (2.0 * time + sphere.phase)));
+		scene.MoveSphere(sphere.index, sphere.center + Vector3D(0.0, lift, 0.0));
+	}
+	double angle = orbit_radians * (time - 0.5);
+	Vector3D offset = RotateY(camera_origin - pivot, angle) * (1.0 - dolly * time);
+	return Camera(pivot + offset, RotateY(camera_direction, angle), width, height);
+}
+
+void Animation::Reset(Scene &scene) const {
+	for (MovingSphere const &sphere : moving) scene.MoveSphere(sphere.index, sphere.center);
+}
+
+std::string GetFramePath(std::string const &pattern, int frame) {
+	std::vector<char> path(pattern.size() + 32);
+	snprintf(path.data(), path.size(), pattern.c_str(), frame);
+	return path.data();
+}
+
+bool RenderAnimation(Scene &scene, SceneDescription const &description, RenderSettings const &settings,
+	AnimationSettings const &animation_settings, ToneMapping tone_mapping, RenderProgress *progress_ptr,
+	std::vector<FrameTimes> *times_ptr) {
+	Animation animation(scene, description, animation_settings);
+	int width = description.width, height = description.height;
+	int frame_count = std::max(animation_settings.frame_count, 1);
+	// everything a frame needs is made once: threads, the encoder and two frame buffers, one being rendered
+	// while the other is written
+	ThreadPool pool(settings.thread_count);
+	FrameEncoder encoder(tone_mapping);
+	std::vector<Vector3D> images[2];
+	images[0].resize(size_t(width) * height);
+	images[1].resize(size_t(width) * height);
+	RenderSettings frame_settings = settings;
+	frame_settings.report_progress = false;
+	if (times_ptr) times_ptr->assign(frame_count, FrameTimes());
+	if (settings.report_progress) {
+		fprintf(stderr, "Rendering %d frames of %dx%d at %d spp, %d bouncing spheres\n", frame_count, width, height,
+			4 * settings.samples_per_subpixel, animation.GetMovingSphereCount());
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	double overhead_seconds = 0.0, render_seconds = 0.0;
+	bool finished = true;
+	for (int frame = 0; frame < frame_count && finished; frame++) {
+		FrameTimes times;
+		auto phase_start = std::chrono::steady_clock::now();
+		Camera camera = animation.Apply(frame, scene);
+		times.refitted = scene.Update();
+		times.update_seconds = SecondsSince(phase_start);
+
+		phase_start = std::chrono::steady_clock::now();
+		std::vector<Vector3D> &image = images[frame % 2];
+		finished = RenderImage(scene, camera, frame_settings, image.data(), progress_ptr, &pool);
+		times.render_seconds = SecondsSince(phase_start);
+
+		// a cancelled frame is not written, its tiles are incomplete
+		phase_start = std::chrono::steady_clock::now();
+		if (finished) encoder.Submit(GetFramePath(animation_settings.output_pattern, frame), image.data(), width, height);
+		times.handoff_seconds = SecondsSince(phase_start);
+
+		overhead_seconds += times.update_seconds + times.handoff_seconds;
+		render_seconds += times.render_seconds;
+		if (times_ptr) (*times_ptr)[frame] = times;
+		if (settings.report_progress) {
+			fprintf(stderr, "Frame %d: update %.3f ms (%s), render %.3f s, handoff %.3f ms\n", frame, 1e3 * times.update_seconds,
+				times.refitted ? "refit" : "rebuild", times.render_seconds, 1e3 * times.handoff_seconds);
+		}
+	}
+	auto finish_start = std::chrono::steady_clock::now();
+	encoder.Finish();
+	double finish_seconds = SecondsSince(finish_start);
+	if (settings.report_progress) {
+		double total_seconds = SecondsSince(start);
+		fprintf(stderr, "%s in %.3f s: overhead outside rendering %.3f ms per frame (%.3f%%), last write %.3f ms\n",
+			finished ? "Finished" : "Cancelled", total_seconds, 1e3 * overhead_seconds / frame_count,
+			100.0 * overhead_seconds / std::max(render_seconds, 1e-9), 1e3 * finish_seconds);
+	}
+	return finished;
+}
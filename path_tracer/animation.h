@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "camera.h"
+#include "render.h"
+#include "scene_file.h"
+#include "image_writer.h"
+
+// Batch rendering of an animated sequence in one process: the camera turns around the small objects of the
+// scene while moving closer to them, and some of the spheres among them bounce. Between frames the scene structures are refitted instead
+// of rebuilt (Scene::Update), the frame buffers, render threads and image encoder are kept, and every frame
+// is encoded and written on a thread of its own while the next one renders.
+struct AnimationSettings {
+	int frame_count = 24;
+	double orbit_degrees = 8.0; // turn of the camera over the whole sequence
+	double dolly = 0.2; // part of the distance to the pivot the camera moves toward it over the sequence
+	int moving_spheres = -1; // bouncing spheres, -1 - 2% of the small spheres but at least 2
+	std::string output_pattern = "frame_%04d.bmp"; // printf pattern of the frame number
+};
+
+// camera and sphere positions of every frame
+class Animation {
+	public:
+		// Small spheres are the non-emissive ones under 1% of the radius of the biggest sphere (walls of the
+		// built-in scenes), or all non-emissive spheres if there is no such wall. Their center is the pivot
+		// of the camera.
+		Animation(Scene const &scene, SceneDescription const &description, AnimationSettings const &settings);
+		int GetMovingSphereCount() const { return int(moving.size()); }
+		// move the spheres to their positions in frame (the scene still has to be updated), returns the camera
+		Camera Apply(int frame, Scene &scene) const;
+		// move the spheres back to where they were when the animation was made
+		void Reset(Scene &scene) const;
+
+	private:
+		struct MovingSphere {
+			int index; // object index in the scene
+			Vector3D center; // resting position
+			double height; // of the bounces
+			double phase;
+		};
+
+		std::vector<MovingSphere> moving;
+		Vector3D pivot;
+		Vector3D camera_origin, camera_direction;
+		int width, height, frame_count;
+		double orbit_radians, dolly;
+};
+
+// time of every part of a frame, all but render_seconds is overhead of the batch
+struct FrameTimes {
+	double update_seconds = 0.0; // moving the spheres and updating the scene
+	double render_seconds = 0.0; // RenderImage
+	double handoff_seconds = 0.0; // waiting for the encoder to take the frame
+	bool refitted = true; // whether Scene::Update refitted rather than rebuilt
+};
+
+// File name of a frame: pattern formatted with the frame number
+std::string GetFramePath(std::string const &pattern, int frame);
+
+// Render all frames of the animation with the samples, seed and integrator of settings and write them.
+// Prints the timings of every frame unless settings.report_progress is false, times_ptr receives them.
+// Returns false if the render was cancelled through progress_ptr, frames finished before are written.
+bool RenderAnimation(Scene &scene, SceneDescription const &description, RenderSettings const &settings,
+	AnimationSettings const &animation_settings, ToneMapping tone_mapping, RenderProgress *progress_ptr = nullptr,
+	std::vector<FrameTimes> *times_ptr = nullptr);
@@ -0,0 +1,1247 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstring>
+
+#include "benchmark.h"
+#include "scene_file.h"
+#include "mesh.h"
+#include "image_writer.h"
+#include "animation.h"
+#include "checkpoint.h"
+#include "server.h"
+#include "photon_map.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+void RunThreadScalingBenchmark(Scene const &scene, Camera const &camera, RenderSettings const &settings, int max_threads) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	double total_samples = double(width) * height * 4 * settings.samples_per_subpixel;
+	std::vector<Vector3D> reference(width * height);
+	std::vector<Vector3D> image(width * height);
+	double base_time = 0.0;
+
+	printf("threads  seconds    samples/sec  speedup  identical\n");
+	for (int threads = 1; threads <= max_threads; threads++) {
+		RenderSettings thread_settings = settings;
+		thread_settings.thread_count = threads;
+		thread_settings.report_progress = false;
+		ThreadPool pool(threads);
+		auto start = std::chrono::steady_clock::now();
+		RenderImage(scene, camera, thread_settings, threads == 1 ? reference.data() : image.data(), nullptr, &pool);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (threads == 1) base_time = seconds;
+
+		bool identical = true;
+		for (size_t i = 0; threads > 1 && i < image.size(); i++) {
+			if (image[i].x != reference[i].x || image[i].y != reference[i].y || image[i].z != reference[i].z) identical = false;
+		}
+		printf("%7d  %7.3f  %13.0f  %7.2f  %s\n", threads, seconds, total_samples / seconds, base_time / seconds, identical ? "yes" : "NO");
+	}
+}
+
+namespace {
+	// fill the scene with count random spheres in a 100x100x100 box
+	void CreateRandomSpheres(Scene &scene, int count, Sampler &sampler) {
+		double radius = 30.0 / cbrt(double(count));
+		for (int i = 0; i < count; i++) {
+			Vector3D center(100.0 * sampler.Next1D(), 100.0 * sampler.Next1D(), 100.0 * sampler.Next1D());
+			scene.AddSphere(radius * (0.5 + sampler.Next1D()), center, Object::Material::diffuse, Vector3D(0.5, 0.5, 0.5), Vector3D());
+		}
+	}
+
+	std::vector<Ray3D> CreateRandomRays(int count, Sampler &sampler) {
+		std::vector<Ray3D> rays;
+		rays.reserve(count);
+		for (int i = 0; i < count; i++) {
+			Vector3D origin(100.0 * sampler.Next1D(), 100.0 * sampler.Next1D(), 100.0 * sampler.Next1D());
+			Vector3D direction(sampler.Next1D() - 0.5, sampler.Next1D() - 0.5, sampler.Next1D() - 0.5);
+			rays.push_back(Ray3D(origin, direction.norm()));
+		}
+		return rays;
+	}
+
+	// returns rays/sec, hits receives the number of rays that hit something
+	double TraceRays(Scene const &scene, std::vector<Ray3D> const &rays, bool any_hit, int &hits) {
+		hits = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rays.size(); i++) {
+			double t;
+			if (any_hit) hits += scene.IntersectWithAnyObject(rays[i], 50.0) ? 1 : 0;
+			else hits += scene.IntersectWithNearestObject(rays[i], t) ? 1 : 0;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return rays.size() / seconds;
+	}
+}
+
+void RunIntersectionBenchmark(int max_primitives) {
+	printf("primitives  build_ms  linear_nearest  bvh_nearest  linear_any  bvh_any  (rays/sec)\n");
+	for (int count = 10; count <= max_primitives; count *= 10) {
+		Sampler sampler(count);
+		sampler.StartPixelSample(0, 0);
+		std::unique_ptr<Scene> scene_ptr(new Scene());
+		CreateRandomSpheres(*scene_ptr, count, sampler);
+
+		// the linear scan gets fewer rays so that large scenes finish in reasonable time
+		std::vector<Ray3D> rays = CreateRandomRays(200000, sampler);
+		std::vector<Ray3D> linear_rays(rays.begin(), rays.begin() + std::max<size_t>(1000, std::min<size_t>(rays.size(), size_t(2e7 / count))));
+
+		int linear_hits, bvh_hits, linear_any_hits, bvh_any_hits;
+		scene_ptr->Build(false);
+		double linear_nearest = TraceRays(*scene_ptr, linear_rays, false, linear_hits);
+		double linear_any = TraceRays(*scene_ptr, linear_rays, true, linear_any_hits);
+
+		auto start = std::chrono::steady_clock::now();
+		scene_ptr->Build(true);
+		double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		double bvh_nearest = TraceRays(*scene_ptr, rays, false, bvh_hits);
+		double bvh_any = TraceRays(*scene_ptr, rays, true, bvh_any_hits);
+
+		// both paths must agree on the rays they share
+		int check_hits, check_any_hits;
+		std::vector<Ray3D> check_rays(rays.begin(), rays.begin() + linear_rays.size());
+		TraceRays(*scene_ptr, check_rays, false, check_hits);
+		TraceRays(*scene_ptr, check_rays, true, check_any_hits);
+		bool agree = check_hits == linear_hits && check_any_hits == linear_any_hits;
+
+		printf("%10d  %8.2f  %14.0f  %11.0f  %10.0f  %7.0f%s\n", count, build_ms, linear_nearest, bvh_nearest,
+			linear_any, bvh_any, agree ? "" : "  MISMATCH");
+	}
+}
+
+namespace {
+	void BenchmarkKernels(Scene &scene, std::vector<Ray3D> const &rays, char const *name) {
+		SimdLevel supported = DetectSimdLevel();
+		for (int use_bvh = 0; use_bvh < 2; use_bvh++) {
+			double scalar_rate = 0.0;
+			for (Precision precision : { Precision::float64, Precision::float32 }) {
+				for (int level = int(SimdLevel::scalar); level <= int(supported); level++) {
+					int hits;
+					// leaf sizes depend on the kernel width, so rebuild for every kernel
+					scene.SetSimdLevel(SimdLevel(level));
+					scene.SetPrecision(precision);
+					scene.Build(use_bvh != 0);
+					double rate = TraceRays(scene, rays, false, hits);
+					if (level == int(SimdLevel::scalar) && precision == Precision::float64) scalar_rate = rate;
+					printf("%-16s  %-6s  %-6s  %-6s  %12.0f  %7.2f  %d\n", name, use_bvh ? "bvh" : "linear",
+						GetSimdLevelName(SimdLevel(level)), GetPrecisionName(precision), rate, rate / scalar_rate, hits);
+				}
+			}
+		}
+		scene.SetSimdLevel(supported);
+		scene.SetPrecision(Precision::float64);
+		scene.Build();
+	}
+}
+
+void RunSphereKernelBenchmark(Scene &scene, Camera const &camera) {
+	printf("detected kernel: %s\n", GetSimdLevelName(DetectSimdLevel()));
+	printf("rays              mode    kernel  type        rays/sec  speedup  hits\n");
+
+	// primary rays, one per pixel
+	Sampler sampler(0);
+	std::vector<Ray3D> primary_rays;
+	for (int y = 0; y < camera.GetHeight(); y++) {
+		for (int x = 0; x < camera.GetWidth(); x++) {
+			sampler.StartPixelSample(uint32_t(y * camera.GetWidth() + x), 0);
+			primary_rays.push_back(camera.GenerateRay(x, y, 0, 0, sampler));
+		}
+	}
+	BenchmarkKernels(scene, primary_rays, "cornell primary");
+
+	sampler.StartPixelSample(0, 0);
+	Scene random_scene;
+	CreateRandomSpheres(random_scene, 1000, sampler);
+	BenchmarkKernels(random_scene, CreateRandomRays(100000, sampler), "1000 spheres");
+}
+
+void RunIntegratorBenchmark(Scene const &scene, Camera const &camera, int max_samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	std::vector<Vector3D> image(width * height);
+	std::vector<Vector3D> iterative_image(width * height);
+
+	printf("spp  integrator  seconds    samples/sec  speedup\n");
+	for (int spp = 4; spp <= max_samples_per_pixel; spp *= 2) {
+		double recursive_time = 0.0;
+		for (IntegratorType type : { IntegratorType::recursive, IntegratorType::iterative, IntegratorType::wavefront }) {
+			RenderSettings settings;
+			settings.samples_per_subpixel = spp / 4;
+			settings.integrator = type;
+			settings.report_progress = false;
+			auto start = std::chrono::steady_clock::now();
+			RenderImage(scene, camera, settings, type == IntegratorType::iterative ? iterative_image.data() : image.data());
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (type == IntegratorType::recursive) recursive_time = seconds;
+
+			// the wavefront integrator runs the same estimator as the iterative one
+			char const *note = "";
+			if (type == IntegratorType::wavefront) {
+				for (size_t i = 0; i < image.size(); i++) {
+					if (image[i].x != iterative_image[i].x || image[i].y != iterative_image[i].y || image[i].z != iterative_image[i].z) note = "  DIFFERS FROM ITERATIVE";
+				}
+			}
+			printf("%3d  %-10s  %7.3f  %13.0f  %7.2f%s\n", spp, GetIntegratorName(type), seconds,
+				double(width) * height * spp / seconds, recursive_time / seconds, note);
+		}
+	}
+}
+
+void RunSchedulerBenchmark(Scene const &scene, Camera const &camera, RenderSettings const &settings) {
+	ThreadPool pool(settings.thread_count);
+	std::vector<Vector3D> image(camera.GetWidth() * camera.GetHeight());
+
+	printf("%d threads\n", pool.GetThreadCount());
+	printf("schedule    seconds  mean_idle  max_idle  stolen\n");
+	for (int tile_size : { 0, 8, 16, 32, 64 }) {
+		RenderSettings schedule_settings = settings;
+		schedule_settings.tile_size = tile_size;
+		schedule_settings.report_progress = false;
+		auto start = std::chrono::steady_clock::now();
+		RenderImage(scene, camera, schedule_settings, image.data(), nullptr, &pool);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double idle_sum = 0.0, idle_max = 0.0;
+		int stolen = 0;
+		for (ThreadStats const &stats : pool.GetThreadStats()) {
+			idle_sum += stats.idle_seconds;
+			idle_max = std::max(idle_max, stats.idle_seconds);
+			stolen += stats.stolen;
+		}
+		char name[32];
+		if (tile_size == 0) snprintf(name, sizeof(name), "scanline");
+		else snprintf(name, sizeof(name), "tile %dx%d", tile_size, tile_size);
+		printf("%-10s  %7.3f  %9.4f  %8.4f  %6d\n", name, seconds, idle_sum / pool.GetThreadCount(), idle_max, stolen);
+	}
+}
+
+namespace {
+	inline double Clamp01(double x) { return x < 0.0 ? 0.0 : x > 1.0 ? 1.0 : x; }
+
+	// root mean square error of the displayable (clamped) images, of the pixels set in the mask if there is one
+	double ComputeRmse(std::vector<Vector3D> const &image, std::vector<Vector3D> const &reference, std::vector<char> const *mask_ptr = nullptr) {
+		double sum = 0.0;
+		size_t count = 0;
+		for (size_t i = 0; i < image.size(); i++) {
+			if (mask_ptr && !(*mask_ptr)[i]) continue;
+			double dx = Clamp01(image[i].x) - Clamp01(reference[i].x);
+			double dy = Clamp01(image[i].y) - Clamp01(reference[i].y);
+			double dz = Clamp01(image[i].z) - Clamp01(reference[i].z);
+			sum += dx * dx + dy * dy + dz * dz;
+			count++;
+		}
+		return count > 0 ? sqrt(sum / (3.0 * count)) : 0.0;
+	}
+}
+
+void RunAdaptiveBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	ThreadPool pool;
+	Film film(width, height);
+	std::vector<Vector3D> reference(width * height), image(width * height);
+
+	// uniform sampling is adaptive sampling with a zero threshold: every tile runs up to the maximum
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.adaptive = true;
+	settings.adaptive_threshold = 0.0;
+	settings.samples_per_subpixel = 4;
+	settings.max_samples_per_pixel = reference_samples_per_pixel;
+	settings.seed = 12345; // the reference must not share sample streams with the measured renders
+	RenderAdaptive(scene, camera, settings, film, nullptr, &pool);
+	film.Resolve(reference.data());
+	settings.seed = 0;
+
+	printf("reference: %d spp\n", reference_samples_per_pixel);
+	printf("mode      parameter   avg_spp    samples     rmse  seconds\n");
+	struct Run { bool adaptive; double threshold; int max_spp; };
+	Run runs[] = { { false, 0.0, 16 }, { false, 0.0, 32 }, { false, 0.0, 64 }, { false, 0.0, 128 },
+		{ true, 0.4, 256 }, { true, 0.3, 256 }, { true, 0.2, 256 } };
+	for (Run const &run : runs) {
+		film.Clear();
+		settings.adaptive_threshold = run.threshold;
+		settings.max_samples_per_pixel = run.max_spp;
+		auto start = std::chrono::steady_clock::now();
+		RenderAdaptive(scene, camera, settings, film, nullptr, &pool);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		film.Resolve(image.data());
+		uint64_t samples = film.GetTotalSampleCount();
+		if (run.adaptive) printf("adaptive  err<%-7.3f", run.threshold);
+		else printf("uniform   %3d spp    ", run.max_spp);
+		printf("  %7.1f  %9llu  %7.5f  %7.2f\n", double(samples) / (width * height), (unsigned long long)samples,
+			ComputeRmse(image, reference), seconds);
+	}
+}
+
+void RunSamplerBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	ThreadPool pool;
+	std::vector<Vector3D> reference(width * height), image(width * height);
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.samples_per_subpixel = std::max(1, reference_samples_per_pixel / 4);
+	settings.seed = 12345; // the reference must not share sample streams with the measured renders
+	RenderImage(scene, camera, settings, reference.data(), nullptr, &pool);
+	settings.seed = 0;
+
+	// the error of independent samples falls as 1 / sqrt(spp), so the squared ratio of the errors is the factor
+	// of samples the independent sampler needs for the error of the other one
+	printf("reference: %d spp\n", reference_samples_per_pixel);
+	printf(" spp  sampler        rmse  seconds  spp_factor\n");
+	for (int spp = 4; spp <= 256; spp *= 2) {
+		double independent_rmse = 0.0;
+		for (SamplerType type : { SamplerType::independent, SamplerType::sobol, SamplerType::halton }) {
+			settings.samples_per_subpixel = spp / 4;
+			settings.sampler = type;
+			auto start = std::chrono::steady_clock::now();
+			RenderImage(scene, camera, settings, image.data(), nullptr, &pool);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double rmse = ComputeRmse(image, reference);
+			if (type == SamplerType::independent) independent_rmse = rmse;
+			printf("%4d  %-11s  %7.5f  %7.3f  %10.2f\n", spp, GetSamplerName(type), rmse, seconds,
+				independent_rmse * independent_rmse / (rmse * rmse));
+		}
+	}
+}
+
+void RunDenoiserBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	ThreadPool pool;
+	std::vector<Vector3D> reference(width * height), image(width * height);
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.samples_per_subpixel = std::max(1, reference_samples_per_pixel / 4);
+	settings.seed = 12345; // the reference must not share sample streams with the measured renders
+	RenderImage(scene, camera, settings, reference.data(), nullptr, &pool);
+	settings.seed = 0;
+
+	auto time_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	printf("reference: %d spp\n", reference_samples_per_pixel);
+	printf(" spp  render_s  denoise_s  rmse_noisy  rmse_denoised\n");
+	AovBuffers aovs;
+	for (int spp = 4; spp <= 256; spp *= 4) {
+		settings.samples_per_subpixel = spp / 4;
+		auto start = std::chrono::steady_clock::now();
+		RenderImage(scene, camera, settings, image.data(), nullptr, &pool, &aovs);
+		double render_seconds = time_since(start);
+		double noisy_rmse = ComputeRmse(image, reference);
+		start = std::chrono::steady_clock::now();
+		DenoiseImage(image.data(), aovs, DenoiserSettings(), &pool);
+		printf("%4d  %8.3f  %9.3f  %10.5f  %13.5f\n", spp, render_seconds, time_since(start), noisy_rmse, ComputeRmse(image, reference));
+	}
+
+	// denoise time does not depend on the content, larger frames get the guides of a noisy gradient
+	printf("frame       denoise_s  threads\n");
+	for (int size : { 512, 2160 }) {
+		int frame_width = size == 512 ? 512 : 3840, frame_height = size;
+		AovBuffers frame_aovs;
+		frame_aovs.Resize(frame_width, frame_height);
+		std::vector<Vector3D> frame(size_t(frame_width) * frame_height);
+		Sampler sampler(9);
+		for (size_t i = 0; i < frame.size(); i++) {
+			float v = float(i % frame_width) / frame_width;
+			frame[i] = Vector3D(v, v, v) * (0.5 + sampler.Next1D());
+			frame_aovs.albedo[i] = Vector3F(0.75f, 0.75f, 0.75f);
+			frame_aovs.normal[i] = Vector3F(0.0f, 0.0f, 1.0f);
+			frame_aovs.depth[i] = 100.0f + v;
+			frame_aovs.variance[i] = 0.01f;
+		}
+		auto start = std::chrono::steady_clock::now();
+		DenoiseImage(frame.data(), frame_aovs, DenoiserSettings(), &pool);
+		printf("%4dx%-4d  %9.3f  %7d\n", frame_width, frame_height, time_since(start), pool.GetThreadCount());
+	}
+}
+
+void RunAnimationBenchmark(Scene &scene, SceneDescription const &description, RenderSettings const &settings, int frame_count) {
+	SceneDescription frame_description = description;
+	frame_description.width = frame_description.height = 256;
+	AnimationSettings animation_settings;
+	animation_settings.frame_count = frame_count;
+	Animation animation(scene, frame_description, animation_settings);
+	RenderSettings frame_settings = settings;
+	frame_settings.report_progress = false;
+	frame_settings.samples_per_subpixel = 1;
+	int width = frame_description.width, height = frame_description.height;
+	printf("%d frames of %dx%d at %d spp, %d bouncing spheres among %d objects\n", frame_count, width, height,
+		4 * frame_settings.samples_per_subpixel, animation.GetMovingSphereCount(), scene.GetObjectCount());
+
+	auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	// what a launch per frame does, apart from starting the process and parsing the scene
+	double update_seconds = 0.0, relaunch_render_seconds = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frame_count; frame++) {
+		Camera camera = animation.Apply(frame, scene);
+		auto phase_start = std::chrono::steady_clock::now();
+		scene.Build();
+		update_seconds += seconds_since(phase_start);
+		std::unique_ptr<Vector3D[]> image_ptr(new Vector3D[width * height]);
+		ThreadPool pool(frame_settings.thread_count);
+		phase_start = std::chrono::steady_clock::now();
+		RenderImage(scene, camera, frame_settings, image_ptr.get(), nullptr, &pool);
+		relaunch_render_seconds += seconds_since(phase_start);
+		ImageWriter writer(frame_settings.thread_count);
+		writer.Write(GetFramePath("bench_relaunch_%04d.bmp", frame), image_ptr.get(), width, height);
+	}
+	double relaunch_seconds = seconds_since(start);
+	animation.Reset(scene);
+	scene.Build();
+
+	animation_settings.output_pattern = "bench_batch_%04d.bmp";
+	std::vector<FrameTimes> times;
+	start = std::chrono::steady_clock::now();
+	RenderAnimation(scene, frame_description, frame_settings, animation_settings, ToneMapping::clamp, nullptr, &times);
+	double batch_seconds = seconds_since(start);
+	animation.Reset(scene);
+	scene.Build();
+
+	// anything a frame takes outside of RenderImage is overhead
+	double render_seconds = 0.0, refit_seconds = 0.0;
+	int refits = 0;
+	for (FrameTimes const &frame_times : times) {
+		render_seconds += frame_times.render_seconds;
+		refit_seconds += frame_times.update_seconds;
+		if (frame_times.refitted) refits++;
+	}
+	printf("mode      total_s  overhead_ms/frame  scene_update_ms/frame\n");
+	printf("relaunch  %7.3f  %17.3f  %21.3f (rebuild)\n", relaunch_seconds, 1e3 * (relaunch_seconds - relaunch_render_seconds) / frame_count, 1e3 * update_seconds / frame_count);
+	printf("batch     %7.3f  %17.3f  %21.3f (%d of %d refitted)\n", batch_seconds, 1e3 * (batch_seconds - render_seconds) / frame_count, 1e3 * refit_seconds / frame_count, refits, frame_count);
+
+	bool identical = true;
+	for (int frame = 0; frame < frame_count; frame++) {
+		std::ifstream relaunch_file(GetFramePath("bench_relaunch_%04d.bmp", frame), std::ios::binary), batch_file(GetFramePath("bench_batch_%04d.bmp", frame), std::ios::binary);
+		std::string relaunch_bytes((std::istreambuf_iterator<char>(relaunch_file)), std::istreambuf_iterator<char>());
+		std::string batch_bytes((std::istreambuf_iterator<char>(batch_file)), std::istreambuf_iterator<char>());
+		if (relaunch_bytes.empty() || relaunch_bytes != batch_bytes) identical = false;
+	}
+	printf("frames of both modes identical: %s\n", identical ? "yes" : "no");
+}
+
+void RunCheckpointBenchmark(Scene const &scene, Camera const &camera, int samples_per_pixel) {
+	int width = camera.GetWidth(), height = camera.GetHeight();
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.progressive = true;
+	settings.samples_per_subpixel = std::max(1, samples_per_pixel / 4);
+	SceneDescription description;
+	description.width = width;
+	description.height = height;
+	CheckpointKey key = MakeCheckpointKey("benchmark", description, settings, scene.GetLightSampling(), scene.GetPrecision());
+	char const *path = "bench_checkpoint.ptc";
+	ThreadPool pool;
+	auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	printf("%dx%d, %d spp progressive, %d threads\n", width, height, 4 * settings.samples_per_subpixel, pool.GetThreadCount());
+
+	// the fastest of a few runs, render times of this size vary by more than the checkpoint overhead
+	const int repeats = 3;
+	Film reference(width, height);
+	double plain_seconds = 1e30, checkpoint_seconds = 1e30;
+	Checkpoint every_pass(0.0);
+	std::string error;
+	for (int repeat = 0; repeat < repeats; repeat++) {
+		reference.Clear();
+		auto start = std::chrono::steady_clock::now();
+		RenderProgressive(scene, camera, settings, reference, nullptr, nullptr, &pool);
+		plain_seconds = std::min(plain_seconds, seconds_since(start));
+
+		Film film(width, height);
+		if (!every_pass.Open(path, key, false, error)) {
+			printf("%s\n", error.c_str());
+			return;
+		}
+		start = std::chrono::steady_clock::now();
+		RenderProgressive(scene, camera, settings, film, nullptr, nullptr, &pool, &every_pass);
+		checkpoint_seconds = std::min(checkpoint_seconds, seconds_since(start));
+	}
+	printf("no checkpoints           %8.3f s\n", plain_seconds);
+	printf("checkpoint every pass    %8.3f s (%+.2f%%, %.3f s on the main thread)\n", checkpoint_seconds,
+		100.0 * (checkpoint_seconds / plain_seconds - 1.0), every_pass.GetSeconds() / repeats);
+
+	// stop after half of the passes as a killed process would have, then resume in a new film
+	{
+		Checkpoint first_half(0.0);
+		first_half.Open(path, key, false, error);
+		RenderSettings half_settings = settings;
+		half_settings.samples_per_subpixel = std::max(1, settings.samples_per_subpixel / 2);
+		Film half(width, height);
+		RenderProgressive(scene, camera, half_settings, half, nullptr, nullptr, &pool, &first_half);
+	}
+	Checkpoint second_half(0.0);
+	Film resumed(width, height);
+	if (!second_half.Open(path, key, true, error) || !second_half.Load(resumed)) {
+		printf("cannot resume: %s\n", error.c_str());
+		return;
+	}
+	int saved_passes = second_half.GetSavedPasses();
+	RenderProgressive(scene, camera, settings, resumed, nullptr, nullptr, &pool, &second_half);
+	std::vector<Vector3D> reference_image(width * height), resumed_image(width * height);
+	reference.Resolve(reference_image.data());
+	resumed.Resolve(resumed_image.data());
+	bool identical = memcmp(reference_image.data(), resumed_image.data(), sizeof(Vector3D) * reference_image.size()) == 0;
+	printf("resumed after %d passes, image identical to the uninterrupted render: %s\n", saved_passes, identical ? "yes" : "no");
+	remove(path);
+}
+
+void RunLightSamplingBenchmark(Scene &scene, Camera const &camera, int reference_samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	ThreadPool pool;
+	std::vector<Vector3D> reference(width * height), image(width * height);
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.samples_per_subpixel = std::max(1, reference_samples_per_pixel / 4);
+	settings.seed = 12345; // the reference must not share sample streams with the measured renders
+	scene.SetLightSampling(true);
+	RenderImage(scene, camera, settings, reference.data(), nullptr, &pool);
+	settings.seed = 0;
+
+	printf("reference: %d spp with light sampling\n", reference_samples_per_pixel);
+	printf("light_sampling  spp     rmse  seconds\n");
+	for (bool light_sampling : { false, true }) {
+		scene.SetLightSampling(light_sampling);
+		for (int spp = 4; spp <= 256; spp *= 4) {
+			settings.samples_per_subpixel = spp / 4;
+			auto start = std::chrono::steady_clock::now();
+			RenderImage(scene, camera, settings, image.data(), nullptr, &pool);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			printf("%-14s %4d  %7.5f  %7.2f\n", light_sampling ? "on" : "off", spp, ComputeRmse(image, reference), seconds);
+		}
+	}
+	scene.SetLightSampling(true);
+}
+
+void RunPrecisionBenchmark(Scene &scene, Camera const &camera, int samples_per_pixel) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	ThreadPool pool;
+	std::vector<Vector3D> reference(width * height), image(width * height), other_seed(width * height);
+
+	// Rays leaving the primary hits of spheres into the outer hemisphere cannot hit the same convex sphere again,
+	// every such hit is a self-intersection. The previous scheme started them at the hit point moved 1e-4 along
+	// the new direction, which equals ignoring hits closer than 1e-4.
+	const int rays_per_hit = 4;
+	printf("precision  rays     self_hits_shift_1e-4  self_hits_offset\n");
+	for (Precision precision : { Precision::float64, Precision::float32 }) {
+		scene.SetPrecision(precision);
+		scene.Build();
+		Sampler sampler(0);
+		int ray_count = 0, shift_hits = 0, offset_hits = 0;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				sampler.StartPixelSample(uint32_t(y * width + x), 0);
+				Ray3D ray = camera.GenerateRay(x, y, 0, 0, sampler);
+				double t;
+				int primitive;
+				Object *object_ptr = scene.IntersectWithNearestObject(ray, t, primitive);
+				if (object_ptr == nullptr || dynamic_cast<SphereObject *>(object_ptr) == nullptr) continue;
+				double offset;
+				Vector3D point = scene.GetHitPoint(*object_ptr, primitive, ray, t, offset);
+				Vector3D normal = object_ptr->GetPrimitiveNormal(point, primitive);
+				Vector3D normal2 = normal.dot(ray.direction) < 0.0 ? normal : normal * (-1.0);
+				for (int i = 0; i < rays_per_hit; i++) {
+					Vector3D direction = scene.GenerateRandomUnitVectorInHemisphere(normal2, sampler);
+					if (normal2.dot(direction) <= 0.0) continue;
+					double tmp_t;
+					int tmp_primitive;
+					Ray3D shifted(ray.origin + ray.direction * t + direction * 1e-4, direction);
+					if (scene.IntersectWithNearestObject(shifted, tmp_t, tmp_primitive) == object_ptr) shift_hits++;
+					Ray3D offset_ray(OffsetRayOrigin(point, normal, direction, offset), direction);
+					if (scene.IntersectWithNearestObject(offset_ray, tmp_t, tmp_primitive) == object_ptr) offset_hits++;
+					ray_count++;
+				}
+			}
+		}
+		printf("%-9s  %7d  %20d  %16d\n", GetPrecisionName(precision), ray_count, shift_hits, offset_hits);
+	}
+
+	// the difference of float and double renders of the same samples against that of two double renders
+	// of different samples, the noise the images have anyway
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.samples_per_subpixel = std::max(1, samples_per_pixel / 4);
+	printf("\n%d spp\n", 4 * settings.samples_per_subpixel);
+	printf("precision  seconds  samples/sec  speedup\n");
+	double double_seconds = 0.0;
+	for (Precision precision : { Precision::float64, Precision::float32 }) {
+		scene.SetPrecision(precision);
+		scene.Build();
+		auto start = std::chrono::steady_clock::now();
+		RenderImage(scene, camera, settings, precision == Precision::float64 ? reference.data() : image.data(), nullptr, &pool);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (precision == Precision::float64) double_seconds = seconds;
+		printf("%-9s  %7.3f  %11.0f  %7.2f\n", GetPrecisionName(precision), seconds,
+			double(width) * height * 4 * settings.samples_per_subpixel / seconds, double_seconds / seconds);
+	}
+	scene.SetPrecision(Precision::float64);
+	scene.Build();
+	settings.seed = 1;
+	RenderImage(scene, camera, settings, other_seed.data(), nullptr, &pool);
+	double max_difference = 0.0;
+	for (size_t i = 0; i < image.size(); i++) {
+		Vector3D d = image[i] - reference[i];
+		max_difference = std::max(max_difference, MaxMagnitude(d));
+	}
+	printf("float vs double: rmse %.5f, max difference %.4f\n", ComputeRmse(image, reference), max_difference);
+	printf("double, seed 0 vs seed 1: rmse %.5f\n", ComputeRmse(other_seed, reference));
+}
+
+void RunCausticsBenchmark(Scene &scene, Camera const &camera, int reference_samples_per_pixel, int photon_count) {
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	PhotonMapSettings photon_settings;
+	photon_settings.photon_count = photon_count;
+	PhotonMap caustic_map;
+
+	// the photon pass on 1, 2, 4, ... threads, every path has its own sample stream so the map is always the same
+	int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	printf("photon paths: %d, radius %.2f\n", photon_count, photon_settings.radius);
+	printf("threads  trace_s  sort_s  speedup  stored  memory_kib\n");
+	double single_thread_seconds = 0.0;
+	for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+		ThreadPool thread_pool(threads);
+		caustic_map.Build(scene, photon_settings, &thread_pool);
+		PhotonMapStats const &stats = caustic_map.GetStats();
+		double seconds = stats.trace_seconds + stats.build_seconds;
+		if (threads == 1) single_thread_seconds = seconds;
+		printf("%7d  %7.3f  %6.3f  %7.2f  %6d  %10zu\n", threads, stats.trace_seconds, stats.build_seconds,
+			single_thread_seconds / seconds, stats.stored, stats.bytes / 1024);
+		if (threads == max_threads) break;
+	}
+	double photon_seconds = caustic_map.GetStats().trace_seconds + caustic_map.GetStats().build_seconds;
+
+	// the reference is path traced without the map, which is unbiased but slow to resolve caustics
+	ThreadPool pool;
+	std::vector<Vector3D> reference(width * height), image(width * height);
+	RenderSettings settings;
+	settings.report_progress = false;
+	settings.samples_per_subpixel = std::max(1, reference_samples_per_pixel / 4);
+	settings.seed = 12345; // the reference must not share sample streams with the measured renders
+	scene.SetCausticMap(nullptr);
+	RenderImage(scene, camera, settings, reference.data(), nullptr, &pool);
+	settings.seed = 0;
+
+	// caustic pixels: the caustic light reflected at the first diffuse hit of a camera ray through the pixel center,
+	// following mirrors and glass there like the renderer, is at least a tenth of the reference
+	std::vector<char> caustic_mask(width * height, 0);
+	int caustic_pixels = 0;
+	Sampler sampler(0);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			sampler.StartPixelSample(uint32_t(y * width + x), 0);
+			Ray3D ray = camera.GenerateRay(x, y, 0, 0, sampler);
+			Vector3D weight(1.0, 1.0, 1.0);
+			for (int depth = 1; depth <= 8; depth++) {
+				double t;
+				int primitive;
+				Object *object_ptr = scene.IntersectWithNearestObject(ray, t, primitive);
+				if (object_ptr == nullptr || object_ptr->IsLight()) break;
+				Ray3D next_ray;
+				double pdf;
+				if (!scene.Scatter(*object_ptr, primitive, ray, t, depth, sampler, next_ray, weight, pdf)) break;
+				if (pdf == 0.0) {
+					ray = next_ray;
+					continue;
+				}
+				double offset;
+				Vector3D point = scene.GetHitPoint(*object_ptr, primitive, ray, t, offset);
+				Vector3D normal = object_ptr->GetPrimitiveNormal(point, primitive);
+				Vector3D normal2 = normal.dot(ray.direction) < 0.0 ? normal : normal * (-1.0);
+				Vector3D caustic = weight.mult(caustic_map.EstimateIrradiance(point, normal2)) * (1.0 / M_PI);
+				int i = (height - y - 1) * width + x; // images are stored from the top row down
+				double caustic_sum = caustic.x + caustic.y + caustic.z;
+				if (caustic_sum > 0.0 && caustic_sum >= 0.1 * (reference[i].x + reference[i].y + reference[i].z)) {
+					caustic_mask[i] = 1;
+					caustic_pixels++;
+				}
+				break;
+			}
+		}
+	}
+
+	// the error against a path traced reference includes the noise of the reference, which is large in caustics,
+	// so their noise is also measured on its own: the difference of two renders with other seeds over sqrt(2)
+	printf("reference: %d spp without the map, %d caustic pixels of %d\n", reference_samples_per_pixel, caustic_pixels, width * height);
+	printf("map   spp     rmse  caustic_rmse  caustic_noise  seconds(+%.2f photon pass with the map)\n", photon_seconds);
+	std::vector<Vector3D> other_seed(width * height);
+	for (bool use_map : { false, true }) {
+		scene.SetCausticMap(use_map ? &caustic_map : nullptr);
+		for (int spp = 4; spp <= 256; spp *= 4) {
+			settings.samples_per_subpixel = spp / 4;
+			settings.seed = 0;
+			auto start = std::chrono::steady_clock::now();
+			RenderImage(scene, camera, settings, image.data(), nullptr, &pool);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			settings.seed = 1;
+			RenderImage(scene, camera, settings, other_seed.data(), nullptr, &pool);
+			printf("%-4s %4d  %7.5f  %12.5f  %13.5f  %7.2f\n", use_map ? "on" : "off", spp, ComputeRmse(image, reference),
+				ComputeRmse(image, reference, &caustic_mask), ComputeRmse(other_seed, image, &caustic_mask) / sqrt(2.0), seconds);
+		}
+	}
+	scene.SetCausticMap(nullptr);
+}
+
+namespace {
+	// high-water mark of the resident memory of the process in bytes
+	size_t GetPeakResidentBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		return K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+		return size_t(usage.ru_maxrss);
+#else
+		return size_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+	}
+
+	std::vector<char> ReadWholeFile(std::string const &path) {
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+}
+
+void RunTiledOutputBenchmark(Scene const &scene, SceneDescription const &description, int width, int height, int samples_per_pixel) {
+	RenderSettings settings;
+	settings.samples_per_subpixel = std::max(1, samples_per_pixel / 4);
+	settings.report_progress = false;
+	ThreadPool pool(settings.thread_count);
+	printf("%dx%d frame, %d spp, %d threads, tile size %d\n", width, height, 4 * settings.samples_per_subpixel, pool.GetThreadCount(), settings.tile_size);
+	printf("mode        frame        seconds  Msamples/s  peak_rss_growth_MB\n");
+	// the peak only grows, so the runs go from the smallest expected footprint to the largest
+	size_t baseline = GetPeakResidentBytes();
+	auto print_run = [&](char const *mode, int frame_height, double seconds) {
+		double samples = double(width) * frame_height * 4 * settings.samples_per_subpixel;
+		printf("%-11s %5dx%-6d %8.2f %11.3f %19.1f\n", mode, width, frame_height, seconds, 1e-6 * samples / seconds,
+			(GetPeakResidentBytes() - baseline) / (1024.0 * 1024.0));
+	};
+
+	std::string streamed_path = "bench_tiled.bmp", memory_path = "bench_memory.bmp";
+	for (int frame_height : { std::max(1, height / 4), height }) {
+		Camera camera(description.camera_origin, description.camera_direction, width, frame_height);
+		auto start = std::chrono::steady_clock::now();
+		ImageStream stream;
+		std::string error;
+		if (!stream.Open(streamed_path, width, frame_height, error)) {
+			printf("%s\n", error.c_str());
+			return;
+		}
+		RenderImageStreamed(scene, camera, settings, stream, nullptr, &pool);
+		stream.Close();
+		print_run("streamed", frame_height, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	{
+		Camera camera(description.camera_origin, description.camera_direction, width, height);
+		auto start = std::chrono::steady_clock::now();
+		std::vector<Vector3D> image(size_t(width) * height);
+		RenderImage(scene, camera, settings, image.data(), nullptr, &pool);
+		ImageWriter writer(settings.thread_count);
+		writer.Write(memory_path, image.data(), width, height);
+		print_run("in memory", height, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	printf("streamed file identical to in-memory one: %s\n", ReadWholeFile(streamed_path) == ReadWholeFile(memory_path) ? "yes" : "NO");
+	remove(streamed_path.c_str());
+	remove(memory_path.c_str());
+}
+
+void RunServerBenchmark(std::string const &executable, std::string const &scene_name, int samples_per_pixel) {
+	auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	int samples_per_subpixel = std::max(1, samples_per_pixel / 4);
+	printf("%s, %d spp, %d runs each\n", scene_name.c_str(), 4 * samples_per_subpixel, 3);
+	printf("mode          first_tile_ms  tile_render_ms  total_ms\n");
+
+	// what the preview service pays now: a process per request, which sees no result before it exits
+#ifdef _WIN32
+	std::string command = "\"" + executable + "\" " + std::to_string(4 * samples_per_subpixel) + " --scene " + scene_name + " --output server_benchmark.bmp > NUL 2>&1";
+#else
+	std::string command = "'" + executable + "' " + std::to_string(4 * samples_per_subpixel) + " --scene " + scene_name + " --output server_benchmark.bmp > /dev/null 2>&1";
+#endif
+	for (int run = 0; run < 3; run++) {
+		auto start = std::chrono::steady_clock::now();
+		if (std::system(command.c_str()) != 0) {
+			printf("cannot run %s\n", executable.c_str());
+			return;
+		}
+		double seconds = seconds_since(start);
+		printf("spawn         %13.2f  %14s  %8.1f\n", 1e3 * seconds, "-", 1e3 * seconds);
+	}
+	std::remove("server_benchmark.bmp");
+
+	ServerSettings server_settings;
+	server_settings.report_jobs = false;
+	RenderRequest request;
+	request.scene_name = scene_name;
+	if (!IsBuiltinScene(scene_name)) {
+		// requests name scene files relative to the data directory of the server
+		size_t slash = scene_name.find_last_of("/\\");
+		server_settings.data_directory = slash == std::string::npos ? "." : slash == 0 ? "/" : scene_name.substr(0, slash);
+		request.scene_name = scene_name.substr(slash == std::string::npos ? 0 : slash + 1);
+	}
+	RenderServer server(server_settings);
+	std::string error;
+	if (!server.Start(error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	request.settings.samples_per_subpixel = samples_per_subpixel;
+	std::unique_ptr<Film> film_ptr;
+	std::atomic<int> tiles_received(0);
+	auto accept_film = [&](int width, int height) { film_ptr.reset(new Film(width, height)); };
+	auto add_tile = [&](Tile const &tile, float const *sums, uint32_t const *counts) {
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++) {
+				int i = (y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0;
+				film_ptr->AddSampleSums(x, y, sums + 3 * i, counts[i]);
+			}
+		}
+		tiles_received++;
+	};
+	// the first request loads the scene, the others find it resident
+	for (int run = 0; run < 4; run++) {
+		JobTimes times;
+		auto start = std::chrono::steady_clock::now();
+		double first_tile_seconds = 0.0;
+		bool submitted = SubmitRenderRequest("localhost", server.GetPort(), request, accept_film, [&](Tile const &tile, float const *sums, uint32_t const *counts) {
+			if (first_tile_seconds == 0.0) first_tile_seconds = seconds_since(start);
+			add_tile(tile, sums, counts);
+		}, times, error);
+		if (!submitted) {
+			printf("%s\n", error.c_str());
+			return;
+		}
+		printf("%-12s  %13.2f  %14.2f  %8.1f\n", run == 0 ? "server cold" : "server warm", 1e3 * first_tile_seconds,
+			1e3 * times.first_tile_render_seconds, 1e3 * seconds_since(start));
+	}
+
+	// the tiles of the server add up to the image of a progressive render of the same seed
+	Scene scene;
+	SceneDescription description;
+	if (!CreateBuiltinScene(scene_name, scene) && !LoadScene(scene_name, scene, description, error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	Camera camera(description.camera_origin, description.camera_direction, description.width, description.height);
+	RenderSettings settings;
+	settings.samples_per_subpixel = samples_per_subpixel;
+	settings.report_progress = false;
+	Film progressive(description.width, description.height);
+	RenderProgressive(scene, camera, settings, progressive, nullptr);
+	std::vector<Vector3D> expected(description.width * description.height), streamed(expected.size());
+	progressive.Resolve(expected.data());
+	film_ptr->Resolve(streamed.data());
+	bool identical = true;
+	for (size_t i = 0; i < expected.size(); i++) {
+		if (expected[i].x != streamed[i].x || expected[i].y != streamed[i].y || expected[i].z != streamed[i].z) identical = false;
+	}
+	printf("streamed image equals a progressive render: %s\n", identical ? "yes" : "NO");
+
+	// a 128x128 preview submitted while a background render of the same scene runs, with the priority of the
+	// background render (it waits) and with a higher one (it preempts after the tile in flight)
+	printf("\npreview during a background render\n");
+	printf("priority  first_tile_ms  total_ms  background_tiles_meanwhile\n");
+	for (int priority : { 0, 1 }) {
+		std::unique_ptr<Film> background_ptr;
+		std::atomic<int> background_tiles(0);
+		std::thread background([&]() {
+			JobTimes times;
+			std::string background_error;
+			SubmitRenderRequest("localhost", server.GetPort(), request, [&](int width, int height) { background_ptr.reset(new Film(width, height)); },
+				[&](Tile const &, float const *, uint32_t const *) { background_tiles++; }, times, background_error);
+		});
+		while (background_tiles == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		RenderRequest preview = request;
+		preview.width = 128;
+		preview.height = 128;
+		preview.priority = priority;
+		JobTimes times;
+		auto start = std::chrono::steady_clock::now();
+		double first_tile_seconds = 0.0;
+		SubmitRenderRequest("localhost", server.GetPort(), preview, accept_film, [&](Tile const &, float const *, uint32_t const *) {
+			if (first_tile_seconds == 0.0) first_tile_seconds = seconds_since(start);
+		}, times, error);
+		double total_seconds = seconds_since(start);
+		background.join();
+		printf("%8d  %13.2f  %8.1f  %26d\n", priority, 1e3 * first_tile_seconds, 1e3 * total_seconds, times.tiles_rendered_meanwhile);
+	}
+}
+
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+namespace {
+	// the vector type the renderer used before Vec3: a vtable pointer and operations compiled out of line
+	class LegacyVector3D {
+		public:
+			LegacyVector3D(double xx = 0.0, double yy = 0.0, double zz = 0.0) : x(xx), y(yy), z(zz) {}
+			LegacyVector3D(LegacyVector3D const &other) : x(other.x), y(other.y), z(other.z) {}
+			virtual ~LegacyVector3D() {}
+			NOINLINE LegacyVector3D& operator= (LegacyVector3D const &other) { x = other.x; y = other.y; z = other.z; return *this; }
+			NOINLINE LegacyVector3D operator+ (LegacyVector3D const &other) const { return LegacyVector3D(x + other.x, y + other.y, z + other.z); }
+			NOINLINE LegacyVector3D operator- (LegacyVector3D const &other) const { return LegacyVector3D(x - other.x, y - other.y, z - other.z); }
+			NOINLINE LegacyVector3D operator* (double scalar) const { return LegacyVector3D(x * scalar, y * scalar, z * scalar); }
+			NOINLINE LegacyVector3D mult(LegacyVector3D const &other) const { return LegacyVector3D(x * other.x, y * other.y, z * other.z); }
+			NOINLINE LegacyVector3D& norm() { return *this = *this * (1.0 / sqrt(x * x + y * y + z * z)); }
+			NOINLINE double dot(LegacyVector3D const &other) const { return x * other.x + y * other.y + z * other.z; }
+			NOINLINE LegacyVector3D operator% (LegacyVector3D const &other) const { return LegacyVector3D(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x); }
+			double x, y, z;
+	};
+
+	// the work of a diffuse bounce: build a frame around the normal, rotate a direction into it, weight the color
+	template <typename Vector>
+	double BenchmarkShading(std::vector<Vector> const &normals, std::vector<Vector> const &directions, int repeats) {
+		Vector sum;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++) {
+			for (size_t i = 0; i < normals.size(); i++) {
+				Vector const &normal = normals[i];
+				Vector u = ((std::fabs(normal.x) > 0.1 ? Vector(0, 1, 0) : Vector(1, 0, 0)) % normal).norm();
+				Vector v = normal % u;
+				Vector d = directions[i];
+				Vector w = (u * d.x + v * d.y + normal * d.z).norm();
+				sum = sum + Vector(0.75f, 0.25f, 0.25f).mult(w) * normal.dot(w);
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (sum.x == 12345.0) printf(" "); // keep the result alive
+		return seconds * 1e9 / (double(repeats) * normals.size());
+	}
+
+	// add a weighted sample to every pixel of the image, the way a film or a tile is accumulated
+	template <typename Vector>
+	double BenchmarkAccumulation(std::vector<Vector> &image, std::vector<Vector> const &samples, int repeats) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++) {
+			for (size_t i = 0; i < image.size(); i++) image[i] = image[i] + samples[i] * 0.25f;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (image[image.size() / 2].x == 12345.0) printf(" ");
+		return seconds * 1e9 / (double(repeats) * image.size());
+	}
+
+	template <typename Vector>
+	void BenchmarkVector(char const *name, int pixel_count, int repeats) {
+		Sampler sampler(1);
+		std::vector<Vector> normals, directions, samples, image(pixel_count);
+		for (int i = 0; i < pixel_count; i++) {
+			Vector normal(sampler.Next1D() - 0.5, sampler.Next1D() - 0.5, sampler.Next1D() - 0.5);
+			normals.push_back(normal.norm());
+			directions.push_back(Vector(sampler.Next1D(), sampler.Next1D(), sampler.Next1D()));
+			samples.push_back(Vector(sampler.Next1D(), sampler.Next1D(), sampler.Next1D()));
+		}
+		double accumulate_ns = BenchmarkAccumulation(image, samples, repeats);
+		double shade_ns = BenchmarkShading(normals, directions, repeats);
+		printf("%-24s %5d  %10.2f  %12.2f  %10.2f\n", name, int(sizeof(Vector)), double(sizeof(Vector)) * pixel_count / (1024.0 * 1024.0),
+			accumulate_ns, shade_ns);
+	}
+}
+
+void RunVectorBenchmark() {
+	int pixel_count = 512 * 512;
+	int repeats = 20;
+	printf("vector                   bytes  image (MB)  accumulate ns  shading ns\n");
+	BenchmarkVector<LegacyVector3D>("legacy (virtual)", pixel_count, repeats);
+	BenchmarkVector<Vector3D>("Vec3<double>", pixel_count, repeats);
+	BenchmarkVector<Vector3F>("Vec3<float>", pixel_count, repeats);
+	BenchmarkVector<Vector3FA>("Vec3<float, aligned>", pixel_count, repeats);
+}
+
+namespace {
+	// read a whole file through a small buffer, the time of pure I/O the loaders are compared with
+	size_t ReadFileBytes(std::string const &path) {
+		std::vector<char> buffer(1 << 20);
+		size_t total = 0;
+		FILE *file = fopen(path.c_str(), "rb");
+		if (file == nullptr) return 0;
+		while (size_t read = fread(buffer.data(), 1, buffer.size(), file)) total += read;
+		fclose(file);
+		return total;
+	}
+
+	void PrintLoadStep(char const *step, double seconds, size_t bytes) {
+		if (bytes) printf("%-22s %8.3f  %9.1f  %9.1f\n", step, seconds, bytes / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0) / seconds);
+		else printf("%-22s %8.3f\n", step, seconds);
+	}
+}
+
+void RunSceneLoadBenchmark(int sphere_count) {
+	std::string text_path = "bench_scene.txt", binary_path = "bench_scene.ptscene";
+	FILE *file = fopen(text_path.c_str(), "w");
+	if (file == nullptr) {
+		printf("cannot create %s\n", text_path.c_str());
+		return;
+	}
+	Sampler sampler(1);
+	fprintf(file, "# %d random spheres\ncamera 50 50 -150 0 0 1\nresolution 512 512\n", sphere_count);
+	fprintf(file, "material white diffuse 0.75 0.75 0.75\nmaterial mirror specular 0.999 0.999 0.999\nmaterial lamp diffuse 0 0 0 12 12 12\n");
+	char const *material_names[3] = { "white", "mirror", "lamp" };
+	double radius = 30.0 / cbrt(double(sphere_count));
+	for (int i = 0; i < sphere_count; i++) {
+		double x = 100.0 * sampler.Next1D(), y = 100.0 * sampler.Next1D(), z = 100.0 * sampler.Next1D();
+		fprintf(file, "sphere %.6f %.6f %.6f %.6f %s\n", radius * (0.5 + sampler.Next1D()), x, y, z, material_names[i % 100 == 0 ? 2 : i % 10 == 0 ? 1 : 0]);
+	}
+	fclose(file);
+
+	printf("%d spheres\n", sphere_count);
+	printf("step                    seconds         MB       MB/s\n");
+	auto time_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	std::string error;
+	SceneDescription description;
+
+	auto start = std::chrono::steady_clock::now();
+	size_t text_bytes = ReadFileBytes(text_path);
+	PrintLoadStep("read text bytes", time_since(start), text_bytes);
+
+	Scene text_scene;
+	start = std::chrono::steady_clock::now();
+	if (!LoadTextScene(text_path, text_scene, description, error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	PrintLoadStep("parse text", time_since(start), text_bytes);
+	start = std::chrono::steady_clock::now();
+	text_scene.Build();
+	PrintLoadStep("build BVH", time_since(start), 0);
+
+	start = std::chrono::steady_clock::now();
+	if (!SaveBinaryScene(binary_path, text_scene, description, error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	PrintLoadStep("save binary", time_since(start), 0);
+
+	start = std::chrono::steady_clock::now();
+	size_t binary_bytes = ReadFileBytes(binary_path);
+	PrintLoadStep("read binary bytes", time_since(start), binary_bytes);
+
+	Scene binary_scene;
+	start = std::chrono::steady_clock::now();
+	if (!LoadBinaryScene(binary_path, binary_scene, description, error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	PrintLoadStep("load binary (mapped)", time_since(start), binary_bytes);
+
+	// both scenes must report the same hits
+	std::vector<Ray3D> rays = CreateRandomRays(100000, sampler);
+	int mismatches = 0;
+	for (Ray3D const &ray : rays) {
+		double t_text, t_binary;
+		Object const *text_hit = text_scene.IntersectWithNearestObject(ray, t_text);
+		Object const *binary_hit = binary_scene.IntersectWithNearestObject(ray, t_binary);
+		if ((text_hit == nullptr) != (binary_hit == nullptr) || (text_hit && t_text != t_binary)) mismatches++;
+	}
+	printf("hits of %d random rays identical: %s\n", int(rays.size()), mismatches == 0 ? "yes" : "NO");
+	remove(text_path.c_str());
+	remove(binary_path.c_str());
+}
+
+void RunMeshBenchmark(int triangle_count) {
+	// torus around the center of the 100x100x100 box of the random rays
+	int rings = std::max(3, int(sqrt(triangle_count / 4.0))), segments = 2 * rings;
+	double major_radius = 30.0, minor_radius = 12.0;
+	std::string path = "bench_mesh.obj";
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		printf("cannot create %s\n", path.c_str());
+		return;
+	}
+	for (int i = 0; i < segments; i++) {
+		double phi = 2.0 * M_PI * i / segments;
+		for (int j = 0; j < rings; j++) {
+			double theta = 2.0 * M_PI * j / rings;
+			double r = major_radius + minor_radius * cos(theta);
+			fprintf(file, "v %.6f %.6f %.6f\n", 50.0 + r * cos(phi), 50.0 + minor_radius * sin(theta), 50.0 + r * sin(phi));
+		}
+	}
+	for (int i = 0; i < segments; i++) {
+		for (int j = 0; j < rings; j++) {
+			int a = i * rings + j + 1, b = (i + 1) % segments * rings + j + 1;
+			int c = (i + 1) % segments * rings + (j + 1) % rings + 1, d = i * rings + (j + 1) % rings + 1;
+			fprintf(file, "f %d %d %d\nf %d %d %d\n", a, b, c, a, c, d);
+		}
+	}
+	fclose(file);
+
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<TriangleMesh> mesh_ptr(new TriangleMesh(Object::Material::diffuse, Vector3D(0.75, 0.75, 0.75), Vector3D()));
+	std::string error;
+	if (!LoadObjMesh(path, *mesh_ptr, error)) {
+		printf("%s\n", error.c_str());
+		return;
+	}
+	double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	remove(path.c_str());
+	TriangleMesh const &mesh = *mesh_ptr;
+	printf("%d triangles, %d vertices, loaded and built in %.2f s\n", mesh.GetTriangleCount(), mesh.GetVertexCount(), load_seconds);
+	printf("memory: %.1f MB, %.1f bytes per triangle (a SphereObject alone is %d bytes)\n", mesh.GetMemoryUsage() / (1024.0 * 1024.0),
+		double(mesh.GetMemoryUsage()) / mesh.GetTriangleCount(), int(sizeof(SphereObject)));
+
+	Scene scene;
+	scene.AddObject(mesh_ptr.release());
+	scene.Build();
+	Sampler sampler(1);
+	std::vector<Ray3D> rays = CreateRandomRays(1000000, sampler);
+	int hits;
+	double nearest = TraceRays(scene, rays, false, hits);
+	printf("nearest hit: %12.0f rays/sec, %d hits\n", nearest, hits);
+	double any = TraceRays(scene, rays, true, hits);
+	printf("any hit:     %12.0f rays/sec, %d hits\n", any, hits);
+
+	// rays from the core circle of the tube are inside the closed surface and must all hit it
+	int leaks = 0, inside_rays = 1000000;
+	for (int i = 0; i < inside_rays; i++) {
+		double phi = 2.0 * M_PI * sampler.Next1D();
+		Vector3D origin(50.0 + major_radius * cos(phi), 50.0, 50.0 + major_radius * sin(phi));
+		Vector3D direction(sampler.Next1D() - 0.5, sampler.Next1D() - 0.5, sampler.Next1D() - 0.5);
+		double t;
+		if (scene.IntersectWithNearestObject(Ray3D(origin, direction.norm()), t) == nullptr) leaks++;
+	}
+	printf("rays escaping from inside the tube: %d of %d\n", leaks, inside_rays);
+}
+
+namespace {
+	// the BMP writer ImageWriter replaced: pow per channel, column-major loop, one write per row
+	inline double LegacyClamp(double x) { return x<0 ? 0 : x>1 ? 1 : x; }
+	inline int LegacyToInt(double x) { return int(pow(LegacyClamp(x), 1 / 2.2) * 255 + .5); }
+
+	NOINLINE int LegacyWriteImageToBmp(std::string const &path, Vector3D const *image, int width, int height) {
+		int filesize = 54 + 3 * width * height;
+		std::vector<unsigned char> data(3 * width * height);
+		for (int i = 0; i < width; i++) {
+			for (int j = 0; j < height; j++) {
+				int x = i, y = (height - 1) - j;
+				data[(x + y * width) * 3 + 2] = (unsigned char)(LegacyToInt(image[y * width + x].x));
+				data[(x + y * width) * 3 + 1] = (unsigned char)(LegacyToInt(image[y * width + x].y));
+				data[(x + y * width) * 3 + 0] = (unsigned char)(LegacyToInt(image[y * width + x].z));
+			}
+		}
+		unsigned char bmpfileheader[14] = { 'B','M', 0,0,0,0, 0,0, 0,0, 54,0,0,0 };
+		unsigned char bmpinfoheader[40] = { 40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0, 24,0 };
+		unsigned char bmppad[3] = { 0,0,0 };
+		for (int i = 0; i < 4; i++) {
+			bmpfileheader[2 + i] = (unsigned char)(filesize >> (8 * i));
+			bmpinfoheader[4 + i] = (unsigned char)(width >> (8 * i));
+			bmpinfoheader[8 + i] = (unsigned char)(height >> (8 * i));
+		}
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+		if (!file.is_open()) return -1;
+		file.write((const char *)bmpfileheader, sizeof(bmpfileheader));
+		file.write((const char *)bmpinfoheader, sizeof(bmpinfoheader));
+		for (int i = 0; i < height; i++) {
+			file.write((const char *)&data[width * (height - i - 1) * 3], 3 * width);
+			file.write((const char *)bmppad, (4 - (width * 3) % 4) % 4);
+		}
+		return 0;
+	}
+}
+
+void RunImageOutputBenchmark(int width, int height) {
+	// the gamma table must agree with pow right at its thresholds, not only on random values
+	int mismatches = 0;
+	for (int code = 0; code < 256; code++) {
+		double x = pow((code + 0.5) / 255.0, 2.2);
+		for (double probe : { nextafter(x, 0.0), x, nextafter(x, 2.0) }) {
+			if (EncodeGamma(probe) != LegacyToInt(probe)) mismatches++;
+		}
+	}
+	printf("gamma table mismatches at thresholds: %d\n", mismatches);
+
+	// radiance of a converging render: mostly below 1, some highlights above it
+	std::vector<Vector3D> image(size_t(width) * height);
+	Sampler sampler(7);
+	for (Vector3D &pixel : image) {
+		double scale = sampler.Next1D() < 0.05 ? 8.0 : 1.0;
+		pixel = Vector3D(sampler.Next1D(), sampler.Next1D(), sampler.Next1D()) * scale;
+	}
+	int hardware_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	printf("%dx%d image, %d hardware threads\n", width, height, hardware_threads);
+	printf("writer                  seconds       MB       MB/s\n");
+	auto print_run = [](char const *name, double seconds, std::string const &path) {
+		double megabytes = ReadFileBytes(path) / (1024.0 * 1024.0);
+		printf("%-22s %8.3f %8.1f %10.1f\n", name, seconds, megabytes, megabytes / seconds);
+	};
+	auto time_since = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	std::string legacy_path = "bench_legacy.bmp", bmp_path = "bench_output.bmp", pfm_path = "bench_output.pfm";
+	auto start = std::chrono::steady_clock::now();
+	LegacyWriteImageToBmp(legacy_path, image.data(), width, height);
+	print_run("legacy bmp", time_since(start), legacy_path);
+
+	std::vector<int> thread_counts = { 1 };
+	if (hardware_threads > 1) thread_counts.push_back(hardware_threads);
+	for (int threads : thread_counts) {
+		ImageWriter writer(threads);
+		char name[64];
+		// the first write allocates the buffer, the second one shows the steady state of snapshots
+		for (int pass = 0; pass < 2; pass++) {
+			start = std::chrono::steady_clock::now();
+			writer.Write(bmp_path, image.data(), width, height);
+			snprintf(name, sizeof(name), "bmp %d thread%s%s", threads, threads > 1 ? "s" : "", pass ? " reuse" : "");
+			print_run(name, time_since(start), bmp_path);
+		}
+		start = std::chrono::steady_clock::now();
+		writer.Write(pfm_path, image.data(), width, height);
+		snprintf(name, sizeof(name), "pfm %d thread%s", threads, threads > 1 ? "s" : "");
+		print_run(name, time_since(start), pfm_path);
+	}
+	printf("bmp identical to legacy: %s\n", ReadWholeFile(legacy_path) == ReadWholeFile(bmp_path) ? "yes" : "NO");
+	remove(legacy_path.c_str());
+	remove(bmp_path.c_str());
+	remove(pfm_path.c_str());
+}
@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "scene.h"
+#include "render.h"
+#include "scene_file.h"
+
+// render the same frame with 1..max_threads threads and report samples/sec and speedup.
+// Also checks that every run produces the same image as the single-threaded one.
+void RunThreadScalingBenchmark(Scene const &scene, Camera const &camera, RenderSettings const &settings, int max_threads);
+
+// cast random rays into scenes of 10..max_primitives random spheres and report rays/sec
+// of the linear scan and of the BVH for nearest-hit and any-hit queries
+void RunIntersectionBenchmark(int max_primitives);
+
+// trace the primary rays of the camera and random rays through 1000 spheres with every ray-sphere
+// kernel the CPU supports, with and without the BVH, and report rays/sec
+void RunSphereKernelBenchmark(Scene &scene, Camera const &camera);
+
+// render the frame with every integrator at 4..max_samples_per_pixel spp and report samples/sec
+void RunIntegratorBenchmark(Scene const &scene, Camera const &camera, int max_samples_per_pixel);
+
+// render the frame with scanline and square tile schedules and report wall-clock time and per-thread idle time
+void RunSchedulerBenchmark(Scene const &scene, Camera const &camera, RenderSettings const &settings);
+
+// compare uniform and adaptive sampling by RMSE against a high-spp reference and by the number of samples used
+void RunAdaptiveBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel);
+
+// render with 4..256 spp with every sampler and report RMSE against a reference of independent samples, render
+// time and how many times more independent samples give the same error
+void RunSamplerBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel);
+// render with 4..256 spp and report RMSE against a reference before and after denoising, render and denoise time,
+// then the denoise time of 512x512 and 3840x2160 frames
+void RunDenoiserBenchmark(Scene const &scene, Camera const &camera, int reference_samples_per_pixel);
+// render a short animation at 256x256 once like separate launches would (scene rebuilt, buffers and threads
+// made and the image written synchronously for every frame) and once in batch mode; reports the time per frame
+// spent outside of rendering and whether the frames are identical
+void RunAnimationBenchmark(Scene &scene, SceneDescription const &description, RenderSettings const &settings, int frame_count);
+// progressive render of samples_per_pixel spp without checkpoints and with a checkpoint after every pass,
+// then stopped halfway and resumed from the checkpoint; reports the checkpoint overhead and whether the
+// resumed image equals the uninterrupted one
+void RunCheckpointBenchmark(Scene const &scene, Camera const &camera, int samples_per_pixel);
+// compare renders with and without next-event estimation at equal spp by RMSE against a reference with it
+void RunLightSamplingBenchmark(Scene &scene, Camera const &camera, int reference_samples_per_pixel);
+// count self-intersections of rays leaving the primary hits with a fixed 1e-4 shift and with the error-scaled
+// offset in both precisions, then render with double and float kernels and report samples/sec and how much
+// the images differ compared to the noise between two double renders
+void RunPrecisionBenchmark(Scene &scene, Camera const &camera, int samples_per_pixel);
+// time the caustic photon pass with 1, 2, 4, ... threads and report the photons stored and the memory of the map,
+// then render with 4..256 spp with and without the map and report RMSE of the image and of the pixels whose
+// first hit receives photons against a path traced reference
+void RunCausticsBenchmark(Scene &scene, Camera const &camera, int reference_samples_per_pixel, int photon_count);
+// render a width x height frame (1024x1024 by default) streamed to the file by RenderImageStreamed, first a
+// quarter of its height, then all of it, then in memory with RenderImage and ImageWriter; report seconds,
+// samples/sec, the growth of the peak resident memory of the process and whether both files are the same
+void RunTiledOutputBenchmark(Scene const &scene, SceneDescription const &description, int width, int height, int samples_per_pixel);
+// time requests for the scene when every one spawns executable and when a RenderServer with the scene resident
+// serves them: latency to the first tile, its render time and the total; check the streamed image against a
+// progressive render, then measure a preview submitted during a background render with equal and higher priority
+void RunServerBenchmark(std::string const &executable, std::string const &scene_name, int samples_per_pixel);
+
+// compare the previous Vector3D (virtual destructor, out-of-line operations) with the Vec3 variants:
+// size, bytes of a 512x512 image buffer, time of accumulating samples into it and of shading arithmetic
+void RunVectorBenchmark();
+
+// write a text scene of sphere_count random spheres, then time reading its bytes, parsing it, building it,
+// saving it in the binary format, reading the bytes of that and loading it, and check both scenes agree
+void RunSceneLoadBenchmark(int sphere_count);
+
+// write a closed torus of about triangle_count triangles as OBJ, load it, report memory per triangle and
+// rays/sec of random rays, and check the mesh is watertight by casting rays from inside its tube
+void RunMeshBenchmark(int triangle_count);
+// encode a random HDR image of width x height (8K by default) with the previous BMP writer and with ImageWriter
+// on 1 and all threads as BMP and PFM, report seconds and MB/s, and check both BMP writers produce the same bytes
+void RunImageOutputBenchmark(int width, int height);
@@ -0,0 +1,187 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+#include "benchmark_suite.h"
+#include "benchmark.h"
+
+namespace {
+	void PrintUsage(char const *executable) {
+		std::cout << "Usage: " << executable << " [--json results.json] [--filter name_part] [--threads N,M,...] [--repeats N] [--quick]" << std::endl;
+		std::cout << "       " << executable << " study [arguments] [--scene cornell|small-light|many-spheres|file] [--resolution WIDTHxHEIGHT] [--light-sampling 0|1]" << std::endl;
+		std::cout << "       " << "    [--integrator recursive|iterative|wavefront] [--sampler independent|sobol|halton] [--precision double|float] [--threads N] [--tile-size N]" << std::endl;
+		std::cout << "studies: threads [samples_per_pixel] [max_threads]" << std::endl;
+		std::cout << "         intersect [max_primitives]" << std::endl;
+		std::cout << "         simd" << std::endl;
+		std::cout << "         integrators [max_samples_per_pixel]" << std::endl;
+		std::cout << "         schedule [samples_per_pixel]" << std::endl;
+		std::cout << "         adaptive [reference_samples_per_pixel]" << std::endl;
+		std::cout << "         lights [reference_samples_per_pixel] --scene small-light" << std::endl;
+		std::cout << "         vector" << std::endl;
+		std::cout << "         load [sphere_count]" << std::endl;
+		std::cout << "         mesh [triangle_count]" << std::endl;
+		std::cout << "         output [width height]" << std::endl;
+		std::cout << "         sampler [reference_samples_per_pixel]" << std::endl;
+		std::cout << "         denoise [reference_samples_per_pixel]" << std::endl;
+		std::cout << "         animation [frames] --scene many-spheres" << std::endl;
+		std::cout << "         checkpoint [samples_per_pixel]" << std::endl;
+		std::cout << "         precision [samples_per_pixel]" << std::endl;
+		std::cout << "         server [samples_per_pixel] [--renderer path_tracer_executable(default next to this one)]" << std::endl;
+		std::cout << "         caustics [reference_samples_per_pixel] [photon_paths]" << std::endl;
+		std::cout << "         tiled [width height] [samples_per_pixel]" << std::endl;
+	}
+
+	// one of the studies of benchmark.h: positional arguments and "--name value" options as in the renderer
+	int RunStudy(int argc, char *argv[]) {
+		std::string study = argv[1];
+		std::vector<std::string> positional;
+		std::map<std::string, std::string> options;
+		for (int i = 2; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg.compare(0, 2, "--") == 0) options[arg.substr(2)] = i + 1 < argc ? argv[++i] : "";
+			else positional.push_back(arg);
+		}
+		auto argument = [&](size_t index, int default_value) { return positional.size() > index ? atoi(positional[index].c_str()) : default_value; };
+
+		// studies without a scene
+		if (study == "output") {
+			RunImageOutputBenchmark(positional.size() > 1 ? argument(0, 0) : 7680, positional.size() > 1 ? argument(1, 0) : 4320);
+			return 0;
+		}
+		if (study == "vector") {
+			RunVectorBenchmark();
+			return 0;
+		}
+		if (study == "load") {
+			RunSceneLoadBenchmark(argument(0, 1000000));
+			return 0;
+		}
+		if (study == "mesh") {
+			RunMeshBenchmark(argument(0, 4000000));
+			return 0;
+		}
+		if (study == "intersect") {
+			RunIntersectionBenchmark(argument(0, 1000000));
+			return 0;
+		}
+		if (study == "server") {
+			// the renderer is spawned once per request to compare with the server
+			std::string executable = argv[0];
+			size_t slash = executable.find_last_of("/\\");
+			std::string renderer = options.count("renderer") ? options["renderer"] :
+				executable.substr(0, slash == std::string::npos ? 0 : slash + 1) + "path_tracer";
+			RunServerBenchmark(renderer, options.count("scene") ? options["scene"] : "cornell", argument(0, 4));
+			return 0;
+		}
+
+		RenderSettings settings;
+		Precision precision = Precision::float64;
+		if ((options.count("integrator") && !ParseIntegratorType(options["integrator"], settings.integrator)) ||
+			(options.count("sampler") && !ParseSamplerType(options["sampler"], settings.sampler)) ||
+			(options.count("precision") && !ParsePrecision(options["precision"], precision))) {
+			std::cerr << "Unknown integrator, sampler or precision" << std::endl;
+			return 1;
+		}
+		if (options.count("threads")) settings.thread_count = atoi(options["threads"].c_str());
+		if (options.count("tile-size")) settings.tile_size = atoi(options["tile-size"].c_str());
+		settings.samples_per_subpixel = std::max(1, argument(0, 4) / 4); // since every pixel is split into 4 subpixels
+
+		std::string scene_name = options.count("scene") ? options["scene"] : "cornell";
+		Scene scene(5);
+		SceneDescription description;
+		scene.SetPrecision(precision); // before the scene is built, BVH leaves are sized for the kernel width
+		std::string error;
+		if (!CreateBuiltinScene(scene_name, scene) && !LoadScene(scene_name, scene, description, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		scene.SetLightSampling(!options.count("light-sampling") || atoi(options["light-sampling"].c_str()) != 0);
+		if (options.count("resolution") && (sscanf(options["resolution"].c_str(), "%dx%d", &description.width, &description.height) != 2 ||
+			description.width < 1 || description.height < 1)) {
+			std::cerr << "Expected WIDTHxHEIGHT after --resolution" << std::endl;
+			return 1;
+		}
+		Vector3D origin = description.camera_origin;
+		Vector3D direction = description.camera_direction;
+		Camera camera(origin, direction, description.width, description.height);
+		// smaller frames keep references at high spp affordable
+		Camera small_camera(origin, direction, 128, 128);
+		Camera medium_camera(origin, direction, 256, 256);
+
+		if (study == "simd") RunSphereKernelBenchmark(scene, camera);
+		else if (study == "threads") RunThreadScalingBenchmark(scene, camera, settings, std::max(1, argument(1, int(std::thread::hardware_concurrency()))));
+		else if (study == "integrators") RunIntegratorBenchmark(scene, small_camera, argument(0, 64));
+		else if (study == "schedule") RunSchedulerBenchmark(scene, camera, settings);
+		else if (study == "adaptive") RunAdaptiveBenchmark(scene, small_camera, argument(0, 1024));
+		else if (study == "sampler") RunSamplerBenchmark(scene, small_camera, argument(0, 4096));
+		else if (study == "denoise") RunDenoiserBenchmark(scene, small_camera, argument(0, 1024));
+		else if (study == "checkpoint") RunCheckpointBenchmark(scene, medium_camera, argument(0, 32));
+		else if (study == "animation") RunAnimationBenchmark(scene, description, settings, argument(0, 8));
+		else if (study == "precision") RunPrecisionBenchmark(scene, medium_camera, argument(0, 64));
+		else if (study == "caustics") RunCausticsBenchmark(scene, small_camera, argument(0, 4096), argument(1, 1000000));
+		else if (study == "lights") RunLightSamplingBenchmark(scene, small_camera, argument(0, 4096));
+		else if (study == "tiled") {
+			RunTiledOutputBenchmark(scene, description, positional.size() > 1 ? argument(0, 0) : 1024, positional.size() > 1 ? argument(1, 0) : 1024, argument(2, 4));
+		}
+		else {
+			std::cerr << "Unknown study " << study << std::endl;
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		return 0;
+	}
+}
+
+// entry point of the path_tracer_bench executable: the suite, or a study named by the first argument
+int main(int argc, char *argv[]) {
+	if (argc > 1 && argv[1][0] != '-') return RunStudy(argc, argv);
+	std::map<std::string, std::string> options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--quick") options["quick"] = "1";
+		else if (arg.compare(0, 2, "--") == 0 && arg != "--help" && i + 1 < argc) options[arg.substr(2)] = argv[++i];
+		else {
+			PrintUsage(argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	BenchmarkSuiteSettings settings;
+	if (options.count("json")) settings.json_path = options["json"];
+	if (options.count("filter")) settings.filter = options["filter"];
+	if (options.count("repeats")) settings.repeats = atoi(options["repeats"].c_str());
+	if (options.count("quick")) settings.quick = true;
+	if (options.count("threads")) {
+		std::stringstream list(options["threads"]);
+		std::string item;
+		while (std::getline(list, item, ',')) {
+			if (atoi(item.c_str()) > 0) settings.thread_counts.push_back(atoi(item.c_str()));
+		}
+	}
+	return RunBenchmarkSuite(settings) ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+#include "benchmark_suite.h"
+#include "objects.h"
+#include "scene.h"
+#include "camera.h"
+#include "render.h"
+#include "scene_file.h"
+#include "image_writer.h"
+#include "sphere_store.h"
+
+namespace {
+	struct MicroResult {
+		std::string name;
+		double ops; // operations of one repeat
+		double median_ns, min_ns; // per operation
+	};
+
+	struct MacroResult {
+		std::string scene;
+		int threads, width, height, samples_per_pixel;
+		uint64_t seed;
+		double seconds; // median over the repeats
+		double samples_per_second, rays_per_second;
+		uint64_t checksum;
+	};
+
+	// results are folded into this, so that the compiler cannot drop the measured work
+	volatile double benchmark_sink = 0.0;
+
+	double Median(std::vector<double> values) {
+		std::sort(values.begin(), values.end());
+		size_t middle = values.size() / 2;
+		return values.size() % 2 ? values[middle] : 0.5 * (values[middle - 1] + values[middle]);
+	}
+
+	// time repeats runs of body, which performs ops operations and returns a value depending on all of them
+	MicroResult TimeMicro(std::string const &name, double ops, int repeats, std::function<double()> const &body) {
+		std::vector<double> times;
+		body(); // warm up caches and lazily built tables
+		for (int repeat = 0; repeat < repeats; repeat++) {
+			auto start = std::chrono::steady_clock::now();
+			benchmark_sink = benchmark_sink + body();
+			times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+		MicroResult result;
+		result.name = name;
+		result.ops = ops;
+		result.median_ns = Median(times) * 1e9 / ops;
+		result.min_ns = *std::min_element(times.begin(), times.end()) * 1e9 / ops;
+		return result;
+	}
+
+	// FNV-1a of the bytes of the image, equal images of the same build give equal checksums
+	uint64_t ImageChecksum(std::vector<Vector3D> const &image) {
+		uint64_t hash = 14695981039346656037ull;
+		unsigned char const *bytes = reinterpret_cast<unsigned char const *>(image.data());
+		for (size_t i = 0; i < image.size() * sizeof(Vector3D); i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+		return hash;
+	}
+
+	bool Selected(BenchmarkSuiteSettings const &settings, std::string const &name) {
+		return settings.filter.empty() || name.find(settings.filter) != std::string::npos;
+	}
+
+	void RunMicroBenchmarks(BenchmarkSuiteSettings const &settings, std::vector<MicroResult> &results) {
+		const int count = 4096; // inputs of the arithmetic benchmarks, they stay in L1/L2
+		int passes = settings.quick ? 16 : 256;
+		Sampler sampler(3);
+		std::vector<Vector3D> a(count), b(count);
+		for (int i = 0; i < count; i++) {
+			a[i] = Vector3D(sampler.Next1D(), sampler.Next1D(), sampler.Next1D());
+			b[i] = Vector3D(sampler.Next1D() - 0.5, sampler.Next1D() - 0.5, sampler.Next1D() - 0.5).norm();
+		}
+		double ops = double(count) * passes;
+
+		std::vector<std::pair<std::string, std::function<double()>>> benchmarks;
+		benchmarks.emplace_back("vector/add_mult", [&]() {
+			Vector3D sum;
+			for (int pass = 0; pass < passes; pass++) {
+				for (int i = 0; i < count; i++) sum = sum + a[i].mult(b[i]) * 0.5;
+			}
+			return sum.x + sum.y + sum.z;
+		});
+		benchmarks.emplace_back("vector/dot_cross_norm", [&]() {
+			double sum = 0.0;
+			for (int pass = 0; pass < passes; pass++) {
+				for (int i = 0; i < count; i++) sum += (a[i] % b[i]).norm().dot(b[i]) + a[i].dot(b[i]);
+			}
+			return sum;
+		});
+
+		// random rays from around a unit sphere, about half of them hit it
+		SphereObject sphere(1.0, Vector3D(), Object::Material::diffuse, Vector3D(.5, .5, .5), Vector3D());
+		std::vector<Ray3D> rays(count);
+		for (int i = 0; i < count; i++) rays[i] = Ray3D(a[i] * 4.0 - Vector3D(2, 2, 2) + Vector3D(0, 0, 3), Vector3D(b[i].x * 0.5, b[i].y * 0.5, -1).norm());
+		benchmarks.emplace_back("sphere/intersect", [&]() {
+			double sum = 0.0;
+			for (int pass = 0; pass < passes; pass++) {
+				for (int i = 0; i < count; i++) sum += sphere.Intersect(rays[i]);
+			}
+			return sum;
+		});
+
+		Scene empty_scene;
+		benchmarks.emplace_back("scene/hemisphere_sample", [&]() {
+			Sampler hemisphere_sampler(5);
+			Vector3D sum;
+			for (int pass = 0; pass < passes; pass++) {
+				for (int i = 0; i < count; i++) sum = sum + empty_scene.GenerateRandomUnitVectorInHemisphere(b[i], hemisphere_sampler);
+			}
+			return sum.x + sum.y + sum.z;
+		});
+		benchmarks.emplace_back("image/encode_gamma", [&]() {
+			double sum = 0.0;
+			for (int pass = 0; pass < passes; pass++) {
+				for (int i = 0; i < count; i++) sum += EncodeGamma(a[i].x) + EncodeGamma(a[i].y * 1.5) + EncodeGamma(a[i].z * 0.1);
+			}
+			return sum;
+		});
+		for (auto const &benchmark : benchmarks) {
+			if (Selected(settings, benchmark.first)) results.push_back(TimeMicro(benchmark.first, ops, settings.repeats, benchmark.second));
+		}
+
+		// whole-image output of a full HD frame, one operation is one pixel
+		int width = settings.quick ? 320 : 1920, height = settings.quick ? 180 : 1080;
+		std::vector<Vector3D> image(size_t(width) * height);
+		for (size_t i = 0; i < image.size(); i++) image[i] = a[i % count] * 1.5;
+		ImageWriter writer(1);
+		for (char const *extension : { "bmp", "pfm" }) {
+			std::string name = std::string("image/write_") + extension, path = std::string("bench_suite.") + extension;
+			if (!Selected(settings, name)) continue;
+			results.push_back(TimeMicro(name, double(image.size()), settings.repeats, [&]() {
+				return writer.Write(path, image.data(), width, height) ? 1.0 : 0.0;
+			}));
+			remove(path.c_str());
+		}
+	}
+
+	void RunMacroBenchmarks(BenchmarkSuiteSettings const &settings, std::vector<MacroResult> &results) {
+		int width = settings.quick ? 64 : 256, height = width;
+		int samples_per_pixel = settings.quick ? 4 : 16;
+		SceneDescription description;
+		Camera camera(description.camera_origin, description.camera_direction, width, height);
+
+		for (char const *scene_name : { "cornell", "small-light", "many-spheres" }) {
+			if (!Selected(settings, std::string("render/") + scene_name)) continue;
+			Scene scene;
+			CreateBuiltinScene(scene_name, scene);
+			for (int threads : settings.thread_counts) {
+				ThreadPool pool(threads);
+				RenderSettings render_settings;
+				render_settings.samples_per_subpixel = samples_per_pixel / 4;
+				render_settings.thread_count = threads;
+				render_settings.report_progress = false;
+
+				MacroResult result;
+				result.scene = scene_name;
+				result.threads = threads;
+				result.width = width;
+				result.height = height;
+				result.samples_per_pixel = samples_per_pixel;
+				result.seed = render_settings.seed;
+
+				std::vector<Vector3D> image(size_t(width) * height);
+				std::vector<double> render_times, ray_times;
+				for (int repeat = 0; repeat < settings.repeats; repeat++) {
+					auto start = std::chrono::steady_clock::now();
+					RenderImage(scene, camera, render_settings, image.data(), nullptr, &pool);
+					render_times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+					// nearest hits of the primary rays of every subpixel, rows are the work items
+					start = std::chrono::steady_clock::now();
+					std::vector<double> row_sums(height);
+					pool.Run(height, [&](int y, int) {
+						Sampler sampler(render_settings.seed);
+						double sum = 0.0;
+						for (int x = 0; x < width; x++) {
+							for (int subpixel = 0; subpixel < 4; subpixel++) {
+								sampler.StartPixelSample(uint32_t(y * width + x), uint32_t(subpixel));
+								double t;
+								if (scene.IntersectWithNearestObject(camera.GenerateRay(x, y, subpixel % 2, subpixel / 2, sampler), t) != nullptr) sum += t;
+							}
+						}
+						row_sums[y] = sum;
+					});
+					ray_times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+					for (double sum : row_sums) benchmark_sink = benchmark_sink + sum;
+				}
+				result.seconds = Median(render_times);
+				result.samples_per_second = double(width) * height * samples_per_pixel / result.seconds;
+				result.rays_per_second = double(width) * height * 4 / Median(ray_times);
+				result.checksum = ImageChecksum(image);
+				results.push_back(result);
+			}
+		}
+	}
+
+	char const *GetCompilerName() {
+#if defined(__clang__)
+		return "clang " __clang_version__;
+#elif defined(__GNUC__)
+		return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+#define PATH_TRACER_STRING(x) #x
+#define PATH_TRACER_VERSION(x) PATH_TRACER_STRING(x)
+		return "msvc " PATH_TRACER_VERSION(_MSC_FULL_VER);
+#else
+		return "unknown";
+#endif
+	}
+
+	bool WriteJson(std::string const &path, BenchmarkSuiteSettings const &settings, std::vector<MicroResult> const &micro, std::vector<MacroResult> const &macro) {
+		FILE *file = fopen(path.c_str(), "w");
+		if (file == nullptr) return false;
+		fprintf(file, "{\n  \"suite\": \"path_tracer\",\n  \"format_version\": 1,\n");
+		fprintf(file, "  \"environment\": {\"compiler\": \"%s\", \"simd\": \"%s\", \"hardware_threads\": %u, \"repeats\": %d, \"quick\": %s},\n",
+			GetCompilerName(), GetSimdLevelName(DetectSimdLevel()), std::thread::hardware_concurrency(), settings.repeats, settings.quick ? "true" : "false");
+		fprintf(file, "  \"micro\": [");
+		for (size_t i = 0; i < micro.size(); i++) {
+			fprintf(file, "%s\n    {\"name\": \"%s\", \"ops\": %.0f, \"median_ns_per_op\": %.4f, \"min_ns_per_op\": %.4f}",
+				i ? "," : "", micro[i].name.c_str(), micro[i].ops, micro[i].median_ns, micro[i].min_ns);
+		}
+		fprintf(file, "\n  ],\n  \"macro\": [");
+		for (size_t i = 0; i < macro.size(); i++) {
+			MacroResult const &result = macro[i];
+			fprintf(file, "%s\n    {\"scene\": \"%s\", \"threads\": %d, \"width\": %d, \"height\": %d, \"samples_per_pixel\": %d, \"seed\": %llu, "
+				"\"seconds\": %.6f, \"samples_per_second\": %.1f, \"rays_per_second\": %.1f, \"checksum\": \"%016llx\"}",
+				i ? "," : "", result.scene.c_str(), result.threads, result.width, result.height, result.samples_per_pixel,
+				(unsigned long long)result.seed, result.seconds, result.samples_per_second, result.rays_per_second, (unsigned long long)result.checksum);
+		}
+		fprintf(file, "\n  ]\n}\n");
+		return fclose(file) == 0;
+	}
+}
+
+bool RunBenchmarkSuite(BenchmarkSuiteSettings const &settings_) {
+	BenchmarkSuiteSettings settings = settings_;
+	if (settings.repeats < 1) settings.repeats = 1;
+	if (settings.thread_counts.empty()) {
+		int hardware_threads = std::max(1, int(std::thread::hardware_concurrency()));
+		settings.thread_counts.push_back(1);
+		if (hardware_threads > 1) settings.thread_counts.push_back(hardware_threads);
+	}
+
+	std::vector<MicroResult> micro;
+	RunMicroBenchmarks(settings, micro);
+	printf("micro benchmark           median ns/op   min ns/op\n");
+	for (MicroResult const &result : micro) printf("%-24s %13.3f %11.3f\n", result.name.c_str(), result.median_ns, result.min_ns);
+
+	std::vector<MacroResult> macro;
+	RunMacroBenchmarks(settings, macro);
+	printf("scene          threads  seconds    samples/sec       rays/sec  checksum\n");
+	for (MacroResult const &result : macro) {
+		printf("%-14s %7d %8.3f %14.0f %14.0f  %016llx\n", result.scene.c_str(), result.threads, result.seconds,
+			result.samples_per_second, result.rays_per_second, (unsigned long long)result.checksum);
+	}
+
+	if (settings.json_path.empty()) return true;
+	if (!WriteJson(settings.json_path, settings, micro, macro)) {
+		fprintf(stderr, "cannot write %s\n", settings.json_path.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// what RunBenchmarkSuite measures and where it reports
+struct BenchmarkSuiteSettings {
+	std::string json_path; // empty - results are only printed
+	std::string filter; // run only the benchmarks whose name contains it, empty - all of them
+	std::vector<int> thread_counts; // thread counts of the macro benchmarks, empty - 1 and all hardware threads
+	int repeats = 5; // every benchmark is timed this many times and the median is reported
+	bool quick = false; // small workloads for a smoke run
+};
+
+// Reproducible benchmark suite. Micro benchmarks time single operations in isolation: Vector3D arithmetic,
+// SphereObject::Intersect, Scene::GenerateRandomUnitVectorInHemisphere, gamma encoding and ImageWriter.
+// Macro benchmarks render the built-in scenes (cornell, small-light, many-spheres) at a fixed resolution,
+// spp and seed with every thread count and report samples/sec, rays/sec of the primary rays and a checksum
+// of the image, which must not change between thread counts or runs of the same build.
+// Results are printed as a table and written as JSON; returns false if the JSON file cannot be written.
+bool RunBenchmarkSuite(BenchmarkSuiteSettings const &settings);
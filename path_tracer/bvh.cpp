@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include "bvh.h"
+
+namespace {
+	const int bin_count = 16;
+	const double traversal_cost = 1.0; // cost of a node visit relative to one primitive test
+
+	double GetComponent(Vector3D const &v, int axis) {
+		return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+	}
+
+	bool SameBounds(BoundingBox const &a, BoundingBox const &b) {
+		return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z && a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+	}
+
+	// cost of testing count primitives when width of them are tested at once
+	double GroupCost(int count, int width) {
+		return double((count + width - 1) / width);
+	}
+}
+
+void BVH::Clear() {
+	nodes.clear();
+	primitive_indices.clear();
+	node_ptr = nullptr;
+	primitive_index_ptr = nullptr;
+	node_count = primitive_count = 0;
+	parents.clear();
+	position_leaves.clear();
+	cost = built_cost = 0.0;
+}
+
+void BVH::Attach(Node const *nodes_, int node_count_, int const *primitive_indices_, int primitive_count_) {
+	Clear();
+	node_ptr = nodes_;
+	node_count = node_count_;
+	primitive_index_ptr = primitive_indices_;
+	primitive_count = primitive_count_;
+}
+
+void BVH::Build(std::vector<BoundingBox> const &primitive_bounds) {
+	Clear();
+	int count = int(primitive_bounds.size());
+	if (count == 0) return;
+
+	std::vector<BuildItem> items(count);
+	for (int i = 0; i < count; i++) {
+		items[i].bounds = primitive_bounds[i];
+		items[i].center = primitive_bounds[i].Center();
+		items[i].index = i;
+	}
+	nodes.reserve(2 * count);
+	primitive_indices.reserve(count);
+	BuildRecursive(items, 0, count, 0);
+	node_ptr = nodes.data();
+	node_count = int(nodes.size());
+	primitive_index_ptr = primitive_indices.data();
+	primitive_count = int(primitive_indices.size());
+	for (Node const &node : nodes) cost += GetNodeCost(node, node.bounds);
+	built_cost = cost;
+}
+
+double BVH::GetNodeCost(Node const &node, BoundingBox const &bounds) const {
+	return bounds.SurfaceArea() * (node.count == 0 ? traversal_cost : GroupCost(node.count, leaf_width));
+}
+
+bool BVH::PrepareRefit() {
+	if (node_count == 0 || node_ptr != nodes.data()) return false;
+	if (!parents.empty()) return true;
+	parents.assign(node_count, -1);
+	position_leaves.assign(primitive_count, -1);
+	for (int i = 0; i < node_count; i++) {
+		Node const &node = nodes[i];
+		if (node.count > 0) {
+			for (int position = node.offset; position < node.offset + node.count; position++) position_leaves[position] = i;
+		}
+		else {
+			parents[i + 1] = i;
+			parents[node.offset] = i;
+		}
+	}
+	return true;
+}
+
+bool BVH::SetNodeBounds(int node_index, BoundingBox const &bounds) {
+	Node &node = nodes[node_index];
+	if (SameBounds(bounds, node.bounds)) return false;
+	cost += GetNodeCost(node, bounds) - GetNodeCost(node, node.bounds);
+	node.bounds = bounds;
+	return true;
+}
+
+int BVH::BuildRecursive(std::vector<BuildItem> &items, int begin, int end, int depth) {
+	int node_index = int(nodes.size());
+	nodes.push_back(Node());
+
+	BoundingBox bounds, center_bounds;
+	for (int i = begin; i < end; i++) {
+		bounds.Extend(items[i].bounds);
+		center_bounds.Extend(items[i].center);
+	}
+	nodes[node_index].bounds = bounds;
+	nodes[node_index].axis = 0;
+
+	int count = end - begin;
+	// SAH splits of skewed scenes can chain deeper than the traversal stack allows; from half of its depth on
+	// nodes are split at the median instead, which halves the count and so ends within the other half
+	bool median_split = depth >= stack_capacity / 2;
+	double leaf_cost = GroupCost(count, leaf_width);
+	double best_cost = std::numeric_limits<double>::max();
+	int best_axis = -1, best_bin = -1;
+
+	// binned SAH: evaluate bin_count - 1 candidate planes along every axis of the centroid box
+	for (int axis = 0; axis < 3 && count > 1 && !median_split; axis++) {
+		double axis_min = GetComponent(center_bounds.min, axis);
+		double axis_extent = GetComponent(center_bounds.max, axis) - axis_min;
+		if (axis_extent <= 0.0) continue;
+
+		BoundingBox bin_bounds[bin_count];
+		int bin_counts[bin_count] = { 0 };
+		for (int i = begin; i < end; i++) {
+			int bin = int(bin_count * (GetComponent(items[i].center, axis) - axis_min) / axis_extent);
+			bin = std::min(bin, bin_count - 1);
+			bin_counts[bin]++;
+			bin_bounds[bin].Extend(items[i].bounds);
+		}
+
+		// sweep from the right to get areas of all right partitions
+		double right_area[bin_count];
+		int right_count[bin_count];
+		BoundingBox accumulated;
+		int accumulated_count = 0;
+		for (int bin = bin_count - 1; bin > 0; bin--) {
+			accumulated.Extend(bin_bounds[bin]);
+			accumulated_count += bin_counts[bin];
+			right_area[bin] = accumulated.SurfaceArea();
+			right_count[bin] = accumulated_count;
+		}
+		accumulated = BoundingBox();
+		accumulated_count = 0;
+		for (int bin = 0; bin < bin_count - 1; bin++) {
+			accumulated.Extend(bin_bounds[bin]);
+			accumulated_count += bin_counts[bin];
+			if (accumulated_count == 0 || right_count[bin + 1] == 0) continue;
+			double cost = traversal_cost + (accumulated.SurfaceArea() * GroupCost(accumulated_count, leaf_width) +
+				right_area[bin + 1] * GroupCost(right_count[bin + 1], leaf_width)) / std::max(bounds.SurfaceArea(), 1e-300);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+
+	int mid = begin;
+	if (median_split) {
+		// split along the widest centroid axis; an inner node must not have stack_capacity inner ancestors
+		if (count > max_leaf_size && depth < stack_capacity - 1) {
+			Vector3D extent = center_bounds.max - center_bounds.min;
+			best_axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+			mid = begin + count / 2;
+			std::nth_element(&items[begin], &items[mid], &items[begin] + count, [&](BuildItem const &a, BuildItem const &b) {
+				return GetComponent(a.center, best_axis) < GetComponent(b.center, best_axis);
+			});
+		}
+	}
+	else if (best_axis >= 0 && (best_cost < leaf_cost || count > max_leaf_size)) {
+		double axis_min = GetComponent(center_bounds.min, best_axis);
+		double axis_extent = GetComponent(center_bounds.max, best_axis) - axis_min;
+		BuildItem *mid_ptr = std::partition(&items[begin], &items[begin] + count, [&](BuildItem const &item) {
+			int bin = int(bin_count * (GetComponent(item.center, best_axis) - axis_min) / axis_extent);
+			return std::min(bin, bin_count - 1) <= best_bin;
+		});
+		mid = int(mid_ptr - &items[0]);
+	}
+	else if (count > max_leaf_size) {
+		// all centroids coincide, split in the middle of the list
+		mid = begin + count / 2;
+		best_axis = 0;
+	}
+
+	if (mid == begin || mid == end) {
+		nodes[node_index].offset = int(primitive_indices.size());
+		nodes[node_index].count = count;
+		for (int i = begin; i < end; i++) primitive_indices.push_back(items[i].index);
+		return node_index;
+	}
+
+	// the first child directly follows its parent, the second one is referenced by offset
+	nodes[node_index].axis = best_axis;
+	nodes[node_index].count = 0;
+	BuildRecursive(items, begin, mid, depth + 1);
+	int second_child = BuildRecursive(items, mid, end, depth + 1);
+	nodes[node_index].offset = second_child;
+	return node_index;
+}
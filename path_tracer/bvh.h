@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include "utils.h"
+#include "stats.h"
+
+// Bounding volume hierarchy over an arbitrary set of primitives, built with the surface area heuristic.
+// The hierarchy only knows primitive bounds; the traversal routines take a functor
+// intersect(primitive, ray) that returns the hit distance (0 for a miss).
+class BVH {
+	public:
+		struct Node {
+			BoundingBox bounds;
+			int offset; // index of the second child for inner nodes, first primitive for leaves
+			int count; // number of primitives in a leaf, 0 for inner nodes
+			int axis; // split axis of an inner node, used to visit the nearer child first
+		};
+		// entries of the fixed traversal stack: an inner node may have at most stack_capacity - 1 inner ancestors
+		static const int stack_capacity = 64;
+
+		// leaf_width is the number of primitives the caller tests at once (the SIMD width of its kernel),
+		// the surface area heuristic then prefers leaves filled up to a multiple of it
+		BVH(int max_leaf_size_ = 4, int leaf_width_ = 1) : max_leaf_size(max_leaf_size_), leaf_width(leaf_width_) { Clear(); }
+		void SetLeafSize(int max_leaf_size_, int leaf_width_) { max_leaf_size = max_leaf_size_; leaf_width = leaf_width_; }
+		// build the hierarchy over the boxes of primitives
+		void Build(std::vector<BoundingBox> const &primitive_bounds);
+		// use a hierarchy built earlier and kept elsewhere (e.g. in a memory-mapped file) without copying it,
+		// the arrays must outlive the BVH or the next Build/Clear
+		void Attach(Node const *nodes_, int node_count_, int const *primitive_indices_, int primitive_count_);
+		void Clear();
+		// Refit after primitives moved: recompute the bounds of the leaves holding changed_positions (positions
+		// in GetPrimitiveIndices()) and of their ancestors, keeping the topology. bounds(primitive) returns the
+		// new box of a primitive. Only a built hierarchy can be refitted, returns false for an attached one.
+		template <typename BoundsFunc>
+		bool Refit(std::vector<int> const &changed_positions, BoundsFunc bounds);
+		// surface area cost of the current bounds relative to the one right after Build, refits of primitives
+		// that moved far apart make it grow; 1 for an attached hierarchy
+		double GetRefitDegradation() const { return built_cost > 0.0 ? cost / built_cost : 1.0; }
+		bool IsEmpty() const { return node_count == 0; }
+		// leaves store ranges of this array of primitive indices
+		int const *GetPrimitiveIndices() const { return primitive_index_ptr; }
+		int GetPrimitiveCount() const { return primitive_count; }
+		Node const *GetNodes() const { return node_ptr; }
+		int GetNodeCount() const { return node_count; }
+
+		// find the nearest hit, returns the primitive index or -1, t receives the hit distance
+		template <typename IntersectFunc>
+		int IntersectNearest(Ray3D const &ray, double &t, IntersectFunc intersect) const;
+		// check whether anything is hit closer than t_max, stops at the first hit found
+		template <typename IntersectFunc>
+		bool IntersectAny(Ray3D const &ray, double t_max, IntersectFunc intersect) const;
+
+		// Same queries with a functor that tests a whole leaf, so that the primitives of a leaf can be
+		// intersected at once. The leaf is given as a range [first, first + count) of GetPrimitiveIndices():
+		// leaf_nearest(first, count, ray, t) returns the position of a hit nearer than t (updating t) or -1,
+		// leaf_any(first, count, ray, t_max) returns whether there is a hit nearer than t_max.
+		// TraverseNearest returns the position in GetPrimitiveIndices() of the nearest hit or -1.
+		template <typename LeafFunc>
+		int TraverseNearest(Ray3D const &ray, double &t, LeafFunc leaf_nearest) const {
+			return TraverseNearest(ray, std::numeric_limits<double>::max(), t, leaf_nearest);
+		}
+		// nearest hit closer than t_max only, t receives t_max if there is none
+		template <typename LeafFunc>
+		int TraverseNearest(Ray3D const &ray, double t_max, double &t, LeafFunc leaf_nearest) const;
+		template <typename LeafFunc>
+		bool TraverseAny(Ray3D const &ray, double t_max, LeafFunc leaf_any) const;
+
+	private:
+		struct BuildItem {
+			BoundingBox bounds;
+			Vector3D center;
+			int index;
+		};
+		// node over items [begin, end) with depth inner ancestors
+		int BuildRecursive(std::vector<BuildItem> &items, int begin, int end, int depth);
+		// surface area heuristic cost of a node with the given bounds
+		double GetNodeCost(Node const &node, BoundingBox const &bounds) const;
+		// parents and leaves of positions for Refit, made on its first call after a build
+		bool PrepareRefit();
+		// set the bounds of a node, returns false if they did not change
+		bool SetNodeBounds(int node_index, BoundingBox const &bounds);
+
+		// built arrays, the traversal reads them through the pointers below, which may also point to attached ones
+		std::vector<Node> nodes;
+		std::vector<int> primitive_indices;
+		Node const *node_ptr;
+		int const *primitive_index_ptr;
+		int node_count, primitive_count;
+		int max_leaf_size;
+		int leaf_width;
+		std::vector<int> parents, position_leaves;
+		double cost, built_cost;
+};
+
+inline Vector3D InverseDirection(Vector3D const &direction) {
+	return Vector3D(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z);
+}
+
+template <typename LeafFunc>
+int BVH::TraverseNearest(Ray3D const &ray, double t_max, double &t, LeafFunc leaf_nearest) const {
+	int res_position = -1;
+	double res_t = t_max;
+	if (node_count == 0) {
+		t = res_t;
+		return res_position;
+	}
+
+	Vector3D inv_direction = InverseDirection(ray.direction);
+	bool negative[3] = { ray.direction.x < 0.0, ray.direction.y < 0.0, ray.direction.z < 0.0 };
+	int stack[stack_capacity];
+	int stack_size = 0;
+	int node_index = 0;
+	while (true) {
+		Node const &node = node_ptr[node_index];
+		STATS_COUNT(Counter::bvh_nodes);
+		double t_near;
+		// nodes farther than the nearest hit found so far are culled by the t_max of the slab test
+		if (node.bounds.Intersect(ray, inv_direction, res_t, t_near)) {
+			if (node.count == 0) {
+				// visit the child closer to the ray origin first
+				if (negative[node.axis]) {
+					stack[stack_size++] = node_index + 1;
+					node_index = node.offset;
+				}
+				else {
+					stack[stack_size++] = node.offset;
+					node_index = node_index + 1;
+				}
+				continue;
+			}
+			int position = leaf_nearest(node.offset, node.count, ray, res_t);
+			if (position >= 0) res_position = position;
+		}
+		if (stack_size == 0) break;
+		node_index = stack[--stack_size];
+	}
+	t = res_t;
+	return res_position;
+}
+
+template <typename LeafFunc>
+bool BVH::TraverseAny(Ray3D const &ray, double t_max, LeafFunc leaf_any) const {
+	if (node_count == 0) return false;
+
+	Vector3D inv_direction = InverseDirection(ray.direction);
+	int stack[stack_capacity];
+	int stack_size = 0;
+	int node_index = 0;
+	while (true) {
+		Node const &node = node_ptr[node_index];
+		STATS_COUNT(Counter::bvh_nodes);
+		double t_near;
+		if (node.bounds.Intersect(ray, inv_direction, t_max, t_near)) {
+			if (node.count == 0) {
+				stack[stack_size++] = node.offset;
+				node_index = node_index + 1;
+				continue;
+			}
+			if (leaf_any(node.offset, node.count, ray, t_max)) return true;
+		}
+		if (stack_size == 0) break;
+		node_index = stack[--stack_size];
+	}
+	return false;
+}
+
+template <typename BoundsFunc>
+bool BVH::Refit(std::vector<int> const &changed_positions, BoundsFunc bounds) {
+	if (!PrepareRefit()) return false;
+	for (int position : changed_positions) {
+		int node_index = position_leaves[position];
+		Node const &leaf = nodes[node_index];
+		BoundingBox node_bounds;
+		for (int i = leaf.offset; i < leaf.offset + leaf.count; i++) node_bounds.Extend(bounds(primitive_indices[i]));
+		// walk up while the bounds change, the first child of a node directly follows it
+		while (SetNodeBounds(node_index, node_bounds) && node_index != 0) {
+			node_index = parents[node_index];
+			node_bounds = nodes[node_index + 1].bounds;
+			node_bounds.Extend(nodes[nodes[node_index].offset].bounds);
+		}
+	}
+	return true;
+}
+
+template <typename IntersectFunc>
+int BVH::IntersectNearest(Ray3D const &ray, double &t, IntersectFunc intersect) const {
+	int position = TraverseNearest(ray, t, [&](int first, int count, Ray3D const &r, double &res_t) {
+		int res_position = -1;
+		for (int i = first; i < first + count; i++) {
+			double tmp_t = intersect(primitive_index_ptr[i], r);
+			if (tmp_t && tmp_t < res_t) {
+				res_position = i;
+				res_t = tmp_t;
+			}
+		}
+		return res_position;
+	});
+	return position < 0 ? -1 : primitive_index_ptr[position];
+}
+
+template <typename IntersectFunc>
+bool BVH::IntersectAny(Ray3D const &ray, double t_max, IntersectFunc intersect) const {
+	return TraverseAny(ray, t_max, [&](int first, int count, Ray3D const &r, double res_t_max) {
+		for (int i = first; i < first + count; i++) {
+			double tmp_t = intersect(primitive_index_ptr[i], r);
+			if (tmp_t && tmp_t < res_t_max) return true;
+		}
+		return false;
+	});
+}
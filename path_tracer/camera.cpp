@@ -0,0 +1,37 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "camera.h"
+
+Camera::Camera(Vector3D origin_, Vector3D direction_, int width_, int height_) :
+	eye(origin_, direction_), width(width_), height(height_) {
+	cx = Vector3D(width * 0.5135 / height);
+	cy = (cx % eye.direction).norm() * 0.5135;
+}
+
+Ray3D Camera::GenerateRay(int x, int y, int sx, int sy, Sampler &sampler) const {
+	double r1, r2;
+	sampler.Next2D(r1, r2);
+	r1 *= 2;
+	r2 *= 2;
+	double dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
+	double dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
+	Vector3D d = cx * (((sx + 0.5 + dx) / 2 + x) / width - 0.5) + cy * (((sy + 0.5 + dy) / 2 + y) / height - 0.5) + eye.direction;
+	return Ray3D(eye.origin + d * 140, d.norm());
+}
@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include "utils.h"
+#include "sampler.h"
+
+class Camera {
+	public:
+		Camera(Vector3D origin_, Vector3D direction_, int width_, int height_);
+		// generate a ray through subpixel (sx, sy) of pixel (x, y) with a tent filter jitter
+		Ray3D GenerateRay(int x, int y, int sx, int sy, Sampler &sampler) const;
+		int GetWidth() const { return width; }
+		int GetHeight() const { return height; }
+	private:
+		Ray3D eye;
+		Vector3D cx, cy;
+		int width, height;
+};
+
+// Subpixel (sy * 2 + sx) that sample number sample of a pixel goes to. With samples_per_subpixel > 0 the
+// samples come in blocks, one block per subpixel (fixed spp renders); with 0 consecutive samples cycle
+// through the subpixels (progressive passes).
+inline int SubpixelOfSample(int sample, int samples_per_subpixel) {
+	return samples_per_subpixel > 0 ? sample / samples_per_subpixel : sample % 4;
+}
+
+// number of the sample among the samples of its subpixel, the index of low-discrepancy samplers
+inline int SubpixelSampleIndex(int sample, int samples_per_subpixel) {
+	return samples_per_subpixel > 0 ? sample % samples_per_subpixel : sample / 4;
+}
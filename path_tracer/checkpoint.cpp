@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "checkpoint.h"
+#include "stats.h"
+
+namespace {
+	const char checkpoint_magic[8] = { 'P', 'T', 'C', 'H', 'E', 'C', 'K', '2' };
+
+	// FNV-1a
+	uint64_t Hash(void const *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+		unsigned char const *bytes = static_cast<unsigned char const *>(data);
+		for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+		return hash;
+	}
+}
+
+CheckpointKey MakeCheckpointKey(std::string const &scene_name, SceneDescription const &description, RenderSettings const &settings, bool light_sampling, Precision precision) {
+	CheckpointKey key;
+	memset(&key, 0, sizeof(key));
+	double camera[6] = { description.camera_origin.x, description.camera_origin.y, description.camera_origin.z,
+		description.camera_direction.x, description.camera_direction.y, description.camera_direction.z };
+	key.scene_hash = Hash(camera, sizeof(camera), Hash(scene_name.data(), scene_name.size()));
+	key.seed = settings.seed;
+	key.width = description.width;
+	key.height = description.height;
+	key.integrator = int32_t(settings.integrator);
+	key.light_sampling = light_sampling ? 1 : 0;
+	key.sampler = int32_t(settings.sampler);
+	key.precision = int32_t(precision);
+	return key;
+}
+
+bool Checkpoint::Open(std::string const &path, CheckpointKey const &key, bool resume, std::string &error) {
+	size_t slot_size = sizeof(Film::PixelState) * size_t(key.width) * key.height;
+	size_t size = sizeof(Header) + 2 * slot_size;
+	if (resume) {
+		// tell a missing checkpoint from one that cannot be opened
+		FILE *existing = fopen(path.c_str(), "rb");
+		if (existing == nullptr) {
+			error = "there is no checkpoint at " + path + " to resume";
+			return false;
+		}
+		fclose(existing);
+	}
+	if (!file.OpenWritable(path, resume ? 0 : size, error)) return false;
+	header_ptr = reinterpret_cast<Header *>(file.GetWritableData());
+	if (resume) {
+		if (file.GetSize() != size || memcmp(header_ptr->magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0) {
+			error = path + " is no checkpoint of a render of this size";
+			file.Close();
+			return false;
+		}
+		if (memcmp(&header_ptr->key, &key, sizeof(key)) != 0) {
+			error = path + " was written for another scene, camera, seed, integrator, sampler, light sampling or precision";
+			file.Close();
+			return false;
+		}
+	}
+	else {
+		memset(header_ptr, 0, sizeof(Header));
+		memcpy(header_ptr->magic, checkpoint_magic, sizeof(checkpoint_magic));
+		header_ptr->key = key;
+		header_ptr->current_slot = -1;
+	}
+	slots[0] = reinterpret_cast<Film::PixelState *>(file.GetWritableData() + sizeof(Header));
+	slots[1] = slots[0] + size_t(key.width) * key.height;
+	last_checkpoint = std::chrono::steady_clock::now();
+	return true;
+}
+
+int Checkpoint::GetSavedPasses() const {
+	return header_ptr && header_ptr->current_slot >= 0 ? header_ptr->slot_passes[header_ptr->current_slot] : -1;
+}
+
+bool Checkpoint::Load(Film &film) const {
+	if (GetSavedPasses() < 0) return false;
+	Film::PixelState const *slot = slots[header_ptr->current_slot];
+	for (int y = 0; y < film.GetHeight(); y++) {
+		for (int x = 0; x < film.GetWidth(); x++) film.SetPixelState(x, y, slot[y * film.GetWidth() + x]);
+	}
+	return true;
+}
+
+bool Checkpoint::BeginPass() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count() >= interval_seconds;
+}
+
+void Checkpoint::SaveTile(Film const &film, Tile const &tile) {
+	// the slot that is not current, the header only changes between passes
+	Film::PixelState *slot = slots[header_ptr->current_slot == 0 ? 1 : 0];
+	for (int y = tile.y0; y < tile.y1; y++) {
+		for (int x = tile.x0; x < tile.x1; x++) slot[y * film.GetWidth() + x] = film.GetPixelState(x, y);
+	}
+}
+
+void Checkpoint::Commit(int passes_done) {
+	STATS_TIMER("checkpoint", "output");
+	auto start = std::chrono::steady_clock::now();
+	int slot = header_ptr->current_slot == 0 ? 1 : 0;
+	header_ptr->slot_passes[slot] = passes_done;
+	header_ptr->current_slot = slot;
+	file.Flush();
+	last_checkpoint = std::chrono::steady_clock::now();
+	seconds += std::chrono::duration<double>(last_checkpoint - start).count();
+}
+
+void Checkpoint::SaveFilm(Film const &film, int passes_done) {
+	auto start = std::chrono::steady_clock::now();
+	Tile frame = { 0, 0, film.GetWidth(), film.GetHeight() };
+	SaveTile(film, frame);
+	seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	Commit(passes_done);
+}
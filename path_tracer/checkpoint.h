@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#include "film.h"
+#include "scheduler.h"
+#include "mapped_file.h"
+#include "render.h"
+#include "scene_file.h"
+
+// What a checkpoint must have been written with to be resumed: the same scene and camera, seed, frame size,
+// integrator, sampler, light sampling and precision. The number of samples may differ, a resumed render continues to its own.
+struct CheckpointKey {
+	uint64_t scene_hash; // scene name and camera
+	uint64_t seed;
+	int32_t width, height;
+	int32_t integrator;
+	int32_t light_sampling;
+	int32_t sampler;
+	int32_t precision;
+};
+
+CheckpointKey MakeCheckpointKey(std::string const &scene_name, SceneDescription const &description, RenderSettings const &settings, bool light_sampling, Precision precision);
+
+// Checkpoints of a progressive render in a memory-mapped file: a header and two slots with the state of every
+// pixel of the film (Film::PixelState), one of them current. In a checkpoint pass every render thread copies
+// the tiles it finishes into the other slot, so no thread waits for a copy of the whole film; once the pass is
+// complete the header switches to that slot and the OS writes the pages in the background. A process killed
+// at any moment leaves the film of the last complete checkpoint pass in the current slot.
+// There is no random number generator state to save: every sample draws from a stream seeded by (seed, pixel,
+// sample index), the sample counts of the pixels tell where each of them continues.
+class Checkpoint {
+	public:
+		explicit Checkpoint(double interval_seconds_ = 60.0) : interval_seconds(interval_seconds_), header_ptr(nullptr), slots{ nullptr, nullptr } {}
+		// Open the file for a render with the given key. With resume the file must hold a checkpoint with the same
+		// key, otherwise it is created or overwritten. Returns false and sets error on failure.
+		bool Open(std::string const &path, CheckpointKey const &key, bool resume, std::string &error);
+		// complete passes of the current slot, -1 if nothing was written yet
+		int GetSavedPasses() const;
+		// copy the current slot to the film, returns false if there is none
+		bool Load(Film &film) const;
+
+		// called before every pass: whether it is a checkpoint pass, the interval having passed since the last one
+		bool BeginPass();
+		// copy the pixels of a tile finished during a checkpoint pass, called by the thread that finished it
+		void SaveTile(Film const &film, Tile const &tile);
+		// make the slot written during the checkpoint pass current, passes_done complete passes being in it
+		void Commit(int passes_done);
+		// copy the whole film and make it current, while no thread adds samples
+		void SaveFilm(Film const &film, int passes_done);
+		// time the calling thread spent in Commit and SaveFilm
+		double GetSeconds() const { return seconds; }
+
+	private:
+		struct Header {
+			char magic[8];
+			CheckpointKey key;
+			int32_t current_slot; // -1 - none
+			int32_t slot_passes[2];
+			int32_t reserved;
+		};
+
+		double interval_seconds;
+		MappedFile file;
+		Header *header_ptr;
+		Film::PixelState *slots[2];
+		std::chrono::steady_clock::time_point last_checkpoint;
+		double seconds = 0.0;
+};
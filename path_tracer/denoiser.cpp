@@ -0,0 +1,214 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "denoiser.h"
+
+namespace {
+	const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	const float min_albedo = 1e-3f;
+
+	// e^x for x <= 0 with a relative error below 0.2%: the integer part of x * log2(e) goes to the exponent
+	// bits, a polynomial gives 2 to the fraction; no branches or calls, so loops using it vectorize
+	inline float FastExp(float x) {
+		float t = std::max(x * 1.44269504f, -126.0f);
+		int i = int(t);
+		float f = t - float(i); // (-1, 0]
+		float p = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * 0.00961813f)));
+		int bits = (i + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, sizeof(scale));
+		return p * scale;
+	}
+
+	inline float Luminance(float r, float g, float b) {
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+
+	// planes of one filter iteration
+	struct Planes {
+		std::vector<float> r, g, b, variance;
+		void Resize(size_t size) {
+			r.resize(size);
+			g.resize(size);
+			b.resize(size);
+			variance.resize(size);
+		}
+	};
+
+	struct Guide {
+		std::vector<float> nx, ny, nz, depth, ar, ag, ab;
+	};
+
+	// 3x3 binomial blur of the variance, the estimate of a pixel alone is too noisy at low sample counts
+	// to scale the luminance differences: a black pixel would have no variance and reject every neighbor
+	void BlurVariance(std::vector<float> const &variance, int width, int height, std::vector<float> &blurred) {
+		for (int y = 0; y < height; y++) {
+			size_t rows[3] = { size_t(std::max(y - 1, 0)) * width, size_t(y) * width, size_t(std::min(y + 1, height - 1)) * width };
+			for (int x = 0; x < width; x++) {
+				int xs[3] = { std::max(x - 1, 0), x, std::min(x + 1, width - 1) };
+				float sum = 0.0f;
+				for (int j = 0; j < 3; j++) {
+					float row_sum = variance[rows[j] + xs[0]] + 2.0f * variance[rows[j] + xs[1]] + variance[rows[j] + xs[2]];
+					sum += (j == 1 ? 2.0f : 1.0f) * row_sum;
+				}
+				blurred[rows[1] + x] = sum * (1.0f / 16.0f);
+			}
+		}
+	}
+
+	// pixels of a row filtered together; the sums live on the stack, so the compiler knows the loops
+	// writing them do not alias the planes they read
+	const int span_width = 256;
+
+	// filter pixels [x0, x0 + count) of row y, count <= span_width
+	void FilterSpan(int y, int x0, int count, int step, int width, int height, DenoiserSettings const &settings, Guide const &guide,
+		std::vector<float> const &luminance, std::vector<float> const &blurred_variance, Planes const &in, Planes &out) {
+		float sum_r[span_width], sum_g[span_width], sum_b[span_width], sum_w[span_width], sum_v[span_width];
+		float scale_l[span_width], scale_z[span_width], weights[span_width];
+		size_t p0 = size_t(y) * width + x0;
+		float inv_sigma_albedo2 = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+		int squarings = 0;
+		while ((2 << squarings) <= settings.normal_power) squarings++;
+
+		// the center tap always counts in full
+		float center = kernel[2] * kernel[2];
+		for (int i = 0; i < count; i++) {
+			size_t p = p0 + i;
+			sum_r[i] = center * in.r[p];
+			sum_g[i] = center * in.g[p];
+			sum_b[i] = center * in.b[p];
+			sum_w[i] = center;
+			sum_v[i] = center * center * in.variance[p];
+			scale_l[i] = 1.0f / (settings.sigma_luminance * sqrtf(std::max(blurred_variance[p], 0.0f)) + 1e-2f);
+			scale_z[i] = 1.0f / (settings.sigma_depth * step * guide.depth[p] + 1e-3f);
+		}
+
+		float const *nx = &guide.nx[p0], *ny = &guide.ny[p0], *nz = &guide.nz[p0];
+		float const *ar = &guide.ar[p0], *ag = &guide.ag[p0], *ab = &guide.ab[p0], *z = &guide.depth[p0], *l = &luminance[p0];
+		for (int ty = -2; ty <= 2; ty++) {
+			int qy = y + ty * step;
+			if (qy < 0 || qy >= height) continue;
+			for (int tx = -2; tx <= 2; tx++) {
+				if (tx == 0 && ty == 0) continue;
+				int dx = tx * step;
+				float h = kernel[ty + 2] * kernel[tx + 2];
+				// taps outside of the image are skipped, [begin, end) are the pixels of the span whose tap is inside
+				int begin = std::max(0, -dx - x0), end = std::min(count, width - dx - x0);
+				if (begin >= end) continue;
+				// tap pointers start at the tap of pixel begin, j indexes them, so no pointer leaves the planes
+				size_t q0 = size_t(qy) * width + (x0 + dx + begin);
+				float const *q_nx = &guide.nx[q0], *q_ny = &guide.ny[q0], *q_nz = &guide.nz[q0];
+				float const *q_ar = &guide.ar[q0], *q_ag = &guide.ag[q0], *q_ab = &guide.ab[q0], *q_z = &guide.depth[q0], *q_l = &luminance[q0];
+				float const *q_r = &in.r[q0], *q_g = &in.g[q0], *q_b = &in.b[q0], *q_v = &in.variance[q0];
+				// separate loops keep each one free of inner loops and branches
+				for (int i = begin, j = 0; i < end; i++, j++) weights[i] = std::max(0.0f, nx[i] * q_nx[j] + ny[i] * q_ny[j] + nz[i] * q_nz[j]);
+				for (int k = 0; k < squarings; k++) {
+					for (int i = begin; i < end; i++) weights[i] *= weights[i];
+				}
+				for (int i = begin, j = 0; i < end; i++, j++) {
+					float da = (ar[i] - q_ar[j]) * (ar[i] - q_ar[j]) + (ag[i] - q_ag[j]) * (ag[i] - q_ag[j]) + (ab[i] - q_ab[j]) * (ab[i] - q_ab[j]);
+					float exponent = fabsf(l[i] - q_l[j]) * scale_l[i] + fabsf(z[i] - q_z[j]) * scale_z[i] + da * inv_sigma_albedo2;
+					float w = h * weights[i] * FastExp(-exponent);
+					sum_r[i] += w * q_r[j];
+					sum_g[i] += w * q_g[j];
+					sum_b[i] += w * q_b[j];
+					sum_w[i] += w;
+					sum_v[i] += w * w * q_v[j];
+				}
+			}
+		}
+
+		for (int i = 0; i < count; i++) {
+			size_t p = p0 + i;
+			float inv_w = 1.0f / sum_w[i];
+			out.r[p] = sum_r[i] * inv_w;
+			out.g[p] = sum_g[i] * inv_w;
+			out.b[p] = sum_b[i] * inv_w;
+			out.variance[p] = sum_v[i] * inv_w * inv_w;
+		}
+	}
+}
+
+void AovBuffers::Resize(int width_, int height_) {
+	width = width_;
+	height = height_;
+	size_t size = size_t(width) * height;
+	albedo.assign(size, Vector3F());
+	normal.assign(size, Vector3F());
+	depth.assign(size, 0.0f);
+	variance.assign(size, 0.0f);
+}
+
+void DenoiseImage(Vector3D *image, AovBuffers const &aovs, DenoiserSettings const &settings, ThreadPool *pool_ptr) {
+	int width = aovs.width, height = aovs.height;
+	size_t size = size_t(width) * height;
+	Guide guide;
+	for (std::vector<float> *plane : { &guide.nx, &guide.ny, &guide.nz, &guide.depth, &guide.ar, &guide.ag, &guide.ab }) plane->resize(size);
+	Planes planes[2];
+	planes[0].Resize(size);
+	planes[1].Resize(size);
+	std::vector<float> luminance(size), blurred_variance(size);
+
+	// split the guides into planes and divide the albedo out of the image
+	for (size_t i = 0; i < size; i++) {
+		Vector3F const &n = aovs.normal[i], &a = aovs.albedo[i];
+		guide.nx[i] = n.x;
+		guide.ny[i] = n.y;
+		guide.nz[i] = n.z;
+		guide.depth[i] = aovs.depth[i];
+		guide.ar[i] = std::max(a.x, min_albedo);
+		guide.ag[i] = std::max(a.y, min_albedo);
+		guide.ab[i] = std::max(a.z, min_albedo);
+		planes[0].r[i] = float(image[i].x) / guide.ar[i];
+		planes[0].g[i] = float(image[i].y) / guide.ag[i];
+		planes[0].b[i] = float(image[i].z) / guide.ab[i];
+		planes[0].variance[i] = aovs.variance[i];
+		luminance[i] = Luminance(float(image[i].x), float(image[i].y), float(image[i].z));
+	}
+
+	int current = 0;
+	for (int iteration = 0; iteration < settings.iterations; iteration++) {
+		int step = 1 << iteration;
+		Planes const &in = planes[current];
+		Planes &out = planes[1 - current];
+		BlurVariance(in.variance, width, height, blurred_variance);
+		auto filter_rows = [&](int first_row, int row_count) {
+			for (int y = first_row; y < first_row + row_count; y++) {
+				for (int x = 0; x < width; x += span_width) FilterSpan(y, x, std::min(span_width, width - x), step, width, height, settings, guide, luminance, blurred_variance, in, out);
+			}
+		};
+		// work items of 8 rows keep the scheduling cheap
+		const int rows_per_item = 8;
+		int item_count = (height + rows_per_item - 1) / rows_per_item;
+		auto task = [&](int item, int) { filter_rows(item * rows_per_item, std::min(rows_per_item, height - item * rows_per_item)); };
+		if (pool_ptr) pool_ptr->Run(item_count, task);
+		else for (int item = 0; item < item_count; item++) task(item, 0);
+		current = 1 - current;
+		// edges of the next iteration are found on the filtered radiance
+		for (size_t i = 0; i < size; i++) luminance[i] = Luminance(planes[current].r[i] * guide.ar[i], planes[current].g[i] * guide.ag[i], planes[current].b[i] * guide.ab[i]);
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		image[i] = Vector3D(planes[current].r[i] * guide.ar[i], planes[current].g[i] * guide.ag[i], planes[current].b[i] * guide.ab[i]);
+	}
+}
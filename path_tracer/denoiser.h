@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "utils.h"
+#include "scheduler.h"
+
+// Auxiliary buffers of the first hits of the camera rays averaged over the samples of every pixel, rows from
+// the top down like the image. Lights have albedo 1, misses albedo, normal and depth 0. The variance is that
+// of the mean luminance of the pixel, estimated from its clamped samples.
+struct AovBuffers {
+	int width = 0, height = 0;
+	std::vector<Vector3F> albedo;
+	std::vector<Vector3F> normal; // facing the camera
+	std::vector<float> depth; // distance along the camera ray
+	std::vector<float> variance;
+
+	void Resize(int width_, int height_);
+};
+
+struct DenoiserSettings {
+	int iterations = 5; // filter radius grows as 2^iterations pixels
+	float sigma_luminance = 4.0f; // luminance differences are measured in standard deviations of the pixel
+	float sigma_depth = 0.05f; // relative depth difference per pixel of distance
+	float sigma_albedo = 0.1f;
+	int normal_power = 128; // cosine of the angle between normals to this power, rounded down to a power of two
+};
+
+// Edge-avoiding a-trous wavelet filter: iterations of a 5x5 B3-spline kernel with holes of 1, 2, 4, ... pixels,
+// each tap weighted down by the differences of luminance (relative to the noise of the pixel), normal, depth
+// and albedo, the variance being filtered along so that converged regions are smoothed less and less.
+// Lighting is filtered with the albedo divided out, which keeps texture and color edges sharp.
+// Luminance differences are scaled by the locally blurred variance. Works on float planes, every tap is a
+// branch-free loop over up to 256 pixels of a row that the compiler vectorizes,
+// rows are spread over the pool (nullptr - the calling thread only). image is filtered in place.
+void DenoiseImage(Vector3D *image, AovBuffers const &aovs, DenoiserSettings const &settings, ThreadPool *pool_ptr = nullptr);
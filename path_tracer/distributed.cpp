@@ -0,0 +1,395 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "distributed.h"
+#include "tcp_socket.h"
+#include "camera.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	const char protocol_magic[8] = { 'P', 'T', 'W', 'O', 'R', 'K', '0', '3' };
+
+	enum class MessageType : uint32_t { hello = 1, job, task, result, done };
+
+	struct MessageHeader {
+		uint32_t type;
+		uint32_t size; // bytes of the payload that follows
+	};
+
+	// worker -> coordinator after connecting
+	struct HelloMessage {
+		char magic[8];
+		uint32_t thread_count;
+		uint32_t reserved;
+	};
+
+	// coordinator -> worker, followed by the scene name
+	struct JobMessage {
+		double camera_origin[3];
+		double camera_direction[3];
+		uint64_t seed;
+		int32_t width, height;
+		int32_t samples_per_subpixel;
+		int32_t integrator;
+		int32_t light_sampling;
+		int32_t sampler;
+		int32_t precision;
+		uint32_t scene_name_size;
+	};
+
+	// coordinator -> worker; the result of the worker repeats it, followed by 3 float sums and 1 count per pixel
+	struct TaskMessage {
+		int32_t task;
+		int32_t x0, y0, x1, y1;
+		int32_t first_sample, sample_count;
+		int32_t reserved;
+	};
+
+	bool SendMessage(TcpSocket const &socket, MessageType type, void const *payload, size_t size) {
+		MessageHeader header = { uint32_t(type), uint32_t(size) };
+		return socket.Send(&header, sizeof(header)) && (size == 0 || socket.Send(payload, size));
+	}
+
+	bool ReceiveHeader(TcpSocket const &socket, MessageType type, MessageHeader &header) {
+		return socket.Receive(&header, sizeof(header)) && header.type == uint32_t(type);
+	}
+
+	// a worker process started by the coordinator
+	struct LocalWorker {
+#ifdef _WIN32
+		PROCESS_INFORMATION process;
+#else
+		pid_t pid;
+#endif
+	};
+
+#ifdef _WIN32
+	bool StartLocalWorker(std::string const &executable, int port, int threads, int fail_after, LocalWorker &worker) {
+		std::string command = "\"" + executable + "\" --worker localhost:" + std::to_string(port) + " --threads " + std::to_string(threads);
+		if (fail_after > 0) command += " --fail-after " + std::to_string(fail_after);
+		STARTUPINFOA startup;
+		memset(&startup, 0, sizeof(startup));
+		startup.cb = sizeof(startup);
+		std::vector<char> command_line(command.begin(), command.end());
+		command_line.push_back('\0');
+		return CreateProcessA(nullptr, command_line.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &worker.process) != 0;
+	}
+
+	void WaitLocalWorker(LocalWorker &worker) {
+		WaitForSingleObject(worker.process.hProcess, INFINITE);
+		CloseHandle(worker.process.hProcess);
+		CloseHandle(worker.process.hThread);
+	}
+#else
+	bool StartLocalWorker(std::string const &executable, int port, int threads, int fail_after, LocalWorker &worker) {
+		std::vector<std::string> args = { executable, "--worker", "localhost:" + std::to_string(port), "--threads", std::to_string(threads) };
+		if (fail_after > 0) {
+			args.push_back("--fail-after");
+			args.push_back(std::to_string(fail_after));
+		}
+		std::vector<char *> argv;
+		for (std::string &arg : args) argv.push_back(&arg[0]);
+		argv.push_back(nullptr);
+		worker.pid = fork();
+		if (worker.pid < 0) return false;
+		if (worker.pid == 0) {
+			// the usage banner of the child would clutter the output of the coordinator
+			int null_fd = open("/dev/null", O_WRONLY);
+			if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+			execv(executable.c_str(), argv.data());
+			_exit(127);
+		}
+		return true;
+	}
+
+	void WaitLocalWorker(LocalWorker &worker) {
+		int status;
+		waitpid(worker.pid, &status, 0);
+	}
+#endif
+
+	// tiles of the frame shared by the connection threads of the coordinator
+	class TaskQueue {
+		public:
+			explicit TaskQueue(int task_count_) : task_count(task_count_), done_count(0), stopping(false) {
+				for (int task = 0; task < task_count; task++) pending.push_back(task);
+			}
+
+			// next tile to render, false when all are done or the render stops
+			bool Take(int &task) {
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this]() { return !pending.empty() || done_count == task_count || stopping; });
+				if (pending.empty() || stopping) return false;
+				task = pending.front();
+				pending.pop_front();
+				return true;
+			}
+			// a lost tile is rendered next by whichever worker asks first
+			void Return(int task) {
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_front(task);
+				changed.notify_all();
+			}
+			void Finish() {
+				std::lock_guard<std::mutex> lock(mutex);
+				done_count++;
+				changed.notify_all();
+			}
+			void Stop() {
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+				changed.notify_all();
+			}
+			int GetDoneCount() {
+				std::lock_guard<std::mutex> lock(mutex);
+				return done_count;
+			}
+
+		private:
+			std::mutex mutex;
+			std::condition_variable changed;
+			std::deque<int> pending;
+			int task_count;
+			int done_count;
+			bool stopping;
+	};
+
+	// serve one worker until the queue is empty, tiles it fails to return go back to the queue
+	void ServeWorker(std::unique_ptr<TcpSocket> connection, JobMessage job, std::string const &scene_name, std::vector<Tile> const &tiles,
+		int sample_count, double timeout_seconds, TaskQueue &queue, Film &film) {
+		MessageHeader header;
+		HelloMessage hello;
+		connection->SetReceiveTimeout(timeout_seconds);
+		if (!ReceiveHeader(*connection, MessageType::hello, header) || header.size != sizeof(hello) ||
+			!connection->Receive(&hello, sizeof(hello)) || memcmp(hello.magic, protocol_magic, sizeof(protocol_magic)) != 0) {
+			fprintf(stderr, "\rRejected a connection that is not a worker of this build\n");
+			return;
+		}
+		std::vector<char> job_payload(sizeof(job) + scene_name.size());
+		memcpy(job_payload.data(), &job, sizeof(job));
+		memcpy(job_payload.data() + sizeof(job), scene_name.data(), scene_name.size());
+		if (!SendMessage(*connection, MessageType::job, job_payload.data(), job_payload.size())) return;
+
+		std::vector<float> sums;
+		std::vector<uint32_t> counts;
+		int task;
+		while (queue.Take(task)) {
+			Tile const &tile = tiles[task];
+			int pixel_count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+			TaskMessage message = { task, tile.x0, tile.y0, tile.x1, tile.y1, 0, sample_count, 0 };
+			TaskMessage answer;
+			sums.resize(3 * pixel_count);
+			counts.resize(pixel_count);
+			bool received = SendMessage(*connection, MessageType::task, &message, sizeof(message)) &&
+				ReceiveHeader(*connection, MessageType::result, header) &&
+				header.size == sizeof(answer) + pixel_count * (3 * sizeof(float) + sizeof(uint32_t)) &&
+				connection->Receive(&answer, sizeof(answer)) && answer.task == task &&
+				connection->Receive(sums.data(), sums.size() * sizeof(float)) &&
+				connection->Receive(counts.data(), counts.size() * sizeof(uint32_t));
+			if (!received) {
+				fprintf(stderr, "\rLost a worker (%d threads), its tile %d goes to another worker\n", int(hello.thread_count), task);
+				queue.Return(task);
+				return;
+			}
+			for (int y = tile.y0; y < tile.y1; y++) {
+				for (int x = tile.x0; x < tile.x1; x++) {
+					int i = (y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0;
+					film.AddSampleSums(x, y, &sums[3 * i], counts[i]);
+				}
+			}
+			queue.Finish();
+		}
+		SendMessage(*connection, MessageType::done, nullptr, 0);
+	}
+}
+
+bool RunCoordinator(std::string const &scene_name, SceneDescription const &description, RenderSettings const &settings,
+	bool light_sampling, Precision precision, DistributedSettings const &distributed, Film &film, RenderProgress *progress_ptr) {
+	TcpSocket listener;
+	std::string error;
+	if (!listener.Listen(distributed.port, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return false;
+	}
+	int port = listener.GetPort();
+
+	std::vector<Tile> tiles = distributed.tile_size > 0 ? MakeTiles(description.width, description.height, distributed.tile_size) :
+		MakeScanlineTiles(description.width, description.height);
+	int sample_count = 4 * settings.samples_per_subpixel;
+	JobMessage job;
+	memset(&job, 0, sizeof(job));
+	Vector3D const &origin = description.camera_origin, &direction = description.camera_direction;
+	job.camera_origin[0] = origin.x;
+	job.camera_origin[1] = origin.y;
+	job.camera_origin[2] = origin.z;
+	job.camera_direction[0] = direction.x;
+	job.camera_direction[1] = direction.y;
+	job.camera_direction[2] = direction.z;
+	job.seed = settings.seed;
+	job.width = description.width;
+	job.height = description.height;
+	job.samples_per_subpixel = settings.samples_per_subpixel;
+	job.integrator = int32_t(settings.integrator);
+	job.light_sampling = light_sampling ? 1 : 0;
+	job.sampler = int32_t(settings.sampler);
+	job.precision = int32_t(precision);
+	job.scene_name_size = uint32_t(scene_name.size());
+
+	std::vector<LocalWorker> local_workers;
+	for (int i = 0; i < distributed.local_workers; i++) {
+		LocalWorker worker;
+		if (StartLocalWorker(distributed.executable, port, distributed.worker_threads, i == 0 ? distributed.kill_worker_after : 0, worker)) local_workers.push_back(worker);
+		else fprintf(stderr, "Cannot start a local worker\n");
+	}
+	fprintf(stderr, "Coordinator on port %d: %d tiles of %d spp\n", port, int(tiles.size()), sample_count);
+
+	// one thread per connection, the coordinator itself accepts workers and reports progress
+	TaskQueue queue(int(tiles.size()));
+	std::vector<std::thread> connections;
+	std::atomic<int> live_workers(0);
+	auto idle_start = std::chrono::steady_clock::now();
+	int done_count = 0;
+	bool cancelled = false, abandoned = false;
+	while ((done_count = queue.GetDoneCount()) < int(tiles.size())) {
+		if (progress_ptr && progress_ptr->cancel) {
+			cancelled = true;
+			break;
+		}
+		if (listener.WaitReadable(0.2)) {
+			std::unique_ptr<TcpSocket> connection(new TcpSocket());
+			if (listener.Accept(*connection)) {
+				live_workers++;
+				connections.emplace_back([&, job](std::unique_ptr<TcpSocket> worker_connection) {
+					ServeWorker(std::move(worker_connection), job, scene_name, tiles, sample_count, distributed.worker_timeout_seconds, queue, film);
+					live_workers--;
+				}, std::move(connection));
+			}
+		}
+		// once every worker is gone (all of them died and no local ones are left to reconnect) the tiles left
+		// would wait forever, give up after the worker timeout
+		if (live_workers > 0) idle_start = std::chrono::steady_clock::now();
+		else if (std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_start).count() > distributed.worker_timeout_seconds) {
+			fprintf(stderr, "\rNo worker connected for %g s, %d of %d tiles are left\n", distributed.worker_timeout_seconds,
+				int(tiles.size()) - done_count, int(tiles.size()));
+			abandoned = true;
+			break;
+		}
+		if (settings.report_progress) fprintf(stderr, "\rDistributed render: %d workers, %5.2f%%", int(connections.size()), 100.0 * done_count / tiles.size());
+	}
+	if (settings.report_progress) fprintf(stderr, "\rDistributed render: %d workers, %5.2f%%\n", int(connections.size()), 100.0 * done_count / tiles.size());
+	queue.Stop();
+	listener.Close();
+	for (std::thread &connection : connections) connection.join();
+	for (LocalWorker &worker : local_workers) WaitLocalWorker(worker);
+	return !cancelled && !abandoned;
+}
+
+int RunWorker(std::string const &host, int port, int thread_count, int fail_after) {
+	// the coordinator may still be starting, keep trying for a while
+	TcpSocket connection;
+	std::string error;
+	for (int attempt = 0; !connection.Connect(host, port, error); attempt++) {
+		if (attempt == 50) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+
+	ThreadPool pool(thread_count);
+	HelloMessage hello;
+	memcpy(hello.magic, protocol_magic, sizeof(protocol_magic));
+	hello.thread_count = uint32_t(pool.GetThreadCount());
+	hello.reserved = 0;
+	MessageHeader header;
+	JobMessage job;
+	if (!SendMessage(connection, MessageType::hello, &hello, sizeof(hello)) || !ReceiveHeader(connection, MessageType::job, header) ||
+		header.size < sizeof(job) || !connection.Receive(&job, sizeof(job)) || header.size != sizeof(job) + job.scene_name_size ||
+		job.width < 1 || job.height < 1 || job.samples_per_subpixel < 1 ||
+		job.integrator < 0 || job.integrator > int32_t(IntegratorType::wavefront) || job.sampler < 0 || job.sampler > int32_t(SamplerType::halton) ||
+		job.precision < 0 || job.precision > int32_t(Precision::float32)) {
+		fprintf(stderr, "No job from the coordinator\n");
+		return 1;
+	}
+	std::string scene_name(job.scene_name_size, '\0');
+	if (!connection.Receive(&scene_name[0], scene_name.size())) return 1;
+
+	Scene scene;
+	SceneDescription description;
+	scene.SetPrecision(Precision(job.precision)); // before the scene is built
+	if (!CreateBuiltinScene(scene_name, scene) && !LoadScene(scene_name, scene, description, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	scene.SetLightSampling(job.light_sampling != 0);
+	Camera camera(Vector3D(job.camera_origin[0], job.camera_origin[1], job.camera_origin[2]),
+		Vector3D(job.camera_direction[0], job.camera_direction[1], job.camera_direction[2]), job.width, job.height);
+	RenderSettings settings;
+	settings.seed = job.seed;
+	settings.samples_per_subpixel = job.samples_per_subpixel;
+	settings.integrator = IntegratorType(job.integrator);
+	settings.sampler = SamplerType(job.sampler);
+
+	std::vector<char> result;
+	for (int tasks_done = 0; ; tasks_done++) {
+		if (!connection.Receive(&header, sizeof(header))) return 1;
+		if (header.type == uint32_t(MessageType::done)) return 0;
+		TaskMessage task;
+		if (header.type != uint32_t(MessageType::task) || header.size != sizeof(task) || !connection.Receive(&task, sizeof(task))) return 1;
+		if (fail_after > 0 && tasks_done == fail_after) _Exit(3);
+		// a tile of the frame and samples of a pixel, like the results the coordinator accepts
+		if (task.x0 < 0 || task.y0 < 0 || task.x1 <= task.x0 || task.y1 <= task.y0 || task.x1 > job.width || task.y1 > job.height ||
+			task.first_sample < 0 || task.sample_count < 1) {
+			fprintf(stderr, "Invalid task from the coordinator\n");
+			return 1;
+		}
+
+		size_t pixel_count = size_t(task.x1 - task.x0) * (task.y1 - task.y0);
+		result.assign(sizeof(task) + pixel_count * (3 * sizeof(float) + sizeof(uint32_t)), 0);
+		memcpy(result.data(), &task, sizeof(task));
+		float *sums = reinterpret_cast<float *>(result.data() + sizeof(task));
+		uint32_t *counts = reinterpret_cast<uint32_t *>(sums + 3 * pixel_count);
+		Tile tile = { task.x0, task.y0, task.x1, task.y1 };
+		RenderTileSums(scene, camera, settings, tile, task.first_sample, task.sample_count, sums, counts, pool);
+		if (!SendMessage(connection, MessageType::result, result.data(), result.size())) return 1;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "scene.h"
+#include "render.h"
+#include "film.h"
+#include "scene_file.h"
+
+// Distributed rendering. A coordinator splits the frame into tiles and hands them over TCP to worker
+// processes, one tile at a time per worker. A worker renders all samples of its tile on its own threads and
+// returns the float sums and sample counts of the tile's pixels, which the coordinator adds to its film.
+// Tiles of a worker that disconnects, dies or does not answer in time go back to the queue for the others.
+// Samples are taken exactly as by RenderTileSums, so the image equals that of a single-process progressive
+// render of the same seed whatever the number of workers and whichever worker renders which tile.
+// Messages are the in-memory structures of the build, coordinator and workers must run the same build.
+struct DistributedSettings {
+	int port = 0; // port the coordinator listens on, 0 - any free one
+	int tile_size = 64; // 0 - whole scanlines
+	int local_workers = 0; // worker processes the coordinator starts on this machine
+	int worker_threads = 0; // threads of local workers, 0 - one per hardware thread
+	std::string executable; // program started as local worker, normally argv[0]
+	double worker_timeout_seconds = 300.0; // a worker that does not return a tile for that long is dead
+	int kill_worker_after = 0; // for testing recovery: the first local worker dies after this many tiles, 0 - never
+};
+
+// Render the scene named scene_name (a built-in scene or a file the workers can read) as seen by the camera
+// of the description with the samples, seed and integrator of settings. Returns false if the port cannot be
+// opened, the render was cancelled through progress_ptr or tiles were left while no worker was connected for
+// worker_timeout_seconds; the film then holds the finished tiles.
+bool RunCoordinator(std::string const &scene_name, SceneDescription const &description, RenderSettings const &settings,
+	bool light_sampling, Precision precision, DistributedSettings const &distributed, Film &film, RenderProgress *progress_ptr = nullptr);
+
+// Connect to the coordinator at host:port and render its tiles with thread_count threads until it is done.
+// With fail_after > 0 the process exits abruptly on receiving tile fail_after + 1. Returns the exit code.
+int RunWorker(std::string const &host, int port, int thread_count, int fail_after = 0);
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include "film.h"
+
+Film::Film(int width_, int height_) : width(width_), height(height_),
+	sums(new std::atomic<float>[3 * GetPixelCount()]), counts(new std::atomic<uint32_t>[GetPixelCount()]),
+	luminance_sums(new std::atomic<float>[GetPixelCount()]), luminance_m2(new std::atomic<float>[GetPixelCount()]) {
+	Clear();
+}
+
+void Film::Clear() {
+	for (size_t i = 0; i < 3 * GetPixelCount(); i++) sums[i].store(0.0f, std::memory_order_relaxed);
+	for (size_t i = 0; i < GetPixelCount(); i++) {
+		counts[i].store(0, std::memory_order_relaxed);
+		luminance_sums[i].store(0.0f, std::memory_order_relaxed);
+		luminance_m2[i].store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+double Film::GetRelativeError(int x, int y) const {
+	size_t i = size_t(y) * width + x;
+	uint32_t count = counts[i].load(std::memory_order_acquire);
+	if (count < 2) return std::numeric_limits<double>::max();
+	double mean = luminance_sums[i].load(std::memory_order_relaxed) / count;
+	double variance = std::max(0.0f, luminance_m2[i].load(std::memory_order_relaxed)) / (count - 1);
+	return sqrt(variance / count) / std::max(mean, 0.01);
+}
+
+void Film::Resolve(Vector3D *image) const {
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t i = size_t(y) * width + x;
+			uint32_t count = counts[i].load(std::memory_order_acquire);
+			Vector3D &pixel = image[size_t(height - y - 1) * width + x];
+			if (count == 0) {
+				pixel = Vector3D();
+				continue;
+			}
+			double scale = 1.0 / count;
+			pixel = Vector3D(sums[3 * i].load(std::memory_order_relaxed) * scale,
+				sums[3 * i + 1].load(std::memory_order_relaxed) * scale, sums[3 * i + 2].load(std::memory_order_relaxed) * scale);
+		}
+	}
+}
+
+uint64_t Film::GetTotalSampleCount() const {
+	uint64_t total = 0;
+	for (size_t i = 0; i < GetPixelCount(); i++) total += counts[i].load(std::memory_order_relaxed);
+	return total;
+}
+
+void Film::DumpSampleCounts(std::ostream &out, int region_size) const {
+	for (int y0 = 0; y0 < height; y0 += region_size) {
+		for (int x0 = 0; x0 < width; x0 += region_size) {
+			uint64_t total = 0;
+			int pixels = 0;
+			for (int y = y0; y < std::min(height, y0 + region_size); y++) {
+				for (int x = x0; x < std::min(width, x0 + region_size); x++, pixels++) total += GetSampleCount(x, y);
+			}
+			out << std::setw(5) << (total + pixels / 2) / pixels;
+		}
+		out << std::endl;
+	}
+}
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <ostream>
+
+#include "utils.h"
+
+// Accumulation buffer of a progressive render: running sums of unclamped radiance and the number of
+// samples of every pixel. A pixel is only written by one thread at a time, but other threads may read
+// the film while it is being written (snapshots), so the values are relaxed atomics; a reader may see
+// the sum of one more sample than the count for pixels that are being updated at that moment.
+// Luminance statistics drive adaptive sampling.
+class Film {
+	public:
+		// everything the film keeps of a pixel, for checkpoints
+		struct PixelState {
+			float sum[3];
+			float luminance_sum, luminance_m2;
+			uint32_t count;
+		};
+
+		Film(int width_, int height_);
+		void Clear();
+		int GetWidth() const { return width; }
+		int GetHeight() const { return height; }
+		// pixels, buffers are indexed with size_t as frames may exceed the int range
+		size_t GetPixelCount() const { return size_t(width) * height; }
+		// add a radiance sample to pixel (x, y), y goes from the bottom row up like camera rows.
+		// Besides the sums the film keeps Welford's running M2 of the sample luminance for variance estimates.
+		void AddSample(int x, int y, Vector3D const &radiance) {
+			size_t i = size_t(y) * width + x;
+			uint32_t count = counts[i].load(std::memory_order_relaxed);
+			float luminance = Luminance(radiance);
+			float old_mean = count > 0 ? luminance_sums[i].load(std::memory_order_relaxed) / count : 0.0f;
+			float new_sum = luminance_sums[i].load(std::memory_order_relaxed) + luminance;
+			float new_mean = new_sum / (count + 1);
+			luminance_sums[i].store(new_sum, std::memory_order_relaxed);
+			luminance_m2[i].store(luminance_m2[i].load(std::memory_order_relaxed) + (luminance - old_mean) * (luminance - new_mean), std::memory_order_relaxed);
+			sums[3 * i].store(sums[3 * i].load(std::memory_order_relaxed) + float(radiance.x), std::memory_order_relaxed);
+			sums[3 * i + 1].store(sums[3 * i + 1].load(std::memory_order_relaxed) + float(radiance.y), std::memory_order_relaxed);
+			sums[3 * i + 2].store(sums[3 * i + 2].load(std::memory_order_relaxed) + float(radiance.z), std::memory_order_relaxed);
+			counts[i].store(count + 1, std::memory_order_release);
+		}
+		// add the sums of count samples taken elsewhere (another process) to pixel (x, y); the luminance
+		// statistics are left alone, so the pixel does not take part in adaptive sampling
+		void AddSampleSums(int x, int y, float const *sum, uint32_t count) {
+			size_t i = size_t(y) * width + x;
+			for (int c = 0; c < 3; c++) sums[3 * i + c].store(sums[3 * i + c].load(std::memory_order_relaxed) + sum[c], std::memory_order_relaxed);
+			counts[i].store(counts[i].load(std::memory_order_relaxed) + count, std::memory_order_release);
+		}
+		uint32_t GetSampleCount(int x, int y) const { return counts[size_t(y) * width + x].load(std::memory_order_acquire); }
+		// state of pixel (x, y), consistent only while no thread adds samples to it
+		PixelState GetPixelState(int x, int y) const {
+			size_t i = size_t(y) * width + x;
+			PixelState state;
+			state.count = counts[i].load(std::memory_order_acquire);
+			for (int c = 0; c < 3; c++) state.sum[c] = sums[3 * i + c].load(std::memory_order_relaxed);
+			state.luminance_sum = luminance_sums[i].load(std::memory_order_relaxed);
+			state.luminance_m2 = luminance_m2[i].load(std::memory_order_relaxed);
+			return state;
+		}
+		void SetPixelState(int x, int y, PixelState const &state) {
+			size_t i = size_t(y) * width + x;
+			for (int c = 0; c < 3; c++) sums[3 * i + c].store(state.sum[c], std::memory_order_relaxed);
+			luminance_sums[i].store(state.luminance_sum, std::memory_order_relaxed);
+			luminance_m2[i].store(state.luminance_m2, std::memory_order_relaxed);
+			counts[i].store(state.count, std::memory_order_release);
+		}
+		// standard error of the mean luminance of pixel (x, y) relative to the mean itself,
+		// dark pixels are measured against a floor of 0.01 so that they do not look infinitely noisy
+		double GetRelativeError(int x, int y) const;
+		// average radiance of every pixel, rows from the top down as ImageWriter expects them
+		void Resolve(Vector3D *image) const;
+		// total number of samples taken so far
+		uint64_t GetTotalSampleCount() const;
+		// print average spp of every region_size x region_size block of pixels as a grid, bottom row first
+		void DumpSampleCounts(std::ostream &out, int region_size) const;
+
+		static float Luminance(Vector3D const &radiance) {
+			return float(0.2126 * radiance.x + 0.7152 * radiance.y + 0.0722 * radiance.z);
+		}
+
+	private:
+		int width, height;
+		std::unique_ptr<std::atomic<float>[]> sums;
+		std::unique_ptr<std::atomic<uint32_t>[]> counts;
+		std::unique_ptr<std::atomic<float>[]> luminance_sums;
+		std::unique_ptr<std::atomic<float>[]> luminance_m2;
+};
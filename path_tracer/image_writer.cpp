@@ -0,0 +1,247 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "image_writer.h"
+
+namespace {
+	const int rows_per_item = 16; // rows encoded by one work item
+	const int table_bins = 4096;
+
+	// the reference encoding the table reproduces
+	int GammaReference(double x) {
+		double clamped = x < 0 ? 0 : x > 1 ? 1 : x;
+		return int(pow(clamped, 1 / 2.2) * 255 + .5);
+	}
+
+	// thresholds[k] is the smallest value encoded as k or more; first_code[bin] is the code of the start of a
+	// uniform bin of [0, 1], from where a few threshold comparisons reach the exact code
+	struct GammaTable {
+		double thresholds[257];
+		uint8_t first_code[table_bins + 1];
+
+		GammaTable() {
+			thresholds[0] = -std::numeric_limits<double>::infinity();
+			thresholds[256] = std::numeric_limits<double>::infinity();
+			for (int code = 1; code < 256; code++) {
+				// bisect over the bit patterns of non-negative doubles, which are ordered like their values
+				uint64_t low = 0, high = 0x3ff0000000000000ull; // 0.0 and 1.0
+				while (low < high) {
+					uint64_t middle = low + (high - low) / 2;
+					double value;
+					memcpy(&value, &middle, sizeof(value));
+					if (GammaReference(value) >= code) high = middle;
+					else low = middle + 1;
+				}
+				memcpy(&thresholds[code], &low, sizeof(double));
+			}
+			for (int bin = 0; bin <= table_bins; bin++) first_code[bin] = uint8_t(GammaReference(double(bin) / table_bins));
+		}
+	};
+
+	const GammaTable gamma_table;
+
+	inline double ToneMap(double x, ToneMapping tone_mapping) {
+		return tone_mapping == ToneMapping::reinhard && x > 0.0 ? x / (1.0 + x) : x;
+	}
+
+	// number of bytes of a BMP row, rows are padded to 4 bytes
+	inline int BmpRowSize(int width) {
+		return (3 * width + 3) / 4 * 4;
+	}
+
+	inline void PutLittleEndian32(char *data, uint32_t value) {
+		for (int i = 0; i < 4; i++) data[i] = char((value >> (8 * i)) & 0xff);
+	}
+
+	const int bmp_header_size = 54;
+
+	// bytes of a BMP file, which must fit the 32-bit size field of its header
+	inline uint64_t BmpFileSize(int width, int height) {
+		return bmp_header_size + uint64_t(BmpRowSize(width)) * height;
+	}
+
+	void PutBmpHeader(char *header, int width, int height) {
+		memset(header, 0, bmp_header_size);
+		header[0] = 'B';
+		header[1] = 'M';
+		PutLittleEndian32(header + 2, uint32_t(BmpFileSize(width, height)));
+		PutLittleEndian32(header + 10, bmp_header_size); // offset of the pixels
+		PutLittleEndian32(header + 14, 40); // size of the info header
+		PutLittleEndian32(header + 18, uint32_t(width));
+		PutLittleEndian32(header + 22, uint32_t(height));
+		header[26] = 1; // planes
+		header[28] = 24; // bits per pixel
+	}
+
+	// a negative scale marks little-endian floats, rows go from the bottom of the picture up
+	int PutPfmHeader(char *header, size_t size, int width, int height) {
+		return snprintf(header, size, "PF\n%d %d\n-1.0\n", width, height);
+	}
+
+	// BMP pixels are BGR
+	inline void EncodeBmpPixels(Vector3D const *source, int count, ToneMapping curve, unsigned char *destination) {
+		for (int x = 0; x < count; x++) {
+			destination[3 * x + 0] = EncodeGamma(ToneMap(source[x].z, curve));
+			destination[3 * x + 1] = EncodeGamma(ToneMap(source[x].y, curve));
+			destination[3 * x + 2] = EncodeGamma(ToneMap(source[x].x, curve));
+		}
+	}
+
+	inline void EncodePfmPixels(Vector3D const *source, int count, char *destination) {
+		for (int x = 0; x < count; x++) {
+			float rgb[3] = { float(source[x].x), float(source[x].y), float(source[x].z) };
+			memcpy(destination + x * sizeof(rgb), rgb, sizeof(rgb));
+		}
+	}
+}
+
+uint8_t EncodeGamma(double x) {
+	if (!(x > 0.0)) return 0; // negative values and NaN
+	if (x >= 1.0) return 255;
+	int code = gamma_table.first_code[int(x * table_bins)];
+	while (x >= gamma_table.thresholds[code + 1]) code++;
+	return uint8_t(code);
+}
+
+char const *GetToneMappingName(ToneMapping tone_mapping) {
+	return tone_mapping == ToneMapping::reinhard ? "reinhard" : "clamp";
+}
+
+bool ParseToneMapping(std::string const &name, ToneMapping &tone_mapping) {
+	for (ToneMapping candidate : { ToneMapping::clamp, ToneMapping::reinhard }) {
+		if (name == GetToneMappingName(candidate)) {
+			tone_mapping = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+ImageFormat GetImageFormat(std::string const &path) {
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+	for (char &c : extension) c = char(tolower(c));
+	return extension == "pfm" ? ImageFormat::pfm : ImageFormat::bmp;
+}
+
+ImageWriter::ImageWriter(int thread_count, ToneMapping tone_mapping_) : pool(thread_count), tone_mapping(tone_mapping_) {}
+
+void ImageWriter::EncodeBmp(Vector3D const *image, int width, int height) {
+	int row_size = BmpRowSize(width);
+	buffer.assign(size_t(BmpFileSize(width, height)), 0);
+	PutBmpHeader(buffer.data(), width, height);
+
+	// BMP rows go from the bottom of the picture up
+	char *pixels = buffer.data() + bmp_header_size;
+	ToneMapping curve = tone_mapping;
+	pool.Run((height + rows_per_item - 1) / rows_per_item, [&](int item, int) {
+		int y_end = std::min(height, (item + 1) * rows_per_item);
+		for (int y = item * rows_per_item; y < y_end; y++) {
+			unsigned char *row = reinterpret_cast<unsigned char *>(pixels + size_t(height - 1 - y) * row_size);
+			EncodeBmpPixels(image + size_t(y) * width, width, curve, row);
+		}
+	});
+}
+
+void ImageWriter::EncodePfm(Vector3D const *image, int width, int height) {
+	char header[64];
+	int header_size = PutPfmHeader(header, sizeof(header), width, height);
+	size_t row_size = 3 * sizeof(float) * size_t(width);
+	buffer.resize(header_size + row_size * height);
+	memcpy(buffer.data(), header, header_size);
+
+	char *pixels = buffer.data() + header_size;
+	pool.Run((height + rows_per_item - 1) / rows_per_item, [&](int item, int) {
+		int y_end = std::min(height, (item + 1) * rows_per_item);
+		for (int y = item * rows_per_item; y < y_end; y++) {
+			EncodePfmPixels(image + size_t(y) * width, width, pixels + size_t(height - 1 - y) * row_size);
+		}
+	});
+}
+
+bool ImageWriter::Write(std::string const &path, Vector3D const *image, int width, int height) {
+	if (GetImageFormat(path) == ImageFormat::pfm) EncodePfm(image, width, height);
+	else EncodeBmp(image, width, height);
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	return fclose(file) == 0 && written;
+}
+
+ImageStream::ImageStream(ToneMapping tone_mapping_) : file(nullptr), format(ImageFormat::bmp), tone_mapping(tone_mapping_),
+	row_size(0), height(0), rows_written(0) {}
+
+ImageStream::~ImageStream() {
+	if (file) fclose(file);
+}
+
+bool ImageStream::Open(std::string const &path, int width, int height_, std::string &error) {
+	if (file) Close();
+	format = GetImageFormat(path);
+	height = height_;
+	rows_written = 0;
+	char header[64];
+	int header_size = 0;
+	if (format == ImageFormat::pfm) {
+		row_size = 3 * sizeof(float) * size_t(width);
+		header_size = PutPfmHeader(header, sizeof(header), width, height);
+	}
+	else {
+		if (BmpFileSize(width, height) > std::numeric_limits<uint32_t>::max()) {
+			error = "A " + std::to_string(width) + "x" + std::to_string(height) + " image is too large for BMP, use PFM";
+			return false;
+		}
+		row_size = BmpRowSize(width);
+		PutBmpHeader(header, width, height);
+		header_size = bmp_header_size;
+	}
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr || fwrite(header, 1, header_size, file) != size_t(header_size)) {
+		error = "Cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+void ImageStream::EncodeRow(Vector3D const *pixels, int x0, int count, char *row) const {
+	if (format == ImageFormat::pfm) EncodePfmPixels(pixels, count, row + size_t(x0) * 3 * sizeof(float));
+	else EncodeBmpPixels(pixels, count, tone_mapping, reinterpret_cast<unsigned char *>(row) + size_t(x0) * 3);
+}
+
+bool ImageStream::WriteRows(char const *rows, int row_count) {
+	if (file == nullptr || rows_written + row_count > height) return false;
+	size_t size = row_size * row_count;
+	if (fwrite(rows, 1, size, file) != size) return false;
+	rows_written += row_count;
+	return true;
+}
+
+bool ImageStream::Close() {
+	if (file == nullptr) return false;
+	bool closed = fclose(file) == 0;
+	file = nullptr;
+	return closed && rows_written == height;
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "utils.h"
+#include "scheduler.h"
+
+// tone curve applied to radiance before gamma correction of 8-bit images
+//   clamp    - values above 1 saturate
+//   reinhard - x / (1 + x), compresses highlights instead of clipping them
+enum class ToneMapping { clamp, reinhard };
+
+char const *GetToneMappingName(ToneMapping tone_mapping);
+// parse a tone mapping name, returns false for an unknown one
+bool ParseToneMapping(std::string const &name, ToneMapping &tone_mapping);
+
+// file formats chosen by the extension of the output path: ".pfm" for float radiance, anything else is 8-bit BMP
+enum class ImageFormat { bmp, pfm };
+ImageFormat GetImageFormat(std::string const &path);
+
+// Output stage of the renderer. Rows are encoded in parallel into one buffer, which is kept for the next image
+// and written with a single call. 8-bit values come from a table of gamma thresholds: the result is exactly
+// that of int(pow(x, 1 / 2.2) * 255 + .5) without calling pow. PFM keeps the radiance as 32-bit floats.
+// The writer has its own threads, so it can save snapshots while a ThreadPool renders.
+class ImageWriter {
+	public:
+		explicit ImageWriter(int thread_count = 0, ToneMapping tone_mapping_ = ToneMapping::clamp);
+		// write the image with rows from the top down as Film::Resolve produces them; returns false if the file cannot be written
+		bool Write(std::string const &path, Vector3D const *image, int width, int height);
+		void SetToneMapping(ToneMapping tone_mapping_) { tone_mapping = tone_mapping_; }
+
+	private:
+		void EncodeBmp(Vector3D const *image, int width, int height);
+		void EncodePfm(Vector3D const *image, int width, int height);
+
+		ThreadPool pool;
+		ToneMapping tone_mapping;
+		std::vector<char> buffer;
+};
+
+// Output file written piece by piece, for frames too large to be held in memory. Open writes the header, then
+// rows are appended in file order (from the bottom of the picture up, the order of camera rows) after being
+// encoded with EncodeRow, which several threads may call at once for different rows. Encoded pixels are those
+// ImageWriter writes, so a frame streamed row by row gives the same file.
+class ImageStream {
+	public:
+		explicit ImageStream(ToneMapping tone_mapping_ = ToneMapping::clamp);
+		~ImageStream();
+		// create the file of a width x height image in the format of the path; returns false and sets error if it
+		// cannot be created or the image does not fit the format (BMP sizes are 32-bit)
+		bool Open(std::string const &path, int width, int height, std::string &error);
+		// bytes of an encoded row
+		size_t GetRowSize() const { return row_size; }
+		// encode count pixels into columns [x0, x0 + count) of an encoded row
+		void EncodeRow(Vector3D const *pixels, int x0, int count, char *row) const;
+		// append row_count encoded rows; returns false if they cannot be written or would pass the last row
+		bool WriteRows(char const *rows, int row_count);
+		// close the file, returns false if it is incomplete or cannot be flushed
+		bool Close();
+
+	private:
+		// copying is not allowed
+		ImageStream(ImageStream const &other);
+
+		FILE *file;
+		ImageFormat format;
+		ToneMapping tone_mapping;
+		size_t row_size;
+		int height;
+		int rows_written;
+};
+
+// 8-bit gamma encoding of a tone-mapped value, equal to int(pow(clamp(x), 1 / 2.2) * 255 + .5)
+uint8_t EncodeGamma(double x);
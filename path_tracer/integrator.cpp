@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include "integrator.h"
+#include "photon_map.h"
+
+char const *GetIntegratorName(IntegratorType type) {
+	switch (type) {
+		case IntegratorType::recursive: return "recursive";
+		case IntegratorType::wavefront: return "wavefront";
+		default: return "iterative";
+	}
+}
+
+bool ParseIntegratorType(std::string const &name, IntegratorType &type) {
+	for (IntegratorType candidate : { IntegratorType::recursive, IntegratorType::iterative, IntegratorType::wavefront }) {
+		if (name == GetIntegratorName(candidate)) {
+			type = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+WavefrontIntegrator::WavefrontIntegrator(Scene const &scene_, Camera const &camera_, int max_batch_size_) :
+	scene(scene_), camera(camera_), max_batch_size(max_batch_size_) {}
+
+void WavefrontIntegrator::Render(Tile const &tile, int first_sample, int sample_count, int samples_per_subpixel, uint64_t seed, SamplerType sampler_type, Vector3D *radiance) {
+	// work items are ordered by pixel, then sample, like the loops of the iterative renderer
+	int item_count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0) * sample_count;
+
+	// buffers are allocated on first use and reused by later calls
+	if (paths.size() < size_t(std::min(max_batch_size, item_count))) {
+		paths.resize(std::min(max_batch_size, item_count));
+		ray_queue.reserve(paths.size());
+		next_ray_queue.reserve(paths.size());
+		for (int i = 0; i < 3; i++) material_queues[i].reserve(paths.size());
+	}
+
+	for (int first_item = 0; first_item < item_count; first_item += max_batch_size) {
+		int batch_size = std::min(max_batch_size, item_count - first_item);
+		Generate(tile, first_sample, sample_count, samples_per_subpixel, seed, sampler_type, first_item, batch_size);
+		for (int depth = 1; !ray_queue.empty(); depth++) {
+			Intersect();
+			Shade(depth);
+			std::swap(ray_queue, next_ray_queue);
+		}
+		for (int i = 0; i < batch_size; i++) radiance[first_item + i] = paths[i].radiance;
+	}
+}
+
+void WavefrontIntegrator::Generate(Tile const &tile, int first_sample, int sample_count, int samples_per_subpixel, uint64_t seed, SamplerType sampler_type, int first_item, int item_count) {
+	int width = tile.x1 - tile.x0;
+	ray_queue.clear();
+	for (int i = 0; i < item_count; i++) {
+		int item = first_item + i;
+		int sample = first_sample + item % sample_count;
+		int pixel = item / sample_count;
+		int x = tile.x0 + pixel % width, y = tile.y0 + pixel / width;
+		int subpixel = SubpixelOfSample(sample, samples_per_subpixel);
+
+		Path &path = paths[i];
+		path.sampler = Sampler(seed, sampler_type);
+		path.sampler.StartPixelSample(uint32_t(y * camera.GetWidth() + x), uint32_t(sample), uint32_t(subpixel),
+			uint32_t(SubpixelSampleIndex(sample, samples_per_subpixel)));
+		path.ray = camera.GenerateRay(x, y, subpixel % 2, subpixel / 2, path.sampler);
+		path.throughput = Vector3D(1.0, 1.0, 1.0);
+		path.radiance = Vector3D();
+		path.pdf = 0.0;
+		path.diffuse_bounces = 0;
+		path.caustic = false;
+		ray_queue.push_back(i);
+	}
+}
+
+void WavefrontIntegrator::Intersect() {
+	for (int i = 0; i < 3; i++) material_queues[i].clear();
+	for (int index : ray_queue) {
+		Path &path = paths[index];
+		path.object_ptr = scene.IntersectWithNearestObject(path.ray, path.t, path.primitive);
+		if (path.object_ptr == nullptr) continue;
+
+		// emitted light is gathered right away, lights terminate paths
+		double emission_weight = scene.GetEmissionWeight(*path.object_ptr, path.ray.origin, path.pdf, path.caustic);
+		path.radiance = path.radiance + path.throughput.mult(path.object_ptr->GetEmission()) * emission_weight;
+		if (path.object_ptr->IsLight()) continue;
+		material_queues[int(path.object_ptr->GetMaterial())].push_back(index);
+	}
+}
+
+void WavefrontIntegrator::Shade(int depth) {
+	// shade all hits of one material before going to the next one, so that the same code runs back to back
+	next_ray_queue.clear();
+	for (int material = 0; material < 3; material++) {
+		for (int index : material_queues[material]) {
+			Path &path = paths[index];
+			Ray3D next_ray;
+			if (!scene.Scatter(*path.object_ptr, path.primitive, path.ray, path.t, depth, path.sampler, next_ray, path.throughput, path.pdf)) continue;
+			if (path.pdf > 0.0 && scene.GetLightSampling()) {
+				Vector3D direct = scene.SampleDirectLight(*path.object_ptr, path.primitive, path.ray, path.t, path.sampler);
+				path.radiance = path.radiance + path.throughput.mult(direct);
+			}
+			if (path.pdf > 0.0 && scene.GetCausticMap() != nullptr && path.diffuse_bounces++ == 0) {
+				Vector3D caustics = scene.GatherCaustics(*path.object_ptr, path.primitive, path.ray, path.t);
+				path.radiance = path.radiance + path.throughput.mult(caustics);
+			}
+			path.caustic = path.diffuse_bounces == 1 && scene.GetCausticMap() != nullptr && PhotonMap::IsTarget(*path.object_ptr);
+			path.ray = next_ray;
+			next_ray_queue.push_back(index);
+		}
+	}
+	// trace the next stage in path order, neighboring paths have coherent rays
+	std::sort(next_ray_queue.begin(), next_ray_queue.end());
+}
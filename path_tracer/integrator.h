@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "utils.h"
+#include "scene.h"
+#include "camera.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+// how radiance of camera rays is estimated
+//   recursive - Scene::ComputeRadiance, splits paths at dielectrics during the first bounces, finds lights
+//               by BSDF sampling only
+//   iterative - Scene::TracePath, one path per sample with a throughput weight and light sampling at diffuse hits
+//   wavefront - the iterative estimator run over batches of paths by WavefrontIntegrator
+enum class IntegratorType { recursive, iterative, wavefront };
+
+char const *GetIntegratorName(IntegratorType type);
+// parse an integrator name, returns false for an unknown one
+bool ParseIntegratorType(std::string const &name, IntegratorType &type);
+
+// Wavefront path tracer. All paths of a rectangle of pixels are advanced together stage by stage:
+// generate camera rays -> intersect the ray queue -> shade hits grouped by material -> extend survivors
+// into the next ray queue. Every path keeps its own sampler, so the result is exactly the one of
+// Scene::TracePath whatever the batch size. An instance is used by one thread at a time.
+class WavefrontIntegrator {
+	public:
+		WavefrontIntegrator(Scene const &scene_, Camera const &camera_, int max_batch_size_ = 1 << 14);
+		// trace samples [first_sample, first_sample + sample_count) of every pixel of the tile, the radiance of
+		// sample first_sample + k of pixel (x, y) goes to radiance[((y - y0) * (x1 - x0) + x - x0) * sample_count + k].
+		// Sample s of a pixel uses sampler stream s and subpixel SubpixelOfSample(s, samples_per_subpixel).
+		void Render(Tile const &tile, int first_sample, int sample_count, int samples_per_subpixel, uint64_t seed, SamplerType sampler_type, Vector3D *radiance);
+
+	private:
+		struct Path {
+			Ray3D ray;
+			Vector3D throughput;
+			Vector3D radiance;
+			Sampler sampler;
+			Object const *object_ptr; // object hit by ray, nullptr for a miss
+			int primitive; // hit primitive of the object
+			double t;
+			double pdf; // density the direction of ray was sampled with, 0 for camera and specular rays
+			int diffuse_bounces; // counted with a caustic map only
+			bool caustic; // see Scene::GetEmissionWeight
+		};
+
+		void Generate(Tile const &tile, int first_sample, int sample_count, int samples_per_subpixel, uint64_t seed, SamplerType sampler_type, int first_item, int item_count);
+		void Intersect();
+		void Shade(int depth);
+
+		Scene const &scene;
+		Camera const &camera;
+		int max_batch_size;
+		std::vector<Path> paths;
+		// indices of paths whose rays are to be traced in the current and in the next stage
+		std::vector<int> ray_queue, next_ray_queue;
+		// hits of the current stage sorted by material
+		std::vector<int> material_queues[3];
+};
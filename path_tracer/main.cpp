@@ -21,69 +21,395 @@ THE SOFTWARE.
 #include <memory>
 #include <utility>
 #include <iostream>
+#include <string>
+#include <map>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+#include <chrono>
+#include <functional>
 
 #include "objects.h"
 #include "scene.h"
+#include "render.h"
+#include "scene_file.h"
+#include "image_writer.h"
+#include "stats.h"
+#include "distributed.h"
+#include "animation.h"
+#include "checkpoint.h"
+#include "server.h"
+#include "photon_map.h"
 
 using namespace std;
 
 Scene scene(5);
+RenderProgress progress;
 
-std::default_random_engine generator;
-std::uniform_real_distribution<double> distr(0.0, 1.0);
-double urandom() {
-	return distr(generator);
+// Ctrl+C stops the render after the tiles in flight, the finished part of the image is still written
+void HandleInterrupt(int) {
+	progress.cancel = true;
 }
 
-void CreateScene() {
-	scene.AddObject(new SphereObject(1e5, Vector3D(1e5 + 1, 40.8, 81.6), Object::Material::diffuse, Vector3D(.75, .25, .25), Vector3D())); // left
-	scene.AddObject(new SphereObject(1e5, Vector3D(-1e5 + 99, 40.8, 81.6), Object::Material::diffuse, Vector3D(.25, .25, .75), Vector3D())); // right
-	scene.AddObject(new SphereObject(1e5, Vector3D(50, 40.8, 1e5), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D())); // back
-	scene.AddObject(new SphereObject(1e5, Vector3D(50, 40.8, -1e5 + 170), Object::Material::diffuse, Vector3D(), Vector3D())); // front
-	scene.AddObject(new SphereObject(1e5, Vector3D(50, 1e5, 81.6), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D())); // bottom
-	scene.AddObject(new SphereObject(1e5, Vector3D(50, -1e5 + 81.6, 81.6), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D())); // top
-	scene.AddObject(new SphereObject(16.5, Vector3D(27, 16.5, 47), Object::Material::specular, Vector3D(1, 1, 1)*.999, Vector3D())); // mirror
-	scene.AddObject(new SphereObject(16.5, Vector3D(73, 16.5, 78), Object::Material::refracture, Vector3D(1, 1, 1)*.999, Vector3D())); // glass
-	scene.AddObject(new SphereObject(600, Vector3D(50, 681.6 - .27, 81.6), Object::Material::diffuse, Vector3D(), Vector3D(12, 12, 12))); // light
-}
-
-inline double clamp(double x) { return x < 0.0 ? 0.0 : x > 1.0 ? 1.0 : x; }
-
 int main(int argc, char *argv[]) {
-	// handle command line
-	int samples_per_pixel = 1;
-	std::cout << "Usage: " << argv[0] << " [samples_per_pixel(default value is 1)]" << std::endl;
-	if (argc > 1) samples_per_pixel = atoi(argv[1]) / 4; // since every pixel is split into 4 subpixels
+	// handle command line: positional arguments and "--name value" options
+	std::cout << "Usage: " << argv[0] << " [samples_per_pixel(default value is 1)] [seed(default value is 0)] [--integrator recursive|iterative|wavefront] [--sampler independent|sobol|halton] [--precision double|float] [--threads N] [--tile-size N(0 - scanlines)]" << std::endl;
+	std::cout << "       " << "    [--progressive] [--time-budget seconds] [--snapshot-interval seconds]" << std::endl;
+	std::cout << "       " << "    [--checkpoint file] [--checkpoint-interval seconds(default 60)] [--resume] (progressive)" << std::endl;
+	std::cout << "       " << "    [--adaptive] [--max-spp N] [--threshold relative_error]" << std::endl;
+	std::cout << "       " << "    [--scene cornell|small-light|many-spheres|file] [--save-scene binary_file] [--light-sampling 0|1]" << std::endl;
+	std::cout << "       " << "    [--output image.bmp|image.pfm(default z_out.bmp)] [--tone-mapping clamp|reinhard]" << std::endl;
+	std::cout << "       " << "    [--resolution WIDTHxHEIGHT(default of the scene)] [--tiled] (stream rows to the output instead of holding the frame)" << std::endl;
+	std::cout << "       " << "    [--caustic-photons N] [--caustic-radius r(default 1)] (photon map of caustics, iterative and wavefront)" << std::endl;
+	std::cout << "       " << "    [--stats summary.json] [--trace chrome_trace.json] [--denoise] [--aovs file_prefix]" << std::endl;
+	std::cout << "       " << "    [--frames N] [--orbit degrees] [--moving spheres] (the output path becomes a pattern like z_out_%04d.bmp)" << std::endl;
+	std::cout << "       " << "    [--coordinator port(0 - any)] [--local-workers N] [--kill-worker-after tiles] [--worker-timeout seconds]" << std::endl;
+	std::cout << "       " << argv[0] << " --worker host:port [--threads N] [--fail-after tiles]" << std::endl;
+	std::cout << "       " << argv[0] << " --serve port(0 - any) [--scene resident_scene] [--data-dir directory_of_request_files] [--threads N] [--tile-size N]" << std::endl;
+	std::cout << "       " << argv[0] << " --submit host:port [samples_per_pixel] [seed] [--scene name] [--resolution WIDTHxHEIGHT] [--priority N] [--output image] [--server-output image]" << std::endl;
+	if (argc > 1 && std::string(argv[1]).compare(0, 8, "--bench-") == 0) {
+		std::cerr << "Benchmarks are studies of path_tracer_bench now, e.g. path_tracer_bench " << argv[1] + 8 << std::endl;
+		return 1;
+	}
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--progressive" || arg == "--adaptive" || arg == "--denoise" || arg == "--resume" || arg == "--tiled") options[arg.substr(2)] = "1";
+		else if (arg.compare(0, 2, "--") == 0) options[arg.substr(2)] = i + 1 < argc ? argv[++i] : "";
+		else positional.push_back(arg);
+	}
+
+	RenderSettings settings;
+	if (options.count("integrator") && !ParseIntegratorType(options["integrator"], settings.integrator)) {
+		std::cerr << "Unknown integrator " << options["integrator"] << std::endl;
+		return 1;
+	}
+	if (options.count("sampler") && !ParseSamplerType(options["sampler"], settings.sampler)) {
+		std::cerr << "Unknown sampler " << options["sampler"] << std::endl;
+		return 1;
+	}
+	Precision precision = Precision::float64;
+	if (options.count("precision") && !ParsePrecision(options["precision"], precision)) {
+		std::cerr << "Unknown precision " << options["precision"] << std::endl;
+		return 1;
+	}
+	if (options.count("threads")) settings.thread_count = atoi(options["threads"].c_str());
+	if (options.count("tile-size")) settings.tile_size = atoi(options["tile-size"].c_str());
+	if (options.count("progressive")) settings.progressive = true;
+	if (options.count("time-budget")) {
+		settings.progressive = true;
+		settings.time_budget_seconds = atof(options["time-budget"].c_str());
+	}
+	// checkpoints are taken of the accumulation buffer of progressive renders
+	if (options.count("checkpoint") || options.count("resume")) settings.progressive = true;
+	if (options.count("snapshot-interval")) settings.snapshot_interval_seconds = atof(options["snapshot-interval"].c_str());
+	if (options.count("adaptive")) settings.adaptive = true;
+	if (options.count("max-spp")) {
+		settings.max_samples_per_pixel = atoi(options["max-spp"].c_str());
+		if (settings.max_samples_per_pixel < 1) {
+			std::cerr << "Expected a positive number after --max-spp" << std::endl;
+			return 1;
+		}
+	}
+	if (options.count("threshold")) settings.adaptive_threshold = atof(options["threshold"].c_str());
+	std::string output_path = options.count("output") ? options["output"] : "z_out.bmp";
+	settings.clamp_subpixels = GetImageFormat(output_path) != ImageFormat::pfm;
+	ToneMapping tone_mapping = ToneMapping::clamp;
+	if (options.count("tone-mapping") && !ParseToneMapping(options["tone-mapping"], tone_mapping)) {
+		std::cerr << "Unknown tone mapping " << options["tone-mapping"] << std::endl;
+		return 1;
+	}
+	// frame size overriding that of the scene, 0 - keep it
+	int resolution_width = 0, resolution_height = 0;
+	if (options.count("resolution") && (sscanf(options["resolution"].c_str(), "%dx%d", &resolution_width, &resolution_height) != 2 ||
+		resolution_width < 1 || resolution_height < 1)) {
+		std::cerr << "Expected WIDTHxHEIGHT after --resolution" << std::endl;
+		return 1;
+	}
+	if (options.count("caustic-radius") && !(atof(options["caustic-radius"].c_str()) > 0.0)) {
+		std::cerr << "Expected a positive radius after --caustic-radius" << std::endl;
+		return 1;
+	}
+	if (options.count("worker")) {
+		std::string address = options["worker"];
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			std::cerr << "Expected host:port after --worker" << std::endl;
+			return 1;
+		}
+		return RunWorker(address.substr(0, colon), atoi(address.substr(colon + 1).c_str()), settings.thread_count,
+			options.count("fail-after") ? atoi(options["fail-after"].c_str()) : 0);
+	}
+	bool light_sampling = !options.count("light-sampling") || atoi(options["light-sampling"].c_str()) != 0;
+	if (options.count("serve")) {
+		ServerSettings server;
+		server.port = atoi(options["serve"].c_str());
+		server.thread_count = settings.thread_count;
+		if (options.count("tile-size")) server.tile_size = settings.tile_size;
+		if (options.count("data-dir")) server.data_directory = options["data-dir"];
+		std::vector<std::string> resident_scenes;
+		if (options.count("scene")) resident_scenes.push_back(options["scene"]);
+		return RunRenderServer(server, resident_scenes, light_sampling, precision);
+	}
+	if (options.count("submit")) {
+		// a client of --serve: the image is assembled from the streamed tiles and written here
+		std::string address = options["submit"];
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			std::cerr << "Expected host:port after --submit" << std::endl;
+			return 1;
+		}
+		RenderRequest request;
+		if (options.count("scene")) request.scene_name = options["scene"];
+		request.width = resolution_width;
+		request.height = resolution_height;
+		request.settings = settings;
+		request.settings.samples_per_subpixel = std::max(1, positional.size() > 0 ? atoi(positional[0].c_str()) / 4 : 1);
+		if (positional.size() > 1) request.settings.seed = strtoull(positional[1].c_str(), nullptr, 10);
+		request.light_sampling = light_sampling;
+		request.precision = precision;
+		if (options.count("priority")) request.priority = atoi(options["priority"].c_str());
+		if (options.count("server-output")) request.output_path = options["server-output"];
+		request.tone_mapping = tone_mapping;
+		std::unique_ptr<Film> film_ptr;
+		auto start = std::chrono::steady_clock::now();
+		double first_tile_seconds = 0.0;
+		JobTimes times;
+		std::string error;
+		bool submitted = SubmitRenderRequest(address.substr(0, colon), atoi(address.substr(colon + 1).c_str()), request,
+			[&](int width, int height) { film_ptr.reset(new Film(width, height)); },
+			[&](Tile const &tile, float const *sums, uint32_t const *counts) {
+				if (first_tile_seconds == 0.0) first_tile_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				for (int y = tile.y0; y < tile.y1; y++) {
+					for (int x = tile.x0; x < tile.x1; x++) {
+						int i = (y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0;
+						film_ptr->AddSampleSums(x, y, sums + 3 * i, counts[i]);
+					}
+				}
+			}, times, error);
+		if (!submitted) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		std::cerr << "First tile after " << 1e3 * first_tile_seconds << " ms (server: " << 1e3 * times.first_tile_seconds << " ms, " <<
+			1e3 * times.first_tile_render_seconds << " ms of it rendering), done after " << 1e3 * times.total_seconds << " ms" << std::endl;
+		std::vector<Vector3D> image(size_t(film_ptr->GetWidth()) * film_ptr->GetHeight());
+		film_ptr->Resolve(image.data());
+		ImageWriter image_writer(settings.thread_count, tone_mapping);
+		if (!image_writer.Write(output_path, image.data(), film_ptr->GetWidth(), film_ptr->GetHeight())) {
+			std::cerr << "Cannot write " << output_path << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	if (positional.size() > 0) settings.samples_per_subpixel = atoi(positional[0].c_str()) / 4; // since every pixel is split into 4 subpixels
+	if (settings.samples_per_subpixel < 1) settings.samples_per_subpixel = 1;
 
-	// create a scene to model global illumination
-	CreateScene();
+	// counters are always recorded by an instrumented build, timers only when their results are wanted
+	bool report_stats = options.count("stats") || options.count("trace");
+	if (report_stats && !IsStatsEnabled()) std::cerr << "Built without PATH_TRACER_STATS, counters and timers stay empty" << std::endl;
+	SetTracing(report_stats);
 
-	// create array to store image
-	int width = 512;
-	int height = 512;
-	std::unique_ptr<Vector3D> image_ptr(new Vector3D[width * height]);
-	Vector3D *c = image_ptr.get();
-	Vector3D r;
+	// create a scene to model global illumination: a built-in one or one loaded from a file
+	std::string scene_name = options.count("scene") ? options["scene"] : "cornell";
+	SceneDescription description;
+	scene.SetPrecision(precision); // before the scene is built, BVH leaves are sized for the kernel width
+	{
+		STATS_TIMER("scene", "setup");
+		if (!CreateBuiltinScene(scene_name, scene)) {
+			std::string error;
+			auto start = std::chrono::steady_clock::now();
+			if (!LoadScene(scene_name, scene, description, error)) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+			std::cerr << "Loaded " << scene.GetObjectCount() << " objects in " <<
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+		}
+	}
+	if (options.count("save-scene")) {
+		std::string error;
+		if (!SaveBinaryScene(options["save-scene"], scene, description, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	scene.SetLightSampling(light_sampling);
+	if (resolution_width > 0) {
+		description.width = resolution_width;
+		description.height = resolution_height;
+	}
 
 	// setup camera
-	Ray3D cam(Vector3D(50, 52, 295.6), Vector3D(0, -0.042612, -1).norm());
-	Vector3D cx = Vector3D(width * 0.5135 / height);
-	Vector3D cy = (cx % cam.direction).norm()* 0.5135;
+	int width = description.width;
+	int height = description.height;
+	Vector3D camera_origin = description.camera_origin;
+	Vector3D camera_direction = description.camera_direction;
+	Camera camera(camera_origin, camera_direction, width, height);
 
-    #pragma omp parallel for schedule(dynamic, 1) private(r)
-	for (int y = 0; y < height; y++) {
-		fprintf(stderr, "\rRendering (%d spp) %5.2f%%", samples_per_pixel * 4, 100.*y / (height - 1));
-		for (int x = 0; x < width; x++)
-			for (int sy = 0, i = (height - y - 1) * width + x; sy < 2; sy++)
-				for (int sx = 0; sx < 2; sx++, r = Vector3D()) {
-					for (int s = 0; s < samples_per_pixel; s++) {
-						double r1 = 2 * urandom(), dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
-						double r2 = 2 * urandom(), dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
-						Vector3D d = cx * (((sx + 0.5 + dx) / 2 + x) / width - 0.5) + cy * (((sy + 0.5 + dy) / 2 + y) / height - 0.5) + cam.direction;
-						r = r + scene.ComputeRadiance(Ray3D(cam.origin + d * 140, d.norm()), 0)*(1. / samples_per_pixel);
-					}
-					c[i] = c[i] + Vector3D(clamp(r.x), clamp(r.y), clamp(r.z))* 0.25;
-				}
+	if (positional.size() > 1) settings.seed = strtoull(positional[1].c_str(), nullptr, 10);
+	if ((options.count("denoise") || options.count("aovs")) && (options.count("coordinator") || settings.progressive || settings.adaptive)) {
+		std::cerr << "--denoise and --aovs apply to plain renders only, ignored" << std::endl;
+	}
+
+	auto write_stats = [&]() {
+		if (!report_stats) return;
+		StatsSnapshot stats = CollectStats();
+		std::string error;
+		if (options.count("stats") && !WriteStatsJson(options["stats"], stats, error)) std::cerr << error << std::endl;
+		if (options.count("trace") && !WriteChromeTrace(options["trace"], stats, error)) std::cerr << error << std::endl;
+	};
+	signal(SIGINT, HandleInterrupt);
+	// the photon pre-pass of caustics: built once for the scene as it is, so not for animations
+	PhotonMap caustic_map;
+	if (options.count("caustic-photons")) {
+		if (options.count("frames") || options.count("coordinator") || options.count("checkpoint") || settings.integrator == IntegratorType::recursive) {
+			std::cerr << "--caustic-photons applies to single local renders of the iterative and wavefront integrators without checkpoints, ignored" << std::endl;
+		}
+		else {
+			PhotonMapSettings photon_settings;
+			photon_settings.photon_count = atoi(options["caustic-photons"].c_str());
+			if (options.count("caustic-radius")) photon_settings.radius = atof(options["caustic-radius"].c_str());
+			photon_settings.seed = settings.seed;
+			photon_settings.sampler = settings.sampler;
+			ThreadPool pool(settings.thread_count);
+			caustic_map.Build(scene, photon_settings, &pool);
+			PhotonMapStats const &photon_stats = caustic_map.GetStats();
+			std::cerr << "Caustic map: " << photon_stats.stored << " photons of " << photon_stats.paths << " paths, " <<
+				photon_stats.bytes / 1024 << " KiB, traced in " << photon_stats.trace_seconds << " s, sorted in " << photon_stats.build_seconds << " s" << std::endl;
+			scene.SetCausticMap(&caustic_map);
+		}
+	}
+	if (options.count("frames")) {
+		// a sequence in one process, --output becomes the pattern of the frame files
+		AnimationSettings animation;
+		animation.frame_count = atoi(options["frames"].c_str());
+		if (options.count("orbit")) animation.orbit_degrees = atof(options["orbit"].c_str());
+		if (options.count("moving")) animation.moving_spheres = atoi(options["moving"].c_str());
+		if (options.count("output")) {
+			animation.output_pattern = output_path;
+			if (output_path.find('%') == std::string::npos) {
+				size_t dot = output_path.rfind('.');
+				if (dot == std::string::npos) dot = output_path.size();
+				animation.output_pattern = output_path.substr(0, dot) + "_%04d" + output_path.substr(dot);
+			}
+		}
+		bool finished = RenderAnimation(scene, description, settings, animation, tone_mapping, &progress);
+		write_stats();
+		return finished ? 0 : 1;
+	}
+
+	if (options.count("tiled")) {
+		if (options.count("coordinator") || settings.progressive || settings.adaptive || options.count("denoise") || options.count("aovs")) {
+			std::cerr << "--tiled applies to plain renders without --denoise and --aovs only, ignored" << std::endl;
+		}
+		else {
+			// finished rows go to the file as they come, the frame is never held in memory
+			ImageStream stream(tone_mapping);
+			std::string error;
+			if (!stream.Open(output_path, width, height, error)) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+			bool finished = RenderImageStreamed(scene, camera, settings, stream, &progress);
+			bool written = stream.Close();
+			if (!written) std::cerr << "Cannot write " << output_path << std::endl;
+			else if (!finished) std::cerr << "Render cancelled, the rows after the finished tiles are black" << std::endl;
+			write_stats();
+			return written ? 0 : 1;
+		}
+	}
+
+	// create array to store image
+	std::unique_ptr<Vector3D[]> image_ptr(new Vector3D[size_t(width) * height]);
+	ImageWriter image_writer(settings.thread_count, tone_mapping);
+	auto write_image = [&]() {
+		STATS_TIMER("write image", "output");
+		if (!image_writer.Write(output_path, image_ptr.get(), width, height)) std::cerr << "Cannot write " << output_path << std::endl;
+	};
+	if (options.count("coordinator")) {
+		// workers take whole tiles with all their samples, the image equals that of --progressive
+		DistributedSettings distributed;
+		distributed.port = atoi(options["coordinator"].c_str());
+		if (options.count("tile-size")) distributed.tile_size = settings.tile_size;
+		if (options.count("local-workers")) distributed.local_workers = atoi(options["local-workers"].c_str());
+		if (options.count("kill-worker-after")) distributed.kill_worker_after = atoi(options["kill-worker-after"].c_str());
+		if (options.count("worker-timeout")) distributed.worker_timeout_seconds = atof(options["worker-timeout"].c_str());
+		distributed.worker_threads = settings.thread_count;
+		distributed.executable = argv[0];
+		Film film(width, height);
+		if (!RunCoordinator(scene_name, description, settings, scene.GetLightSampling(), scene.GetPrecision(), distributed, film, &progress)) {
+			std::cerr << "Distributed render failed or was cancelled, writing the finished tiles" << std::endl;
+		}
+		film.Resolve(image_ptr.get());
+	}
+	else if (settings.progressive) {
+		// every snapshot overwrites the output image, so a preview is available after the first pass
+		Film film(width, height);
+		auto start = std::chrono::steady_clock::now();
+		auto write_snapshot = [&](Film const &current_film, int passes_done) {
+			current_film.Resolve(image_ptr.get());
+			write_image();
+			std::cerr << "\rSnapshot after " << passes_done << " spp at " <<
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+		};
+		std::unique_ptr<Checkpoint> checkpoint_ptr;
+		if (options.count("checkpoint")) {
+			checkpoint_ptr.reset(new Checkpoint(options.count("checkpoint-interval") ? atof(options["checkpoint-interval"].c_str()) : 60.0));
+			std::string error;
+			bool resume = options.count("resume") != 0;
+			if (!checkpoint_ptr->Open(options["checkpoint"], MakeCheckpointKey(scene_name, description, settings, scene.GetLightSampling(), scene.GetPrecision()), resume, error)) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+			if (resume && checkpoint_ptr->Load(film)) std::cerr << "Resumed after " << checkpoint_ptr->GetSavedPasses() << " complete passes" << std::endl;
+		}
+		else if (options.count("resume")) {
+			std::cerr << "--resume needs --checkpoint file" << std::endl;
+			return 1;
+		}
+		RenderProgressive(scene, camera, settings, film, write_snapshot, &progress, nullptr, checkpoint_ptr.get());
+		if (checkpoint_ptr) std::cerr << "Checkpoints took " << checkpoint_ptr->GetSeconds() << " s of the main thread" << std::endl;
+		std::cerr << "Finished with " << double(film.GetTotalSampleCount()) / (double(width) * height) << " spp on average" << std::endl;
+		film.Resolve(image_ptr.get());
+	}
+	else if (settings.adaptive) {
+		Film film(width, height);
+		RenderAdaptive(scene, camera, settings, film, &progress);
+		std::cerr << "Finished with " << double(film.GetTotalSampleCount()) / (double(width) * height) << " spp on average" << std::endl;
+		std::cout << "Average spp of every " << settings.tile_size << "x" << settings.tile_size << " tile:" << std::endl;
+		film.DumpSampleCounts(std::cout, settings.tile_size > 0 ? settings.tile_size : 16);
+		film.Resolve(image_ptr.get());
+	}
+	else {
+		// auxiliary buffers of the first hits guide the denoiser and may be saved for inspection
+		bool want_aovs = options.count("denoise") || options.count("aovs");
+		AovBuffers aovs;
+		if (!RenderImage(scene, camera, settings, image_ptr.get(), &progress, nullptr, want_aovs ? &aovs : nullptr)) {
+			std::cerr << "Render cancelled, writing the finished tiles" << std::endl;
+		}
+		if (options.count("aovs")) {
+			std::vector<Vector3D> plane(width * height);
+			auto write_plane = [&](char const *name, std::function<Vector3D(int)> const &value) {
+				for (int i = 0; i < width * height; i++) plane[i] = value(i);
+				std::string path = options["aovs"] + "_" + name + ".pfm";
+				if (!image_writer.Write(path, plane.data(), width, height)) std::cerr << "Cannot write " << path << std::endl;
+			};
+			write_plane("albedo", [&](int i) { return Vector3D(aovs.albedo[i]); });
+			write_plane("normal", [&](int i) { return Vector3D(aovs.normal[i]); });
+			write_plane("depth", [&](int i) { return Vector3D(1.0, 1.0, 1.0) * aovs.depth[i]; });
+			write_plane("variance", [&](int i) { return Vector3D(1.0, 1.0, 1.0) * aovs.variance[i]; });
+		}
+		if (options.count("denoise")) {
+			STATS_TIMER("denoise", "phase");
+			ThreadPool pool(settings.thread_count);
+			auto start = std::chrono::steady_clock::now();
+			DenoiseImage(image_ptr.get(), aovs, DenoiserSettings(), &pool);
+			std::cerr << "Denoised in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+		}
 	}
-	WriteImageToBmp(c, width, height);
+	write_image();
+	write_stats();
 }
@@ -0,0 +1,179 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data(nullptr), size(0), writable(false), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr) {}
+#else
+MappedFile::MappedFile() : data(nullptr), size(0), writable(false) {}
+#endif
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(std::string const &path, std::string &error) {
+	Close();
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		error = "cannot open " + path;
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+		error = "cannot map empty file " + path;
+		Close();
+		return false;
+	}
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle != nullptr) data = static_cast<char const *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr) {
+		error = "cannot map " + path;
+		Close();
+		return false;
+	}
+	size = size_t(file_size.QuadPart);
+	return true;
+}
+
+bool MappedFile::OpenWritable(std::string const &path, size_t size_, std::string &error) {
+	Close();
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, size_ > 0 ? OPEN_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		error = "cannot open " + path + " for writing";
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	file_size.QuadPart = LONGLONG(size_);
+	if (size_ > 0 && (!SetFilePointerEx(file_handle, file_size, nullptr, FILE_BEGIN) || !SetEndOfFile(file_handle))) {
+		error = "cannot resize " + path;
+		Close();
+		return false;
+	}
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+		error = "cannot map empty file " + path;
+		Close();
+		return false;
+	}
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	if (mapping_handle != nullptr) data = static_cast<char const *>(MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, 0));
+	if (data == nullptr) {
+		error = "cannot map " + path;
+		Close();
+		return false;
+	}
+	size = size_t(file_size.QuadPart);
+	writable = true;
+	return true;
+}
+
+void MappedFile::Flush() {
+	if (writable) FlushViewOfFile(data, 0);
+}
+
+void MappedFile::Close() {
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	data = nullptr;
+	size = 0;
+	writable = false;
+	mapping_handle = nullptr;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::Open(std::string const &path, std::string &error) {
+	Close();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		error = "cannot open " + path;
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		error = "cannot map empty file " + path;
+		close(fd);
+		return false;
+	}
+	void *address = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file open
+	if (address == MAP_FAILED) {
+		error = "cannot map " + path;
+		return false;
+	}
+	data = static_cast<char const *>(address);
+	size = size_t(file_stat.st_size);
+	return true;
+}
+
+bool MappedFile::OpenWritable(std::string const &path, size_t size_, std::string &error) {
+	Close();
+	int fd = open(path.c_str(), size_ > 0 ? O_RDWR | O_CREAT : O_RDWR, 0644);
+	if (fd < 0) {
+		error = "cannot open " + path + " for writing";
+		return false;
+	}
+	struct stat file_stat;
+	if ((size_ > 0 && ftruncate(fd, off_t(size_)) != 0) || fstat(fd, &file_stat) != 0) {
+		error = "cannot resize " + path;
+		close(fd);
+		return false;
+	}
+	if (file_stat.st_size == 0) {
+		error = "cannot map empty file " + path;
+		close(fd);
+		return false;
+	}
+	void *address = mmap(nullptr, size_t(file_stat.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) {
+		error = "cannot map " + path;
+		return false;
+	}
+	data = static_cast<char const *>(address);
+	size = size_t(file_stat.st_size);
+	writable = true;
+	return true;
+}
+
+void MappedFile::Flush() {
+	if (writable) msync(const_cast<char *>(data), size, MS_ASYNC);
+}
+
+void MappedFile::Close() {
+	if (data != nullptr) munmap(const_cast<char *>(data), size);
+	data = nullptr;
+	size = 0;
+	writable = false;
+}
+#endif
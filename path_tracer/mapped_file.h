@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Memory mapping of a whole file, the pages are loaded by the OS on first access
+class MappedFile {
+	public:
+		MappedFile();
+		~MappedFile();
+		// map the file read-only, returns false and sets error if it cannot be opened or mapped
+		bool Open(std::string const &path, std::string &error);
+		// Map the file for reading and writing. A size > 0 creates the file if needed and sets its size (new bytes
+		// are zero), 0 opens an existing file as it is and fails if there is none. Changes reach the file through
+		// the page cache, so they survive the process being killed.
+		bool OpenWritable(std::string const &path, size_t size, std::string &error);
+		void Close();
+		char const *GetData() const { return data; }
+		// nullptr unless opened with OpenWritable
+		char *GetWritableData() const { return writable ? const_cast<char *>(data) : nullptr; }
+		size_t GetSize() const { return size; }
+		// start writing the changed pages of a writable mapping to disk without waiting for it
+		void Flush();
+	private:
+		// copying is not allowed
+		MappedFile(MappedFile const &other);
+		MappedFile &operator=(MappedFile const &other);
+
+		char const *data;
+		size_t size;
+		bool writable;
+#ifdef _WIN32
+		void *file_handle;
+		void *mapping_handle;
+#endif
+};
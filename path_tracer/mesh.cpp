@@ -0,0 +1,174 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "mesh.h"
+#include "stats.h"
+
+namespace {
+	// leaves are tested as one batch sharing the sheared ray; letting the SAH fill them up to this size
+	// keeps the hierarchy at a few bytes per triangle and is faster than smaller leaves
+	const int max_leaf_size = 8;
+}
+
+void TriangleMesh::Reserve(int vertex_count, int triangle_count) {
+	positions.reserve(vertex_count);
+	indices.reserve(3 * size_t(triangle_count));
+}
+
+int TriangleMesh::AddVertex(Vector3F const &position) {
+	positions.push_back(position);
+	return int(positions.size()) - 1;
+}
+
+int TriangleMesh::AddNormal(Vector3F const &normal) {
+	normals.push_back(normal);
+	return int(normals.size()) - 1;
+}
+
+void TriangleMesh::AddTriangle(int v0, int v1, int v2, int n0, int n1, int n2) {
+	indices.push_back(uint32_t(v0));
+	indices.push_back(uint32_t(v1));
+	indices.push_back(uint32_t(v2));
+	bool has_normals = n0 >= 0 && n1 >= 0 && n2 >= 0;
+	// normal indices are only stored once some triangle has normals
+	if (has_normals && normal_indices.empty()) normal_indices.resize(indices.size() - 3, -1);
+	if (!normal_indices.empty()) {
+		normal_indices.push_back(has_normals ? n0 : -1);
+		normal_indices.push_back(has_normals ? n1 : -1);
+		normal_indices.push_back(has_normals ? n2 : -1);
+	}
+}
+
+void TriangleMesh::Build() {
+	int triangle_count = GetTriangleCount();
+	std::vector<BoundingBox> triangle_bounds(triangle_count);
+	bounds = BoundingBox();
+	for (int i = 0; i < triangle_count; i++) {
+		for (int corner = 0; corner < 3; corner++) triangle_bounds[i].Extend(Vector3D(positions[indices[3 * i + corner]]));
+		bounds.Extend(triangle_bounds[i]);
+	}
+	bvh.SetLeafSize(max_leaf_size, max_leaf_size);
+	bvh.Build(triangle_bounds);
+	std::vector<BoundingBox>().swap(triangle_bounds);
+
+	// store triangles in leaf order, then leaves refer to triangles directly and the index array is not needed
+	int const *order = bvh.GetPrimitiveIndices();
+	std::vector<uint32_t> sorted_indices(indices.size());
+	std::vector<int32_t> sorted_normal_indices(normal_indices.size());
+	for (int i = 0; i < triangle_count; i++) {
+		for (int corner = 0; corner < 3; corner++) {
+			sorted_indices[3 * i + corner] = indices[3 * order[i] + corner];
+			if (!normal_indices.empty()) sorted_normal_indices[3 * i + corner] = normal_indices[3 * order[i] + corner];
+		}
+	}
+	indices.swap(sorted_indices);
+	normal_indices.swap(sorted_normal_indices);
+	nodes.assign(bvh.GetNodes(), bvh.GetNodes() + bvh.GetNodeCount());
+	bvh.Attach(nodes.data(), int(nodes.size()), nullptr, triangle_count);
+}
+
+size_t TriangleMesh::GetMemoryUsage() const {
+	return sizeof(*this) + positions.capacity() * sizeof(Vector3F) + normals.capacity() * sizeof(Vector3F) +
+		indices.capacity() * sizeof(uint32_t) + normal_indices.capacity() * sizeof(int32_t) + nodes.capacity() * sizeof(BVH::Node);
+}
+
+TriangleMesh::ShearedRay TriangleMesh::ShearRay(Ray3D const &ray) {
+	double direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+	ShearedRay sheared;
+	sheared.kz = std::fabs(direction[0]) > std::fabs(direction[1]) ?
+		(std::fabs(direction[0]) > std::fabs(direction[2]) ? 0 : 2) : (std::fabs(direction[1]) > std::fabs(direction[2]) ? 1 : 2);
+	sheared.kx = (sheared.kz + 1) % 3;
+	sheared.ky = (sheared.kx + 1) % 3;
+	// keep the winding of triangles when the ray goes along -z
+	if (direction[sheared.kz] < 0.0) std::swap(sheared.kx, sheared.ky);
+	sheared.sx = direction[sheared.kx] / direction[sheared.kz];
+	sheared.sy = direction[sheared.ky] / direction[sheared.kz];
+	sheared.sz = 1.0 / direction[sheared.kz];
+	return sheared;
+}
+
+int TriangleMesh::IntersectTriangles(Ray3D const &ray, ShearedRay const &sheared, int first, int count, double &t) const {
+	int res = -1;
+	int kx = sheared.kx, ky = sheared.ky, kz = sheared.kz;
+	for (int triangle = first; triangle < first + count; triangle++) {
+		uint32_t const *corners = &indices[3 * triangle];
+		Vector3F const &p0 = positions[corners[0]], &p1 = positions[corners[1]], &p2 = positions[corners[2]];
+		// vertices relative to the ray origin
+		double a[3] = { p0.x - ray.origin.x, p0.y - ray.origin.y, p0.z - ray.origin.z };
+		double b[3] = { p1.x - ray.origin.x, p1.y - ray.origin.y, p1.z - ray.origin.z };
+		double c[3] = { p2.x - ray.origin.x, p2.y - ray.origin.y, p2.z - ray.origin.z };
+		// shear and scale them so that the ray becomes the +z axis
+		double ax = a[kx] - sheared.sx * a[kz], ay = a[ky] - sheared.sy * a[kz];
+		double bx = b[kx] - sheared.sx * b[kz], by = b[ky] - sheared.sy * b[kz];
+		double cx = c[kx] - sheared.sx * c[kz], cy = c[ky] - sheared.sy * c[kz];
+		// scaled barycentric coordinates, edges are hit by exactly one of the triangles sharing them
+		double u = cx * by - cy * bx;
+		double v = ax * cy - ay * cx;
+		double w = bx * ay - by * ax;
+		if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) continue;
+		double det = u + v + w;
+		if (det == 0.0) continue;
+		double t_scaled = u * sheared.sz * a[kz] + v * sheared.sz * b[kz] + w * sheared.sz * c[kz];
+		double tmp_t = t_scaled / det;
+		// rays leaving a triangle start off its plane (see Object::GetHitError), so every positive distance counts
+		if (tmp_t > 0.0 && tmp_t < t) {
+			t = tmp_t;
+			res = triangle;
+		}
+	}
+	return res;
+}
+
+double TriangleMesh::IntersectNearest(Ray3D const &ray, double t_max, int &primitive) const {
+	ShearedRay sheared = ShearRay(ray);
+	double t;
+	int triangle = bvh.TraverseNearest(ray, t_max, t, [&](int first, int count, Ray3D const &r, double &res_t) {
+		STATS_ADD(Counter::triangle_tests, count);
+		return IntersectTriangles(r, sheared, first, count, res_t);
+	});
+	if (triangle < 0) return 0.0;
+	primitive = triangle;
+	return t;
+}
+
+double TriangleMesh::Intersect(Ray3D const &ray) const {
+	int primitive;
+	return IntersectNearest(ray, std::numeric_limits<double>::max(), primitive);
+}
+
+Vector3D TriangleMesh::GetPrimitiveNormal(Vector3D const &point, int primitive) const {
+	uint32_t const *corners = &indices[3 * primitive];
+	Vector3D p0(positions[corners[0]]), p1(positions[corners[1]]), p2(positions[corners[2]]);
+	Vector3D e1 = p1 - p0, e2 = p2 - p0;
+	if (normal_indices.empty() || normal_indices[3 * primitive] < 0) return (e1 % e2).norm();
+
+	// barycentric coordinates of the point
+	Vector3D e = point - p0;
+	double d11 = e1.dot(e1), d12 = e1.dot(e2), d22 = e2.dot(e2), d1 = e.dot(e1), d2 = e.dot(e2);
+	double denominator = d11 * d22 - d12 * d12;
+	if (denominator == 0.0) return (e1 % e2).norm();
+	double b1 = (d22 * d1 - d12 * d2) / denominator;
+	double b2 = (d11 * d2 - d12 * d1) / denominator;
+	double b0 = 1.0 - b1 - b2;
+	int32_t const *normal_corners = &normal_indices[3 * primitive];
+	return (Vector3D(normals[normal_corners[0]]) * b0 + Vector3D(normals[normal_corners[1]]) * b1 + Vector3D(normals[normal_corners[2]]) * b2).norm();
+}
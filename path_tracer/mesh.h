@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "utils.h"
+#include "objects.h"
+#include "bvh.h"
+
+// Triangle mesh: one object of the scene made of many triangles. Vertex positions and normals live in shared
+// float buffers and a triangle is three 32-bit indices into them, so the cost of a triangle is 12 bytes of
+// indices plus its share of vertices and of the BVH the mesh keeps over its triangles.
+// Rays are tested with the watertight algorithm of Woop, Benthin and Wald: a ray hitting an edge or a vertex
+// shared by several triangles always hits one of them. Primitives of the mesh are its triangles.
+class TriangleMesh : public Object {
+	public:
+		TriangleMesh(Material material_, Vector3D color_, Vector3D emission_) : Object(material_, color_, emission_) {}
+		virtual ~TriangleMesh() {}
+		void Reserve(int vertex_count, int triangle_count);
+		// add a vertex or a normal, returns its index
+		int AddVertex(Vector3F const &position);
+		int AddNormal(Vector3F const &normal);
+		// add a triangle of three vertices, counter-clockwise seen from outside. Normal indices are given
+		// for all three corners or for none (-1), a triangle without normals is shaded flat.
+		void AddTriangle(int v0, int v1, int v2, int n0 = -1, int n1 = -1, int n2 = -1);
+		// build the hierarchy over the triangles, must be called after the last triangle is added.
+		// Triangles are reordered so that every leaf holds consecutive ones.
+		void Build();
+		int GetVertexCount() const { return int(positions.size()); }
+		int GetTriangleCount() const { return int(indices.size() / 3); }
+		// bytes of all buffers of the mesh, the hierarchy included
+		size_t GetMemoryUsage() const;
+
+		virtual double Intersect(Ray3D const &ray) const;
+		virtual double IntersectNearest(Ray3D const &ray, double t_max, int &primitive) const;
+		// a mesh has no single normal, this is the one of the first triangle
+		virtual Vector3D GetNormal(Vector3D const &point) const { return GetPrimitiveNormal(point, 0); }
+		// interpolated vertex normal at a point of a triangle, or the geometric normal for flat triangles
+		virtual Vector3D GetPrimitiveNormal(Vector3D const &point, int primitive) const;
+		virtual BoundingBox GetBounds() const { return bounds; }
+
+	private:
+		// The ray in the coordinates of the watertight test, shared by all triangles tested against it:
+		// axes permuted so that kz is the largest direction component, and the shear to the +z direction
+		struct ShearedRay {
+			int kx, ky, kz;
+			double sx, sy, sz;
+		};
+		static ShearedRay ShearRay(Ray3D const &ray);
+		// nearest of count consecutive triangles starting at first hit closer than t, returns the triangle or -1
+		int IntersectTriangles(Ray3D const &ray, ShearedRay const &sheared, int first, int count, double &t) const;
+
+		std::vector<Vector3F> positions, normals;
+		std::vector<uint32_t> indices; // three vertices per triangle
+		std::vector<int32_t> normal_indices; // three normals per triangle or -1, empty while no triangle has normals
+		// the hierarchy over the reordered triangles, leaf ranges are triangle indices
+		std::vector<BVH::Node> nodes;
+		BVH bvh;
+		BoundingBox bounds;
+};
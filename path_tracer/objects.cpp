@@ -24,24 +24,39 @@ bool Object::IsLight() const {
 	return false;
 }
 
-double SphereObject::Intersect(Ray3D const &ray) const {
-	double eps = 1e-4;
+double Object::IntersectNearest(Ray3D const &ray, double t_max, int &primitive) const {
+	double t = Intersect(ray);
+	primitive = 0;
+	return t < t_max ? t : 0.0;
+}
 
-	// Need to solve t^2*d*d + 2*t*(o-c)*d + (o-c)*(o-c)-r^2 = 0
+double Object::GetHitError(Vector3D const &point, double roundoff) const {
+	return 2.0 * roundoff * MaxMagnitude(point);
+}
+
+double SphereObject::Intersect(Ray3D const &ray) const {
+	// no distance threshold is needed: rays leaving a surface start off it, see Scene::Scatter
+	Vector3D p = center - ray.origin;
 	double a = ray.direction.dot(ray.direction);
-	Vector3D tmp = ray.origin - center;
-	double b = 2.0f * ray.direction.dot(tmp);
-	double c = tmp.dot(tmp) - radius * radius;
-	double det = b * b - 4.0 * a * c;
+	return IntersectSphere(p.x, p.y, p.z, radius * radius, ray.direction.x, ray.direction.y, ray.direction.z, a, 1.0 / a);
+}
+
+Vector3D SphereObject::GetHitPoint(Ray3D const &ray, double t, int /*primitive*/) const {
+	Vector3D offset = ray.origin + ray.direction * t - center;
+	return center + offset * (radius / sqrt(offset.dot(offset)));
+}
 
-	if (det < 0.0f) return 0;
-	double t1 = (-b + sqrt(det)) / (2.0 * a);
-	double t2 = (-b - sqrt(det)) / (2.0 * a); // t2 <= t1 since a > 0
-	if (t2 > eps) return t2;
-	if (t1 > eps) return t1;
-	return 0;
+double SphereObject::GetHitError(Vector3D const &point, double roundoff) const {
+	// c = p*p - r^2 is computed with an error of about roundoff * 2 * r^2, which moves the surface by
+	// roundoff * r, and the center relative to the ray origin is rounded by roundoff * (|center| + |origin|)
+	return roundoff * (2.0 * radius + MaxMagnitude(center) + MaxMagnitude(point));
 }
 
 Vector3D SphereObject::GetNormal(Vector3D const &point) const {
 	return (point - center).norm();
 }
+
+BoundingBox SphereObject::GetBounds() const {
+	Vector3D extent(radius, radius, radius);
+	return BoundingBox(center - extent, center + extent);
+}
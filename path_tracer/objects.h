@@ -30,6 +30,18 @@ class Object {
 		virtual double Intersect(Ray3D const &ray) const = 0;
 		// get a normal at some point of the object
 		virtual Vector3D GetNormal(Vector3D const &point) const = 0;
+		// Objects made of many primitives (triangles of a mesh) tell which one was hit: nearest hit closer
+		// than t_max or 0, primitive receives the index of the hit primitive. Single-primitive objects use 0.
+		virtual double IntersectNearest(Ray3D const &ray, double t_max, int &primitive) const;
+		// normal at a point of a primitive of the object
+		virtual Vector3D GetPrimitiveNormal(Vector3D const &point, int /*primitive*/) const { return GetNormal(point); }
+		// point where ray hit primitive at distance t; objects that can move it back onto their surface do so
+		virtual Vector3D GetHitPoint(Ray3D const &ray, double t, int /*primitive*/) const { return ray.origin + ray.direction * t; }
+		// Bound of the distance of a hit point at point from the surface the intersection with a relative rounding
+		// error of roundoff per operation sees (see GetUnitRoundoff), rays leaving the point are offset beyond it.
+		virtual double GetHitError(Vector3D const &point, double roundoff) const;
+		// get an axis-aligned box enclosing the object
+		virtual BoundingBox GetBounds() const = 0;
 		// get object material
 		virtual Material GetMaterial() const { return material; }
 		virtual bool IsLight() const;
@@ -51,6 +63,14 @@ class SphereObject : public Object {
 		virtual double Intersect(Ray3D const &ray) const;
 		// get a normal at some point of the object
 		virtual Vector3D GetNormal(Vector3D const &point) const;
+		// the hit point projected onto the sphere
+		virtual Vector3D GetHitPoint(Ray3D const &ray, double t, int primitive) const;
+		virtual double GetHitError(Vector3D const &point, double roundoff) const;
+		virtual BoundingBox GetBounds() const;
+		double GetRadius() const { return radius; }
+		Vector3D GetCenter() const { return center; }
+		// the scene keeping the sphere must be told, see Scene::MoveSphere
+		void SetCenter(Vector3D const &center_) { center = center_; }
 		virtual ~SphereObject() {}
 	protected:
 		double radius;
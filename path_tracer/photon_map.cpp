@@ -0,0 +1,206 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#include "photon_map.h"
+
+namespace {
+	// photon paths draw from other streams than the camera samples of the same seed
+	const uint64_t photon_seed_key = 0x70686f746f6e73ULL;
+	// specular bounces a photon path may take before it is dropped
+	const int max_photon_depth = 32;
+	// photons count for surfaces whose normal is within about 25 degrees of theirs
+	const float min_normal_cos = 0.9f;
+}
+
+uint32_t PhotonMap::GetBucket(int64_t x, int64_t y, int64_t z) const {
+	// cells along x follow each other, so the cells of a lookup are runs of consecutive buckets
+	uint64_t h = uint64_t(y) * 0x9e3779b97f4a7c15ULL ^ uint64_t(z) * 0xc2b2ae3d27d4eb4fULL;
+	return (uint32_t(h ^ (h >> 32)) + uint32_t(x)) & hash_mask;
+}
+
+bool PhotonMap::IsTarget(Object const &object) {
+	return object.GetMaterial() == Object::Material::refracture && !object.IsLight() && dynamic_cast<SphereObject const *>(&object) != nullptr;
+}
+
+void PhotonMap::TracePhoton(Scene const &scene, std::vector<SphereObject const *> const &targets, std::vector<double> const &target_cdf,
+	double total_area, double path_weight, Sampler &sampler, std::vector<Photon> &item_photons) const {
+	// a point uniformly on the surfaces of the targets: a sphere in proportion to its area, then a point on it
+	double r0 = sampler.Next1D(), u, v;
+	sampler.Next2D(u, v);
+	int target = int(std::upper_bound(target_cdf.begin(), target_cdf.end(), r0 * total_area) - target_cdf.begin());
+	SphereObject const &sphere = *targets[std::min(target, int(targets.size()) - 1)];
+	double z = 1.0 - 2.0 * u;
+	double s = sqrt(std::max(0.0, 1.0 - z * z));
+	double phi = 2.0 * M_PI * v;
+	Vector3D normal(s * cos(phi), s * sin(phi), z);
+	// a ray coming in along the normal gives the point on the sphere and the offset of rays leaving it
+	double offset, t = 1.0;
+	Vector3D point = scene.GetHitPoint(sphere, 0, Ray3D(sphere.GetCenter() + normal * (sphere.GetRadius() + t), normal * (-1.0)), t, offset);
+
+	// light arriving at the point, the flux through it is L cos / (pdf of the point * pdf of the direction)
+	Vector3D direction;
+	double light_pdf;
+	Vector3D emission = scene.SampleLight(point, normal, offset, sampler, direction, light_pdf);
+	if (emission.x == 0.0 && emission.y == 0.0 && emission.z == 0.0) return;
+	Vector3D power = emission * (normal.dot(direction) * path_weight / light_pdf);
+
+	// follow the photon from the light through the specular bounces to the first diffuse hit
+	Ray3D ray(point + direction * t, direction * (-1.0));
+	Object const *object_ptr = &sphere;
+	int primitive = 0;
+	for (int depth = 1; depth <= max_photon_depth; depth++) {
+		Ray3D next_ray;
+		double pdf;
+		if (!scene.Scatter(*object_ptr, primitive, ray, t, depth, sampler, next_ray, power, pdf)) return;
+		ray = next_ray;
+		object_ptr = scene.IntersectWithNearestObject(ray, t, primitive);
+		if (object_ptr == nullptr || object_ptr->IsLight()) return;
+		if (object_ptr->GetMaterial() != Object::Material::diffuse) continue;
+
+		Vector3D hit_point = scene.GetHitPoint(*object_ptr, primitive, ray, t, offset);
+		Vector3D hit_normal = object_ptr->GetPrimitiveNormal(hit_point, primitive);
+		if (hit_normal.dot(ray.direction) > 0.0) hit_normal = hit_normal * (-1.0);
+		Photon photon;
+		photon.position = Vector3F(hit_point);
+		photon.power = Vector3F(power);
+		photon.normal[0] = int8_t(std::lround(hit_normal.x * 127.0));
+		photon.normal[1] = int8_t(std::lround(hit_normal.y * 127.0));
+		photon.normal[2] = int8_t(std::lround(hit_normal.z * 127.0));
+		photon.padding = 0;
+		item_photons.push_back(photon);
+		return;
+	}
+}
+
+void PhotonMap::Build(Scene const &scene, PhotonMapSettings const &settings, ThreadPool *pool_ptr) {
+	auto start = std::chrono::steady_clock::now();
+	photons.clear();
+	bucket_starts.clear();
+	stats = PhotonMapStats();
+	radius = settings.radius;
+	cell_size = 2.0 * radius;
+	hash_mask = 0;
+
+	std::vector<SphereObject const *> targets;
+	std::vector<double> target_cdf;
+	double total_area = 0.0;
+	for (int i = 0; i < scene.GetObjectCount(); i++) {
+		if (!IsTarget(*scene.GetObject(i))) continue;
+		SphereObject const *sphere_ptr = static_cast<SphereObject const *>(scene.GetObject(i));
+		total_area += 4.0 * M_PI * sphere_ptr->GetRadius() * sphere_ptr->GetRadius();
+		targets.push_back(sphere_ptr);
+		target_cdf.push_back(total_area);
+	}
+	int path_count = settings.photon_count;
+	if (path_count <= 0 || targets.empty() || !(radius > 0.0)) return; // the grid needs cells of a positive size
+
+	// paths of a work item are traced in order into the photons of the item
+	int thread_count = pool_ptr ? pool_ptr->GetThreadCount() : 1;
+	int item_count = std::max(1, std::min(path_count, thread_count * settings.items_per_thread));
+	std::vector<std::vector<Photon>> item_photons(item_count);
+	double path_weight = total_area / path_count; // one over the density of the point and the path count
+	auto trace_item = [&](int item, int) {
+		int begin = int(int64_t(path_count) * item / item_count);
+		int end = int(int64_t(path_count) * (item + 1) / item_count);
+		Sampler sampler(settings.seed ^ photon_seed_key, settings.sampler);
+		for (int path = begin; path < end; path++) {
+			sampler.StartPixelSample(0, uint32_t(path));
+			TracePhoton(scene, targets, target_cdf, total_area, path_weight, sampler, item_photons[item]);
+		}
+	};
+	if (pool_ptr) pool_ptr->Run(item_count, trace_item);
+	else for (int item = 0; item < item_count; item++) trace_item(item, 0);
+	auto traced = std::chrono::steady_clock::now();
+
+	// counting sort of the photons by bucket, a table of at least as many buckets as photons
+	size_t photon_count = 0;
+	for (auto const &item : item_photons) photon_count += item.size();
+	uint32_t bucket_count = 1;
+	while (bucket_count < photon_count && bucket_count < (1u << 31)) bucket_count <<= 1;
+	hash_mask = bucket_count - 1;
+	bucket_starts.assign(size_t(bucket_count) + 1, 0);
+	auto bucket_of = [&](Photon const &photon) {
+		return GetBucket(GetCell(photon.position.x), GetCell(photon.position.y), GetCell(photon.position.z));
+	};
+	for (auto const &item : item_photons) {
+		for (Photon const &photon : item) bucket_starts[bucket_of(photon) + 1]++;
+	}
+	for (uint32_t b = 0; b < bucket_count; b++) bucket_starts[b + 1] += bucket_starts[b];
+	std::vector<uint32_t> cursors(bucket_starts.begin(), bucket_starts.end() - 1);
+	photons.resize(photon_count);
+	for (auto &item : item_photons) {
+		for (Photon const &photon : item) photons[cursors[bucket_of(photon)]++] = photon;
+		std::vector<Photon>().swap(item);
+	}
+	auto built = std::chrono::steady_clock::now();
+
+	stats.paths = path_count;
+	stats.stored = int(photon_count);
+	stats.bytes = photons.capacity() * sizeof(Photon) + bucket_starts.capacity() * sizeof(uint32_t);
+	stats.trace_seconds = std::chrono::duration<double>(traced - start).count();
+	stats.build_seconds = std::chrono::duration<double>(built - traced).count();
+}
+
+Vector3D PhotonMap::EstimateIrradiance(Vector3D const &point, Vector3D const &normal) const {
+	if (photons.empty()) return Vector3D();
+	// the cells the sphere of the estimate touches, 1 or 2 along every axis: one run of buckets per row along x.
+	// Sorted and merged, buckets shared by several cells are read once and the photons of a run are contiguous.
+	int64_t x0 = GetCell(point.x - radius), y0 = GetCell(point.y - radius), z0 = GetCell(point.z - radius);
+	// rounding must not make it 3
+	int64_t x1 = std::min(GetCell(point.x + radius), x0 + 1), y1 = std::min(GetCell(point.y + radius), y0 + 1), z1 = std::min(GetCell(point.z + radius), z0 + 1);
+	uint32_t buckets[8];
+	int bucket_count = 0;
+	for (int64_t z = z0; z <= z1; z++) {
+		for (int64_t y = y0; y <= y1; y++) {
+			for (int64_t x = x0; x <= x1; x++) buckets[bucket_count++] = GetBucket(x, y, z);
+		}
+	}
+	// an insertion sort of the at most 8 buckets
+	for (int i = 1; i < bucket_count; i++) {
+		uint32_t bucket = buckets[i];
+		int j = i;
+		for (; j > 0 && buckets[j - 1] > bucket; j--) buckets[j] = buckets[j - 1];
+		buckets[j] = bucket;
+	}
+	bucket_count = int(std::unique(buckets, buckets + bucket_count) - buckets);
+
+	Vector3F p(point), n(normal);
+	float radius2 = float(radius * radius);
+	float min_normal_dot = min_normal_cos * 127.0f;
+	Vector3F sum;
+	for (int i = 0; i < bucket_count; ) {
+		int run_end = i + 1;
+		while (run_end < bucket_count && buckets[run_end] == buckets[run_end - 1] + 1) run_end++;
+		for (uint32_t j = bucket_starts[buckets[i]]; j < bucket_starts[buckets[run_end - 1] + 1]; j++) {
+			Photon const &photon = photons[j];
+			Vector3F d = photon.position - p;
+			float distance2 = d.dot(d);
+			if (distance2 >= radius2) continue;
+			if (n.x * photon.normal[0] + n.y * photon.normal[1] + n.z * photon.normal[2] < min_normal_dot) continue;
+			sum = sum + photon.power * (1.0f - distance2 / radius2);
+		}
+		i = run_end;
+	}
+	return Vector3D(sum) * (2.0 / (M_PI * radius * radius));
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+
+#include "utils.h"
+#include "scene.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+struct PhotonMapSettings {
+	int photon_count = 0; // photon paths shot from the lights, 0 - no caustic map
+	double radius = 1.0; // radius of the radiance estimate in scene units
+	uint64_t seed = 0;
+	SamplerType sampler = SamplerType::independent;
+	int items_per_thread = 16; // photon paths are split into this many work items per thread
+};
+
+// statistics of the last Build
+struct PhotonMapStats {
+	int paths = 0; // photon paths shot
+	int stored = 0; // photons stored at diffuse hits
+	size_t bytes = 0; // memory of the photons and the grid
+	double trace_seconds = 0.0; // parallel photon tracing
+	double build_seconds = 0.0; // sorting the photons into the grid
+};
+
+// Photon map of the caustics of glass: light that leaves a light, passes a glass sphere and then any number of
+// mirror and glass bounces and reaches a diffuse surface. Path tracing finds these paths only when a diffuse
+// bounce happens to hit a light through the glass, so small lights seen through glass stay noisy for thousands
+// of samples, while photons shot at the glass find them in a pre-pass.
+// Every photon path starts at a point picked uniformly on the surfaces of the glass spheres, takes the light
+// arriving there from a light sampled like next-event estimation and follows it through the specular bounces of
+// Scene::Scatter to the first diffuse hit, where the photon is stored. Paths are traced in parallel on a pool,
+// path i drawing from the sampler stream (seed, i), and the photons of every work item are concatenated in item
+// order, so the map depends only on the settings, not on the thread count.
+// Photons live in one array sorted by the cells of a hash grid whose cells are twice the estimate radius. Cells
+// along x go to consecutive buckets, so the at most 8 cells of a lookup are read as up to 4 contiguous runs of
+// 28-byte photons.
+class PhotonMap {
+	public:
+		PhotonMap() : radius(1.0), cell_size(2.0), hash_mask(0) {}
+		// trace the photons of the scene, which must be built; pool_ptr nullptr traces on the calling thread.
+		// The map stays empty unless the radius is positive.
+		void Build(Scene const &scene, PhotonMapSettings const &settings, ThreadPool *pool_ptr = nullptr);
+		// Irradiance at point of a surface with the given normal (facing the side the light comes from) estimated
+		// from the photons within the radius on the same side of a surface of a similar orientation, weighted
+		// by the Epanechnikov kernel 2 / (pi r^2) * (1 - d^2 / r^2)
+		Vector3D EstimateIrradiance(Vector3D const &point, Vector3D const &normal) const;
+		// whether photons are shot at the object: glass spheres that are no lights. Light reaching a diffuse hit
+		// straight from the glass of such an object is in the map.
+		static bool IsTarget(Object const &object);
+		int GetPhotonCount() const { return int(photons.size()); }
+		double GetRadius() const { return radius; }
+		PhotonMapStats const &GetStats() const { return stats; }
+
+	private:
+		struct Photon {
+			Vector3F position;
+			Vector3F power;
+			int8_t normal[3]; // surface normal on the lit side scaled to 127
+			uint8_t padding;
+		};
+
+		// trace one photon path with the sampler started for it, a photon stored at its diffuse hit goes to item_photons
+		void TracePhoton(Scene const &scene, std::vector<SphereObject const *> const &targets, std::vector<double> const &target_cdf,
+			double total_area, double path_weight, Sampler &sampler, std::vector<Photon> &item_photons) const;
+		// grid cell of a position and its bucket in the hash table
+		int64_t GetCell(double coordinate) const { return int64_t(std::floor(coordinate / cell_size)); }
+		uint32_t GetBucket(int64_t x, int64_t y, int64_t z) const;
+
+		std::vector<Photon> photons; // sorted by bucket
+		std::vector<uint32_t> bucket_starts; // photons of bucket b are [bucket_starts[b], bucket_starts[b + 1])
+		double radius;
+		double cell_size;
+		uint32_t hash_mask;
+		PhotonMapStats stats;
+};
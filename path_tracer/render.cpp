@@ -0,0 +1,416 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+#include "render.h"
+#include "checkpoint.h"
+#include "image_writer.h"
+#include "stats.h"
+
+inline double clamp(double x) { return x < 0.0 ? 0.0 : x > 1.0 ? 1.0 : x; }
+
+namespace {
+	// per-thread state of a render
+	struct TileContext {
+		TileContext(Scene const &scene, Camera const &camera) : wavefront(scene, camera) {}
+		WavefrontIntegrator wavefront;
+		std::vector<Vector3D> sample_radiance;
+		std::vector<Vector3D> pixels; // one resolved row of a tile
+	};
+
+	// pixel of the radiance of its 4 * samples_per_subpixel samples: the samples of every subpixel are averaged
+	// and, with clamp_subpixels, clamped before the subpixels are averaged
+	inline Vector3D ResolvePixel(Vector3D const *radiance, int samples_per_subpixel, bool clamp_subpixels) {
+		Vector3D pixel;
+		for (int sub = 0; sub < 4; sub++) {
+			Vector3D r;
+			for (int s = 0; s < samples_per_subpixel; s++) r = r + radiance[sub * samples_per_subpixel + s] * (1. / samples_per_subpixel);
+			if (clamp_subpixels) r = Vector3D(clamp(r.x), clamp(r.y), clamp(r.z));
+			pixel = pixel + r * 0.25;
+		}
+		return pixel;
+	}
+
+	// radiance of samples [first_sample, first_sample + sample_count) of every pixel of the tile,
+	// stored to context.sample_radiance in the layout of WavefrontIntegrator::Render
+	void TraceSamples(Scene const &scene, Camera const &camera, RenderSettings const &settings, Tile const &tile,
+		int first_sample, int sample_count, int samples_per_subpixel, TileContext &context) {
+		STATS_TILE_TIMER(tile);
+		int tile_width = tile.x1 - tile.x0;
+		STATS_ADD(Counter::samples, tile_width * (tile.y1 - tile.y0) * sample_count);
+		context.sample_radiance.resize(tile_width * (tile.y1 - tile.y0) * sample_count);
+		if (settings.integrator == IntegratorType::wavefront) {
+			context.wavefront.Render(tile, first_sample, sample_count, samples_per_subpixel, settings.seed, settings.sampler, context.sample_radiance.data());
+			return;
+		}
+
+		Sampler sampler(settings.seed, settings.sampler);
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++) {
+				Vector3D *radiance = &context.sample_radiance[((y - tile.y0) * tile_width + x - tile.x0) * sample_count];
+				for (int k = 0; k < sample_count; k++) {
+					// every sample of every pixel owns an independent stream
+					int sample = first_sample + k;
+					int subpixel = SubpixelOfSample(sample, samples_per_subpixel);
+					sampler.StartPixelSample(uint32_t(y * camera.GetWidth() + x), uint32_t(sample), uint32_t(subpixel),
+						uint32_t(SubpixelSampleIndex(sample, samples_per_subpixel)));
+					Ray3D ray = camera.GenerateRay(x, y, subpixel % 2, subpixel / 2, sampler);
+					radiance[k] = settings.integrator == IntegratorType::recursive ?
+						scene.ComputeRadiance(ray, 0, sampler) : scene.TracePath(ray, sampler);
+				}
+			}
+		}
+	}
+
+	// first hits of the camera rays of every sample of the tile and the variance of the clamped samples,
+	// the samples are those TraceSamples just left in the context
+	void GatherAovs(Scene const &scene, Camera const &camera, RenderSettings const &settings, Tile const &tile,
+		TileContext const &context, AovBuffers &aovs) {
+		int samples_per_subpixel = settings.samples_per_subpixel;
+		int sample_count = 4 * samples_per_subpixel;
+		Sampler sampler(settings.seed, settings.sampler);
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++) {
+				Vector3D albedo, normal;
+				double depth = 0.0, luminance_sum = 0.0, luminance_sum2 = 0.0;
+				Vector3D const *radiance = &context.sample_radiance[((y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0) * sample_count];
+				for (int sample = 0; sample < sample_count; sample++) {
+					int subpixel = SubpixelOfSample(sample, samples_per_subpixel);
+					sampler.StartPixelSample(uint32_t(y * camera.GetWidth() + x), uint32_t(sample), uint32_t(subpixel),
+						uint32_t(SubpixelSampleIndex(sample, samples_per_subpixel)));
+					Ray3D ray = camera.GenerateRay(x, y, subpixel % 2, subpixel / 2, sampler);
+					double t;
+					int primitive;
+					Object const *object_ptr = scene.IntersectWithNearestObject(ray, t, primitive);
+					if (object_ptr) {
+						Vector3D n = object_ptr->GetPrimitiveNormal(ray.origin + ray.direction * t, primitive);
+						normal = normal + (n.dot(ray.direction) < 0.0 ? n : n * -1.0);
+						albedo = albedo + (object_ptr->IsLight() ? Vector3D(1.0, 1.0, 1.0) : object_ptr->GetColor());
+						depth += t;
+					}
+					double luminance = Film::Luminance(Vector3D(clamp(radiance[sample].x), clamp(radiance[sample].y), clamp(radiance[sample].z)));
+					luminance_sum += luminance;
+					luminance_sum2 += luminance * luminance;
+				}
+				double scale = 1.0 / sample_count;
+				int i = (camera.GetHeight() - y - 1) * camera.GetWidth() + x;
+				aovs.albedo[i] = Vector3F(albedo * scale);
+				aovs.normal[i] = Vector3F(normal * scale);
+				aovs.depth[i] = float(depth * scale);
+				double mean = luminance_sum * scale;
+				double sample_variance = sample_count > 1 ? std::max(0.0, luminance_sum2 - sample_count * mean * mean) / (sample_count - 1) : 1.0;
+				aovs.variance[i] = float(sample_variance * scale);
+			}
+		}
+	}
+
+	// pool and per-thread contexts of one render call
+	class TileJob {
+		public:
+			// without all_tiles the caller makes its own tiles, a streamed render those of one window at a time
+			TileJob(Scene const &scene, Camera const &camera, RenderSettings const &settings, RenderProgress *progress_ptr, ThreadPool *pool_ptr,
+				bool all_tiles = true) :
+				tiles(!all_tiles ? std::vector<Tile>() : settings.tile_size > 0 ? MakeTiles(camera.GetWidth(), camera.GetHeight(), settings.tile_size) :
+					MakeScanlineTiles(camera.GetWidth(), camera.GetHeight())),
+				pool(pool_ptr), progress(progress_ptr ? *progress_ptr : own_progress) {
+				if (pool == nullptr) {
+					own_pool_ptr.reset(new ThreadPool(settings.thread_count));
+					pool = own_pool_ptr.get();
+				}
+				for (int i = 0; i < pool->GetThreadCount(); i++) contexts.push_back(std::unique_ptr<TileContext>(new TileContext(scene, camera)));
+			}
+
+			std::vector<Tile> tiles;
+			ThreadPool *pool;
+			RenderProgress own_progress;
+			RenderProgress &progress;
+			std::vector<std::unique_ptr<TileContext>> contexts;
+
+		private:
+			std::unique_ptr<ThreadPool> own_pool_ptr;
+	};
+
+	void ReportProgress(RenderSettings const &settings, RenderProgress const &progress, char const *end) {
+		if (!settings.report_progress) return;
+		fprintf(stderr, "\rRendering (%d spp) %5.2f%%%s", settings.samples_per_subpixel * 4,
+			100. * progress.tiles_done / std::max(1, progress.tile_count), end);
+	}
+}
+
+bool RenderImage(Scene const &scene, Camera const &camera, RenderSettings const &settings, Vector3D *image,
+	RenderProgress *progress_ptr, ThreadPool *pool_ptr, AovBuffers *aovs_ptr) {
+	STATS_TIMER("render", "phase");
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	int samples_per_subpixel = settings.samples_per_subpixel;
+	TileJob job(scene, camera, settings, progress_ptr, pool_ptr);
+	RenderProgress &progress = job.progress;
+	progress.tiles_done = 0;
+	progress.tile_count = int(job.tiles.size());
+	for (size_t i = 0; i < size_t(width) * height; i++) image[i] = Vector3D();
+	if (aovs_ptr) aovs_ptr->Resize(width, height);
+
+	job.pool->Start(int(job.tiles.size()), [&](int tile_index, int thread_index) {
+		if (progress.cancel) return;
+		Tile const &tile = job.tiles[tile_index];
+		TileContext &context = *job.contexts[thread_index];
+		TraceSamples(scene, camera, settings, tile, 0, 4 * samples_per_subpixel, samples_per_subpixel, context);
+
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++) {
+				size_t i = size_t(height - y - 1) * width + x;
+				image[i] = ResolvePixel(&context.sample_radiance[((y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0) * 4 * samples_per_subpixel],
+					samples_per_subpixel, settings.clamp_subpixels);
+			}
+		}
+		if (aovs_ptr) GatherAovs(scene, camera, settings, tile, context, *aovs_ptr);
+		progress.tiles_done++;
+	});
+
+	// workers only bump the counter, the calling thread does all the printing
+	while (!job.pool->Wait(0.2)) ReportProgress(settings, progress, "");
+	ReportProgress(settings, progress, "\n");
+	return progress.tiles_done == progress.tile_count;
+}
+
+bool RenderImageStreamed(Scene const &scene, Camera const &camera, RenderSettings const &settings, ImageStream &stream,
+	RenderProgress *progress_ptr, ThreadPool *pool_ptr) {
+	STATS_TIMER("render", "phase");
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	int samples_per_subpixel = settings.samples_per_subpixel;
+	TileJob job(scene, camera, settings, progress_ptr, pool_ptr, false);
+	RenderProgress &progress = job.progress;
+
+	// a band is a row of tiles, bands go from the bottom of the picture up like the rows of the file;
+	// a window has enough bands for 8 tiles per thread
+	int band_height = settings.tile_size > 0 ? settings.tile_size : 1;
+	int tile_width = settings.tile_size > 0 ? settings.tile_size : width;
+	int band_tiles = (width + tile_width - 1) / tile_width;
+	int band_count = (height + band_height - 1) / band_height;
+	int window_rows = std::max(1, (8 * job.pool->GetThreadCount() + band_tiles - 1) / band_tiles) * band_height;
+	int window_count = (height + window_rows - 1) / window_rows;
+	progress.tiles_done = 0;
+	progress.tile_count = band_tiles * band_count;
+
+	// encoded rows and tiles of the window being rendered and of the one being written
+	size_t row_size = stream.GetRowSize();
+	std::vector<char> window_data[2];
+	std::vector<Tile> window_tiles[2];
+	int window_row_counts[2] = { 0, 0 };
+	auto start_window = [&](int window) {
+		int y0 = window * window_rows, y1 = std::min(height, y0 + window_rows);
+		std::vector<char> &data = window_data[window % 2];
+		std::vector<Tile> &tiles = window_tiles[window % 2];
+		data.assign(row_size * (y1 - y0), 0); // tiles skipped after cancellation stay black
+		tiles.clear();
+		for (int y = y0; y < y1; y += band_height) {
+			for (int x = 0; x < width; x += tile_width) tiles.push_back(Tile{ x, y, std::min(width, x + tile_width), std::min(y1, y + band_height) });
+		}
+		window_row_counts[window % 2] = y1 - y0;
+		char *rows = data.data();
+		Tile const *tile_ptr = tiles.data();
+		job.pool->Start(int(tiles.size()), [&, rows, tile_ptr, y0](int tile_index, int thread_index) {
+			if (progress.cancel) return;
+			Tile const &tile = tile_ptr[tile_index];
+			TileContext &context = *job.contexts[thread_index];
+			TraceSamples(scene, camera, settings, tile, 0, 4 * samples_per_subpixel, samples_per_subpixel, context);
+			int count = tile.x1 - tile.x0;
+			context.pixels.resize(count);
+			for (int y = tile.y0; y < tile.y1; y++) {
+				for (int x = tile.x0; x < tile.x1; x++) {
+					context.pixels[x - tile.x0] = ResolvePixel(&context.sample_radiance[((y - tile.y0) * count + x - tile.x0) * 4 * samples_per_subpixel],
+						samples_per_subpixel, settings.clamp_subpixels);
+				}
+				stream.EncodeRow(context.pixels.data(), tile.x0, count, rows + size_t(y - y0) * row_size);
+			}
+			progress.tiles_done++;
+		});
+	};
+
+	// the workers render the next window while the calling thread writes the last one
+	bool written = true;
+	if (window_count > 0) start_window(0);
+	for (int window = 0; window < window_count; window++) {
+		while (!job.pool->Wait(0.2)) ReportProgress(settings, progress, "");
+		if (window + 1 < window_count) start_window(window + 1);
+		if (written && !stream.WriteRows(window_data[window % 2].data(), window_row_counts[window % 2])) {
+			// nothing more can be written, skip the remaining tiles
+			written = false;
+			progress.cancel = true;
+		}
+	}
+	ReportProgress(settings, progress, "\n");
+	return written && progress.tiles_done == progress.tile_count;
+}
+
+bool RenderProgressive(Scene const &scene, Camera const &camera, RenderSettings const &settings, Film &film,
+	std::function<void(Film const &, int)> const &snapshot, RenderProgress *progress_ptr, ThreadPool *pool_ptr,
+	Checkpoint *checkpoint_ptr) {
+	int pass_count = 4 * settings.samples_per_subpixel;
+	TileJob job(scene, camera, settings, progress_ptr, pool_ptr);
+	RenderProgress &progress = job.progress;
+	int tile_count = int(job.tiles.size());
+
+	// a film of an earlier render continues with the pass of its least sampled pixels
+	uint32_t first_pass = std::numeric_limits<uint32_t>::max();
+	for (int y = 0; y < film.GetHeight(); y++) {
+		for (int x = 0; x < film.GetWidth(); x++) first_pass = std::min(first_pass, film.GetSampleCount(x, y));
+	}
+	int passes_done = int(std::min(first_pass, uint32_t(pass_count)));
+	int resumed_passes = passes_done;
+	progress.tiles_done = 0;
+	progress.tile_count = tile_count * (pass_count - resumed_passes);
+
+	auto start = std::chrono::steady_clock::now();
+	auto last_snapshot = start;
+	std::atomic<bool> out_of_time(false);
+	for (int pass = passes_done; pass < pass_count && !progress.cancel && !out_of_time; pass++) {
+		STATS_TIMER("pass", "phase");
+		bool checkpoint_pass = checkpoint_ptr && checkpoint_ptr->BeginPass();
+		job.pool->Start(tile_count, [&](int tile_index, int thread_index) {
+			if (progress.cancel || out_of_time) return;
+			Tile const &tile = job.tiles[tile_index];
+			// pixels of a resumed render may have their sample of this pass already
+			bool tile_done = true;
+			for (int y = tile.y0; y < tile.y1 && tile_done; y++) {
+				for (int x = tile.x0; x < tile.x1; x++) tile_done = tile_done && film.GetSampleCount(x, y) > uint32_t(pass);
+			}
+			if (!tile_done) {
+				TileContext &context = *job.contexts[thread_index];
+				TraceSamples(scene, camera, settings, tile, pass, 1, 0, context);
+				for (int y = tile.y0; y < tile.y1; y++) {
+					for (int x = tile.x0; x < tile.x1; x++) {
+						if (film.GetSampleCount(x, y) > uint32_t(pass)) continue;
+						film.AddSample(x, y, context.sample_radiance[(y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0]);
+					}
+				}
+			}
+			if (checkpoint_pass) checkpoint_ptr->SaveTile(film, tile);
+			progress.tiles_done++;
+		});
+
+		// the previous pass is complete, publish it while the workers are busy with this one
+		auto now = std::chrono::steady_clock::now();
+		if (snapshot && passes_done > 0 && std::chrono::duration<double>(now - last_snapshot).count() >= settings.snapshot_interval_seconds) {
+			STATS_TIMER("snapshot", "output");
+			snapshot(film, passes_done);
+			last_snapshot = now;
+		}
+
+		do {
+			ReportProgress(settings, progress, "");
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (settings.time_budget_seconds > 0.0 && seconds > settings.time_budget_seconds) out_of_time = true;
+		} while (!job.pool->Wait(0.05));
+		if (progress.tiles_done < (pass + 1 - resumed_passes) * tile_count) break;
+		passes_done++;
+		if (checkpoint_pass) checkpoint_ptr->Commit(passes_done);
+	}
+	// the workers are idle, the film may end in the middle of a pass
+	if (checkpoint_ptr) checkpoint_ptr->SaveFilm(film, passes_done);
+	ReportProgress(settings, progress, "\n");
+	return passes_done >= pass_count;
+}
+
+void RenderTileSums(Scene const &scene, Camera const &camera, RenderSettings const &settings, Tile const &tile,
+	int first_sample, int sample_count, float *sums, uint32_t *counts, ThreadPool &pool) {
+	int tile_width = tile.x1 - tile.x0;
+	std::vector<std::unique_ptr<TileContext>> contexts;
+	for (int i = 0; i < pool.GetThreadCount(); i++) contexts.push_back(std::unique_ptr<TileContext>(new TileContext(scene, camera)));
+	pool.Run(tile.y1 - tile.y0, [&](int row, int thread_index) {
+		Tile row_tile = { tile.x0, tile.y0 + row, tile.x1, tile.y0 + row + 1 };
+		TileContext &context = *contexts[thread_index];
+		TraceSamples(scene, camera, settings, row_tile, first_sample, sample_count, 0, context);
+		for (int x = 0; x < tile_width; x++) {
+			int i = row * tile_width + x;
+			Vector3D const *radiance = &context.sample_radiance[x * sample_count];
+			for (int k = 0; k < sample_count; k++) {
+				sums[3 * i] += float(radiance[k].x);
+				sums[3 * i + 1] += float(radiance[k].y);
+				sums[3 * i + 2] += float(radiance[k].z);
+			}
+			counts[i] += uint32_t(sample_count);
+		}
+	});
+}
+
+namespace {
+	double GetTileError(Film const &film, Tile const &tile) {
+		double error = 0.0;
+		for (int y = tile.y0; y < tile.y1; y++) {
+			for (int x = tile.x0; x < tile.x1; x++) error += std::min(film.GetRelativeError(x, y), 1e3);
+		}
+		return error / ((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	}
+}
+
+bool RenderAdaptive(Scene const &scene, Camera const &camera, RenderSettings const &settings, Film &film,
+	RenderProgress *progress_ptr, ThreadPool *pool_ptr) {
+	int round_samples = 4 * settings.samples_per_subpixel;
+	TileJob job(scene, camera, settings, progress_ptr, pool_ptr);
+	RenderProgress &progress = job.progress;
+
+	// every round samples the active tiles and then keeps those that are still too noisy
+	std::vector<int> active_tiles(job.tiles.size());
+	for (size_t i = 0; i < job.tiles.size(); i++) active_tiles[i] = int(i);
+	for (int round = 0; !active_tiles.empty() && !progress.cancel; round++) {
+		STATS_TIMER("round", "phase");
+		progress.tiles_done = 0;
+		progress.tile_count = int(active_tiles.size());
+		job.pool->Start(int(active_tiles.size()), [&](int item, int thread_index) {
+			if (progress.cancel) return;
+			Tile const &tile = job.tiles[active_tiles[item]];
+			TileContext &context = *job.contexts[thread_index];
+			int first_sample = int(film.GetSampleCount(tile.x0, tile.y0));
+			int sample_count = std::min(round_samples, settings.max_samples_per_pixel - first_sample);
+			if (sample_count <= 0) {
+				// the tile already has all the samples it may get
+				progress.tiles_done++;
+				return;
+			}
+			TraceSamples(scene, camera, settings, tile, first_sample, sample_count, 0, context);
+			for (int y = tile.y0; y < tile.y1; y++) {
+				for (int x = tile.x0; x < tile.x1; x++) {
+					Vector3D const *radiance = &context.sample_radiance[((y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0) * sample_count];
+					for (int k = 0; k < sample_count; k++) film.AddSample(x, y, radiance[k]);
+				}
+			}
+			progress.tiles_done++;
+		});
+		while (!job.pool->Wait(0.2)) {
+			if (settings.report_progress) fprintf(stderr, "\rAdaptive round %d: %d tiles %5.2f%%", round, progress.tile_count, 100. * progress.tiles_done / progress.tile_count);
+		}
+
+		std::vector<int> next_active_tiles;
+		for (int tile_index : active_tiles) {
+			Tile const &tile = job.tiles[tile_index];
+			if (int(film.GetSampleCount(tile.x0, tile.y0)) >= settings.max_samples_per_pixel) continue;
+			if (GetTileError(film, tile) > settings.adaptive_threshold) next_active_tiles.push_back(tile_index);
+		}
+		active_tiles.swap(next_active_tiles);
+	}
+	if (settings.report_progress) fprintf(stderr, "\n");
+	return !progress.cancel;
+}
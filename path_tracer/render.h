@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#include "utils.h"
+#include "scene.h"
+#include "camera.h"
+#include "integrator.h"
+#include "scheduler.h"
+#include "film.h"
+#include "denoiser.h"
+
+class Checkpoint;
+class ImageStream;
+
+struct RenderSettings {
+	int samples_per_subpixel = 1; // every pixel is split into 2x2 subpixels
+	uint64_t seed = 0;
+	SamplerType sampler = SamplerType::independent;
+	IntegratorType integrator = IntegratorType::iterative;
+	int thread_count = 0; // 0 - one thread per hardware thread
+	int tile_size = 16; // 0 - schedule whole scanlines instead of square tiles
+	// fixed-spp renders clamp the mean of every subpixel to [0, 1] before averaging them, as 8-bit output
+	// always did; off for HDR output (PFM), which then gets the plain mean radiance like the Film does
+	bool clamp_subpixels = true;
+	bool report_progress = true; // print progress to stderr
+	// progressive rendering: passes of 1 spp each until 4 * samples_per_subpixel spp or the time budget
+	bool progressive = false;
+	double time_budget_seconds = 0.0; // 0 - no limit
+	double snapshot_interval_seconds = 0.0; // minimal time between snapshots, 0 - after every pass
+	// adaptive sampling: 4 * samples_per_subpixel spp everywhere, then rounds of as many more samples for
+	// tiles whose mean relative error is above the threshold, up to max_samples_per_pixel
+	bool adaptive = false;
+	int max_samples_per_pixel = 1024;
+	double adaptive_threshold = 0.05;
+};
+
+// State of a render shared with other threads: the number of finished tiles can be polled at any time,
+// setting cancel makes workers skip the tiles they have not started yet.
+struct RenderProgress {
+	std::atomic<int> tiles_done;
+	std::atomic<bool> cancel;
+	int tile_count;
+	RenderProgress() : tiles_done(0), cancel(false), tile_count(0) {}
+};
+
+// Render the whole image on the tiles of a work-stealing thread pool, the pool of the call is used when
+// pool_ptr is nullptr. The result depends only on the settings: every sample draws its random numbers from
+// a stream seeded by (seed, pixel, sample index), so neither the tile layout nor the thread that renders a
+// tile changes it. Returns false if the render was cancelled, tiles that were not rendered stay black.
+// With aovs_ptr the camera ray of every sample is traced once more to its first hit for the denoiser's
+// auxiliary buffers, which are resized to the frame; the image itself does not change.
+bool RenderImage(Scene const &scene, Camera const &camera, RenderSettings const &settings, Vector3D *image,
+	RenderProgress *progress_ptr = nullptr, ThreadPool *pool_ptr = nullptr, AovBuffers *aovs_ptr = nullptr);
+
+// Render the image of RenderImage without holding it in memory, for frames too large for that. Rows of tiles
+// are rendered from the bottom of the picture up, the order of rows in the files, tone-mapped and encoded by
+// the workers and appended to the opened stream. Workers fill one window of rows, at least 8 tiles per thread,
+// while the calling thread writes the previous one, so memory depends on the width, tile size and thread count
+// but not on the height. The file equals the one ImageWriter writes of the RenderImage result. Returns false if
+// the render was cancelled (the rest of the image is written black) or the stream cannot be written.
+bool RenderImageStreamed(Scene const &scene, Camera const &camera, RenderSettings const &settings, ImageStream &stream,
+	RenderProgress *progress_ptr = nullptr, ThreadPool *pool_ptr = nullptr);
+
+// Progressive render into the accumulation buffer, one pass of 1 spp per pixel after another, cycling through
+// the 2x2 subpixels. Stops after 4 * samples_per_subpixel passes, when the time budget is over (in the middle
+// of a pass, the film keeps per-pixel sample counts) or on cancellation; returns true if all passes finished.
+// snapshot(film, passes_done) is called between passes on the calling thread while the workers already render
+// the next pass. The film is not cleared, so a render can continue an earlier one: every pixel continues with
+// its next sample, passes start at the smallest sample count of the film. The result equals that of one
+// render of all passes. With checkpoint_ptr the film is checkpointed at its intervals and when the render stops.
+bool RenderProgressive(Scene const &scene, Camera const &camera, RenderSettings const &settings, Film &film,
+	std::function<void(Film const &, int)> const &snapshot, RenderProgress *progress_ptr = nullptr, ThreadPool *pool_ptr = nullptr,
+	Checkpoint *checkpoint_ptr = nullptr);
+
+// Render samples [first_sample, first_sample + sample_count) of every pixel of the tile on the pool, the
+// rows of the tile being its work items. Samples cycle through the subpixels like progressive passes and are
+// added to the float sums (3 per pixel) and counts of the tile, pixel (x, y) at (y - tile.y0) * tile width +
+// x - tile.x0, in sample order with the operations of Film::AddSample. A tile rendered with all its samples
+// at once therefore holds exactly the sums a progressive render of the same seed leaves in the film.
+void RenderTileSums(Scene const &scene, Camera const &camera, RenderSettings const &settings, Tile const &tile,
+	int first_sample, int sample_count, float *sums, uint32_t *counts, ThreadPool &pool);
+
+// Adaptive render into the accumulation buffer, see RenderSettings::adaptive. Samples keep cycling through
+// the subpixels like progressive passes, and which tiles get more samples depends only on the samples
+// already taken, so the result does not depend on the thread count. Returns false if cancelled.
+bool RenderAdaptive(Scene const &scene, Camera const &camera, RenderSettings const &settings, Film &film,
+	RenderProgress *progress_ptr = nullptr, ThreadPool *pool_ptr = nullptr);
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include "sampler.h"
+
+namespace {
+	// bases of the Halton dimensions
+	const uint32_t halton_primes[Sampler::sequence_dimensions] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+	uint32_t ReverseBits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	// random permutation of 32-bit numbers where every bit of the result depends on the seed and on the bits below
+	// it only (Laine-Karras permutation); on reversed bits it is a hash-based Owen scrambling
+	uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	// second dimension of the Sobol sequence with reversed bits (the first one is the reversed index): the XOR
+	// of the direction numbers of the set bits of the index, looked up for one byte of it at a time
+	struct SobolTables {
+		uint32_t bytes[4][256];
+		SobolTables() {
+			uint32_t directions[32];
+			directions[0] = 1u << 31;
+			for (int i = 1; i < 32; i++) directions[i] = directions[i - 1] ^ (directions[i - 1] >> 1);
+			for (int byte = 0; byte < 4; byte++) {
+				for (int value = 0; value < 256; value++) {
+					uint32_t result = 0;
+					for (int bit = 0; bit < 8; bit++) {
+						if (value & (1 << bit)) result ^= ReverseBits(directions[byte * 8 + bit]);
+					}
+					bytes[byte][value] = result;
+				}
+			}
+		}
+	};
+	const SobolTables sobol_tables;
+
+	uint32_t ReversedSobolSecondDimension(uint32_t index) {
+		return sobol_tables.bytes[0][index & 0xff] ^ sobol_tables.bytes[1][(index >> 8) & 0xff] ^
+			sobol_tables.bytes[2][(index >> 16) & 0xff] ^ sobol_tables.bytes[3][index >> 24];
+	}
+
+	// Owen-scrambled point of a 2D Sobol pattern whose index is shuffled by Owen scrambling too (Burley 2020),
+	// all scrambles seeded by the hash; v is skipped for nullptr
+	void ShuffledSobol(uint32_t reversed_index, uint64_t hash, double &u, double *v_ptr) {
+		uint32_t index = ReverseBits(LaineKarrasPermutation(reversed_index, uint32_t(hash)));
+		u = ReverseBits(LaineKarrasPermutation(index, uint32_t(hash >> 32))) * (1.0 / 4294967296.0);
+		if (v_ptr) *v_ptr = ReverseBits(LaineKarrasPermutation(ReversedSobolSecondDimension(index), uint32_t((hash * 0x9e3779b97f4a7c15ULL) >> 32))) * (1.0 / 4294967296.0);
+	}
+
+	// Radical inverse of index in the base with nested random digit scrambling: every digit is shifted by an
+	// amount that depends on the hash and on all more significant digits of the result. The digits are
+	// scrambled down to cells of 2^-16, so the first 65536 points stay stratified like the unscrambled ones;
+	// the scrambled digits below are independent uniform numbers, one uniform offset in the cell.
+	double ScrambledRadicalInverse(uint32_t base, uint32_t index, uint64_t hash) {
+		double inv_base = 1.0 / base, inv_base_m = 1.0;
+		uint64_t reversed = 0;
+		for (uint32_t digit_count = 0; inv_base_m > 1.0 / 65536.0; digit_count++) {
+			uint32_t next = index / base;
+			uint32_t digit = index - next * base;
+			uint32_t shift = uint32_t((MixBits(hash ^ (reversed << 6) ^ digit_count) >> 32) * base >> 32);
+			digit += shift;
+			reversed = reversed * base + (digit >= base ? digit - base : digit);
+			inv_base_m *= inv_base;
+			index = next;
+		}
+		double offset = (MixBits(hash ^ (reversed << 6) ^ 63) >> 11) * (1.0 / 9007199254740992.0);
+		return std::min((reversed + offset) * inv_base_m, 1.0 - 1.0 / 9007199254740992.0);
+	}
+}
+
+char const *GetSamplerName(SamplerType type) {
+	switch (type) {
+		case SamplerType::sobol: return "sobol";
+		case SamplerType::halton: return "halton";
+		default: return "independent";
+	}
+}
+
+bool ParseSamplerType(std::string const &name, SamplerType &type) {
+	for (SamplerType candidate : { SamplerType::independent, SamplerType::sobol, SamplerType::halton }) {
+		if (name == GetSamplerName(candidate)) {
+			type = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint64_t MixBits(uint64_t key) {
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+void Sampler::StartPixelSample(uint32_t pixel, uint32_t sample_index, uint32_t subpixel, uint32_t subpixel_index) {
+	uint64_t key = MixBits(seed ^ MixBits((uint64_t(pixel) << 32) | sample_index));
+
+	// standard PCG32 seeding: the key selects both the starting state and the stream
+	state = 0;
+	inc = (MixBits(key + 0x9e3779b97f4a7c15ULL) << 1) | 1;
+	NextUInt();
+	state += key;
+	NextUInt();
+
+	// the samples of a subpixel share the scrambling of the position in the subpixel, all samples of the pixel
+	// that of the other dimensions
+	subpixel_key = MixBits(seed ^ MixBits(((uint64_t(pixel) << 2) | subpixel) + 0x632be59bd9b4e019ULL));
+	pixel_key = MixBits(seed ^ MixBits(uint64_t(pixel) + 0xd1b54a32d192ed03ULL));
+	pixel_sample_index = sample_index;
+	subpixel_sample_index = subpixel_index;
+	dimension = 0;
+}
+
+double Sampler::NextSequence1D() {
+	uint64_t hash = MixBits((dimension < 2 ? subpixel_key : pixel_key) ^ dimension);
+	if (type == SamplerType::halton) {
+		uint32_t index = dimension < 2 ? subpixel_sample_index : pixel_sample_index;
+		return ScrambledRadicalInverse(halton_primes[dimension++], index, hash);
+	}
+	// every dimension is a pattern of its own with a differently shuffled index, so that they are not correlated
+	double u;
+	ShuffledSobol(ReverseBits(dimension < 2 ? subpixel_sample_index : pixel_sample_index), hash, u, nullptr);
+	dimension++;
+	return u;
+}
+
+void Sampler::NextSequence2D(double &u, double &v) {
+	if (type == SamplerType::halton) {
+		u = NextSequence1D();
+		v = Next1D();
+		return;
+	}
+	uint64_t hash = MixBits((dimension < 2 ? subpixel_key : pixel_key) ^ dimension);
+	ShuffledSobol(ReverseBits(dimension < 2 ? subpixel_sample_index : pixel_sample_index), hash, u, &v);
+	dimension += 2;
+}
@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// how the numbers of a pixel sample are generated
+//   independent - uniform random numbers of a PCG32 stream
+//   sobol       - Owen-scrambled Sobol points, every pair of dimensions is a separately scrambled and
+//                 shuffled 2D Sobol pattern (padding)
+//   halton      - Halton points with nested random digit scrambling
+// The first two dimensions of the low-discrepancy sequences, the position in the subpixel taken by
+// Camera::GenerateRay, are indexed by the sample of the subpixel, the others by the sample of the pixel.
+// They are scrambled per (seed, pixel, dimension), so no sampler needs state shared between samples or threads.
+// Dimensions past Sampler::sequence_dimensions (the later bounces, which gain little from stratification)
+// come from the PCG32 stream.
+enum class SamplerType { independent, sobol, halton };
+
+char const *GetSamplerName(SamplerType type);
+// parse a sampler name, returns false for an unknown one
+bool ParseSamplerType(std::string const &name, SamplerType &type);
+
+// Random numbers for one pixel sample.
+// The stream is derived from (seed, pixel, sample index) only, so the numbers a path
+// consumes do not depend on the thread that renders it or on the order pixels are visited.
+class Sampler {
+	public:
+		Sampler(uint64_t seed_ = 0, SamplerType type_ = SamplerType::independent) :
+			seed(seed_), type(type_), state(0), inc(1),
+			subpixel_key(0), pixel_key(0), subpixel_sample_index(0), pixel_sample_index(0), dimension(0) {}
+		// restart the stream for a given sample of a given pixel
+		void StartPixelSample(uint32_t pixel, uint32_t sample_index) { StartPixelSample(pixel, sample_index, 0, sample_index); }
+		// same, the sample being sample subpixel_index of the subpixel, which the position in the subpixel of the
+		// low-discrepancy samplers depends on; the independent stream depends on sample_index only
+		void StartPixelSample(uint32_t pixel, uint32_t sample_index, uint32_t subpixel, uint32_t subpixel_index);
+		// uniformly distributed 32-bit integer of the PCG32 stream
+		uint32_t NextUInt() {
+			uint64_t old_state = state;
+			state = old_state * 6364136223846793005ULL + inc;
+			uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+			uint32_t rot = uint32_t(old_state >> 59u);
+			return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+		// number in [0, 1) of the next dimension
+		double Next1D() {
+			if (type == SamplerType::independent || dimension >= sequence_dimensions) return NextUInt() * (1.0 / 4294967296.0);
+			return NextSequence1D();
+		}
+		// point in [0, 1)^2 of the next two dimensions, stratified jointly by the low-discrepancy sequences;
+		// the independent stream gives u, then v like two calls of Next1D
+		void Next2D(double &u, double &v) {
+			if (type == SamplerType::independent || dimension >= sequence_dimensions) {
+				u = Next1D();
+				v = Next1D();
+			}
+			else NextSequence2D(u, v);
+		}
+		uint64_t GetSeed() const { return seed; }
+		SamplerType GetType() const { return type; }
+
+		static const uint32_t sequence_dimensions = 16;
+	private:
+		double NextSequence1D();
+		void NextSequence2D(double &u, double &v);
+
+		uint64_t seed;
+		SamplerType type;
+		uint64_t state;
+		uint64_t inc;
+		// scrambling keys and indices of the points of the sequences, the next dimension
+		uint64_t subpixel_key, pixel_key;
+		uint32_t subpixel_sample_index, pixel_sample_index;
+		uint32_t dimension;
+};
+
+// mix bits of a 64-bit key (SplitMix64 finalizer)
+uint64_t MixBits(uint64_t key);
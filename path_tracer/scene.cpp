@@ -19,25 +19,181 @@ THE SOFTWARE.
 
 #define _USE_MATH_DEFINES
 #include <cmath> 
+#include <algorithm>
 
 #include "scene.h"
+#include "stats.h"
+#include "photon_map.h"
 
-Object* Scene::IntersectWithNearestObject(Ray3D const &ray, double &t) {
-	Object *res_ptr = nullptr;
-	double res_t = std::numeric_limits<double>::max();
-	for (int i = 0; i < object_ptrs.size(); i++) {
-		Object *object_ptr = object_ptrs[i].get();
-		double tmp_t = object_ptr->Intersect(ray);
-		if (tmp_t && tmp_t < res_t) {
-			res_ptr = object_ptr;
-			res_t = tmp_t;
+namespace {
+	const int sphere_chunk_size = 1 << 14;
+	// rays leaving a surface start this many hit error bounds away from it
+	const double hit_offset_scale = 4.0;
+}
+
+void Scene::Invalidate() {
+	bvh.Clear();
+	spheres.Clear();
+	slot_objects.clear();
+	slot_object_ptr = nullptr;
+	slot_count = 0;
+	object_slots.clear();
+	moved_objects.clear();
+	light_ptrs.clear();
+	attached_storage.reset();
+}
+
+void Scene::AddSphere(double radius, Vector3D const &center, Object::Material material, Vector3D const &color, Vector3D const &emission) {
+	if (sphere_chunks.empty() || sphere_chunks.back().size() == sphere_chunk_size) {
+		sphere_chunks.emplace_back();
+		sphere_chunks.back().reserve(sphere_chunk_size);
+	}
+	sphere_chunks.back().emplace_back(radius, center, material, color, emission);
+	object_ptrs.push_back(&sphere_chunks.back().back());
+	if (slot_count > 0 || !bvh.IsEmpty()) Invalidate();
+}
+
+void Scene::Build(bool use_bvh_) {
+	Invalidate();
+	use_bvh = use_bvh_;
+	// a few vectors of spheres are tested faster by a plain scan than by traversing a hierarchy
+	int object_count = int(object_ptrs.size());
+	if (use_bvh && object_count > 4 * spheres.GetSimdWidth()) {
+		// leaves hold up to two vectors of spheres
+		bvh.SetLeafSize(2 * spheres.GetSimdWidth(), spheres.GetSimdWidth());
+		std::vector<BoundingBox> bounds(object_count);
+		for (int i = 0; i < object_count; i++) bounds[i] = object_ptrs[i]->GetBounds();
+		bvh.Build(bounds);
+		slot_object_ptr = bvh.GetPrimitiveIndices();
+		slot_count = bvh.GetPrimitiveCount();
+	}
+	else {
+		slot_objects.resize(object_count);
+		for (int i = 0; i < object_count; i++) slot_objects[i] = i;
+		slot_object_ptr = slot_objects.data();
+		slot_count = int(slot_objects.size());
+	}
+
+	// copy spheres into the store so that leaves are tested by the vectorized kernel
+	for (int slot = 0; slot < slot_count; slot++) {
+		SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(object_ptrs[slot_object_ptr[slot]]);
+		if (sphere_ptr) spheres.AddSphere(sphere_ptr->GetCenter(), sphere_ptr->GetRadius());
+		else spheres.AddEmpty();
+	}
+	FinishBuild();
+}
+
+void Scene::Attach(BVH::Node const *nodes, int node_count, int const *slot_objects_, int slot_count_,
+	SphereStore::Arrays const &sphere_arrays, std::shared_ptr<void> storage) {
+	Invalidate();
+	bvh.Attach(nodes, node_count, slot_objects_, slot_count_);
+	spheres.Attach(sphere_arrays);
+	slot_object_ptr = slot_objects_;
+	slot_count = slot_count_;
+	attached_storage = storage;
+	FinishBuild();
+}
+
+bool Scene::MoveSphere(int index, Vector3D const &center) {
+	SphereObject *sphere_ptr = dynamic_cast<SphereObject *>(object_ptrs[index]);
+	if (sphere_ptr == nullptr) return false;
+	sphere_ptr->SetCenter(center);
+	moved_objects.push_back(index);
+	return true;
+}
+
+bool Scene::Update() {
+	if (moved_objects.empty()) return true;
+	if (slot_count == 0 || spheres.IsAttached() || moved_objects.size() * 4 > object_ptrs.size() || bvh.GetRefitDegradation() > 1.5) {
+		Build(use_bvh);
+		return false;
+	}
+
+	if (object_slots.size() != object_ptrs.size()) {
+		object_slots.assign(object_ptrs.size(), -1);
+		for (int slot = 0; slot < slot_count; slot++) object_slots[slot_object_ptr[slot]] = slot;
+	}
+	// slots of the BVH are its primitive positions
+	for (int &index : moved_objects) {
+		SphereObject const *sphere_ptr = static_cast<SphereObject const *>(object_ptrs[index]);
+		index = object_slots[index];
+		spheres.SetSphere(index, sphere_ptr->GetCenter(), sphere_ptr->GetRadius());
+	}
+	if (!bvh.IsEmpty()) bvh.Refit(moved_objects, [&](int object_index) { return object_ptrs[object_index]->GetBounds(); });
+	moved_objects.clear();
+	return true;
+}
+
+void Scene::FinishBuild() {
+	all_spheres = true;
+	for (int slot = 0; slot < slot_count; slot++) {
+		if (!spheres.IsSphere(slot)) all_spheres = false;
+	}
+	for (Object const *object_ptr : object_ptrs) {
+		SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(object_ptr);
+		if (sphere_ptr && sphere_ptr->IsLight()) light_ptrs.push_back(sphere_ptr);
+	}
+}
+
+int Scene::IntersectSlots(Ray3D const &ray, int begin, int end, double &t, int &primitive) const {
+	STATS_ADD(Counter::slot_tests, end - begin);
+	int res_slot = spheres.IntersectNearest(ray, begin, end, t);
+	if (res_slot >= 0) primitive = 0;
+	if (all_spheres) return res_slot;
+
+	for (int slot = begin; slot < end; slot++) {
+		if (spheres.IsSphere(slot)) continue;
+		int tmp_primitive;
+		double tmp_t = object_ptrs[slot_object_ptr[slot]]->IntersectNearest(ray, t, tmp_primitive);
+		if (tmp_t && tmp_t < t) {
+			res_slot = slot;
+			t = tmp_t;
+			primitive = tmp_primitive;
 		}
 	}
-	t = res_t;
-	return res_ptr;
+	return res_slot;
+}
+
+Object* Scene::IntersectWithNearestObject(Ray3D const &ray, double &t) const {
+	int primitive;
+	return IntersectWithNearestObject(ray, t, primitive);
+}
+
+Object* Scene::IntersectWithNearestObject(Ray3D const &ray, double &t, int &primitive) const {
+	int slot;
+	primitive = 0;
+	if (!bvh.IsEmpty()) {
+		slot = bvh.TraverseNearest(ray, t, [this, &primitive](int first, int count, Ray3D const &r, double &res_t) {
+			return IntersectSlots(r, first, first + count, res_t, primitive);
+		});
+	}
+	else {
+		t = std::numeric_limits<double>::max();
+		slot = IntersectSlots(ray, 0, slot_count, t, primitive);
+	}
+	STATS_COUNT(Counter::nearest_rays);
+	if (slot < 0) STATS_COUNT(Counter::nearest_misses);
+	return slot < 0 ? nullptr : object_ptrs[slot_object_ptr[slot]];
+}
+
+bool Scene::IntersectWithAnyObject(Ray3D const &ray, double t_max) const {
+	bool occluded;
+	if (!bvh.IsEmpty()) {
+		occluded = bvh.TraverseAny(ray, t_max, [this](int first, int count, Ray3D const &r, double res_t_max) {
+			int primitive;
+			return IntersectSlots(r, first, first + count, res_t_max, primitive) >= 0;
+		});
+	}
+	else {
+		int primitive;
+		occluded = IntersectSlots(ray, 0, slot_count, t_max, primitive) >= 0;
+	}
+	STATS_COUNT(Counter::shadow_rays);
+	if (occluded) STATS_COUNT(Counter::shadow_occluded);
+	return occluded;
 }
 
-Vector3D Scene::GenerateRandomUnitVectorInHemisphere(Vector3D const &normal) {
+Vector3D Scene::GenerateRandomUnitVectorInHemisphere(Vector3D const &normal, Sampler &sampler) const {
 	Vector3D u, v; // form orthogonal system of vectors with normal
 	Vector3D tmp;
 	if (fabsf(normal.x) > 0.1) tmp = Vector3D(0.0, 1.0, 0.0);
@@ -46,16 +202,18 @@ Vector3D Scene::GenerateRandomUnitVectorInHemisphere(Vector3D const &normal) {
 	v = normal % u;
 
 	// generate two random numbers
-	double r1 = 2.0f * M_PI * distribution(generator);
-	double r2 = distribution(generator);
+	double r1, r2;
+	sampler.Next2D(r1, r2);
+	r1 = 2.0f * M_PI * r1;
 	Vector3D res = (u * cosf(r1) * sqrtf(r2) + v * sinf(r1) * sqrtf(r2) + normal * sqrtf(1 - r2)).norm();
 	return res;
 }
 
-Vector3D Scene::ComputeRadiance(Ray3D const &r, int depth) {
+Vector3D Scene::ComputeRadiance(Ray3D const &r, int depth, Sampler &sampler) const {
 	Ray3D current_ray = r;
 	double tmp_t;
-	Object *current_object_ptr = IntersectWithNearestObject(current_ray, tmp_t);
+	int primitive;
+	Object *current_object_ptr = IntersectWithNearestObject(current_ray, tmp_t, primitive);
 
 	// if the ray does not hit any object on the scene
 	if (current_object_ptr == nullptr) return Vector3D(0.0, 0.0, 0.0);
@@ -63,37 +221,46 @@ Vector3D Scene::ComputeRadiance(Ray3D const &r, int depth) {
 	// if the ray intersects light object on the scene
 	if (current_object_ptr->IsLight()) return current_object_ptr->GetEmission();
 
-	Vector3D intersect_point = current_ray.origin + current_ray.direction * tmp_t;
-	Vector3D normal = current_object_ptr->GetNormal(intersect_point);
+	double offset;
+	Vector3D intersect_point = GetHitPoint(*current_object_ptr, primitive, current_ray, tmp_t, offset);
+	Vector3D normal = current_object_ptr->GetPrimitiveNormal(intersect_point, primitive);
 	Vector3D normal2 = normal.dot(current_ray.direction) < 0.0 ? normal : normal * (-1.0);
 	Object::Material object_material = current_object_ptr->GetMaterial();
 	Vector3D object_color = current_object_ptr->GetColor();
 	Vector3D object_emission = current_object_ptr->GetEmission();
 
 	double p = std::max<double>(object_color.x, std::max<double>(object_color.y, object_color.z));
-	if (++depth > max_depth) {
-		if (distribution(generator) < p) object_color = object_color * (1 / p);
-		else return object_emission;
+	depth++;
+	STATS_DEPTH(depth);
+	STATS_COUNT(object_material == Object::Material::diffuse ? Counter::diffuse_hits :
+		object_material == Object::Material::specular ? Counter::specular_hits : Counter::refracture_hits);
+	if (depth > max_depth) {
+		STATS_COUNT(Counter::roulette_tests);
+		if (sampler.Next1D() < p) object_color = object_color * (1 / p);
+		else {
+			STATS_COUNT(Counter::roulette_terminations);
+			return object_emission;
+		}
 	}
 
 	// a case of diffuse reflection - diffuse material
 	if (object_material == Object::Material::diffuse) {
-		Vector3D new_ray_direction = GenerateRandomUnitVectorInHemisphere(normal2);
-		Ray3D new_ray(intersect_point, new_ray_direction);
-		return object_emission + object_color.mult(ComputeRadiance(new_ray, depth));
+		Vector3D new_ray_direction = GenerateRandomUnitVectorInHemisphere(normal2, sampler);
+		Ray3D new_ray(OffsetRayOrigin(intersect_point, normal, new_ray_direction, offset), new_ray_direction);
+		return object_emission + object_color.mult(ComputeRadiance(new_ray, depth, sampler));
 	}
 
 	// a case of specular reflection - mirror
 	if (object_material == Object::Material::specular) {
 		Vector3D new_ray_direction = current_ray.direction - normal * 2.0 * normal.dot(current_ray.direction);
-		Ray3D new_ray(intersect_point, new_ray_direction);
-		return object_emission + ComputeRadiance(new_ray, depth);
+		Ray3D new_ray(OffsetRayOrigin(intersect_point, normal, new_ray_direction, offset), new_ray_direction);
+		return object_emission + ComputeRadiance(new_ray, depth, sampler);
 	}
 
 	// a case of glass (dielectric) material
 	if (object_material == Object::Material::refracture) {
 		Vector3D reflection_ray_direction = current_ray.direction - normal * 2.0 * normal.dot(current_ray.direction);
-		Ray3D reflection_ray(intersect_point, reflection_ray_direction);
+		Ray3D reflection_ray(OffsetRayOrigin(intersect_point, normal, reflection_ray_direction, offset), reflection_ray_direction);
 		bool into = normal.dot(normal2) > 0; // where is the current ray going: into glass or outside?
 		double n_outside = 1.0; // index of refraction for air
 		double n_inside = 1.5; // index of refraction for glass
@@ -103,15 +270,14 @@ Vector3D Scene::ComputeRadiance(Ray3D const &r, int depth) {
 		double cos_2_theta2 = 1 - nnt * nnt * (1 - cos_2_theta1);
 
 		if (cos_2_theta2 < 0.0) { // if angle is too shalow, total internal reflection occurs
-			return object_emission + object_color.mult(ComputeRadiance(reflection_ray, depth));
+			return object_emission + object_color.mult(ComputeRadiance(reflection_ray, depth, sampler));
 		}
 
 		// compute refracted ray		
 		double cos_theta2 = sqrtf(cos_2_theta2);
-		double sin_theta2 = sqrtf(1 - cos_2_theta2);
 		double ddn = current_ray.direction.dot(normal2);
 		Vector3D refraction_ray_direction = (current_ray.direction * nnt - normal * ((into ? 1 : -1)*(ddn * nnt + sqrt(cos_2_theta2)))).norm();
-		Ray3D refraction_ray(intersect_point, refraction_ray_direction);
+		Ray3D refraction_ray(OffsetRayOrigin(intersect_point, normal, refraction_ray_direction, offset), refraction_ray_direction);
 
 		// compute reflectance and refranction percentages
 		double F0 = (nnt - 1) * (nnt - 1) / ((nnt + 1) * (nnt + 1));
@@ -122,13 +288,214 @@ Vector3D Scene::ComputeRadiance(Ray3D const &r, int depth) {
 		double RP = Re / P;
 		double TP = Tr / (1.0f - P);
 		if (depth > 2) {
-			if (distribution(generator) < P) return object_emission + object_color.mult(ComputeRadiance(reflection_ray, depth)) * RP;
-			else return object_emission + object_color.mult(ComputeRadiance(refraction_ray, depth)) * TP;
+			if (sampler.Next1D() < P) return object_emission + object_color.mult(ComputeRadiance(reflection_ray, depth, sampler)) * RP;
+			else return object_emission + object_color.mult(ComputeRadiance(refraction_ray, depth, sampler)) * TP;
 		}
 		else {
-			return object_emission + object_color.mult(ComputeRadiance(reflection_ray, depth) * Re + ComputeRadiance(refraction_ray, depth) * Tr);
+			// evaluate the branches in a fixed order so that the sampler stream is consumed deterministically
+			Vector3D reflected = ComputeRadiance(reflection_ray, depth, sampler);
+			Vector3D refracted = ComputeRadiance(refraction_ray, depth, sampler);
+			return object_emission + object_color.mult(reflected * Re + refracted * Tr);
 		}
 	}
 
 	return Vector3D(0.0, 0.0, 0.0); // unknown material
 }
+
+Vector3D Scene::GetHitPoint(Object const &object, int primitive, Ray3D const &ray, double t, double &offset) const {
+	Vector3D point = object.GetHitPoint(ray, t, primitive);
+	offset = hit_offset_scale * object.GetHitError(point, GetUnitRoundoff(precision));
+	return point;
+}
+
+bool Scene::Scatter(Object const &object, int primitive, Ray3D const &ray, double t, int depth, Sampler &sampler, Ray3D &next_ray, Vector3D &weight, double &pdf) const {
+	double offset;
+	Vector3D intersect_point = GetHitPoint(object, primitive, ray, t, offset);
+	Vector3D normal = object.GetPrimitiveNormal(intersect_point, primitive);
+	Vector3D normal2 = normal.dot(ray.direction) < 0.0 ? normal : normal * (-1.0);
+	Object::Material object_material = object.GetMaterial();
+	Vector3D object_color = object.GetColor();
+
+	double p = std::max<double>(object_color.x, std::max<double>(object_color.y, object_color.z));
+	STATS_DEPTH(depth);
+	STATS_COUNT(object_material == Object::Material::diffuse ? Counter::diffuse_hits :
+		object_material == Object::Material::specular ? Counter::specular_hits : Counter::refracture_hits);
+	if (depth > max_depth) {
+		STATS_COUNT(Counter::roulette_tests);
+		if (sampler.Next1D() < p) object_color = object_color * (1 / p);
+		else {
+			STATS_COUNT(Counter::roulette_terminations);
+			return false;
+		}
+	}
+
+	// a case of diffuse reflection - diffuse material
+	if (object_material == Object::Material::diffuse) {
+		Vector3D direction = GenerateRandomUnitVectorInHemisphere(normal2, sampler);
+		next_ray = Ray3D(intersect_point + normal2 * offset, direction);
+		weight = weight.mult(object_color);
+		pdf = normal2.dot(next_ray.direction) / M_PI; // cosine-weighted hemisphere
+		return true;
+	}
+
+	pdf = 0.0;
+	Vector3D reflection_ray_direction = ray.direction - normal * 2.0 * normal.dot(ray.direction);
+
+	// a case of specular reflection - mirror
+	if (object_material == Object::Material::specular) {
+		next_ray = Ray3D(OffsetRayOrigin(intersect_point, normal, reflection_ray_direction, offset), reflection_ray_direction);
+		return true;
+	}
+
+	// a case of glass (dielectric) material
+	if (object_material == Object::Material::refracture) {
+		bool into = normal.dot(normal2) > 0; // where is the current ray going: into glass or outside?
+		double n_outside = 1.0; // index of refraction for air
+		double n_inside = 1.5; // index of refraction for glass
+		double nnt = into ? n_outside / n_inside : n_inside / n_outside; // Snell's law
+		double cos_2_theta1 = normal2.dot(ray.direction) * normal2.dot(ray.direction);
+		double cos_theta1 = sqrt(cos_2_theta1);
+		double cos_2_theta2 = 1 - nnt * nnt * (1 - cos_2_theta1);
+
+		weight = weight.mult(object_color);
+		if (cos_2_theta2 < 0.0) { // if angle is too shalow, total internal reflection occurs
+			next_ray = Ray3D(OffsetRayOrigin(intersect_point, normal, reflection_ray_direction, offset), reflection_ray_direction);
+			return true;
+		}
+
+		// compute reflectance and refraction percentages, then follow one of them
+		double cos_theta2 = sqrt(cos_2_theta2);
+		double ddn = ray.direction.dot(normal2);
+		double F0 = (nnt - 1) * (nnt - 1) / ((nnt + 1) * (nnt + 1));
+		double c = 1 - (into ? cos_theta1 : cos_theta2);
+		double Re = F0 + (1 - F0)*c*c*c*c*c; // reflection percentage
+		double Tr = 1.0 - Re; // refraction percentage
+		double P = 0.25 + 0.5 * Re;
+		if (sampler.Next1D() < P) {
+			next_ray = Ray3D(OffsetRayOrigin(intersect_point, normal, reflection_ray_direction, offset), reflection_ray_direction);
+			weight = weight * (Re / P);
+		}
+		else {
+			Vector3D refraction_ray_direction = (ray.direction * nnt - normal * ((into ? 1 : -1)*(ddn * nnt + cos_theta2))).norm();
+			next_ray = Ray3D(OffsetRayOrigin(intersect_point, normal, refraction_ray_direction, offset), refraction_ray_direction);
+			weight = weight * (Tr / (1.0 - P));
+		}
+		return true;
+	}
+
+	return false; // unknown material
+}
+
+double Scene::GetLightPdf(SphereObject const &light, Vector3D const &point) const {
+	if (!light.IsLight()) return 0.0;
+	Vector3D axis = light.GetCenter() - point;
+	double distance2 = axis.dot(axis);
+	double radius2 = light.GetRadius() * light.GetRadius();
+	if (distance2 <= radius2) return 0.0; // inside of the light
+	// 1 - cos(theta_max) computed without cancellation for small lights
+	double sin2_theta_max = radius2 / distance2;
+	double one_minus_cos = sin2_theta_max / (1.0 + sqrt(1.0 - sin2_theta_max));
+	return 1.0 / (2.0 * M_PI * one_minus_cos * light_ptrs.size());
+}
+
+double Scene::GetEmissionWeight(Object const &light, Vector3D const &origin, double bsdf_pdf, bool caustic) const {
+	if (caustic && caustic_map_ptr != nullptr) return 0.0;
+	if (bsdf_pdf <= 0.0 || !light_sampling) return 1.0;
+	SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(&light);
+	double light_pdf = sphere_ptr ? GetLightPdf(*sphere_ptr, origin) : 0.0;
+	// power heuristic
+	return bsdf_pdf * bsdf_pdf / (bsdf_pdf * bsdf_pdf + light_pdf * light_pdf);
+}
+
+Vector3D Scene::SampleLight(Vector3D const &point, Vector3D const &normal, double offset, Sampler &sampler, Vector3D &direction, double &light_pdf) const {
+	// pick a light uniformly and a direction uniformly in the cone it subtends, always consuming three numbers
+	double r0 = sampler.Next1D(), r1, r2;
+	sampler.Next2D(r1, r2);
+	light_pdf = 0.0;
+	if (light_ptrs.empty()) return Vector3D();
+	SphereObject const &light = *light_ptrs[std::min(int(r0 * light_ptrs.size()), int(light_ptrs.size()) - 1)];
+	light_pdf = GetLightPdf(light, point);
+	if (light_pdf == 0.0) return Vector3D();
+
+	Vector3D axis = light.GetCenter() - point;
+	double distance2 = axis.dot(axis);
+	axis = axis * (1.0 / sqrt(distance2));
+	double sin2_theta_max = light.GetRadius() * light.GetRadius() / distance2;
+	double one_minus_cos_max = sin2_theta_max / (1.0 + sqrt(1.0 - sin2_theta_max));
+	double one_minus_cos = r1 * one_minus_cos_max;
+	double cos_theta = 1.0 - one_minus_cos;
+	double sin_theta = sqrt(std::max(0.0, one_minus_cos * (2.0 - one_minus_cos)));
+	double phi = 2.0 * M_PI * r2;
+	Vector3D u = ((fabs(axis.x) > 0.1 ? Vector3D(0.0, 1.0, 0.0) : Vector3D(1.0, 0.0, 0.0)) % axis).norm();
+	Vector3D v = axis % u;
+	direction = (u * (cos(phi) * sin_theta) + v * (sin(phi) * sin_theta) + axis * cos_theta).norm();
+
+	if (normal.dot(direction) <= 0.0) return Vector3D();
+	Ray3D shadow_ray(point + normal * offset, direction);
+	double t_light = light.Intersect(shadow_ray);
+	if (t_light == 0.0) return Vector3D();
+	// stop the shadow ray short of the light by the error of its hit point, measured along the ray
+	Vector3D light_point = shadow_ray.origin + direction * t_light;
+	double cos_light = fabs(light.GetNormal(light_point).dot(direction));
+	double t_max = t_light - hit_offset_scale * light.GetHitError(light_point, GetUnitRoundoff(precision)) / std::max(cos_light, 1e-3);
+	if (t_max <= 0.0 || IntersectWithAnyObject(shadow_ray, t_max)) return Vector3D();
+	return light.GetEmission();
+}
+
+Vector3D Scene::SampleDirectLight(Object const &object, int primitive, Ray3D const &ray, double t, Sampler &sampler) const {
+	if (light_ptrs.empty()) return Vector3D();
+	double offset;
+	Vector3D intersect_point = GetHitPoint(object, primitive, ray, t, offset);
+	Vector3D normal = object.GetPrimitiveNormal(intersect_point, primitive);
+	Vector3D normal2 = normal.dot(ray.direction) < 0.0 ? normal : normal * (-1.0);
+
+	Vector3D direction;
+	double light_pdf;
+	Vector3D emission = SampleLight(intersect_point, normal2, offset, sampler, direction, light_pdf);
+	if (emission.x == 0.0 && emission.y == 0.0 && emission.z == 0.0) return Vector3D();
+
+	// the diffuse BSDF color / pi times cos over the pdf of Scatter leaves cos / pi divided by color,
+	// and color is already in the path weight
+	double bsdf_pdf = normal2.dot(direction) / M_PI;
+	double mis_weight = light_pdf * light_pdf / (light_pdf * light_pdf + bsdf_pdf * bsdf_pdf);
+	return emission * (bsdf_pdf / light_pdf * mis_weight);
+}
+
+Vector3D Scene::GatherCaustics(Object const &object, int primitive, Ray3D const &ray, double t) const {
+	if (caustic_map_ptr == nullptr) return Vector3D();
+	double offset;
+	Vector3D intersect_point = GetHitPoint(object, primitive, ray, t, offset);
+	Vector3D normal = object.GetPrimitiveNormal(intersect_point, primitive);
+	Vector3D normal2 = normal.dot(ray.direction) < 0.0 ? normal : normal * (-1.0);
+	// irradiance times the diffuse BSDF without its color, which is already in the path weight
+	return caustic_map_ptr->EstimateIrradiance(intersect_point, normal2) * (1.0 / M_PI);
+}
+
+Vector3D Scene::TracePath(Ray3D const &r, Sampler &sampler) const {
+	Vector3D radiance;
+	Vector3D throughput(1.0, 1.0, 1.0);
+	Ray3D current_ray = r;
+	double pdf = 0.0; // camera rays are not sampled by a BSDF, so emission they hit is taken in full
+	// with a caustic map the first diffuse hit gathers caustics from it instead of finding them through glass
+	int diffuse_bounces = 0; // counted with a caustic map only
+	bool caustic = false; // see GetEmissionWeight
+	for (int depth = 1; ; depth++) {
+		double tmp_t;
+		int primitive;
+		Object *current_object_ptr = IntersectWithNearestObject(current_ray, tmp_t, primitive);
+		if (current_object_ptr == nullptr) break;
+
+		double emission_weight = GetEmissionWeight(*current_object_ptr, current_ray.origin, pdf, caustic);
+		radiance = radiance + throughput.mult(current_object_ptr->GetEmission()) * emission_weight;
+		if (current_object_ptr->IsLight()) break;
+		Ray3D next_ray;
+		if (!Scatter(*current_object_ptr, primitive, current_ray, tmp_t, depth, sampler, next_ray, throughput, pdf)) break;
+		if (pdf > 0.0 && light_sampling) radiance = radiance + throughput.mult(SampleDirectLight(*current_object_ptr, primitive, current_ray, tmp_t, sampler));
+		if (pdf > 0.0 && caustic_map_ptr != nullptr && diffuse_bounces++ == 0) {
+			radiance = radiance + throughput.mult(GatherCaustics(*current_object_ptr, primitive, current_ray, tmp_t));
+		}
+		caustic = diffuse_bounces == 1 && caustic_map_ptr != nullptr && PhotonMap::IsTarget(*current_object_ptr);
+		current_ray = next_ray;
+	}
+	return radiance;
+}
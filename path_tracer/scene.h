@@ -22,36 +22,149 @@ THE SOFTWARE.
 #include <memory>
 #include <utility>
 #include <limits>
-#include <random>
 
 #include "utils.h"
 #include "objects.h"
+#include "sampler.h"
+#include "bvh.h"
+#include "sphere_store.h"
 
 using namespace std;
 
+class PhotonMap;
+
 class Scene {
 	public:
 		// empty constructor
-		Scene(int max_depth_ = 5) : distribution(0.0, 1.0), max_depth(max_depth_) {}
+		Scene(int max_depth_ = 5) : slot_object_ptr(nullptr), slot_count(0), use_bvh(true), all_spheres(true), light_sampling(true), max_depth(max_depth_), precision(Precision::float64), caustic_map_ptr(nullptr) {}
 		// destructor
 		virtual ~Scene() {}
 		// add a new object to scene
 		void AddObject(Object* object_ptr) {
 			std::unique_ptr<Object> tmp_ptr(object_ptr);
-			object_ptrs.push_back(std::move(tmp_ptr));
+			object_ptrs.push_back(tmp_ptr.get());
+			owned_objects.push_back(std::move(tmp_ptr));
+			Invalidate();
 		}
-		Vector3D ComputeRadiance(Ray3D const &r, int depth);
+		// add a sphere without a heap allocation of its own, spheres are stored in large chunks
+		void AddSphere(double radius, Vector3D const &center, Object::Material material, Vector3D const &color, Vector3D const &emission);
+		// expect count objects in total
+		void Reserve(int count) { object_ptrs.reserve(count); }
+		// prepare the scene for rendering, must be called after the last object is added.
+		// Without the acceleration structure (or for very small scenes) every ray is tested against every object.
+		void Build(bool use_bvh = true);
+		// Use acceleration structures built by Build for the same objects added in the same order, kept elsewhere
+		// (e.g. in a memory-mapped scene file) instead of building them: BVH nodes (node_count may be 0 for
+		// the linear scan), the object of every slot and the sphere arrays in slot order. Nothing is copied,
+		// storage keeps the memory of the arrays alive as long as the scene uses it.
+		void Attach(BVH::Node const *nodes, int node_count, int const *slot_objects_, int slot_count_,
+			SphereStore::Arrays const &sphere_arrays, std::shared_ptr<void> storage);
+		// Move the sphere with the given object index between frames. The acceleration structures are
+		// brought up to date by Update before the next render. Returns false if the object is no sphere.
+		bool MoveSphere(int index, Vector3D const &center);
+		// Update the structures after spheres moved: the sphere store slots of the moved spheres are rewritten
+		// and the BVH is refitted, unless more than a quarter of the objects moved, refits made the BVH
+		// 50% costlier than a fresh build or the structures are attached, then the scene is built again.
+		// Returns true if the structures were refitted.
+		bool Update();
+		int GetObjectCount() const { return int(object_ptrs.size()); }
+		Object const *GetObject(int index) const { return object_ptrs[index]; }
+		// built acceleration structures, valid after Build or Attach
+		BVH const &GetBVH() const { return bvh; }
+		SphereStore const &GetSphereStore() const { return spheres; }
+		int const *GetSlotObjects() const { return slot_object_ptr; }
+		int GetSlotCount() const { return slot_count; }
+		// select the ray-sphere kernel, by default the best one for the CPU
+		void SetSimdLevel(SimdLevel level) { spheres.SetSimdLevel(level); }
+		SimdLevel GetSimdLevel() const { return spheres.GetSimdLevel(); }
+		// Precision of the ray-sphere kernels, double by default. Rays leaving a surface start at an offset scaled
+		// to the rounding error of the precision, so a scene renders alike in both. Set it before Build, the
+		// leaves of the BVH are sized for the kernel width.
+		void SetPrecision(Precision precision_) { precision = precision_; spheres.SetPrecision(precision); }
+		Precision GetPrecision() const { return precision; }
+		// next-event estimation: TracePath samples sphere lights directly at diffuse hits, on by default
+		void SetLightSampling(bool light_sampling_) { light_sampling = light_sampling_; }
+		bool GetLightSampling() const { return light_sampling; }
+		// Photon map of caustics (see PhotonMap) used by TracePath and the wavefront integrator, nullptr by default.
+		// The first diffuse hit of a path then adds its radiance estimate, and light that reaches that hit through
+		// the glass the map was shot at is no longer gathered from the lights, the map holds it. Later diffuse hits
+		// find caustics by path tracing, they are blurred by the bounce anyway. The map must outlive its use.
+		void SetCausticMap(PhotonMap const *caustic_map_ptr_) { caustic_map_ptr = caustic_map_ptr_; }
+		PhotonMap const *GetCausticMap() const { return caustic_map_ptr; }
+		// intersect a ray with the nearest object of the scene
+		Object* IntersectWithNearestObject(Ray3D const &ray, double &t) const;
+		// same, primitive receives the hit primitive of the object (see Object::IntersectNearest)
+		Object* IntersectWithNearestObject(Ray3D const &ray, double &t, int &primitive) const;
+		// check whether any object is hit closer than t_max (shadow rays)
+		bool IntersectWithAnyObject(Ray3D const &ray, double t_max) const;
+		// the scene is read-only during rendering, all randomness comes from the sampler of the path
+		Vector3D ComputeRadiance(Ray3D const &r, int depth, Sampler &sampler) const;
+		// iterative version of ComputeRadiance: one path carrying a throughput weight, dielectrics pick
+		// reflection or refraction at random instead of splitting, Russian roulette ends the path
+		Vector3D TracePath(Ray3D const &r, Sampler &sampler) const;
+		// continue a path that hit primitive of a non-emissive object at distance t along ray: sample the next ray and
+		// multiply weight by the BSDF weight of it. Returns false if Russian roulette terminates the path.
+		// depth is the number of the current bounce starting from 1. pdf receives the solid angle density
+		// of the sampled direction, 0 for the perfectly specular directions of mirrors and glass.
+		bool Scatter(Object const &object, int primitive, Ray3D const &ray, double t, int depth, Sampler &sampler, Ray3D &next_ray, Vector3D &weight, double &pdf) const;
+		// Light arriving at the diffuse hit of ray with primitive of object at distance t from one randomly picked sphere
+		// light, sampled over the cone the light subtends and tested with a shadow ray. The result is MIS
+		// weighted against BSDF sampling and is to be multiplied by the path weight returned by Scatter.
+		Vector3D SampleDirectLight(Object const &object, int primitive, Ray3D const &ray, double t, Sampler &sampler) const;
+		// Caustic radiance leaving the diffuse hit of ray with primitive of object at distance t towards the ray origin,
+		// to be multiplied by the path weight returned by Scatter like SampleDirectLight. Zero without a caustic map.
+		Vector3D GatherCaustics(Object const &object, int primitive, Ray3D const &ray, double t) const;
+		// Pick one sphere light at random and a direction from point uniformly in the cone it subtends, three
+		// numbers of the sampler. Returns the emission of the light if the direction leaves the surface of normal
+		// and a ray from point + normal * offset reaches the light unoccluded, zero otherwise; direction and
+		// light_pdf receive the direction and its solid angle density.
+		Vector3D SampleLight(Vector3D const &point, Vector3D const &normal, double offset, Sampler &sampler, Vector3D &direction, double &light_pdf) const;
+		// point where ray hits primitive of object at distance t and the distance along the normal that rays
+		// leaving it start from, several times the rounding error the intersection of the precision has there
+		Vector3D GetHitPoint(Object const &object, int primitive, Ray3D const &ray, double t, double &offset) const;
+		// MIS weight of the emission of light hit by a ray from origin whose direction was sampled with bsdf_pdf.
+		// caustic tells that the ray left a target of the caustic map (PhotonMap::IsTarget) after the first diffuse
+		// bounce of the path and no other, the map holds such light and it weighs 0.
+		double GetEmissionWeight(Object const &light, Vector3D const &origin, double bsdf_pdf, bool caustic = false) const;
+		// generate a random cosine-distributed unit vector in the hemisphere around normal
+		Vector3D GenerateRandomUnitVectorInHemisphere(Vector3D const &normal, Sampler &sampler) const;
 	private:
 		// copy constructor is not allowed
-		Scene(Scene const &other) {}
-		// intersect a ray with the nearest object of the scene
-		Object* IntersectWithNearestObject(Ray3D const &ray, double &t);
-		// generate a random unit vector in hemisphere
-		Vector3D GenerateRandomUnitVectorInHemisphere(Vector3D const &normal);
+		Scene(Scene const &/*other*/) {}
+		// drop the acceleration structures after the set of objects changed
+		void Invalidate();
+		// find the lights and whether every slot holds a sphere once the slots are known
+		void FinishBuild();
+		// nearest hit among slots [begin, end) of the sphere store, including objects that are not spheres;
+		// primitive receives the hit primitive of the object in the returned slot
+		int IntersectSlots(Ray3D const &ray, int begin, int end, double &t, int &primitive) const;
+		// solid angle density of sampling a direction towards light from point, 0 inside of the light or for objects that are no lights
+		double GetLightPdf(SphereObject const &light, Vector3D const &point) const;
 
 	private:
-		std::vector<std::unique_ptr<Object>> object_ptrs;
-		std::default_random_engine generator;
-		std::uniform_real_distribution<double> distribution;
+		// all objects in the order they were added; objects of AddObject are owned one by one,
+		// spheres of AddSphere live in chunks of fixed capacity, so that pointers to them stay valid
+		std::vector<Object *> object_ptrs;
+		std::vector<std::unique_ptr<Object>> owned_objects;
+		std::vector<std::vector<SphereObject>> sphere_chunks;
+		BVH bvh;
+		// spheres in the order of BVH leaves (or of object_ptrs without BVH) and the object of every slot.
+		// Slots of a BVH are its primitive indices, slots of the linear scan are kept in slot_objects.
+		SphereStore spheres;
+		std::vector<int> slot_objects;
+		int const *slot_object_ptr;
+		int slot_count;
+		bool use_bvh;
+		// slot of every object, made on the first Update after a build, and the objects moved since then
+		std::vector<int> object_slots;
+		std::vector<int> moved_objects;
+		// memory of attached structures
+		std::shared_ptr<void> attached_storage;
+		// emissive spheres, the lights sampled by next-event estimation
+		std::vector<SphereObject const *> light_ptrs;
+		bool all_spheres;
+		bool light_sampling;
 		int max_depth;
+		Precision precision;
+		PhotonMap const *caustic_map_ptr;
 };
@@ -0,0 +1,541 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <fstream>
+#include <type_traits>
+#include <algorithm>
+
+#include "scene_file.h"
+#include "mapped_file.h"
+#include "sampler.h"
+
+namespace {
+	const size_t chunk_size = 1 << 20; // bytes the text reader holds at once, also the longest allowed line
+
+	// Reads a file line by line through a buffer of fixed size
+	class LineReader {
+		public:
+			LineReader() : file(nullptr), buffer(chunk_size + 1), begin(0), end(0), eof(false) {}
+			~LineReader() { if (file) fclose(file); }
+			bool Open(std::string const &path) {
+				file = fopen(path.c_str(), "rb");
+				return file != nullptr;
+			}
+			// next line without the line break, null-terminated and writable, or nullptr at the end of the file.
+			// too_long is set when a line does not fit into the buffer.
+			char *NextLine(bool &too_long) {
+				too_long = false;
+				while (true) {
+					char *line = buffer.data() + begin;
+					char *line_end = static_cast<char *>(memchr(line, '\n', end - begin));
+					if (line_end) {
+						*line_end = '\0';
+						begin = line_end + 1 - buffer.data();
+						return line;
+					}
+					if (eof) {
+						if (begin == end) return nullptr;
+						buffer[end] = '\0';
+						begin = end;
+						return line;
+					}
+					if (begin == 0 && end == chunk_size) {
+						too_long = true;
+						return nullptr;
+					}
+					// keep the incomplete line and fill the rest of the buffer
+					memmove(buffer.data(), line, end - begin);
+					end -= begin;
+					begin = 0;
+					size_t read = fread(buffer.data() + end, 1, chunk_size - end, file);
+					if (read == 0) eof = true;
+					end += read;
+				}
+			}
+		private:
+			FILE *file;
+			std::vector<char> buffer;
+			size_t begin, end; // unread part of the buffer
+			bool eof;
+	};
+
+	// split off the next whitespace-separated token of a line, nullptr at the end of the line or at a comment
+	char *NextToken(char *&position) {
+		while (*position == ' ' || *position == '\t' || *position == '\r') position++;
+		if (*position == '\0' || *position == '#') return nullptr;
+		char *token = position;
+		while (*position != '\0' && *position != ' ' && *position != '\t' && *position != '\r') position++;
+		if (*position != '\0') *position++ = '\0';
+		return token;
+	}
+
+	// whether only spaces or a comment are left on the line
+	bool AtLineEnd(char const *position) {
+		while (*position == ' ' || *position == '\t' || *position == '\r') position++;
+		return *position == '\0' || *position == '#';
+	}
+
+	bool ParseDouble(char *&position, double &value) {
+		char *token = NextToken(position);
+		if (token == nullptr) return false;
+		char *token_end;
+		value = strtod(token, &token_end);
+		return *token_end == '\0';
+	}
+
+	bool ParseInt(char *&position, int &value) {
+		char *token = NextToken(position);
+		if (token == nullptr) return false;
+		char *token_end;
+		value = int(strtol(token, &token_end, 10));
+		return *token_end == '\0';
+	}
+
+	bool ParseVector(char *&position, Vector3D &value) {
+		return ParseDouble(position, value.x) && ParseDouble(position, value.y) && ParseDouble(position, value.z);
+	}
+
+	bool ParseMaterialType(char const *name, Object::Material &type) {
+		if (strcmp(name, "diffuse") == 0) type = Object::Material::diffuse;
+		else if (strcmp(name, "specular") == 0) type = Object::Material::specular;
+		else if (strcmp(name, "refracture") == 0) type = Object::Material::refracture;
+		else return false;
+		return true;
+	}
+
+	// a path relative to the directory of base_path
+	std::string ResolvePath(std::string const &base_path, std::string const &path) {
+		bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+		size_t separator = base_path.find_last_of("/\\");
+		if (absolute || separator == std::string::npos) return path;
+		return base_path.substr(0, separator + 1) + path;
+	}
+
+	// parse an OBJ index, 1-based or negative (relative to the end), into a 0-based index below count
+	bool ParseObjIndex(char *&position, int count, int &index) {
+		char *end;
+		long value = strtol(position, &end, 10);
+		if (end == position) return false;
+		position = end;
+		index = value > 0 ? int(value - 1) : count + int(value);
+		return index >= 0 && index < count;
+	}
+
+	struct MaterialRecord {
+		Object::Material type;
+		Vector3D color, emission;
+	};
+
+	const char binary_magic[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+	const uint32_t binary_version = 1;
+	const uint32_t byte_order_mark = 0x01020304;
+	const uint64_t section_alignment = 64;
+
+	struct BinaryHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order; // byte_order_mark as written by the machine that saved the file
+		uint32_t node_size; // sizeof(BVH::Node) of the build that saved the file
+		uint32_t material_count, object_count, node_count, slot_count;
+		int32_t width, height;
+		uint32_t reserved;
+		double camera_origin[3], camera_direction[3];
+		uint64_t material_offset, object_offset, node_offset, slot_offset, sphere_offsets[4];
+	};
+
+	struct BinaryMaterial {
+		uint32_t type;
+		uint32_t reserved;
+		double color[3], emission[3];
+	};
+
+	struct BinarySphere {
+		double center[3];
+		double radius;
+		uint32_t material;
+		uint32_t reserved;
+	};
+
+	static_assert(std::is_trivially_copyable<BVH::Node>::value, "BVH nodes are stored in scene files as they are");
+
+	uint64_t AlignSection(uint64_t offset) {
+		return (offset + section_alignment - 1) / section_alignment * section_alignment;
+	}
+
+	// write bytes at offset, the gap after the previous section is filled with zeros
+	void WriteSection(std::ofstream &file, uint64_t offset, void const *data, size_t bytes) {
+		static const char zeros[section_alignment] = { 0 };
+		uint64_t position = uint64_t(file.tellp());
+		if (offset > position) file.write(zeros, std::streamsize(offset - position));
+		file.write(static_cast<char const *>(data), std::streamsize(bytes));
+	}
+}
+
+bool LoadTextScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error) {
+	LineReader reader;
+	if (!reader.Open(path)) {
+		error = "cannot open " + path;
+		return false;
+	}
+
+	std::unordered_map<std::string, int> material_indices;
+	std::vector<MaterialRecord> materials;
+	int line_number = 0;
+	bool too_long;
+	auto fail = [&](std::string const &message) {
+		error = path + ":" + std::to_string(line_number) + ": " + message;
+		return false;
+	};
+
+	while (char *line = reader.NextLine(too_long)) {
+		line_number++;
+		char *position = line;
+		char *keyword = NextToken(position);
+		if (keyword == nullptr) continue; // empty line or comment
+
+		if (strcmp(keyword, "sphere") == 0) {
+			double radius;
+			Vector3D center;
+			if (!ParseDouble(position, radius) || !ParseVector(position, center)) return fail("expected sphere <radius> <center x y z> <material>");
+			char *name = NextToken(position);
+			auto material_it = name ? material_indices.find(name) : material_indices.end();
+			if (material_it == material_indices.end()) return fail("unknown material");
+			MaterialRecord const &material = materials[material_it->second];
+			scene.AddSphere(radius, center, material.type, material.color, material.emission);
+		}
+		else if (strcmp(keyword, "mesh") == 0) {
+			char *mesh_path = NextToken(position);
+			char *name = mesh_path ? NextToken(position) : nullptr;
+			auto material_it = name ? material_indices.find(name) : material_indices.end();
+			if (material_it == material_indices.end()) return fail("expected mesh <OBJ file> <material>");
+			MaterialRecord const &material = materials[material_it->second];
+			std::unique_ptr<TriangleMesh> mesh_ptr(new TriangleMesh(material.type, material.color, material.emission));
+			std::string mesh_error;
+			if (!LoadObjMesh(ResolvePath(path, mesh_path), *mesh_ptr, mesh_error)) return fail(mesh_error);
+			scene.AddObject(mesh_ptr.release());
+		}
+		else if (strcmp(keyword, "material") == 0) {
+			char *name = NextToken(position);
+			char *type_name = name ? NextToken(position) : nullptr;
+			MaterialRecord material;
+			if (type_name == nullptr || !ParseMaterialType(type_name, material.type)) return fail("expected material <name> diffuse|specular|refracture <color r g b> [<emission r g b>]");
+			if (!ParseVector(position, material.color)) return fail("expected material color");
+			if (!AtLineEnd(position) && !ParseVector(position, material.emission)) return fail("expected material emission");
+			material_indices[name] = int(materials.size());
+			materials.push_back(material);
+		}
+		else if (strcmp(keyword, "camera") == 0) {
+			if (!ParseVector(position, description.camera_origin) || !ParseVector(position, description.camera_direction)) return fail("expected camera <origin x y z> <direction x y z>");
+			description.camera_direction.norm();
+		}
+		else if (strcmp(keyword, "resolution") == 0) {
+			if (!ParseInt(position, description.width) || !ParseInt(position, description.height) || description.width <= 0 || description.height <= 0) return fail("expected resolution <width> <height>");
+		}
+		else return fail(std::string("unknown statement ") + keyword);
+
+		if (!AtLineEnd(position)) return fail("unexpected text at the end of the line");
+	}
+	if (too_long) return fail("line is too long");
+	return true;
+}
+
+bool LoadObjMesh(std::string const &path, TriangleMesh &mesh, std::string &error) {
+	LineReader reader;
+	if (!reader.Open(path)) {
+		error = "cannot open " + path;
+		return false;
+	}
+
+	int line_number = 0;
+	bool too_long;
+	auto fail = [&](std::string const &message) {
+		error = path + ":" + std::to_string(line_number) + ": " + message;
+		return false;
+	};
+	int normal_count = 0;
+	std::vector<int> face_vertices, face_normals;
+	while (char *line = reader.NextLine(too_long)) {
+		line_number++;
+		char *position = line;
+		char *keyword = NextToken(position);
+		if (keyword == nullptr) continue;
+
+		if (strcmp(keyword, "v") == 0) {
+			Vector3D vertex;
+			if (!ParseVector(position, vertex)) return fail("expected v <x y z>");
+			mesh.AddVertex(Vector3F(vertex));
+		}
+		else if (strcmp(keyword, "vn") == 0) {
+			Vector3D normal;
+			if (!ParseVector(position, normal)) return fail("expected vn <x y z>");
+			mesh.AddNormal(Vector3F(normal.norm()));
+			normal_count++;
+		}
+		else if (strcmp(keyword, "f") == 0) {
+			// corners are v, v/vt, v//vn or v/vt/vn
+			face_vertices.clear();
+			face_normals.clear();
+			while (char *corner = NextToken(position)) {
+				int vertex, normal = -1;
+				if (!ParseObjIndex(corner, mesh.GetVertexCount(), vertex)) return fail("bad vertex index");
+				if (*corner == '/') {
+					corner++;
+					if (*corner != '/') strtol(corner, &corner, 10); // texture coordinates are not used
+					if (*corner == '/') {
+						corner++;
+						if (!ParseObjIndex(corner, normal_count, normal)) return fail("bad normal index");
+					}
+				}
+				face_vertices.push_back(vertex);
+				face_normals.push_back(normal);
+			}
+			if (face_vertices.size() < 3) return fail("a face needs at least 3 vertices");
+			for (size_t i = 1; i + 1 < face_vertices.size(); i++) {
+				mesh.AddTriangle(face_vertices[0], face_vertices[i], face_vertices[i + 1], face_normals[0], face_normals[i], face_normals[i + 1]);
+			}
+		}
+	}
+	if (too_long) return fail("line is too long");
+	if (mesh.GetTriangleCount() == 0) return fail("no faces");
+	mesh.Build();
+	return true;
+}
+
+bool SaveBinaryScene(std::string const &path, Scene const &scene, SceneDescription const &description, std::string &error) {
+	int object_count = scene.GetObjectCount();
+	if (scene.GetSlotCount() != object_count) {
+		error = "the scene must be built before it is saved";
+		return false;
+	}
+
+	// spheres reference a table of distinct materials
+	std::vector<BinaryMaterial> materials;
+	std::vector<BinarySphere> spheres(object_count);
+	std::map<std::vector<double>, uint32_t> material_indices;
+	for (int i = 0; i < object_count; i++) {
+		SphereObject const *sphere_ptr = dynamic_cast<SphereObject const *>(scene.GetObject(i));
+		if (sphere_ptr == nullptr) {
+			error = "only scenes of spheres can be saved in the binary format";
+			return false;
+		}
+		Vector3D color = sphere_ptr->GetColor(), emission = sphere_ptr->GetEmission();
+		std::vector<double> key = { double(sphere_ptr->GetMaterial()), color.x, color.y, color.z, emission.x, emission.y, emission.z };
+		auto material_it = material_indices.find(key);
+		if (material_it == material_indices.end()) {
+			BinaryMaterial material = { uint32_t(sphere_ptr->GetMaterial()), 0, { color.x, color.y, color.z }, { emission.x, emission.y, emission.z } };
+			material_it = material_indices.insert(std::make_pair(key, uint32_t(materials.size()))).first;
+			materials.push_back(material);
+		}
+		Vector3D center = sphere_ptr->GetCenter();
+		BinarySphere sphere = { { center.x, center.y, center.z }, sphere_ptr->GetRadius(), material_it->second, 0 };
+		spheres[i] = sphere;
+	}
+
+	BVH const &bvh = scene.GetBVH();
+	SphereStore::Arrays const &arrays = scene.GetSphereStore().GetArrays();
+	size_t sphere_array_bytes = sizeof(double) * SphereStore::GetPaddedSize(arrays.size);
+	BinaryHeader header = {};
+	memcpy(header.magic, binary_magic, sizeof(binary_magic));
+	header.version = binary_version;
+	header.byte_order = byte_order_mark;
+	header.node_size = sizeof(BVH::Node);
+	header.material_count = uint32_t(materials.size());
+	header.object_count = uint32_t(object_count);
+	header.node_count = uint32_t(bvh.GetNodeCount());
+	header.slot_count = uint32_t(scene.GetSlotCount());
+	header.width = description.width;
+	header.height = description.height;
+	Vector3D const &origin = description.camera_origin, &direction = description.camera_direction;
+	double camera[6] = { origin.x, origin.y, origin.z, direction.x, direction.y, direction.z };
+	memcpy(header.camera_origin, camera, sizeof(camera));
+	header.material_offset = AlignSection(sizeof(header));
+	header.object_offset = AlignSection(header.material_offset + sizeof(BinaryMaterial) * materials.size());
+	header.node_offset = AlignSection(header.object_offset + sizeof(BinarySphere) * spheres.size());
+	header.slot_offset = AlignSection(header.node_offset + sizeof(BVH::Node) * header.node_count);
+	header.sphere_offsets[0] = AlignSection(header.slot_offset + sizeof(int) * header.slot_count);
+	for (int i = 1; i < 4; i++) header.sphere_offsets[i] = AlignSection(header.sphere_offsets[i - 1] + sphere_array_bytes);
+
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		error = "cannot create " + path;
+		return false;
+	}
+	WriteSection(file, 0, &header, sizeof(header));
+	WriteSection(file, header.material_offset, materials.data(), sizeof(BinaryMaterial) * materials.size());
+	WriteSection(file, header.object_offset, spheres.data(), sizeof(BinarySphere) * spheres.size());
+	WriteSection(file, header.node_offset, bvh.GetNodes(), sizeof(BVH::Node) * header.node_count);
+	WriteSection(file, header.slot_offset, scene.GetSlotObjects(), sizeof(int) * header.slot_count);
+	double const *sphere_arrays[4] = { arrays.center_x, arrays.center_y, arrays.center_z, arrays.radius2 };
+	for (int i = 0; i < 4; i++) WriteSection(file, header.sphere_offsets[i], sphere_arrays[i], sphere_array_bytes);
+	if (!file.good()) {
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool LoadBinaryScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error) {
+	if (scene.GetObjectCount() != 0) {
+		error = "binary scenes can only be loaded into an empty scene";
+		return false;
+	}
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->Open(path, error)) return false;
+	char const *data = file->GetData();
+	uint64_t size = file->GetSize();
+
+	BinaryHeader header;
+	if (size < sizeof(header)) {
+		error = path + " is not a binary scene";
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0) {
+		error = path + " is not a binary scene";
+		return false;
+	}
+	if (header.version != binary_version || header.byte_order != byte_order_mark || header.node_size != sizeof(BVH::Node)) {
+		error = path + " was written by an incompatible version or platform";
+		return false;
+	}
+	uint64_t sphere_array_bytes = sizeof(double) * uint64_t(SphereStore::GetPaddedSize(int(header.slot_count)));
+	auto fits = [&](uint64_t offset, uint64_t bytes) { return offset % sizeof(double) == 0 && offset <= size && bytes <= size - offset; };
+	bool valid = header.slot_count == header.object_count &&
+		fits(header.material_offset, sizeof(BinaryMaterial) * uint64_t(header.material_count)) &&
+		fits(header.object_offset, sizeof(BinarySphere) * uint64_t(header.object_count)) &&
+		fits(header.node_offset, sizeof(BVH::Node) * uint64_t(header.node_count)) &&
+		fits(header.slot_offset, sizeof(int) * uint64_t(header.slot_count));
+	for (int i = 0; i < 4; i++) valid = valid && fits(header.sphere_offsets[i], sphere_array_bytes);
+	if (!valid) {
+		error = path + " is truncated or corrupted";
+		return false;
+	}
+
+	// the arrays are used in place, only indices that would make the traversal leave them are checked
+	BinaryMaterial const *materials = reinterpret_cast<BinaryMaterial const *>(data + header.material_offset);
+	BinarySphere const *spheres = reinterpret_cast<BinarySphere const *>(data + header.object_offset);
+	BVH::Node const *nodes = reinterpret_cast<BVH::Node const *>(data + header.node_offset);
+	int const *slot_objects = reinterpret_cast<int const *>(data + header.slot_offset);
+	for (uint32_t i = 0; i < header.slot_count; i++) {
+		if (uint32_t(slot_objects[i]) >= header.object_count) valid = false;
+	}
+	// children follow their parents, so one pass finds the depth of every node; the traversal stack of BVH
+	// bounds how deep inner nodes may be nested
+	std::vector<int> depths(header.node_count, 0);
+	for (uint32_t i = 0; i < header.node_count && valid; i++) {
+		BVH::Node const &node = nodes[i];
+		if (node.count == 0) {
+			valid = node.offset > int(i) + 1 && uint32_t(node.offset) < header.node_count && node.axis >= 0 && node.axis < 3 &&
+				depths[i] < BVH::stack_capacity;
+			if (valid) {
+				depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+				depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+			}
+		}
+		else valid = node.count > 0 && node.offset >= 0 && uint64_t(node.offset) + node.count <= header.slot_count;
+	}
+	for (uint32_t i = 0; i < header.object_count; i++) {
+		if (spheres[i].material >= header.material_count) valid = false;
+	}
+	for (uint32_t i = 0; i < header.material_count; i++) {
+		if (materials[i].type > uint32_t(Object::Material::refracture)) valid = false;
+	}
+	if (!valid) {
+		error = path + " is corrupted";
+		return false;
+	}
+
+	description.camera_origin = Vector3D(header.camera_origin[0], header.camera_origin[1], header.camera_origin[2]);
+	description.camera_direction = Vector3D(header.camera_direction[0], header.camera_direction[1], header.camera_direction[2]);
+	description.width = header.width;
+	description.height = header.height;
+
+	// shading needs objects, they are created in file order so that slot_objects refers to them
+	scene.Reserve(int(header.object_count));
+	for (uint32_t i = 0; i < header.object_count; i++) {
+		BinarySphere const &sphere = spheres[i];
+		BinaryMaterial const &material = materials[sphere.material];
+		scene.AddSphere(sphere.radius, Vector3D(sphere.center[0], sphere.center[1], sphere.center[2]), Object::Material(material.type),
+			Vector3D(material.color[0], material.color[1], material.color[2]), Vector3D(material.emission[0], material.emission[1], material.emission[2]));
+	}
+	SphereStore::Arrays arrays;
+	arrays.center_x = reinterpret_cast<double const *>(data + header.sphere_offsets[0]);
+	arrays.center_y = reinterpret_cast<double const *>(data + header.sphere_offsets[1]);
+	arrays.center_z = reinterpret_cast<double const *>(data + header.sphere_offsets[2]);
+	arrays.radius2 = reinterpret_cast<double const *>(data + header.sphere_offsets[3]);
+	arrays.size = int(header.slot_count);
+	scene.Attach(nodes, int(header.node_count), slot_objects, int(header.slot_count), arrays, file);
+	return true;
+}
+
+bool LoadScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error) {
+	char magic[sizeof(binary_magic)] = { 0 };
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		error = "cannot open " + path;
+		return false;
+	}
+	size_t read = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+	if (read == sizeof(magic) && memcmp(magic, binary_magic, sizeof(magic)) == 0) return LoadBinaryScene(path, scene, description, error);
+	if (!LoadTextScene(path, scene, description, error)) return false;
+	scene.Build();
+	return true;
+}
+
+bool IsBuiltinScene(std::string const &name) {
+	return name == "cornell" || name == "small-light" || name == "many-spheres";
+}
+
+bool CreateBuiltinScene(std::string const &name, Scene &scene) {
+	if (!IsBuiltinScene(name)) return false;
+	scene.AddSphere(1e5, Vector3D(1e5 + 1, 40.8, 81.6), Object::Material::diffuse, Vector3D(.75, .25, .25), Vector3D()); // left
+	scene.AddSphere(1e5, Vector3D(-1e5 + 99, 40.8, 81.6), Object::Material::diffuse, Vector3D(.25, .25, .75), Vector3D()); // right
+	scene.AddSphere(1e5, Vector3D(50, 40.8, 1e5), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D()); // back
+	scene.AddSphere(1e5, Vector3D(50, 40.8, -1e5 + 170), Object::Material::diffuse, Vector3D(), Vector3D()); // front
+	scene.AddSphere(1e5, Vector3D(50, 1e5, 81.6), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D()); // bottom
+	scene.AddSphere(1e5, Vector3D(50, -1e5 + 81.6, 81.6), Object::Material::diffuse, Vector3D(.75, .75, .75), Vector3D()); // top
+	if (name == "many-spheres") {
+		// a fixed seed keeps the scene the same from run to run
+		Sampler sampler(1);
+		for (int i = 0; i < 1000; i++) {
+			double radius = 1.5 + 2.0 * sampler.Next1D();
+			Vector3D center(10 + 80 * sampler.Next1D(), radius + 60 * sampler.Next1D(), 20 + 120 * sampler.Next1D());
+			Object::Material material = i % 10 == 0 ? Object::Material::specular : i % 10 == 1 ? Object::Material::refracture : Object::Material::diffuse;
+			Vector3D color = material == Object::Material::diffuse ? Vector3D(sampler.Next1D(), sampler.Next1D(), sampler.Next1D()) * .75 : Vector3D(1, 1, 1) * .999;
+			scene.AddSphere(radius, center, material, color, Vector3D());
+		}
+	}
+	else {
+		scene.AddSphere(16.5, Vector3D(27, 16.5, 47), Object::Material::specular, Vector3D(1, 1, 1)*.999, Vector3D()); // mirror
+		scene.AddSphere(16.5, Vector3D(73, 16.5, 78), Object::Material::refracture, Vector3D(1, 1, 1)*.999, Vector3D()); // glass
+	}
+	if (name == "small-light") scene.AddSphere(4, Vector3D(50, 70, 81.6), Object::Material::diffuse, Vector3D(), Vector3D(50, 50, 50)); // light
+	else scene.AddSphere(600, Vector3D(50, 681.6 - .27, 81.6), Object::Material::diffuse, Vector3D(), Vector3D(12, 12, 12)); // light
+	scene.Build();
+	return true;
+}
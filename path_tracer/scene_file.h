@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "utils.h"
+#include "scene.h"
+#include "mesh.h"
+
+// Everything a scene file defines besides the objects, the defaults are those of the built-in Cornell box
+struct SceneDescription {
+	Vector3D camera_origin = Vector3D(50, 52, 295.6);
+	Vector3D camera_direction = Vector3D(0, -0.042612, -1).norm();
+	int width = 512;
+	int height = 512;
+};
+
+// Add one of the built-in scenes to the scene and build it, returns false for an unknown name:
+//   cornell      - the classic Cornell box lit through the ceiling by a huge sphere (scenes/cornell.scene)
+//   small-light  - the same box lit by a small sphere light (scenes/small-light.scene)
+//   many-spheres - the Cornell box filled with 1000 small random spheres of all materials
+bool CreateBuiltinScene(std::string const &name, Scene &scene);
+bool IsBuiltinScene(std::string const &name);
+
+// Text scene format, one statement per line, '#' starts a comment:
+//   camera <origin x y z> <direction x y z>
+//   resolution <width> <height>
+//   material <name> diffuse|specular|refracture <color r g b> [<emission r g b>]
+//   sphere <radius> <center x y z> <material name>
+//   mesh <OBJ file, relative to the scene file> <material name>
+// Materials must be defined before the objects using them. The file is read in fixed-size chunks,
+// so memory use does not depend on the file size, and spheres are added by Scene::AddSphere.
+// The objects are added to the scene, which still has to be built.
+bool LoadTextScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error);
+
+// Binary scene format: the description, materials and sphere records followed by the acceleration
+// structures of the built scene (BVH nodes, slot objects, sphere arrays) in their in-memory layout.
+// Loading maps the file and attaches those arrays to the scene without copying or building anything,
+// only the sphere objects used for shading are created. The file is specific to the byte order and
+// structure layout of the build that wrote it. Scenes of other objects than spheres cannot be saved.
+bool SaveBinaryScene(std::string const &path, Scene const &scene, SceneDescription const &description, std::string &error);
+bool LoadBinaryScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error);
+
+// Load the triangles of a Wavefront OBJ file into a mesh and build it. Vertices ("v"), vertex normals ("vn")
+// and faces ("f", polygons are split into fans of triangles) are read, other statements are ignored.
+bool LoadObjMesh(std::string const &path, TriangleMesh &mesh, std::string &error);
+
+// load a scene of either format and make it ready for rendering
+bool LoadScene(std::string const &path, Scene &scene, SceneDescription &description, std::string &error);
@@ -0,0 +1,184 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cstdint>
+
+#include "scheduler.h"
+
+namespace {
+	// position of cell (x, y) along the Hilbert curve filling an n x n grid, n is a power of two
+	int HilbertIndex(int n, int x, int y) {
+		int d = 0;
+		for (int s = n / 2; s > 0; s /= 2) {
+			int rx = (x & s) > 0;
+			int ry = (y & s) > 0;
+			d += s * s * ((3 * rx) ^ ry);
+			// rotate the quadrant so that the curve inside it has the canonical orientation
+			if (ry == 0) {
+				if (rx == 1) {
+					x = n - 1 - x;
+					y = n - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return d;
+	}
+}
+
+std::vector<Tile> MakeTiles(int width, int height, int tile_size) {
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tiles_y = (height + tile_size - 1) / tile_size;
+	int n = 1;
+	while (n < tiles_x || n < tiles_y) n *= 2;
+
+	std::vector<std::pair<int, Tile>> ordered;
+	for (int ty = 0; ty < tiles_y; ty++) {
+		for (int tx = 0; tx < tiles_x; tx++) {
+			Tile tile = { tx * tile_size, ty * tile_size, std::min(width, (tx + 1) * tile_size), std::min(height, (ty + 1) * tile_size) };
+			ordered.push_back(std::make_pair(HilbertIndex(n, tx, ty), tile));
+		}
+	}
+	std::sort(ordered.begin(), ordered.end(), [](std::pair<int, Tile> const &a, std::pair<int, Tile> const &b) { return a.first < b.first; });
+
+	std::vector<Tile> tiles;
+	for (size_t i = 0; i < ordered.size(); i++) tiles.push_back(ordered[i].second);
+	return tiles;
+}
+
+std::vector<Tile> MakeScanlineTiles(int width, int height) {
+	std::vector<Tile> tiles;
+	for (int y = 0; y < height; y++) {
+		Tile tile = { 0, y, width, y + 1 };
+		tiles.push_back(tile);
+	}
+	return tiles;
+}
+
+ThreadPool::ThreadPool(int thread_count) : generation(0), running_workers(0), job_active(false), stopping(false) {
+	if (thread_count <= 0) thread_count = std::max(1, int(std::thread::hardware_concurrency()));
+	stats.resize(thread_count);
+	for (int i = 0; i < thread_count; i++) queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	for (int i = 0; i < thread_count; i++) workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+	Wait(-1.0);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_ready.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void ThreadPool::Run(int item_count, std::function<void(int, int)> const &task_) {
+	Start(item_count, task_);
+	Wait(-1.0);
+}
+
+void ThreadPool::Start(int item_count, std::function<void(int, int)> const &task_) {
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this] { return !job_active; });
+
+	// workers are idle, so queues and statistics can be set up without their locks
+	int thread_count = GetThreadCount();
+	for (int i = 0; i < thread_count; i++) {
+		queues[i]->items.clear();
+		for (int item = int(int64_t(item_count) * i / thread_count); item < int(int64_t(item_count) * (i + 1) / thread_count); item++) {
+			queues[i]->items.push_back(item);
+		}
+		stats[i] = ThreadStats();
+	}
+	task = task_;
+	running_workers = thread_count;
+	job_active = true;
+	job_start = std::chrono::steady_clock::now();
+	generation++;
+	lock.unlock();
+	work_ready.notify_all();
+}
+
+bool ThreadPool::Wait(double timeout_seconds) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (timeout_seconds < 0.0) {
+		work_done.wait(lock, [this] { return !job_active; });
+		return true;
+	}
+	return work_done.wait_for(lock, std::chrono::duration<double>(timeout_seconds), [this] { return !job_active; });
+}
+
+bool ThreadPool::PopItem(int thread_index, int &item, bool &stolen) {
+	{
+		WorkQueue &queue = *queues[thread_index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.items.empty()) {
+			item = queue.items.front();
+			queue.items.pop_front();
+			stolen = false;
+			return true;
+		}
+	}
+	// steal from the far end of other queues, the owner keeps the items next to the ones it works on
+	int thread_count = GetThreadCount();
+	for (int i = 1; i < thread_count; i++) {
+		WorkQueue &queue = *queues[(thread_index + i) % thread_count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.items.empty()) {
+			item = queue.items.back();
+			queue.items.pop_back();
+			stolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(int thread_index) {
+	int seen_generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+			if (stopping) return;
+			seen_generation = generation;
+		}
+
+		// statistics of a thread are only touched by the thread itself while the job runs
+		ThreadStats &thread_stats = stats[thread_index];
+		int item;
+		bool stolen;
+		while (PopItem(thread_index, item, stolen)) {
+			auto start = std::chrono::steady_clock::now();
+			task(item, thread_index);
+			thread_stats.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			thread_stats.items++;
+			if (stolen) thread_stats.stolen++;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--running_workers == 0) {
+			double job_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job_start).count();
+			for (size_t i = 0; i < stats.size(); i++) stats[i].idle_seconds = std::max(0.0, job_seconds - stats[i].busy_seconds);
+			job_active = false;
+			work_done.notify_all();
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+// rectangle [x0, x1) x [y0, y1) of the frame
+struct Tile {
+	int x0, y0, x1, y1;
+};
+
+// split the frame into tiles of tile_size x tile_size pixels ordered along a Hilbert curve,
+// so that consecutive tiles are neighbors and a thread working on a run of tiles touches nearby data
+std::vector<Tile> MakeTiles(int width, int height, int tile_size);
+// one tile per scanline, camera rows from the bottom of the picture up
+std::vector<Tile> MakeScanlineTiles(int width, int height);
+
+// time a worker spent on the last job
+struct ThreadStats {
+	double busy_seconds = 0.0;
+	double idle_seconds = 0.0;
+	int items = 0; // items processed
+	int stolen = 0; // items taken from queues of other threads
+};
+
+// Fixed set of worker threads with one work queue per thread.
+// Items of a job are split into contiguous runs, thread i starts with the i-th run taking items from the
+// front of its queue, and a thread that runs out of work steals items from the back of the other queues.
+class ThreadPool {
+	public:
+		// thread_count 0 starts one thread per hardware thread
+		explicit ThreadPool(int thread_count = 0);
+		~ThreadPool();
+		int GetThreadCount() const { return int(workers.size()); }
+
+		// run task(item, thread_index) for every item in [0, item_count), returns when all items are done.
+		// Only one job runs at a time.
+		void Run(int item_count, std::function<void(int, int)> const &task);
+		// asynchronous version of Run: Start returns at once, Wait returns true when the job is done
+		// or false when timeout_seconds passed
+		void Start(int item_count, std::function<void(int, int)> const &task);
+		bool Wait(double timeout_seconds);
+		// per-thread statistics of the last finished job
+		std::vector<ThreadStats> const &GetThreadStats() const { return stats; }
+
+	private:
+		struct WorkQueue {
+			std::mutex mutex;
+			std::deque<int> items;
+		};
+		void WorkerLoop(int thread_index);
+		bool PopItem(int thread_index, int &item, bool &stolen);
+
+		std::vector<std::thread> workers;
+		std::vector<std::unique_ptr<WorkQueue>> queues;
+		std::vector<ThreadStats> stats;
+		std::function<void(int, int)> task;
+		std::mutex mutex;
+		std::condition_variable work_ready, work_done;
+		std::chrono::steady_clock::time_point job_start;
+		int generation;
+		int running_workers;
+		bool job_active;
+		bool stopping;
+};
@@ -0,0 +1,583 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <deque>
+#include <chrono>
+#include <exception>
+
+#include "server.h"
+#include "camera.h"
+#include "film.h"
+
+namespace {
+	const char protocol_magic[8] = { 'P', 'T', 'S', 'E', 'R', 'V', '0', '1' };
+	// longest request payload accepted, two paths and the fixed part
+	const uint32_t max_request_size = 1 << 16;
+
+	enum class MessageType : uint32_t { request = 1, accepted, tile, done, error };
+
+	struct MessageHeader {
+		uint32_t type;
+		uint32_t size; // bytes of the payload that follows
+	};
+
+	// client -> server, followed by the scene name and the output path
+	struct RequestMessage {
+		char magic[8];
+		double camera_origin[3];
+		double camera_direction[3];
+		uint64_t seed;
+		int32_t width, height; // 0 - the frame size of the scene
+		int32_t scene_camera;
+		int32_t samples_per_subpixel;
+		int32_t integrator;
+		int32_t sampler;
+		int32_t light_sampling;
+		int32_t precision;
+		int32_t priority;
+		int32_t tone_mapping;
+		uint32_t scene_name_size, output_path_size;
+	};
+
+	// server -> client once the job is queued
+	struct AcceptedMessage {
+		uint64_t job;
+		int32_t width, height;
+		int32_t tile_count;
+		int32_t reserved;
+	};
+
+	// server -> client for every tile, followed by 3 float sums and 1 count per pixel
+	struct TileMessage {
+		uint64_t job;
+		int32_t x0, y0, x1, y1;
+	};
+
+	// server -> client after the last tile
+	struct DoneMessage {
+		uint64_t job;
+		int32_t output_written; // 1 - the output image was written, 0 - there was none or writing failed
+		int32_t tiles_rendered_meanwhile;
+		double scene_seconds, queue_seconds, first_tile_seconds, first_tile_render_seconds, total_seconds;
+	};
+
+	// one write per message, so that the header and a small payload travel in one segment
+	bool SendMessage(TcpSocket const &socket, MessageType type, void const *payload, size_t size, void const *extra = nullptr, size_t extra_size = 0) {
+		std::vector<char> message(sizeof(MessageHeader) + size + extra_size);
+		MessageHeader header = { uint32_t(type), uint32_t(size + extra_size) };
+		memcpy(message.data(), &header, sizeof(header));
+		if (size > 0) memcpy(message.data() + sizeof(header), payload, size);
+		if (extra_size > 0) memcpy(message.data() + sizeof(header) + size, extra, extra_size);
+		return socket.Send(message.data(), message.size());
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()) {
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	// path of a file a request names inside directory; false without a directory or if the name is absolute,
+	// names a drive or has a ".." component that could leave the directory
+	bool ResolveDataPath(std::string const &directory, std::string const &name, std::string &path) {
+		if (directory.empty() || name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos) return false;
+		for (size_t start = 0; start <= name.size(); ) {
+			size_t end = name.find_first_of("/\\", start);
+			if (end == std::string::npos) end = name.size();
+			if (end - start == 2 && name.compare(start, 2, "..") == 0) return false;
+			start = end + 1;
+		}
+		path = directory + "/" + name;
+		return true;
+	}
+}
+
+struct RenderServer::ResidentScene {
+	Scene scene;
+	SceneDescription description;
+	std::mutex load_mutex;
+	bool loaded = false;
+};
+
+struct RenderServer::Job {
+	// the sums and counts of a finished tile on their way to the client
+	struct TileResult {
+		int tile;
+		std::vector<float> sums;
+		std::vector<uint32_t> counts;
+	};
+
+	Job(std::shared_ptr<ResidentScene> const &scene_ptr_, Camera const &camera_) : scene_ptr(scene_ptr_), camera(camera_), cancelled(false) {}
+
+	uint64_t id = 0;
+	int priority = 0;
+	std::shared_ptr<ResidentScene> scene_ptr;
+	Camera camera;
+	RenderSettings settings;
+	std::vector<Tile> tiles;
+	int next_tile = 0; // guarded by the queue mutex of the server
+	uint64_t tiles_rendered_before = 0; // tiles the server had rendered when the job was queued
+	std::chrono::steady_clock::time_point received;
+	// handed from the dispatcher to the connection
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<TileResult> results;
+	int tiles_done = 0;
+	JobTimes times;
+	std::atomic<bool> cancelled; // the client is gone
+};
+
+bool RenderServer::JobOrder::operator()(std::shared_ptr<Job> const &a, std::shared_ptr<Job> const &b) const {
+	// the top of the queue is the job of the highest priority, the oldest one among equals
+	return a->priority != b->priority ? a->priority < b->priority : a->id > b->id;
+}
+
+RenderServer::RenderServer(ServerSettings const &settings_) : settings(settings_), pool(settings_.thread_count), next_job_id(1),
+	tiles_rendered(0), stopping(false), started(false) {}
+
+RenderServer::~RenderServer() {
+	Stop();
+}
+
+bool RenderServer::Start(std::string &error) {
+	if (started) return true;
+	if (!listener.Listen(settings.port, error, true)) return false;
+	stopping = false;
+	started = true;
+	accept_thread = std::thread([this]() { AcceptLoop(); });
+	dispatch_thread = std::thread([this]() { DispatchLoop(); });
+	return true;
+}
+
+void RenderServer::Stop() {
+	if (!started) return;
+	started = false;
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	queue_changed.notify_all();
+	accept_thread.join();
+	dispatch_thread.join();
+	// connections notice stopping within their polling interval
+	for (Connection &connection : connections) connection.thread.join();
+	connections.clear();
+	listener.Close();
+	queue = decltype(queue)();
+}
+
+bool RenderServer::LoadScene(std::string const &name, bool light_sampling, Precision precision, std::string &error) {
+	double seconds;
+	if (!FindScene(name, light_sampling, precision, seconds, error)) return false;
+	std::lock_guard<std::mutex> lock(scenes_mutex);
+	operator_scenes.insert(name);
+	return true;
+}
+
+std::shared_ptr<RenderServer::ResidentScene> RenderServer::FindScene(std::string const &name, bool light_sampling, Precision precision,
+	double &seconds, std::string &error) {
+	std::string key = name + (light_sampling ? "|1|" : "|0|") + GetPrecisionName(precision);
+	std::shared_ptr<ResidentScene> scene_ptr;
+	{
+		std::lock_guard<std::mutex> lock(scenes_mutex);
+		std::shared_ptr<ResidentScene> &entry = scenes[key];
+		if (!entry) entry = std::make_shared<ResidentScene>();
+		scene_ptr = entry;
+	}
+	// a scene is loaded once, requests for it wait for the first one while other scenes stay available
+	std::lock_guard<std::mutex> lock(scene_ptr->load_mutex);
+	seconds = 0.0;
+	if (scene_ptr->loaded) return scene_ptr;
+	auto start = std::chrono::steady_clock::now();
+	Scene &scene = scene_ptr->scene;
+	scene.SetPrecision(precision);
+	if (!CreateBuiltinScene(name, scene) && !::LoadScene(name, scene, scene_ptr->description, error)) {
+		// the next request starts over with an empty scene
+		std::lock_guard<std::mutex> scenes_lock(scenes_mutex);
+		if (scenes[key] == scene_ptr) scenes.erase(key);
+		return nullptr;
+	}
+	scene.SetLightSampling(light_sampling);
+	scene_ptr->loaded = true;
+	seconds = SecondsSince(start);
+	return scene_ptr;
+}
+
+void RenderServer::AcceptLoop() {
+	while (!stopping) {
+		if (!listener.WaitReadable(0.1)) continue;
+		std::unique_ptr<TcpSocket> socket_ptr(new TcpSocket());
+		if (!listener.Accept(*socket_ptr)) continue;
+		// join the threads of clients that left
+		for (size_t i = 0; i < connections.size(); ) {
+			if (*connections[i].finished) {
+				connections[i].thread.join();
+				connections[i] = std::move(connections.back());
+				connections.pop_back();
+			}
+			else i++;
+		}
+		Connection connection;
+		connection.finished = std::make_shared<std::atomic<bool>>(false);
+		std::shared_ptr<std::atomic<bool>> finished = connection.finished;
+		TcpSocket *raw_socket_ptr = socket_ptr.release();
+		connection.thread = std::thread([this, raw_socket_ptr, finished]() {
+			std::unique_ptr<TcpSocket> owned_socket_ptr(raw_socket_ptr);
+			ServeClient(*owned_socket_ptr);
+			*finished = true;
+		});
+		connections.push_back(std::move(connection));
+	}
+}
+
+void RenderServer::DispatchLoop() {
+	for (;;) {
+		std::shared_ptr<Job> job_ptr;
+		int tile_index;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_changed.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (stopping) return;
+			job_ptr = queue.top();
+			if (job_ptr->cancelled) {
+				queue.pop();
+				continue;
+			}
+			// a job leaves the queue with its last tile, jobs queued meanwhile are considered for the next one
+			tile_index = job_ptr->next_tile++;
+			if (job_ptr->next_tile == int(job_ptr->tiles.size())) queue.pop();
+		}
+		Job &job = *job_ptr;
+		Tile const &tile = job.tiles[tile_index];
+		int pixel_count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+		Job::TileResult result;
+		result.tile = tile_index;
+		result.sums.assign(3 * pixel_count, 0.0f);
+		result.counts.assign(pixel_count, 0);
+		auto start = std::chrono::steady_clock::now();
+		RenderTileSums(job.scene_ptr->scene, job.camera, job.settings, tile, 0, 4 * job.settings.samples_per_subpixel,
+			result.sums.data(), result.counts.data(), pool);
+		auto end = std::chrono::steady_clock::now();
+		uint64_t rendered;
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			rendered = ++tiles_rendered;
+		}
+		{
+			std::lock_guard<std::mutex> lock(job.mutex);
+			if (job.tiles_done == 0) {
+				job.times.queue_seconds = SecondsSince(job.received, start);
+				job.times.first_tile_seconds = SecondsSince(job.received, end);
+				job.times.first_tile_render_seconds = SecondsSince(start, end);
+			}
+			if (++job.tiles_done == int(job.tiles.size())) {
+				job.times.total_seconds = SecondsSince(job.received, end);
+				job.times.tiles_rendered_meanwhile = int(rendered - job.tiles_rendered_before - job.tiles.size());
+			}
+			job.results.push_back(std::move(result));
+		}
+		job.changed.notify_all();
+	}
+}
+
+void RenderServer::ServeClient(TcpSocket &connection) {
+	std::vector<char> payload;
+	while (!stopping) {
+		if (!connection.WaitReadable(0.1)) continue;
+		MessageHeader header;
+		if (!connection.Receive(&header, sizeof(header)) || header.type != uint32_t(MessageType::request) ||
+			header.size < sizeof(RequestMessage) || header.size > max_request_size) return;
+		payload.resize(header.size);
+		if (!connection.Receive(payload.data(), payload.size())) return;
+		// a failure of one request, e.g. a frame that does not fit in memory, must not take the server down
+		bool served;
+		try {
+			served = ServeRequest(connection, payload);
+		}
+		catch (std::exception const &e) {
+			fprintf(stderr, "Request failed: %s\n", e.what());
+			std::string error = "the server failed to render the request";
+			SendMessage(connection, MessageType::error, error.data(), error.size());
+			return;
+		}
+		if (!served) return;
+	}
+}
+
+bool RenderServer::ServeRequest(TcpSocket &connection, std::vector<char> const &payload) {
+	auto received = std::chrono::steady_clock::now();
+	RequestMessage request;
+	memcpy(&request, payload.data(), sizeof(request));
+	if (memcmp(request.magic, protocol_magic, sizeof(protocol_magic)) != 0 ||
+		payload.size() != sizeof(request) + request.scene_name_size + request.output_path_size) {
+		std::string error = "request of another build";
+		SendMessage(connection, MessageType::error, error.data(), error.size());
+		return false;
+	}
+	std::string scene_name(payload.data() + sizeof(request), request.scene_name_size);
+	std::string output_path(payload.data() + sizeof(request) + request.scene_name_size, request.output_path_size);
+	auto reject = [&](std::string const &error) {
+		return SendMessage(connection, MessageType::error, error.data(), error.size());
+	};
+	if (request.samples_per_subpixel < 1 || request.samples_per_subpixel > max_request_samples_per_subpixel ||
+		request.width < 0 || request.height < 0 || int64_t(request.width) * request.height > max_request_pixels) {
+		return reject("invalid frame size or samples");
+	}
+	// enums are only cast once they are known to be values of them
+	if (request.integrator < 0 || request.integrator > int32_t(IntegratorType::wavefront) ||
+		request.sampler < 0 || request.sampler > int32_t(SamplerType::halton) ||
+		request.precision < 0 || request.precision > int32_t(Precision::float32) ||
+		request.tone_mapping < 0 || request.tone_mapping > int32_t(ToneMapping::reinhard)) {
+		return reject("invalid integrator, sampler, precision or tone mapping");
+	}
+
+	// any local user may send requests, so files are only read and written inside the data directory
+	std::string scene_path = scene_name;
+	bool operator_scene;
+	{
+		std::lock_guard<std::mutex> lock(scenes_mutex);
+		operator_scene = operator_scenes.count(scene_name) != 0;
+	}
+	if (!IsBuiltinScene(scene_name) && !operator_scene && !ResolveDataPath(settings.data_directory, scene_name, scene_path)) {
+		return reject("unknown scene " + scene_name);
+	}
+	if (!output_path.empty() && !ResolveDataPath(settings.data_directory, output_path, output_path)) {
+		return reject("output images must be relative to the data directory of the server");
+	}
+	double scene_seconds;
+	std::string error;
+	std::shared_ptr<ResidentScene> scene_ptr = FindScene(scene_path, request.light_sampling != 0, Precision(request.precision), scene_seconds, error);
+	if (!scene_ptr) {
+		// the parser quotes the file, which only the operator may see
+		fprintf(stderr, "%s\n", error.c_str());
+		return reject("cannot load scene " + scene_name);
+	}
+	SceneDescription const &description = scene_ptr->description;
+	int width = request.width > 0 ? request.width : description.width;
+	int height = request.height > 0 ? request.height : description.height;
+	if (int64_t(width) * height > max_request_pixels) return reject("frame of scene " + scene_name + " too large");
+	Vector3D origin = request.scene_camera ? description.camera_origin : Vector3D(request.camera_origin[0], request.camera_origin[1], request.camera_origin[2]);
+	Vector3D direction = request.scene_camera ? description.camera_direction :
+		Vector3D(request.camera_direction[0], request.camera_direction[1], request.camera_direction[2]).norm();
+
+	std::shared_ptr<Job> job_ptr = std::make_shared<Job>(scene_ptr, Camera(origin, direction, width, height));
+	Job &job = *job_ptr;
+	job.priority = request.priority;
+	job.received = received;
+	job.settings.seed = request.seed;
+	job.settings.samples_per_subpixel = request.samples_per_subpixel;
+	job.settings.integrator = IntegratorType(request.integrator);
+	job.settings.sampler = SamplerType(request.sampler);
+	job.tiles = settings.tile_size > 0 ? MakeTiles(width, height, settings.tile_size) : MakeScanlineTiles(width, height);
+	// the server keeps a film only for an image it writes itself, made before the job is queued
+	std::unique_ptr<Film> film_ptr(output_path.empty() ? nullptr : new Film(width, height));
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		job.id = next_job_id++;
+		job.tiles_rendered_before = tiles_rendered;
+		queue.push(job_ptr);
+	}
+	queue_changed.notify_all();
+
+	AcceptedMessage accepted = { job.id, width, height, int32_t(job.tiles.size()), 0 };
+	if (!SendMessage(connection, MessageType::accepted, &accepted, sizeof(accepted))) {
+		job.cancelled = true;
+		return false;
+	}
+	std::vector<char> pixels;
+	for (size_t sent = 0; sent < job.tiles.size(); sent++) {
+		Job::TileResult result;
+		{
+			std::unique_lock<std::mutex> lock(job.mutex);
+			while (job.results.empty()) {
+				if (stopping) {
+					job.cancelled = true;
+					return false;
+				}
+				job.changed.wait_for(lock, std::chrono::milliseconds(100));
+			}
+			result = std::move(job.results.front());
+			job.results.pop_front();
+		}
+		Tile const &tile = job.tiles[result.tile];
+		if (film_ptr) {
+			for (int y = tile.y0; y < tile.y1; y++) {
+				for (int x = tile.x0; x < tile.x1; x++) {
+					int i = (y - tile.y0) * (tile.x1 - tile.x0) + x - tile.x0;
+					film_ptr->AddSampleSums(x, y, &result.sums[3 * i], result.counts[i]);
+				}
+			}
+		}
+		size_t sums_size = result.sums.size() * sizeof(float), counts_size = result.counts.size() * sizeof(uint32_t);
+		pixels.resize(sums_size + counts_size);
+		memcpy(pixels.data(), result.sums.data(), sums_size);
+		memcpy(pixels.data() + sums_size, result.counts.data(), counts_size);
+		TileMessage message = { job.id, tile.x0, tile.y0, tile.x1, tile.y1 };
+		if (!SendMessage(connection, MessageType::tile, &message, sizeof(message), pixels.data(), pixels.size())) {
+			job.cancelled = true;
+			return false;
+		}
+	}
+
+	DoneMessage done;
+	memset(&done, 0, sizeof(done));
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+		done.job = job.id;
+		done.tiles_rendered_meanwhile = job.times.tiles_rendered_meanwhile;
+		done.scene_seconds = scene_seconds;
+		done.queue_seconds = job.times.queue_seconds;
+		done.first_tile_seconds = job.times.first_tile_seconds;
+		done.first_tile_render_seconds = job.times.first_tile_render_seconds;
+		done.total_seconds = job.times.total_seconds;
+	}
+	if (film_ptr) {
+		std::vector<Vector3D> image(size_t(width) * height);
+		film_ptr->Resolve(image.data());
+		ImageWriter writer(1, ToneMapping(request.tone_mapping));
+		done.output_written = writer.Write(output_path, image.data(), width, height) ? 1 : 0;
+	}
+	if (settings.report_jobs) {
+		fprintf(stderr, "Job %llu: priority %d, %dx%d, %d spp, %s; first tile after %.2f ms (%.2f ms rendering), done after %.1f ms\n",
+			(unsigned long long)job.id, job.priority, width, height, 4 * request.samples_per_subpixel, scene_name.c_str(),
+			1e3 * done.first_tile_seconds, 1e3 * done.first_tile_render_seconds, 1e3 * done.total_seconds);
+	}
+	return SendMessage(connection, MessageType::done, &done, sizeof(done));
+}
+
+int RunRenderServer(ServerSettings const &settings, std::vector<std::string> const &scene_names, bool light_sampling, Precision precision) {
+	RenderServer server(settings);
+	std::string error;
+	for (std::string const &name : scene_names) {
+		auto start = std::chrono::steady_clock::now();
+		if (!server.LoadScene(name, light_sampling, precision, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		fprintf(stderr, "Scene %s resident after %.3f s\n", name.c_str(), SecondsSince(start));
+	}
+	if (!server.Start(error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Render server on port %d\n", server.GetPort());
+	for (;;) std::this_thread::sleep_for(std::chrono::hours(1));
+}
+
+bool SubmitRenderRequest(std::string const &host, int port, RenderRequest const &request,
+	std::function<void(int, int)> const &accepted, std::function<void(Tile const &, float const *, uint32_t const *)> const &tile,
+	JobTimes &times, std::string &error) {
+	TcpSocket connection;
+	if (!connection.Connect(host, port, error)) return false;
+	RequestMessage message;
+	memset(&message, 0, sizeof(message));
+	memcpy(message.magic, protocol_magic, sizeof(protocol_magic));
+	message.camera_origin[0] = request.camera_origin.x;
+	message.camera_origin[1] = request.camera_origin.y;
+	message.camera_origin[2] = request.camera_origin.z;
+	message.camera_direction[0] = request.camera_direction.x;
+	message.camera_direction[1] = request.camera_direction.y;
+	message.camera_direction[2] = request.camera_direction.z;
+	message.seed = request.settings.seed;
+	message.width = request.width;
+	message.height = request.height;
+	message.scene_camera = request.scene_camera ? 1 : 0;
+	message.samples_per_subpixel = request.settings.samples_per_subpixel;
+	message.integrator = int32_t(request.settings.integrator);
+	message.sampler = int32_t(request.settings.sampler);
+	message.light_sampling = request.light_sampling ? 1 : 0;
+	message.precision = int32_t(request.precision);
+	message.priority = request.priority;
+	message.tone_mapping = int32_t(request.tone_mapping);
+	message.scene_name_size = uint32_t(request.scene_name.size());
+	message.output_path_size = uint32_t(request.output_path.size());
+	std::string names = request.scene_name + request.output_path;
+	if (!SendMessage(connection, MessageType::request, &message, sizeof(message), names.data(), names.size())) {
+		error = "cannot send the request";
+		return false;
+	}
+
+	MessageHeader header;
+	AcceptedMessage job;
+	std::vector<char> payload;
+	auto receive = [&]() {
+		if (!connection.Receive(&header, sizeof(header))) return false;
+		payload.resize(header.size);
+		return header.size == 0 || connection.Receive(payload.data(), payload.size());
+	};
+	if (!receive()) {
+		error = "the server closed the connection";
+		return false;
+	}
+	if (header.type == uint32_t(MessageType::error)) {
+		error = std::string(payload.begin(), payload.end());
+		return false;
+	}
+	if (header.type != uint32_t(MessageType::accepted) || header.size != sizeof(job)) {
+		error = "unexpected answer of the server";
+		return false;
+	}
+	memcpy(&job, payload.data(), sizeof(job));
+	if (job.width <= 0 || job.height <= 0 || int64_t(job.width) * job.height > max_request_pixels) {
+		error = "unexpected answer of the server";
+		return false;
+	}
+	accepted(job.width, job.height);
+	for (int i = 0; i < job.tile_count; i++) {
+		TileMessage message;
+		if (!receive() || header.type != uint32_t(MessageType::tile) || header.size < sizeof(message)) {
+			error = "the server closed the connection";
+			return false;
+		}
+		memcpy(&message, payload.data(), sizeof(message));
+		Tile rect = { message.x0, message.y0, message.x1, message.y1 };
+		if (rect.x0 < 0 || rect.y0 < 0 || rect.x0 >= rect.x1 || rect.y0 >= rect.y1 || rect.x1 > job.width || rect.y1 > job.height) {
+			error = "unexpected answer of the server";
+			return false;
+		}
+		size_t pixel_count = size_t(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+		if (header.size != sizeof(message) + pixel_count * (3 * sizeof(float) + sizeof(uint32_t))) {
+			error = "unexpected answer of the server";
+			return false;
+		}
+		std::vector<float> sums(3 * pixel_count);
+		std::vector<uint32_t> counts(pixel_count);
+		memcpy(sums.data(), payload.data() + sizeof(message), sums.size() * sizeof(float));
+		memcpy(counts.data(), payload.data() + sizeof(message) + sums.size() * sizeof(float), counts.size() * sizeof(uint32_t));
+		tile(rect, sums.data(), counts.data());
+	}
+	DoneMessage done;
+	if (!receive() || header.type != uint32_t(MessageType::done) || header.size != sizeof(done)) {
+		error = "the server closed the connection";
+		return false;
+	}
+	memcpy(&done, payload.data(), sizeof(done));
+	times.scene_seconds = done.scene_seconds;
+	times.queue_seconds = done.queue_seconds;
+	times.first_tile_seconds = done.first_tile_seconds;
+	times.first_tile_render_seconds = done.first_tile_render_seconds;
+	times.total_seconds = done.total_seconds;
+	times.tiles_rendered_meanwhile = done.tiles_rendered_meanwhile;
+	if (!request.output_path.empty() && !done.output_written) {
+		error = "the server could not write " + request.output_path;
+		return false;
+	}
+	return true;
+}
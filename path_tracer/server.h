@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#include "scene.h"
+#include "render.h"
+#include "scheduler.h"
+#include "scene_file.h"
+#include "image_writer.h"
+#include "tcp_socket.h"
+
+// Long-lived render server. Scenes stay resident after the first job that names them and one thread pool
+// renders all jobs, so a job pays neither for process startup nor for building its scene again. Clients
+// connect over TCP (normally to localhost) and send render requests, one after another on a connection.
+// Jobs wait in a priority queue and are rendered one tile at a time: after every tile the dispatcher takes
+// the next one from the job of the highest priority (the oldest of equal ones), so an interactive preview
+// preempts a background render after the tile in flight. Finished tiles are streamed to the client as the
+// float sums and sample counts of their pixels, taken exactly as by RenderTileSums, so the image a client
+// assembles equals that of a progressive render of the same seed.
+// Messages are the in-memory structures of the build, server and clients must run the same build.
+// The server only listens on the loopback interface, but every local user can reach it: requests may only name
+// built-in scenes, scenes the operator made resident and files inside the data directory, and errors sent
+// back never quote the files.
+struct ServerSettings {
+	int port = 0; // 0 - any free port
+	int thread_count = 0; // render threads, 0 - one per hardware thread
+	int tile_size = 32; // 0 - whole scanlines
+	bool report_jobs = true; // print the latency of every job to stderr
+	// scene files and output images of requests are relative to it, empty - no files (built-in and resident scenes only)
+	std::string data_directory;
+};
+
+// largest frame and samples per subpixel of a request, the film of such a job takes 1 GB
+const int64_t max_request_pixels = int64_t(1) << 26;
+const int max_request_samples_per_subpixel = 1 << 16;
+
+// what a client asks the server to render
+struct RenderRequest {
+	std::string scene_name = "cornell"; // built-in or resident scene or a scene file relative to the data directory
+	int width = 0, height = 0; // 0 - the frame size of the scene
+	bool scene_camera = true; // view of the scene, otherwise camera_origin and camera_direction
+	Vector3D camera_origin, camera_direction;
+	RenderSettings settings; // samples, seed, integrator and sampler, the server has its own threads and tiles
+	bool light_sampling = true;
+	Precision precision = Precision::float64;
+	int priority = 0; // jobs of higher priority are rendered first
+	// image the server writes into its data directory when the job is done, empty - none; tiles are streamed
+	// to the client anyway
+	std::string output_path;
+	ToneMapping tone_mapping = ToneMapping::clamp;
+};
+
+// Latency of a job as the server measured it, from the moment its request was read. Loading a scene that was
+// not resident yet is part of the wait for the first tile.
+struct JobTimes {
+	double scene_seconds = 0.0; // loading the scene, 0 if it was resident
+	double queue_seconds = 0.0; // until the first tile of the job started rendering
+	double first_tile_seconds = 0.0; // until the first tile was ready to be sent
+	double first_tile_render_seconds = 0.0; // rendering the first tile
+	double total_seconds = 0.0; // until the last tile was ready
+	int tiles_rendered_meanwhile = 0; // tiles of other jobs rendered between the request and the last tile
+};
+
+class RenderServer {
+	public:
+		explicit RenderServer(ServerSettings const &settings_);
+		// stops the server
+		~RenderServer();
+		// listen and start serving, returns false and sets error if the port cannot be opened
+		bool Start(std::string &error);
+		int GetPort() const { return listener.GetPort(); }
+		// drop all jobs and connections and join the threads
+		void Stop();
+		// make a scene resident before a request names it, requests may then name it even if it is no built-in
+		// scene or file of the data directory
+		bool LoadScene(std::string const &name, bool light_sampling, Precision precision, std::string &error);
+
+	private:
+		struct ResidentScene;
+		struct Job;
+		struct JobOrder {
+			bool operator()(std::shared_ptr<Job> const &a, std::shared_ptr<Job> const &b) const;
+		};
+		// connection of a client and whether its thread has finished
+		struct Connection {
+			std::thread thread;
+			std::shared_ptr<std::atomic<bool>> finished;
+		};
+
+		// copying is not allowed
+		RenderServer(RenderServer const &other);
+		RenderServer &operator=(RenderServer const &other);
+
+		std::shared_ptr<ResidentScene> FindScene(std::string const &name, bool light_sampling, Precision precision, double &seconds, std::string &error);
+		void AcceptLoop();
+		void DispatchLoop();
+		void ServeClient(TcpSocket &connection);
+		// render a job read from the connection and stream its tiles, false if the connection is lost
+		bool ServeRequest(TcpSocket &connection, std::vector<char> const &payload);
+
+		ServerSettings settings;
+		TcpSocket listener;
+		ThreadPool pool;
+		std::thread accept_thread, dispatch_thread;
+		std::vector<Connection> connections;
+		// resident scenes by name, light sampling and precision, and the names made resident by LoadScene
+		std::mutex scenes_mutex;
+		std::map<std::string, std::shared_ptr<ResidentScene>> scenes;
+		std::set<std::string> operator_scenes;
+		// jobs with tiles left to render
+		std::mutex queue_mutex;
+		std::condition_variable queue_changed;
+		std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job>>, JobOrder> queue;
+		uint64_t next_job_id;
+		uint64_t tiles_rendered; // by the dispatcher so far, guarded by queue_mutex
+		std::atomic<bool> stopping;
+		bool started;
+};
+
+// Serve render requests on settings.port until the process is killed, with the named scenes resident from
+// the start. Returns the exit code.
+int RunRenderServer(ServerSettings const &settings, std::vector<std::string> const &scene_names, bool light_sampling, Precision precision);
+
+// Send a request to the server at host:port and receive the job. accepted(width, height) is called with the
+// frame size before the first tile, tile(tile, sums, counts) for every tile as it arrives (3 sums and 1 count
+// per pixel, pixel (x, y) at (y - tile.y0) * tile width + x - tile.x0). Frames above max_request_pixels and
+// tiles outside the frame are not passed on. Returns false and sets error if the server cannot be reached,
+// rejects the request or answers anything else.
+bool SubmitRenderRequest(std::string const &host, int port, RenderRequest const &request,
+	std::function<void(int, int)> const &accepted, std::function<void(Tile const &, float const *, uint32_t const *)> const &tile,
+	JobTimes &times, std::string &error);
@@ -0,0 +1,400 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <limits>
+
+#include "sphere_store.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PATH_TRACER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PATH_TRACER_X86) && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace {
+	const int max_lanes = 4; // widest double kernel, arrays are padded by this many slots
+	const int max_float_lanes = 8; // widest float kernel, float copies are padded by this many slots
+
+	// The kernels solve t^2*a - 2*t*b + c = 0 with b = d*(center - o) and c = |center - o|^2 - r^2 using
+	// exactly the operations of IntersectSphere, so all kernels of a precision report the same distances.
+	// Rays leave surfaces from offset origins, so every hit at a positive distance counts.
+	template <typename T>
+	int NearestScalar(T const *cx, T const *cy, T const *cz, T const *r2, Ray3D const &ray, int begin, int end, double &t) {
+		T ox = T(ray.origin.x), oy = T(ray.origin.y), oz = T(ray.origin.z);
+		T dx = T(ray.direction.x), dy = T(ray.direction.y), dz = T(ray.direction.z);
+		T a = dx * dx + dy * dy + dz * dz, inv_a = T(1) / a;
+		int res = -1;
+		for (int slot = begin; slot < end; slot++) {
+			T tmp_t = IntersectSphere(cx[slot] - ox, cy[slot] - oy, cz[slot] - oz, r2[slot], dx, dy, dz, a, inv_a);
+			if (tmp_t > T(0) && tmp_t < t) {
+				t = tmp_t;
+				res = slot;
+			}
+		}
+		return res;
+	}
+
+#ifdef PATH_TRACER_X86
+	int NearestSse2(double const *cx, double const *cy, double const *cz, double const *r2, Ray3D const &ray, int begin, int end, double &t) {
+		__m128d ox = _mm_set1_pd(ray.origin.x), oy = _mm_set1_pd(ray.origin.y), oz = _mm_set1_pd(ray.origin.z);
+		__m128d dx = _mm_set1_pd(ray.direction.x), dy = _mm_set1_pd(ray.direction.y), dz = _mm_set1_pd(ray.direction.z);
+		double a_scalar = ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z;
+		__m128d a = _mm_set1_pd(a_scalar), inv_a = _mm_set1_pd(1.0 / a_scalar);
+		__m128d zero = _mm_setzero_pd(), sign_mask = _mm_set1_pd(-0.0);
+		int res = -1;
+		for (int slot = begin; slot < end; slot += 2) {
+			__m128d px = _mm_sub_pd(_mm_loadu_pd(cx + slot), ox);
+			__m128d py = _mm_sub_pd(_mm_loadu_pd(cy + slot), oy);
+			__m128d pz = _mm_sub_pd(_mm_loadu_pd(cz + slot), oz);
+			__m128d rr = _mm_loadu_pd(r2 + slot);
+			__m128d b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, px), _mm_mul_pd(dy, py)), _mm_mul_pd(dz, pz));
+			__m128d k = _mm_mul_pd(b, inv_a);
+			__m128d lx = _mm_sub_pd(px, _mm_mul_pd(dx, k)), ly = _mm_sub_pd(py, _mm_mul_pd(dy, k)), lz = _mm_sub_pd(pz, _mm_mul_pd(dz, k));
+			__m128d det = _mm_mul_pd(a, _mm_sub_pd(rr, _mm_add_pd(_mm_add_pd(_mm_mul_pd(lx, lx), _mm_mul_pd(ly, ly)), _mm_mul_pd(lz, lz))));
+			__m128d hit = _mm_cmpge_pd(det, zero);
+			if (_mm_movemask_pd(hit) == 0) continue;
+			__m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(px, px), _mm_mul_pd(py, py)), _mm_mul_pd(pz, pz)), rr);
+			__m128d s = _mm_sqrt_pd(_mm_max_pd(det, zero));
+			__m128d q = _mm_add_pd(b, _mm_or_pd(_mm_andnot_pd(sign_mask, s), _mm_and_pd(sign_mask, b)));
+			__m128d ta = _mm_div_pd(c, q), tb = _mm_div_pd(q, a);
+			__m128d t0 = _mm_min_pd(ta, tb), t1 = _mm_max_pd(ta, tb);
+			__m128d use_t0 = _mm_cmpgt_pd(t0, zero);
+			__m128d tt = _mm_or_pd(_mm_and_pd(use_t0, t0), _mm_andnot_pd(use_t0, t1));
+			hit = _mm_and_pd(hit, _mm_cmpgt_pd(tt, zero));
+			int mask = _mm_movemask_pd(hit);
+			double lanes[2];
+			_mm_storeu_pd(lanes, tt);
+			for (int lane = 0; lane < 2 && slot + lane < end; lane++) {
+				if ((mask >> lane) & 1 && lanes[lane] < t) {
+					t = lanes[lane];
+					res = slot + lane;
+				}
+			}
+		}
+		return res;
+	}
+
+	int NearestSse2Float(float const *cx, float const *cy, float const *cz, float const *r2, Ray3D const &ray, int begin, int end, double &t) {
+		float dx_scalar = float(ray.direction.x), dy_scalar = float(ray.direction.y), dz_scalar = float(ray.direction.z);
+		float a_scalar = dx_scalar * dx_scalar + dy_scalar * dy_scalar + dz_scalar * dz_scalar;
+		__m128 ox = _mm_set1_ps(float(ray.origin.x)), oy = _mm_set1_ps(float(ray.origin.y)), oz = _mm_set1_ps(float(ray.origin.z));
+		__m128 dx = _mm_set1_ps(dx_scalar), dy = _mm_set1_ps(dy_scalar), dz = _mm_set1_ps(dz_scalar);
+		__m128 a = _mm_set1_ps(a_scalar), inv_a = _mm_set1_ps(1.0f / a_scalar);
+		__m128 zero = _mm_setzero_ps(), sign_mask = _mm_set1_ps(-0.0f);
+		int res = -1;
+		for (int slot = begin; slot < end; slot += 4) {
+			__m128 px = _mm_sub_ps(_mm_loadu_ps(cx + slot), ox);
+			__m128 py = _mm_sub_ps(_mm_loadu_ps(cy + slot), oy);
+			__m128 pz = _mm_sub_ps(_mm_loadu_ps(cz + slot), oz);
+			__m128 rr = _mm_loadu_ps(r2 + slot);
+			__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, px), _mm_mul_ps(dy, py)), _mm_mul_ps(dz, pz));
+			__m128 k = _mm_mul_ps(b, inv_a);
+			__m128 lx = _mm_sub_ps(px, _mm_mul_ps(dx, k)), ly = _mm_sub_ps(py, _mm_mul_ps(dy, k)), lz = _mm_sub_ps(pz, _mm_mul_ps(dz, k));
+			__m128 det = _mm_mul_ps(a, _mm_sub_ps(rr, _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz))));
+			__m128 hit = _mm_cmpge_ps(det, zero);
+			if (_mm_movemask_ps(hit) == 0) continue;
+			__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz)), rr);
+			__m128 s = _mm_sqrt_ps(_mm_max_ps(det, zero));
+			__m128 q = _mm_add_ps(b, _mm_or_ps(_mm_andnot_ps(sign_mask, s), _mm_and_ps(sign_mask, b)));
+			__m128 ta = _mm_div_ps(c, q), tb = _mm_div_ps(q, a);
+			__m128 t0 = _mm_min_ps(ta, tb), t1 = _mm_max_ps(ta, tb);
+			__m128 use_t0 = _mm_cmpgt_ps(t0, zero);
+			__m128 tt = _mm_or_ps(_mm_and_ps(use_t0, t0), _mm_andnot_ps(use_t0, t1));
+			hit = _mm_and_ps(hit, _mm_cmpgt_ps(tt, zero));
+			int mask = _mm_movemask_ps(hit);
+			if (mask == 0) continue;
+			float lanes[4];
+			_mm_storeu_ps(lanes, tt);
+			for (int lane = 0; lane < 4 && slot + lane < end; lane++) {
+				if ((mask >> lane) & 1 && lanes[lane] < t) {
+					t = lanes[lane];
+					res = slot + lane;
+				}
+			}
+		}
+		return res;
+	}
+
+	TARGET_AVX2 int NearestAvx2(double const *cx, double const *cy, double const *cz, double const *r2, Ray3D const &ray, int begin, int end, double &t) {
+		__m256d ox = _mm256_set1_pd(ray.origin.x), oy = _mm256_set1_pd(ray.origin.y), oz = _mm256_set1_pd(ray.origin.z);
+		__m256d dx = _mm256_set1_pd(ray.direction.x), dy = _mm256_set1_pd(ray.direction.y), dz = _mm256_set1_pd(ray.direction.z);
+		double a_scalar = ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z;
+		__m256d a = _mm256_set1_pd(a_scalar), inv_a = _mm256_set1_pd(1.0 / a_scalar);
+		__m256d zero = _mm256_setzero_pd(), sign_mask = _mm256_set1_pd(-0.0);
+		int res = -1;
+		for (int slot = begin; slot < end; slot += 4) {
+			__m256d px = _mm256_sub_pd(_mm256_loadu_pd(cx + slot), ox);
+			__m256d py = _mm256_sub_pd(_mm256_loadu_pd(cy + slot), oy);
+			__m256d pz = _mm256_sub_pd(_mm256_loadu_pd(cz + slot), oz);
+			__m256d rr = _mm256_loadu_pd(r2 + slot);
+			__m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, px), _mm256_mul_pd(dy, py)), _mm256_mul_pd(dz, pz));
+			__m256d k = _mm256_mul_pd(b, inv_a);
+			__m256d lx = _mm256_sub_pd(px, _mm256_mul_pd(dx, k)), ly = _mm256_sub_pd(py, _mm256_mul_pd(dy, k)), lz = _mm256_sub_pd(pz, _mm256_mul_pd(dz, k));
+			__m256d det = _mm256_mul_pd(a, _mm256_sub_pd(rr, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(lx, lx), _mm256_mul_pd(ly, ly)), _mm256_mul_pd(lz, lz))));
+			__m256d hit = _mm256_cmp_pd(det, zero, _CMP_GE_OQ);
+			if (_mm256_movemask_pd(hit) == 0) continue;
+			__m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(px, px), _mm256_mul_pd(py, py)), _mm256_mul_pd(pz, pz)), rr);
+			__m256d s = _mm256_sqrt_pd(_mm256_max_pd(det, zero));
+			__m256d q = _mm256_add_pd(b, _mm256_or_pd(_mm256_andnot_pd(sign_mask, s), _mm256_and_pd(sign_mask, b)));
+			__m256d ta = _mm256_div_pd(c, q), tb = _mm256_div_pd(q, a);
+			__m256d t0 = _mm256_min_pd(ta, tb), t1 = _mm256_max_pd(ta, tb);
+			__m256d tt = _mm256_blendv_pd(t1, t0, _mm256_cmp_pd(t0, zero, _CMP_GT_OQ));
+			hit = _mm256_and_pd(hit, _mm256_cmp_pd(tt, zero, _CMP_GT_OQ));
+			int mask = _mm256_movemask_pd(hit);
+			if (mask == 0) continue;
+			double lanes[4];
+			_mm256_storeu_pd(lanes, tt);
+			for (int lane = 0; lane < 4 && slot + lane < end; lane++) {
+				if ((mask >> lane) & 1 && lanes[lane] < t) {
+					t = lanes[lane];
+					res = slot + lane;
+				}
+			}
+		}
+		return res;
+	}
+
+	TARGET_AVX2 int NearestAvx2Float(float const *cx, float const *cy, float const *cz, float const *r2, Ray3D const &ray, int begin, int end, double &t) {
+		float dx_scalar = float(ray.direction.x), dy_scalar = float(ray.direction.y), dz_scalar = float(ray.direction.z);
+		float a_scalar = dx_scalar * dx_scalar + dy_scalar * dy_scalar + dz_scalar * dz_scalar;
+		__m256 ox = _mm256_set1_ps(float(ray.origin.x)), oy = _mm256_set1_ps(float(ray.origin.y)), oz = _mm256_set1_ps(float(ray.origin.z));
+		__m256 dx = _mm256_set1_ps(dx_scalar), dy = _mm256_set1_ps(dy_scalar), dz = _mm256_set1_ps(dz_scalar);
+		__m256 a = _mm256_set1_ps(a_scalar), inv_a = _mm256_set1_ps(1.0f / a_scalar);
+		__m256 zero = _mm256_setzero_ps(), sign_mask = _mm256_set1_ps(-0.0f);
+		int res = -1;
+		for (int slot = begin; slot < end; slot += 8) {
+			__m256 px = _mm256_sub_ps(_mm256_loadu_ps(cx + slot), ox);
+			__m256 py = _mm256_sub_ps(_mm256_loadu_ps(cy + slot), oy);
+			__m256 pz = _mm256_sub_ps(_mm256_loadu_ps(cz + slot), oz);
+			__m256 rr = _mm256_loadu_ps(r2 + slot);
+			__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, px), _mm256_mul_ps(dy, py)), _mm256_mul_ps(dz, pz));
+			__m256 k = _mm256_mul_ps(b, inv_a);
+			__m256 lx = _mm256_sub_ps(px, _mm256_mul_ps(dx, k)), ly = _mm256_sub_ps(py, _mm256_mul_ps(dy, k)), lz = _mm256_sub_ps(pz, _mm256_mul_ps(dz, k));
+			__m256 det = _mm256_mul_ps(a, _mm256_sub_ps(rr, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz))));
+			__m256 hit = _mm256_cmp_ps(det, zero, _CMP_GE_OQ);
+			if (_mm256_movemask_ps(hit) == 0) continue;
+			__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)), _mm256_mul_ps(pz, pz)), rr);
+			__m256 s = _mm256_sqrt_ps(_mm256_max_ps(det, zero));
+			__m256 q = _mm256_add_ps(b, _mm256_or_ps(_mm256_andnot_ps(sign_mask, s), _mm256_and_ps(sign_mask, b)));
+			__m256 ta = _mm256_div_ps(c, q), tb = _mm256_div_ps(q, a);
+			__m256 t0 = _mm256_min_ps(ta, tb), t1 = _mm256_max_ps(ta, tb);
+			__m256 tt = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, zero, _CMP_GT_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(tt, zero, _CMP_GT_OQ));
+			int mask = _mm256_movemask_ps(hit);
+			if (mask == 0) continue;
+			float lanes[8];
+			_mm256_storeu_ps(lanes, tt);
+			for (int lane = 0; lane < 8 && slot + lane < end; lane++) {
+				if ((mask >> lane) & 1 && lanes[lane] < t) {
+					t = lanes[lane];
+					res = slot + lane;
+				}
+			}
+		}
+		return res;
+	}
+#endif
+
+	NearestKernel GetKernel(SimdLevel level) {
+#ifdef PATH_TRACER_X86
+		if (level == SimdLevel::avx2) return NearestAvx2;
+		if (level == SimdLevel::sse2) return NearestSse2;
+#endif
+		return NearestScalar<double>;
+	}
+
+	NearestKernelF GetFloatKernel(SimdLevel level) {
+#ifdef PATH_TRACER_X86
+		if (level == SimdLevel::avx2) return NearestAvx2Float;
+		if (level == SimdLevel::sse2) return NearestSse2Float;
+#endif
+		return NearestScalar<float>;
+	}
+}
+
+SimdLevel DetectSimdLevel() {
+#ifdef PATH_TRACER_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		if (os_saves_ymm && (info[1] & (1 << 5))) return SimdLevel::avx2;
+	}
+	return SimdLevel::sse2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return SimdLevel::avx2;
+	if (__builtin_cpu_supports("sse2")) return SimdLevel::sse2;
+#endif
+#endif
+	return SimdLevel::scalar;
+}
+
+char const *GetSimdLevelName(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::avx2: return "avx2";
+		case SimdLevel::sse2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+char const *GetPrecisionName(Precision precision) {
+	return precision == Precision::float32 ? "float" : "double";
+}
+
+bool ParsePrecision(std::string const &name, Precision &precision) {
+	if (name == "double") precision = Precision::float64;
+	else if (name == "float") precision = Precision::float32;
+	else return false;
+	return true;
+}
+
+int SphereStore::GetPaddedSize(int size) {
+	return size + max_lanes;
+}
+
+SphereStore::SphereStore() : simd_level(DetectSimdLevel()), precision(Precision::float64), kernel(GetKernel(simd_level)), float_kernel(GetFloatKernel(simd_level)) {
+	Clear();
+}
+
+void SphereStore::Clear() {
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	radius2.clear();
+	float_center_x.clear();
+	float_center_y.clear();
+	float_center_z.clear();
+	float_radius2.clear();
+	arrays.size = 0;
+	Pad();
+}
+
+void SphereStore::Attach(Arrays const &arrays_) {
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	radius2.clear();
+	arrays = arrays_;
+	if (precision == Precision::float32) SetPrecision(precision);
+}
+
+void SphereStore::Pad() {
+	double nan = std::numeric_limits<double>::quiet_NaN();
+	int padded_size = GetPaddedSize(arrays.size);
+	center_x.resize(padded_size, nan);
+	center_y.resize(padded_size, nan);
+	center_z.resize(padded_size, nan);
+	radius2.resize(padded_size, -1.0);
+	arrays.center_x = center_x.data();
+	arrays.center_y = center_y.data();
+	arrays.center_z = center_z.data();
+	arrays.radius2 = radius2.data();
+	if (precision == Precision::float32) PadFloat();
+}
+
+void SphereStore::PadFloat() {
+	float nan = std::numeric_limits<float>::quiet_NaN();
+	int float_size = arrays.size + max_float_lanes;
+	float_center_x.resize(float_size, nan);
+	float_center_y.resize(float_size, nan);
+	float_center_z.resize(float_size, nan);
+	float_radius2.resize(float_size, -1.0f);
+}
+
+void SphereStore::ConvertSlots(int begin, int end) {
+	for (int slot = begin; slot < end; slot++) {
+		float_center_x[slot] = float(arrays.center_x[slot]);
+		float_center_y[slot] = float(arrays.center_y[slot]);
+		float_center_z[slot] = float(arrays.center_z[slot]);
+		float_radius2[slot] = float(arrays.radius2[slot]);
+	}
+}
+
+void SphereStore::SetPrecision(Precision precision_) {
+	precision = precision_;
+	float_center_x.clear();
+	float_center_y.clear();
+	float_center_z.clear();
+	float_radius2.clear();
+	if (precision == Precision::float32) {
+		PadFloat();
+		ConvertSlots(0, arrays.size);
+	}
+}
+
+void SphereStore::AddSphere(Vector3D const &center, double radius) {
+	int slot = arrays.size;
+	center_x[slot] = center.x;
+	center_y[slot] = center.y;
+	center_z[slot] = center.z;
+	radius2[slot] = radius * radius;
+	arrays.size++;
+	Pad();
+	if (precision == Precision::float32) ConvertSlots(slot, slot + 1);
+}
+
+void SphereStore::SetSphere(int slot, Vector3D const &center, double radius) {
+	center_x[slot] = center.x;
+	center_y[slot] = center.y;
+	center_z[slot] = center.z;
+	radius2[slot] = radius * radius;
+	if (precision == Precision::float32) ConvertSlots(slot, slot + 1);
+}
+
+void SphereStore::AddEmpty() {
+	arrays.size++;
+	Pad();
+}
+
+void SphereStore::SetSimdLevel(SimdLevel level) {
+	SimdLevel supported = DetectSimdLevel();
+	simd_level = int(level) <= int(supported) ? level : supported;
+	kernel = GetKernel(simd_level);
+	float_kernel = GetFloatKernel(simd_level);
+}
+
+int SphereStore::GetSimdWidth() const {
+	int width = simd_level == SimdLevel::avx2 ? 4 : simd_level == SimdLevel::sse2 ? 2 : 1;
+	// float vectors hold twice as many lanes
+	return precision == Precision::float32 && width > 1 ? 2 * width : width;
+}
+
+int SphereStore::IntersectNearest(Ray3D const &ray, int begin, int end, double &t) const {
+	if (precision == Precision::float32) {
+		return float_kernel(float_center_x.data(), float_center_y.data(), float_center_z.data(), float_radius2.data(), ray, begin, end, t);
+	}
+	return kernel(arrays.center_x, arrays.center_y, arrays.center_z, arrays.radius2, ray, begin, end, t);
+}
+
+bool SphereStore::IntersectAny(Ray3D const &ray, int begin, int end, double t_max) const {
+	double t = t_max;
+	return IntersectNearest(ray, begin, end, t) >= 0;
+}
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "utils.h"
+
+// instruction sets the intersection kernels can use
+enum class SimdLevel { scalar, sse2, avx2 };
+
+// best instruction set supported by the CPU we are running on
+SimdLevel DetectSimdLevel();
+char const *GetSimdLevelName(SimdLevel level);
+
+// floating point type the ray-sphere kernels compute with
+enum class Precision { float64, float32 };
+
+char const *GetPrecisionName(Precision precision);
+// parse "double" or "float", returns false for anything else
+bool ParsePrecision(std::string const &name, Precision &precision);
+// relative rounding error of one operation in the precision
+inline double GetUnitRoundoff(Precision precision) {
+	return 0.5 * (precision == Precision::float32 ? std::numeric_limits<float>::epsilon() : std::numeric_limits<double>::epsilon());
+}
+
+typedef int (*NearestKernel)(double const *cx, double const *cy, double const *cz, double const *r2, Ray3D const &ray, int begin, int end, double &t);
+typedef int (*NearestKernelF)(float const *cx, float const *cy, float const *cz, float const *r2, Ray3D const &ray, int begin, int end, double &t);
+
+// Structure-of-arrays copy of sphere geometry for the vectorized ray-sphere kernels.
+// Slots that hold no sphere (other kinds of objects, padding) have NaN centers and never report a hit.
+// The kernel is picked once by CPU feature detection; SSE2 tests 2 spheres and AVX2 4 spheres per instruction.
+// In single precision the kernels read float copies of the arrays, half the bytes per sphere, and test twice
+// as many spheres per instruction; the distances they report are then rounded to float.
+class SphereStore {
+	public:
+		// the four coordinate arrays, each of GetPaddedSize(size) elements
+		struct Arrays {
+			double const *center_x, *center_y, *center_z, *radius2;
+			int size;
+		};
+		// number of elements the arrays of a store of size slots have
+		static int GetPaddedSize(int size);
+
+		SphereStore();
+		void Clear();
+		// use arrays kept elsewhere (e.g. in a memory-mapped file) without copying them, padding included.
+		// They must outlive the store or the next Clear.
+		void Attach(Arrays const &arrays_);
+		Arrays const &GetArrays() const { return arrays; }
+		// append a sphere or an empty slot
+		void AddSphere(Vector3D const &center, double radius);
+		void AddEmpty();
+		// move the sphere of a slot, the arrays must not be attached
+		void SetSphere(int slot, Vector3D const &center, double radius);
+		bool IsAttached() const { return arrays.center_x != center_x.data(); }
+		int Size() const { return arrays.size; }
+		bool IsSphere(int slot) const { return arrays.radius2[slot] >= 0.0; }
+
+		// nearest sphere among slots [begin, end) hit closer than t, returns the slot or -1 and updates t
+		int IntersectNearest(Ray3D const &ray, int begin, int end, double &t) const;
+		// whether any sphere among slots [begin, end) is hit closer than t_max
+		bool IntersectAny(Ray3D const &ray, int begin, int end, double t_max) const;
+
+		SimdLevel GetSimdLevel() const { return simd_level; }
+		// number of spheres the selected kernel tests at once
+		int GetSimdWidth() const;
+		// force a kernel, a level the CPU does not support falls back to the detected one
+		void SetSimdLevel(SimdLevel level);
+		Precision GetPrecision() const { return precision; }
+		// select the precision of the kernels, the float copies of the arrays are made or dropped
+		void SetPrecision(Precision precision_);
+
+	private:
+		void Pad();
+		// pad the float copies to the size of the arrays
+		void PadFloat();
+		// fill the float copies of slots [begin, end) of the arrays
+		void ConvertSlots(int begin, int end);
+
+		// arrays are padded with empty slots so that the kernels may always load full vectors
+		std::vector<double> center_x, center_y, center_z, radius2;
+		// the kernels read the vectors above or attached arrays through these pointers
+		Arrays arrays;
+		// float copies of the arrays in single precision, padding included
+		std::vector<float> float_center_x, float_center_y, float_center_z, float_radius2;
+		SimdLevel simd_level;
+		Precision precision;
+		NearestKernel kernel;
+		NearestKernelF float_kernel;
+};
@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include "stats.h"
+
+namespace {
+	std::mutex registry_mutex;
+	std::vector<std::unique_ptr<StatsBlock>> blocks;
+	std::atomic<bool> tracing(false);
+	const std::chrono::steady_clock::time_point clock_start = std::chrono::steady_clock::now();
+
+	void ClearBlock(StatsBlock &block) {
+		memset(block.counters, 0, sizeof(block.counters));
+		memset(block.vertices_by_depth, 0, sizeof(block.vertices_by_depth));
+		block.events.clear();
+	}
+
+	double Ratio(uint64_t numerator, uint64_t denominator) {
+		return denominator ? double(numerator) / double(denominator) : 0.0;
+	}
+}
+
+char const *GetCounterName(Counter counter) {
+	switch (counter) {
+		case Counter::samples: return "samples";
+		case Counter::nearest_rays: return "nearest_rays";
+		case Counter::nearest_misses: return "nearest_misses";
+		case Counter::shadow_rays: return "shadow_rays";
+		case Counter::shadow_occluded: return "shadow_occluded";
+		case Counter::bvh_nodes: return "bvh_nodes";
+		case Counter::slot_tests: return "slot_tests";
+		case Counter::triangle_tests: return "triangle_tests";
+		case Counter::roulette_tests: return "roulette_tests";
+		case Counter::roulette_terminations: return "roulette_terminations";
+		case Counter::diffuse_hits: return "diffuse_hits";
+		case Counter::specular_hits: return "specular_hits";
+		case Counter::refracture_hits: return "refracture_hits";
+		default: return "unknown";
+	}
+}
+
+StatsBlock &RegisterStatsBlock() {
+	std::unique_ptr<StatsBlock> block_ptr(new StatsBlock());
+	ClearBlock(*block_ptr);
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	block_ptr->thread_id = int(blocks.size());
+	blocks.push_back(std::move(block_ptr));
+	return *blocks.back();
+}
+
+int64_t GetStatsClockNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - clock_start).count();
+}
+
+bool IsStatsEnabled() {
+#ifdef PATH_TRACER_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
+void SetTracing(bool enabled) {
+	tracing = enabled;
+}
+
+bool IsTracing() {
+	return tracing.load(std::memory_order_relaxed);
+}
+
+void ResetStats() {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (auto &block_ptr : blocks) ClearBlock(*block_ptr);
+}
+
+StatsSnapshot CollectStats() {
+	StatsSnapshot snapshot;
+	memset(snapshot.counters, 0, sizeof(snapshot.counters));
+	memset(snapshot.vertices_by_depth, 0, sizeof(snapshot.vertices_by_depth));
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (auto const &block_ptr : blocks) {
+		for (int i = 0; i < int(Counter::count); i++) snapshot.counters[i] += block_ptr->counters[i];
+		for (int i = 0; i < stats_depth_bins; i++) snapshot.vertices_by_depth[i] += block_ptr->vertices_by_depth[i];
+		snapshot.nearest_rays_by_thread.push_back(block_ptr->counters[int(Counter::nearest_rays)]);
+		for (TraceEvent const &event : block_ptr->events) snapshot.events.emplace_back(block_ptr->thread_id, event);
+	}
+	std::sort(snapshot.events.begin(), snapshot.events.end(), [](std::pair<int, TraceEvent> const &a, std::pair<int, TraceEvent> const &b) {
+		return a.second.start_ns < b.second.start_ns;
+	});
+	return snapshot;
+}
+
+bool WriteStatsJson(std::string const &path, StatsSnapshot const &snapshot, std::string &error) {
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		error = "cannot write " + path;
+		return false;
+	}
+	uint64_t const *c = snapshot.counters;
+	auto get = [c](Counter counter) { return c[int(counter)]; };
+	fprintf(file, "{\n  \"enabled\": %s,\n  \"counters\": {", IsStatsEnabled() ? "true" : "false");
+	for (int i = 0; i < int(Counter::count); i++) {
+		fprintf(file, "%s\n    \"%s\": %llu", i ? "," : "", GetCounterName(Counter(i)), (unsigned long long)c[i]);
+	}
+
+	uint64_t rays = get(Counter::nearest_rays) + get(Counter::shadow_rays);
+	uint64_t hits = get(Counter::diffuse_hits) + get(Counter::specular_hits) + get(Counter::refracture_hits);
+	uint64_t vertices = 0;
+	for (uint64_t count : snapshot.vertices_by_depth) vertices += count;
+	fprintf(file, "\n  },\n  \"derived\": {\n");
+	fprintf(file, "    \"rays\": %llu,\n", (unsigned long long)rays);
+	fprintf(file, "    \"rays_per_sample\": %.4f,\n", Ratio(rays, get(Counter::samples)));
+	fprintf(file, "    \"bvh_nodes_per_ray\": %.4f,\n", Ratio(get(Counter::bvh_nodes), rays));
+	fprintf(file, "    \"slot_tests_per_ray\": %.4f,\n", Ratio(get(Counter::slot_tests), rays));
+	fprintf(file, "    \"triangle_tests_per_ray\": %.4f,\n", Ratio(get(Counter::triangle_tests), rays));
+	fprintf(file, "    \"miss_rate\": %.4f,\n", Ratio(get(Counter::nearest_misses), get(Counter::nearest_rays)));
+	fprintf(file, "    \"shadow_occlusion_rate\": %.4f,\n", Ratio(get(Counter::shadow_occluded), get(Counter::shadow_rays)));
+	fprintf(file, "    \"mean_path_vertices\": %.4f,\n", Ratio(vertices, get(Counter::samples)));
+	fprintf(file, "    \"roulette_termination_rate\": %.4f,\n", Ratio(get(Counter::roulette_terminations), get(Counter::roulette_tests)));
+	fprintf(file, "    \"material_split\": {\"diffuse\": %.4f, \"specular\": %.4f, \"refracture\": %.4f}\n",
+		Ratio(get(Counter::diffuse_hits), hits), Ratio(get(Counter::specular_hits), hits), Ratio(get(Counter::refracture_hits), hits));
+
+	fprintf(file, "  },\n  \"vertices_by_depth\": [");
+	for (int i = 0; i < stats_depth_bins; i++) fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)snapshot.vertices_by_depth[i]);
+	fprintf(file, "],\n  \"nearest_rays_by_thread\": [");
+	for (size_t i = 0; i < snapshot.nearest_rays_by_thread.size(); i++) fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)snapshot.nearest_rays_by_thread[i]);
+
+	// timers are summed by name, in the order of their first occurrence
+	struct TimerTotal {
+		char const *category;
+		int count = 0;
+		int64_t total_ns = 0, max_ns = 0;
+	};
+	std::vector<std::string> timer_names;
+	std::map<std::string, TimerTotal> timers;
+	for (auto const &entry : snapshot.events) {
+		TraceEvent const &event = entry.second;
+		if (!timers.count(event.name)) timer_names.push_back(event.name);
+		TimerTotal &total = timers[event.name];
+		total.category = event.category;
+		total.count++;
+		total.total_ns += event.duration_ns;
+		total.max_ns = std::max(total.max_ns, event.duration_ns);
+	}
+	fprintf(file, "],\n  \"timers\": [");
+	for (size_t i = 0; i < timer_names.size(); i++) {
+		TimerTotal const &total = timers[timer_names[i]];
+		fprintf(file, "%s\n    {\"name\": \"%s\", \"category\": \"%s\", \"count\": %d, \"total_ms\": %.3f, \"mean_ms\": %.3f, \"max_ms\": %.3f}",
+			i ? "," : "", timer_names[i].c_str(), total.category, total.count, total.total_ns * 1e-6, total.total_ns * 1e-6 / total.count, total.max_ns * 1e-6);
+	}
+	fprintf(file, "\n  ]\n}\n");
+	if (fclose(file) != 0) {
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool WriteChromeTrace(std::string const &path, StatsSnapshot const &snapshot, std::string &error) {
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		error = "cannot write " + path;
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	int thread_count = int(snapshot.nearest_rays_by_thread.size());
+	for (int thread = 0; thread < thread_count; thread++) {
+		fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}", thread ? "," : "", thread, thread);
+	}
+	for (size_t i = 0; i < snapshot.events.size(); i++) {
+		TraceEvent const &event = snapshot.events[i].second;
+		fprintf(file, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+			i || thread_count ? "," : "", event.name, event.category, snapshot.events[i].first, event.start_ns * 1e-3, event.duration_ns * 1e-3);
+		if (event.tile_x0 >= 0) fprintf(file, ", \"args\": {\"x0\": %d, \"y0\": %d}", event.tile_x0, event.tile_y0);
+		fprintf(file, "}");
+	}
+	fprintf(file, "\n]}\n");
+	if (fclose(file) != 0) {
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
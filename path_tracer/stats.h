@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Render statistics. Counters live in one block per thread, padded by a cache line on both sides so that
+// threads never write to the same line, and are only summed by CollectStats after the work is done.
+// They are compiled in with PATH_TRACER_STATS (cmake -DPATH_TRACER_STATS=ON); without it the STATS_ macros
+// expand to nothing and the hot paths are the same as without instrumentation.
+enum class Counter {
+	samples, // camera samples traced
+	nearest_rays, // nearest-hit queries: camera and bounce rays
+	nearest_misses, // nearest-hit queries that left the scene
+	shadow_rays, // any-hit queries of light sampling
+	shadow_occluded, // any-hit queries that found an occluder
+	bvh_nodes, // nodes visited by traversals of the scene and mesh hierarchies
+	slot_tests, // objects tested by leaves or linear scans, spheres are tested in vectors
+	triangle_tests, // triangles tested by mesh leaves
+	roulette_tests, // bounces past the maximal depth that played Russian roulette
+	roulette_terminations, // paths Russian roulette ended
+	diffuse_hits, // shaded hits by material
+	specular_hits,
+	refracture_hits,
+	count
+};
+const int stats_depth_bins = 32; // vertices deeper than this go to the last bin
+
+char const *GetCounterName(Counter counter);
+
+// one span of the Chrome trace, tile_x0 and tile_y0 are -1 for spans that are not tiles
+struct TraceEvent {
+	char const *name;
+	char const *category;
+	int64_t start_ns, duration_ns; // since the first use of the statistics
+	int tile_x0, tile_y0;
+};
+
+struct StatsBlock {
+	char padding_front[64];
+	uint64_t counters[int(Counter::count)];
+	uint64_t vertices_by_depth[stats_depth_bins]; // shaded path vertices at depth 1, 2, ...
+	int thread_id; // order in which threads first recorded anything
+	std::vector<TraceEvent> events;
+	char padding_back[64];
+
+	void RecordDepth(int depth) { vertices_by_depth[depth < 1 ? 0 : depth > stats_depth_bins ? stats_depth_bins - 1 : depth - 1]++; }
+};
+
+// create the block of the calling thread, which is kept for the life of the program
+StatsBlock &RegisterStatsBlock();
+inline StatsBlock &GetThreadStatsBlock() {
+	static thread_local StatsBlock *block_ptr = nullptr;
+	if (block_ptr == nullptr) block_ptr = &RegisterStatsBlock();
+	return *block_ptr;
+}
+int64_t GetStatsClockNs();
+
+// sums of the counters of all threads and the events of all threads, taken while no thread records anything
+struct StatsSnapshot {
+	uint64_t counters[int(Counter::count)];
+	uint64_t vertices_by_depth[stats_depth_bins];
+	std::vector<uint64_t> nearest_rays_by_thread;
+	std::vector<std::pair<int, TraceEvent>> events; // thread id and event
+};
+
+// whether the build records anything
+bool IsStatsEnabled();
+// timers record trace events only while tracing is on, counters are always recorded
+void SetTracing(bool enabled);
+bool IsTracing();
+void ResetStats();
+StatsSnapshot CollectStats();
+// summary of the counters with derived ratios, the depth histogram and per-phase timer totals
+bool WriteStatsJson(std::string const &path, StatsSnapshot const &snapshot, std::string &error);
+// Chrome trace event format, open it in chrome://tracing or https://ui.perfetto.dev
+bool WriteChromeTrace(std::string const &path, StatsSnapshot const &snapshot, std::string &error);
+
+// records the time from construction to destruction as a trace event of the calling thread
+class ScopedTimer {
+	public:
+		ScopedTimer(char const *name_, char const *category_, int tile_x0_ = -1, int tile_y0_ = -1) :
+			name(name_), category(category_), tile_x0(tile_x0_), tile_y0(tile_y0_), start_ns(IsTracing() ? GetStatsClockNs() : -1) {}
+		~ScopedTimer() {
+			if (start_ns < 0) return;
+			TraceEvent event = { name, category, start_ns, GetStatsClockNs() - start_ns, tile_x0, tile_y0 };
+			GetThreadStatsBlock().events.push_back(event);
+		}
+
+	private:
+		char const *name, *category;
+		int tile_x0, tile_y0;
+		int64_t start_ns;
+};
+
+#define STATS_CONCAT_INNER(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_INNER(a, b)
+#ifdef PATH_TRACER_STATS
+#define STATS_ADD(counter, n) (GetThreadStatsBlock().counters[int(counter)] += uint64_t(n))
+#define STATS_DEPTH(depth) GetThreadStatsBlock().RecordDepth(depth)
+#define STATS_TIMER(name, category) ScopedTimer STATS_CONCAT(stats_timer_, __LINE__)(name, category)
+#define STATS_TILE_TIMER(tile) ScopedTimer STATS_CONCAT(stats_timer_, __LINE__)("tile", "tile", (tile).x0, (tile).y0)
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_DEPTH(depth) ((void)0)
+#define STATS_TIMER(name, category) ((void)0)
+#define STATS_TILE_TIMER(tile) ((void)0)
+#endif
+#define STATS_COUNT(counter) STATS_ADD(counter, 1)
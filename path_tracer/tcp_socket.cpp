@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstring>
+#include <mutex>
+
+#include "tcp_socket.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+typedef int socklen_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	const intptr_t invalid_handle = -1;
+
+#ifdef _WIN32
+	void InitializeSockets() {
+		static std::once_flag once;
+		std::call_once(once, []() {
+			WSADATA data;
+			WSAStartup(MAKEWORD(2, 2), &data);
+		});
+	}
+
+	void CloseSocketHandle(intptr_t handle) {
+		closesocket(SOCKET(handle));
+	}
+#else
+	void InitializeSockets() {}
+
+	void CloseSocketHandle(intptr_t handle) {
+		close(int(handle));
+	}
+#endif
+
+	// send without raising SIGPIPE when the peer is gone, the failure is reported by the return value
+#ifdef MSG_NOSIGNAL
+	const int send_flags = MSG_NOSIGNAL;
+#else
+	const int send_flags = 0;
+#endif
+}
+
+TcpSocket::TcpSocket() : handle(invalid_handle) {}
+
+TcpSocket::~TcpSocket() {
+	Close();
+}
+
+bool TcpSocket::Listen(int port, std::string &error, bool loopback_only) {
+	Close();
+	InitializeSockets();
+	handle = intptr_t(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+	if (handle == invalid_handle) {
+		error = "cannot create a socket";
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const *>(&reuse), sizeof(reuse));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+	address.sin_port = htons(uint16_t(port));
+	if (bind(handle, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0 || listen(handle, 64) != 0) {
+		error = "cannot listen on port " + std::to_string(port);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool TcpSocket::Connect(std::string const &host, int port, std::string &error) {
+	Close();
+	InitializeSockets();
+	addrinfo hints, *addresses = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		error = "cannot resolve " + host;
+		return false;
+	}
+	for (addrinfo *address = addresses; address != nullptr; address = address->ai_next) {
+		handle = intptr_t(socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+		if (handle == invalid_handle) continue;
+		if (connect(handle, address->ai_addr, socklen_t(address->ai_addrlen)) == 0) break;
+		Close();
+	}
+	freeaddrinfo(addresses);
+	if (handle == invalid_handle) {
+		error = "cannot connect to " + host + ":" + std::to_string(port);
+		return false;
+	}
+	// messages are written whole, do not hold back their tails
+	int no_delay = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const *>(&no_delay), sizeof(no_delay));
+	return true;
+}
+
+bool TcpSocket::WaitReadable(double timeout_seconds) const {
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(handle, &readable);
+	timeval timeout;
+	timeout.tv_sec = long(timeout_seconds);
+	timeout.tv_usec = long((timeout_seconds - double(timeout.tv_sec)) * 1e6);
+	return select(int(handle + 1), &readable, nullptr, nullptr, &timeout) > 0;
+}
+
+bool TcpSocket::Accept(TcpSocket &connection) const {
+	connection.Close();
+	connection.handle = intptr_t(accept(handle, nullptr, nullptr));
+	if (connection.handle == invalid_handle) return false;
+	int no_delay = 1;
+	setsockopt(connection.handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const *>(&no_delay), sizeof(no_delay));
+	return true;
+}
+
+void TcpSocket::SetReceiveTimeout(double seconds) {
+#ifdef _WIN32
+	DWORD timeout = DWORD(seconds * 1000.0);
+#else
+	timeval timeout;
+	timeout.tv_sec = long(seconds);
+	timeout.tv_usec = long((seconds - double(timeout.tv_sec)) * 1e6);
+#endif
+	setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char const *>(&timeout), sizeof(timeout));
+}
+
+bool TcpSocket::Send(void const *data, size_t size) const {
+	char const *bytes = static_cast<char const *>(data);
+	while (size > 0) {
+		int chunk = int(size < (1 << 30) ? size : (1 << 30));
+		int sent = int(send(handle, bytes, chunk, send_flags));
+		if (sent <= 0) return false;
+		bytes += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+bool TcpSocket::Receive(void *data, size_t size) const {
+	char *bytes = static_cast<char *>(data);
+	while (size > 0) {
+		int chunk = int(size < (1 << 30) ? size : (1 << 30));
+		int received = int(recv(handle, bytes, chunk, 0));
+		if (received <= 0) return false; // closed, failed or timed out
+		bytes += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+int TcpSocket::GetPort() const {
+	sockaddr_in address;
+	socklen_t length = sizeof(address);
+	if (getsockname(handle, reinterpret_cast<sockaddr *>(&address), &length) != 0) return 0;
+	return ntohs(address.sin_port);
+}
+
+bool TcpSocket::IsOpen() const {
+	return handle != invalid_handle;
+}
+
+void TcpSocket::Close() {
+	if (handle != invalid_handle) CloseSocketHandle(handle);
+	handle = invalid_handle;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Blocking TCP socket: a listening socket of the coordinator or the render server, or a connection to one.
+// Send and Receive transfer whole buffers and fail when the peer closes the connection or dies.
+class TcpSocket {
+	public:
+		TcpSocket();
+		~TcpSocket();
+		// listen on port of all interfaces or only of the loopback one, port 0 picks a free one (see GetPort)
+		bool Listen(int port, std::string &error, bool loopback_only = false);
+		bool Connect(std::string const &host, int port, std::string &error);
+		// wait until a connection can be accepted or data can be read, false on timeout
+		bool WaitReadable(double timeout_seconds) const;
+		bool Accept(TcpSocket &connection) const;
+		// make Receive fail when no data arrives for that long, 0 waits forever
+		void SetReceiveTimeout(double seconds);
+		bool Send(void const *data, size_t size) const;
+		bool Receive(void *data, size_t size) const;
+		int GetPort() const;
+		bool IsOpen() const;
+		void Close();
+	private:
+		// copying is not allowed
+		TcpSocket(TcpSocket const &other);
+		TcpSocket &operator=(TcpSocket const &other);
+
+		intptr_t handle; // SOCKET on Windows, a file descriptor elsewhere
+};
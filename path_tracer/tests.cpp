@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Regression tests of the renderer library, run by ctest: path_tracer_tests [test name]
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+
+#include "bvh.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "camera.h"
+#include "render.h"
+#include "image_writer.h"
+
+namespace {
+	bool Check(bool condition, char const *what) {
+		if (!condition) std::cerr << "  failed: " << what << std::endl;
+		return condition;
+	}
+
+	// largest number of inner ancestors of an inner node, which must stay below the traversal stack capacity
+	int GetMaxInnerDepth(BVH const &bvh) {
+		BVH::Node const *nodes = bvh.GetNodes();
+		std::vector<int> depths(bvh.GetNodeCount(), 0);
+		int max_depth = 0;
+		for (int i = 0; i < bvh.GetNodeCount(); i++) {
+			if (nodes[i].count > 0) continue;
+			max_depth = std::max(max_depth, depths[i]);
+			depths[i + 1] = depths[nodes[i].offset] = depths[i] + 1;
+		}
+		return max_depth;
+	}
+
+	// spheres at z = 16^i: every SAH split peels off the farthest one, a chain as deep as the scene is large
+	void AddSphereChain(Scene &scene, int count) {
+		for (int i = 0; i < count; i++) {
+			scene.AddSphere(5, Vector3D(0, 0, std::pow(16.0, i)), Object::Material::diffuse, Vector3D(.5, .5, .5), Vector3D());
+		}
+	}
+
+	bool CheckChainScene(Scene const &scene) {
+		bool ok = Check(GetMaxInnerDepth(scene.GetBVH()) < BVH::stack_capacity, "BVH depth within the traversal stack");
+		double t;
+		Object const *hit_ptr = scene.IntersectWithNearestObject(Ray3D(Vector3D(0, 0, -200), Vector3D(0, 0, 1)), t);
+		ok &= Check(hit_ptr == scene.GetObject(0) && std::fabs(t - 196.0) < 1e-6, "nearest sphere hit");
+		ok &= Check(scene.IntersectWithAnyObject(Ray3D(Vector3D(0, 0, -200), Vector3D(0, 0, 1)), 1e300), "any hit");
+		return ok;
+	}
+
+	bool TestBvhDepthLimit() {
+		bool ok = true;
+		// the shared builder alone, also used by meshes
+		std::vector<BoundingBox> bounds(149);
+		for (int i = 0; i < int(bounds.size()); i++) {
+			bounds[i].Extend(Vector3D(-5, -5, std::pow(16.0, i) - 5));
+			bounds[i].Extend(Vector3D(5, 5, std::pow(16.0, i) + 5));
+		}
+		BVH bvh;
+		bvh.Build(bounds);
+		ok &= Check(GetMaxInnerDepth(bvh) < BVH::stack_capacity, "builder depth within the traversal stack");
+		ok &= Check(bvh.GetPrimitiveCount() == int(bounds.size()), "every primitive in a leaf");
+
+		Scene scene;
+		AddSphereChain(scene, 149);
+		scene.Build();
+		ok &= CheckChainScene(scene);
+
+		// the binary scene loader rejects hierarchies deeper than the stack
+		SceneDescription description;
+		std::string path = "path_tracer_tests_chain.bin", error;
+		ok &= Check(SaveBinaryScene(path, scene, description, error), "binary scene saved");
+		Scene loaded;
+		bool loaded_ok = LoadBinaryScene(path, loaded, description, error);
+		ok &= Check(loaded_ok, "binary scene loaded");
+		if (loaded_ok) ok &= CheckChainScene(loaded);
+		std::remove(path.c_str());
+		return ok;
+	}
+
+	// largest channel of a PFM file, -1 if it cannot be read
+	float GetPfmMaximum(std::string const &path) {
+		std::ifstream file(path, std::ios::binary);
+		std::string magic;
+		int width = 0, height = 0;
+		double scale = 0.0;
+		file >> magic >> width >> height >> scale;
+		file.get();
+		if (!file || magic != "PF" || width <= 0 || height <= 0) return -1.0f;
+		std::vector<float> data(3 * size_t(width) * height);
+		if (!file.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float))) return -1.0f;
+		return *std::max_element(data.begin(), data.end());
+	}
+
+	// fixed-spp renders to PFM, in memory or streamed, keep the radiance above 1 (the light seen through the
+	// ceiling), BMP stays clamped
+	bool TestPfmHighDynamicRange() {
+		Scene scene;
+		bool ok = Check(CreateBuiltinScene("cornell", scene), "cornell scene");
+		SceneDescription description;
+		int width = 32, height = 32;
+		Camera camera(description.camera_origin, description.camera_direction, width, height);
+		std::vector<Vector3D> image(width * height);
+		ImageWriter writer;
+
+		std::string path = "path_tracer_tests_hdr.pfm";
+		RenderSettings settings;
+		settings.report_progress = false;
+		settings.clamp_subpixels = GetImageFormat(path) != ImageFormat::pfm;
+		RenderImage(scene, camera, settings, image.data());
+		ok &= Check(writer.Write(path, image.data(), width, height), "PFM written");
+		ok &= Check(GetPfmMaximum(path) > 1.0f, "PFM values above 1");
+		std::remove(path.c_str());
+
+		// the same for rows streamed to the file
+		ImageStream stream;
+		std::string error;
+		ok &= Check(stream.Open(path, width, height, error), "PFM stream opened");
+		ok &= Check(RenderImageStreamed(scene, camera, settings, stream) && stream.Close(), "PFM streamed");
+		ok &= Check(GetPfmMaximum(path) > 1.0f, "streamed PFM values above 1");
+		std::remove(path.c_str());
+
+		settings.clamp_subpixels = GetImageFormat("z_out.bmp") != ImageFormat::pfm;
+		RenderImage(scene, camera, settings, image.data());
+		double maximum = 0.0;
+		for (Vector3D const &pixel : image) maximum = std::max(maximum, std::max(pixel.x, std::max(pixel.y, pixel.z)));
+		ok &= Check(maximum <= 1.0, "8-bit path clamped");
+		return ok;
+	}
+
+	struct Test {
+		char const *name;
+		bool (*run)();
+	};
+	Test const tests[] = {
+		{ "bvh_depth_limit", TestBvhDepthLimit },
+		{ "pfm_high_dynamic_range", TestPfmHighDynamicRange },
+	};
+}
+
+int main(int argc, char *argv[]) {
+	int failed = 0, run = 0;
+	for (Test const &test : tests) {
+		if (argc > 1 && test.name != std::string(argv[1])) continue;
+		run++;
+		bool ok = test.run();
+		std::cout << (ok ? "passed " : "FAILED ") << test.name << std::endl;
+		if (!ok) failed++;
+	}
+	if (run == 0) {
+		std::cerr << "Unknown test " << argv[1] << std::endl;
+		return 1;
+	}
+	return failed > 0 ? 1 : 0;
+}
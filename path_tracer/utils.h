@@ -20,30 +20,76 @@ THE SOFTWARE.
 #pragma once
 
 #include <cmath>
+#include <limits>
+#include <algorithm>
 
-class Vector3D {
-public:
-	// constructor
-	Vector3D(double xx = 0.0, double yy = 0.0, double zz = 0.0) : x(xx), y(yy), z(zz) {}
-	// copy contructor
-	Vector3D(Vector3D const &other) : x(other.x), y(other.y), z(other.z) {}
-	// destructor
-	virtual ~Vector3D() {}
-	// operations
-	Vector3D& operator= (Vector3D const & other);
-	Vector3D operator+ (Vector3D const &other) const;
-	Vector3D operator- (Vector3D const &other) const;
-	Vector3D operator* (double scalar) const;
-	Vector3D mult(Vector3D const &other) const;
-	Vector3D& norm();
-	double dot(Vector3D const& other) const;
-	Vector3D operator% (Vector3D const& other) const;
-	double x, y, z;
-};
+#include "vector3d.h"
 
 struct Ray3D {
 	Vector3D origin, direction;
+	Ray3D() {}
 	Ray3D(Vector3D origin_, Vector3D direction_) : origin(origin_), direction(direction_) {}
 };
 
-int WriteImageToBmp(Vector3D const *image, int width, int height);
+// axis-aligned bounding box
+struct BoundingBox {
+	Vector3D min, max;
+	// empty box
+	BoundingBox() : min(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()),
+		max(-std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max()) {}
+	BoundingBox(Vector3D min_, Vector3D max_) : min(min_), max(max_) {}
+	void Extend(BoundingBox const &other) {
+		min = Vector3D(std::min(min.x, other.min.x), std::min(min.y, other.min.y), std::min(min.z, other.min.z));
+		max = Vector3D(std::max(max.x, other.max.x), std::max(max.y, other.max.y), std::max(max.z, other.max.z));
+	}
+	void Extend(Vector3D const &point) { Extend(BoundingBox(point, point)); }
+	Vector3D Center() const { return (min + max) * 0.5; }
+	double SurfaceArea() const {
+		Vector3D d = max - min;
+		if (d.x < 0.0 || d.y < 0.0 || d.z < 0.0) return 0.0;
+		return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+	// slab test of a ray against the box within [0, t_max], t_near is the entry distance
+	bool Intersect(Ray3D const &ray, Vector3D const &inv_direction, double t_max, double &t_near) const {
+		double tx1 = (min.x - ray.origin.x) * inv_direction.x, tx2 = (max.x - ray.origin.x) * inv_direction.x;
+		double ty1 = (min.y - ray.origin.y) * inv_direction.y, ty2 = (max.y - ray.origin.y) * inv_direction.y;
+		double tz1 = (min.z - ray.origin.z) * inv_direction.z, tz2 = (max.z - ray.origin.z) * inv_direction.z;
+		double t0 = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.0));
+		double t1 = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), t_max));
+		t_near = t0;
+		return t0 <= t1;
+	}
+};
+
+// largest absolute value of the components of a vector, the scale of the rounding errors of computing with it
+inline double MaxMagnitude(Vector3D const &v) {
+	return std::max(std::max(std::fabs(v.x), std::fabs(v.y)), std::fabs(v.z));
+}
+
+// Origin of a ray leaving a surface point in direction: the point moved by offset along the normal to the side
+// the ray leaves to. With an offset larger than the rounding error of the point the ray does not hit the surface
+// it starts from again, whatever the scale of the scene.
+inline Vector3D OffsetRayOrigin(Vector3D const &point, Vector3D const &normal, Vector3D const &direction, double offset) {
+	return point + normal * (normal.dot(direction) < 0.0 ? -offset : offset);
+}
+
+// Nearest hit of a ray with a sphere at distance > 0, 0 for a miss: p is the center relative to the ray origin,
+// d the ray direction, a = d*d. This solves t^2*a - 2*t*b + c = 0 with b = d*p and c = p*p - r2 in a form that
+// stays accurate for huge spheres: the discriminant b^2 - a*c is a * (r2 - |p - d*b/a|^2) with the squared
+// distance of the center from the ray, which does not cancel, and the roots are c/q and q/a with
+// q = b + sign(b) * sqrt(discriminant), which do not subtract nearly equal numbers.
+// SphereObject::Intersect and all kernels of SphereStore follow exactly this sequence of operations.
+template <typename T>
+inline T IntersectSphere(T px, T py, T pz, T r2, T dx, T dy, T dz, T a, T inv_a) {
+	T b = dx * px + dy * py + dz * pz;
+	T k = b * inv_a;
+	T lx = px - dx * k, ly = py - dy * k, lz = pz - dz * k;
+	T det = a * (r2 - (lx * lx + ly * ly + lz * lz));
+	if (!(det >= T(0))) return T(0);
+	T c = px * px + py * py + pz * pz - r2;
+	T q = b + std::copysign(std::sqrt(det), b);
+	T ta = c / q, tb = q / a;
+	T t0 = ta < tb ? ta : tb, t1 = ta > tb ? ta : tb;
+	T t = t0 > T(0) ? t0 : t1;
+	return t > T(0) ? t : T(0);
+}
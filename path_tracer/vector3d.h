@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2018 Roman Kazantsev
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PATH_TRACER_SSE
+#include <xmmintrin.h>
+#endif
+
+// Header-only 3D vector of float or double. It has no virtual functions, so it is trivially copyable
+// and as large as its three components, and all operations are inline.
+// Vec3<float, true> is padded to 16 bytes, aligned and computed with SSE where it is available.
+template <typename T, bool Aligned = false>
+struct Vec3 {
+	// constructor
+	constexpr Vec3(T xx = T(0), T yy = T(0), T zz = T(0)) : x(xx), y(yy), z(zz) {}
+	// conversion between precisions
+	template <typename U, bool OtherAligned>
+	constexpr explicit Vec3(Vec3<U, OtherAligned> const &other) : x(T(other.x)), y(T(other.y)), z(T(other.z)) {}
+	// operations
+	constexpr Vec3 operator+ (Vec3 const &other) const { return Vec3(x + other.x, y + other.y, z + other.z); }
+	constexpr Vec3 operator- (Vec3 const &other) const { return Vec3(x - other.x, y - other.y, z - other.z); }
+	constexpr Vec3 operator* (T scalar) const { return Vec3(x * scalar, y * scalar, z * scalar); }
+	constexpr Vec3 mult(Vec3 const &other) const { return Vec3(x * other.x, y * other.y, z * other.z); }
+	Vec3& norm() { return *this = *this * (T(1) / std::sqrt(x * x + y * y + z * z)); }
+	constexpr T dot(Vec3 const &other) const { return x * other.x + y * other.y + z * other.z; }
+	// cross product
+	constexpr Vec3 operator% (Vec3 const &other) const { return Vec3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x); }
+	T x, y, z;
+};
+
+#ifdef PATH_TRACER_SSE
+template <>
+struct alignas(16) Vec3<float, true> {
+	constexpr Vec3(float xx = 0.0f, float yy = 0.0f, float zz = 0.0f) : x(xx), y(yy), z(zz), w(0.0f) {}
+	template <typename U, bool OtherAligned>
+	constexpr explicit Vec3(Vec3<U, OtherAligned> const &other) : x(float(other.x)), y(float(other.y)), z(float(other.z)), w(0.0f) {}
+	Vec3 operator+ (Vec3 const &other) const { return Vec3(_mm_add_ps(Load(), other.Load())); }
+	Vec3 operator- (Vec3 const &other) const { return Vec3(_mm_sub_ps(Load(), other.Load())); }
+	Vec3 operator* (float scalar) const { return Vec3(_mm_mul_ps(Load(), _mm_set1_ps(scalar))); }
+	Vec3 mult(Vec3 const &other) const { return Vec3(_mm_mul_ps(Load(), other.Load())); }
+	Vec3& norm() { return *this = *this * (1.0f / std::sqrt(dot(*this))); }
+	float dot(Vec3 const &other) const {
+		// the padding lane is always 0, so a horizontal sum of all four lanes is the dot product
+		__m128 p = _mm_mul_ps(Load(), other.Load());
+		__m128 s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+		return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+	}
+	Vec3 operator% (Vec3 const &other) const {
+		__m128 a = Load(), b = other.Load();
+		__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+		return Vec3(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+	}
+	float x, y, z, w;
+
+private:
+	explicit Vec3(__m128 v) { _mm_store_ps(&x, v); }
+	__m128 Load() const { return _mm_load_ps(&x); }
+};
+#endif
+
+typedef Vec3<double> Vector3D;
+typedef Vec3<float> Vector3F;
+typedef Vec3<float, true> Vector3FA;
+
+static_assert(std::is_trivially_copyable<Vector3D>::value, "Vector3D must be trivially copyable");
+static_assert(sizeof(Vector3D) == 3 * sizeof(double), "Vector3D must not carry anything but its components");